@@ -0,0 +1,439 @@
+/*
+ *  Frontend discovery benchmark
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <dirent.h>
+
+#include "BackendBase.hpp"
+#include "RingBufferBase.hpp"
+
+#include "mocks/XenStoreMock.hpp"
+
+#include "benchUtils.hpp"
+
+extern "C" {
+#include "benchProtocol.h"
+}
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::condition_variable;
+using std::cout;
+using std::endl;
+using std::list;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::to_string;
+using std::unique_lock;
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+
+using XenBackend::BackendBase;
+using XenBackend::FrontendHandlerBase;
+using XenBackend::FrontendHandlerPtr;
+using XenBackend::Log;
+using XenBackend::LogLevel;
+using XenBackend::RingBufferInBase;
+using XenBackend::RingBufferPtr;
+using XenBackend::WorkerPool;
+using XenBackend::WorkerPoolPtr;
+using XenBackend::XenEvtchnLoop;
+using XenBackend::XenEvtchnLoopPtr;
+using XenBackend::XenStore;
+
+static const domid_t cBeDomId = 0;
+static const char* cDevName = "bench_device";
+
+/*******************************************************************************
+ * Backend
+ ******************************************************************************/
+
+class BenchRingBuffer : public RingBufferInBase<xen_bench_back_ring,
+												xen_bench_sring,
+												xenbench_req, xenbench_rsp>
+{
+public:
+
+	BenchRingBuffer(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+					grant_ref_t ref) :
+		RingBufferInBase<xen_bench_back_ring, xen_bench_sring,
+						 xenbench_req, xenbench_rsp>(loop, domId, port, ref) {}
+
+	BenchRingBuffer(domid_t domId, evtchn_port_t port, grant_ref_t ref) :
+		RingBufferInBase<xen_bench_back_ring, xen_bench_sring,
+						 xenbench_req, xenbench_rsp>(domId, port, ref) {}
+
+	~BenchRingBuffer() { stop(); }
+
+private:
+
+	void processRequest(const xenbench_req& req) override
+	{
+		xenbench_rsp rsp {};
+
+		rsp.seq = req.seq;
+
+		sendResponse(rsp);
+	}
+};
+
+class BenchFrontendHandler : public FrontendHandlerBase
+{
+public:
+
+	BenchFrontendHandler(domid_t beDomId, domid_t feDomId, uint16_t devId,
+						 XenEvtchnLoopPtr loop) :
+		FrontendHandlerBase("BenchFrontend", cDevName, beDomId, feDomId,
+							devId),
+		mLoop(loop) {}
+
+	BenchFrontendHandler(domid_t beDomId, domid_t feDomId, uint16_t devId,
+						 XenEvtchnLoopPtr loop, XenStore& xenStore) :
+		FrontendHandlerBase("BenchFrontend", cDevName, beDomId, feDomId,
+							devId, xenStore),
+		mLoop(loop) {}
+
+	~BenchFrontendHandler() { stop(); }
+
+private:
+
+	XenEvtchnLoopPtr mLoop;
+
+	void onBind() override
+	{
+		auto port = getXenStore().readUint(getXsFrontendPath() +
+										   "/event-channel");
+		auto ref = getXenStore().readUint(getXsFrontendPath() + "/ring-ref");
+
+		RingBufferPtr ringBuffer(mLoop ?
+				new BenchRingBuffer(mLoop, getDomId(), port, ref) :
+				new BenchRingBuffer(getDomId(), port, ref));
+
+		addRingBuffer(ringBuffer);
+	}
+};
+
+class BenchBackend : public BackendBase
+{
+public:
+
+	BenchBackend(bool sharedXenStore, bool sharedLoop) :
+		BackendBase("BenchBackend", cDevName),
+		mSharedXenStore(sharedXenStore)
+	{
+		if (sharedLoop)
+		{
+			mLoop.reset(new XenEvtchnLoop());
+		}
+	}
+
+	~BenchBackend()
+	{
+		stop();
+	}
+
+	uint64_t getNumXenStoreOps()
+	{
+		auto metrics = getXenStore().getMetrics();
+
+		uint64_t numOps = metrics.numReads + metrics.numWrites +
+						  metrics.numTransactions;
+
+		if (!mSharedXenStore)
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			for (auto& frontendHandler : mFrontendHandlers)
+			{
+				metrics = frontendHandler->getXenStore().getMetrics();
+
+				numOps += metrics.numReads + metrics.numWrites +
+						  metrics.numTransactions;
+			}
+		}
+
+		return numOps;
+	}
+
+private:
+
+	bool mSharedXenStore;
+	XenEvtchnLoopPtr mLoop;
+	mutex mMutex;
+	list<FrontendHandlerPtr> mFrontendHandlers;
+
+	void onNewFrontend(domid_t domId, uint16_t devId) override
+	{
+		FrontendHandlerPtr frontendHandler(mSharedXenStore ?
+				new BenchFrontendHandler(getDomId(), domId, devId, mLoop,
+										 getXenStore()) :
+				new BenchFrontendHandler(getDomId(), domId, devId, mLoop));
+
+		addFrontendHandler(frontendHandler);
+
+		lock_guard<mutex> lock(mMutex);
+
+		mFrontendHandlers.push_back(frontendHandler);
+	}
+};
+
+/*******************************************************************************
+ * Frontends
+ ******************************************************************************/
+
+static mutex sMutex;
+static condition_variable sCondVar;
+static unordered_map<string, string> sStatePaths;
+static list<string> sInitWaitFrontends;
+static unordered_set<string> sConnected;
+
+static void onWriteValue(const string& path, const string& value)
+{
+	auto it = sStatePaths.find(path);
+
+	if (it == sStatePaths.end())
+	{
+		return;
+	}
+
+	auto state = static_cast<xenbus_state>(std::stoi(value));
+
+	lock_guard<mutex> lock(sMutex);
+
+	if (state == XenbusStateInitWait)
+	{
+		sInitWaitFrontends.push_back(it->second);
+
+		sCondVar.notify_all();
+	}
+	else if (state == XenbusStateConnected)
+	{
+		sConnected.insert(path);
+
+		sCondVar.notify_all();
+	}
+}
+
+static void prepareDomains(size_t numDomains, size_t numDevices)
+{
+	XenStoreMock::writeValue("domid", to_string(cBeDomId));
+	XenStoreMock::setDomainPath(cBeDomId, "/local/domain/" +
+									to_string(cBeDomId));
+
+	for (size_t dom = 1; dom <= numDomains; dom++)
+	{
+		auto feDomPath = "/local/domain/" + to_string(dom);
+
+		XenStoreMock::setDomainPath(dom, feDomPath);
+
+		for (size_t dev = 0; dev < numDevices; dev++)
+		{
+			auto fePath = feDomPath + "/device/" + cDevName + "/" +
+						  to_string(dev);
+			auto bePath = "/local/domain/" + to_string(cBeDomId) +
+						  "/backend/" + cDevName + "/" + to_string(dom) +
+						  "/" + to_string(dev);
+
+			sStatePaths[bePath + "/state"] = fePath + "/state";
+
+			XenStoreMock::writeValue(fePath + "/event-channel",
+									 to_string(dom * numDevices + dev + 1));
+			XenStoreMock::writeValue(fePath + "/ring-ref",
+									 to_string(dom * numDevices + dev + 1));
+			XenStoreMock::writeValue(fePath + "/state",
+									 to_string(XenbusStateInitialising));
+		}
+	}
+}
+
+static void addDomains(size_t numDomains, size_t numDevices)
+{
+	// the backend entries appear at once as the toolstack creates them
+
+	for (size_t dom = 1; dom <= numDomains; dom++)
+	{
+		for (size_t dev = 0; dev < numDevices; dev++)
+		{
+			auto bePath = "/local/domain/" + to_string(cBeDomId) +
+						  "/backend/" + cDevName + "/" + to_string(dom) +
+						  "/" + to_string(dev);
+			auto fePath = "/local/domain/" + to_string(dom) + "/device/" +
+						  cDevName + "/" + to_string(dev);
+
+			XenStoreMock::writeValue(bePath + "/frontend", fePath);
+			XenStoreMock::writeValue(bePath + "/state",
+									 to_string(XenbusStateInitialising));
+		}
+	}
+}
+
+static size_t countEntries(const char* path)
+{
+	size_t count = 0;
+
+	auto dir = opendir(path);
+
+	if (!dir)
+	{
+		return 0;
+	}
+
+	while (auto entry = readdir(dir))
+	{
+		if (entry->d_name[0] != '.')
+		{
+			count++;
+		}
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+/*******************************************************************************
+ * Main
+ ******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+	Log::setLogLevel(LogLevel::logERROR);
+	Log::setLogMask("*:Error");
+
+	auto numDomains = getOption(argc, argv, "--domains", 16);
+	auto numDevices = getOption(argc, argv, "--devices", 4);
+	auto numWorkers = getOption(argc, argv, "--workers", 0);
+	auto sharedXenStore = getOption(argc, argv, "--shared-xenstore", 0) != 0;
+	auto sharedLoop = getOption(argc, argv, "--shared-loop", 0) != 0;
+	auto timeout = milliseconds(getOption(argc, argv, "--timeout", 30000));
+	auto coalesce = milliseconds(getOption(argc, argv, "--coalesce", 0));
+	auto parallelShutdown = getOption(argc, argv, "--parallel-shutdown", 0) != 0;
+
+	size_t numFrontends = numDomains * numDevices;
+
+	cout << "Domains: " << numDomains << ", devices: " << numDevices
+		 << ", workers: " << numWorkers
+		 << ", shared xen store: " << sharedXenStore
+		 << ", shared event loop: " << sharedLoop
+		 << ", watch coalesce window: " << coalesce.count() << " ms" << endl;
+
+	prepareDomains(numDomains, numDevices);
+
+	XenStoreMock::setWriteValueCbk(onWriteValue);
+
+	auto baseThreads = countEntries("/proc/self/task");
+	auto baseFds = countEntries("/proc/self/fd");
+
+	BenchBackend backend(sharedXenStore, sharedLoop);
+
+	if (numWorkers)
+	{
+		backend.setWorkerPool(WorkerPoolPtr(new WorkerPool(numWorkers)));
+	}
+
+	backend.setWatchCoalesceWindow(coalesce);
+
+	backend.start();
+
+	auto start = steady_clock::now();
+
+	addDomains(numDomains, numDevices);
+
+	// frontends go to initialized state when the backend waits for them
+
+	bool result = true;
+
+	unique_lock<mutex> lock(sMutex);
+
+	while (sConnected.size() < numFrontends)
+	{
+		if (!sCondVar.wait_until(lock, start + timeout, [numFrontends] {
+				return !sInitWaitFrontends.empty() ||
+					   sConnected.size() == numFrontends; }))
+		{
+			cout << "Timeout, connected: " << sConnected.size() << endl;
+
+			result = false;
+
+			break;
+		}
+
+		auto frontends = std::move(sInitWaitFrontends);
+
+		sInitWaitFrontends.clear();
+
+		lock.unlock();
+
+		for (auto& path : frontends)
+		{
+			XenStoreMock::writeValue(path, to_string(XenbusStateInitialised));
+		}
+
+		lock.lock();
+	}
+
+	auto elapsed = steady_clock::now() - start;
+
+	lock.unlock();
+
+	printThroughput("Connected frontends", sConnected.size(), elapsed);
+
+	cout << "Threads: " << countEntries("/proc/self/task") - baseThreads
+		 << ", fds: " << countEntries("/proc/self/fd") - baseFds
+		 << ", xen store operations: " << backend.getNumXenStoreOps()
+		 << endl;
+
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	if (parallelShutdown)
+	{
+		auto shutdownStart = steady_clock::now();
+
+		auto shutdownResult = backend.shutdown(timeout);
+
+		printThroughput("Stopped frontends", shutdownResult.numStopped,
+						steady_clock::now() - shutdownStart);
+
+		if (!shutdownResult.timedOut.empty())
+		{
+			cout << "Timeout, not stopped: "
+				 << shutdownResult.timedOut.size() << endl;
+
+			result = false;
+		}
+	}
+	else
+	{
+		backend.stop();
+	}
+
+	return result ? 0 : 1;
+}
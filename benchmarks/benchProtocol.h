@@ -0,0 +1,59 @@
+/*
+ *  Benchmark protocol
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef BENCHMARKS_BENCHPROTOCOL_H_
+#define BENCHMARKS_BENCHPROTOCOL_H_
+
+#include <xenctrl.h>
+#include <xen/io/ring.h>
+
+/// @cond HIDDEN_SYMBOLS
+
+struct xenbench_req {
+	uint64_t seq;
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct xenbench_rsp {
+	uint64_t seq;
+	uint32_t status;
+	uint32_t checksum;
+};
+
+DEFINE_RING_TYPES(xen_bench, struct xenbench_req, struct xenbench_rsp);
+
+struct xenbench_evt {
+	uint64_t seq;
+	uint64_t data;
+};
+
+struct xenbench_event_page {
+	uint32_t in_cons;
+	uint32_t in_prod;
+	uint8_t reserved[56];
+};
+
+#define XENBENCH_EVENT_RING_OFFS	(sizeof(struct xenbench_event_page))
+#define XENBENCH_EVENT_RING_SIZE	(XC_PAGE_SIZE - XENBENCH_EVENT_RING_OFFS)
+
+/// @endcond
+
+#endif /* BENCHMARKS_BENCHPROTOCOL_H_ */
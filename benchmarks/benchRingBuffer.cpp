@@ -0,0 +1,450 @@
+/*
+ *  Ring buffer benchmark
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "RingBufferBase.hpp"
+
+#include "mocks/XenEvtchnMock.hpp"
+#include "mocks/XenGnttabMock.hpp"
+
+#include "benchUtils.hpp"
+
+extern "C" {
+#include "benchProtocol.h"
+}
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::condition_variable;
+using std::cout;
+using std::endl;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+using XenBackend::Log;
+using XenBackend::LogLevel;
+using XenBackend::OverflowPolicy;
+using XenBackend::RingBufferInBase;
+using XenBackend::RingBufferOutBase;
+using XenBackend::RingMetrics;
+
+static const domid_t cDomId = 3;
+static const evtchn_port_t cPort = 65;
+static const grant_ref_t cRef = 23;
+
+/*******************************************************************************
+ * Input ring buffer
+ ******************************************************************************/
+
+// the static variant passes itself as the handler to avoid virtual dispatch
+
+template<bool Static>
+class BenchRingBufferIn final : public RingBufferInBase<
+		xen_bench_back_ring, xen_bench_sring, xenbench_req, xenbench_rsp,
+		typename std::conditional<Static, BenchRingBufferIn<Static>,
+								  void>::type>
+{
+public:
+
+	typedef RingBufferInBase<xen_bench_back_ring, xen_bench_sring,
+		xenbench_req, xenbench_rsp,
+		typename std::conditional<Static, BenchRingBufferIn<Static>,
+								  void>::type> Base;
+
+	BenchRingBufferIn(const vector<uint8_t>& data) :
+		Base(cDomId, cPort, cRef),
+		mData(data),
+		mCopy(data.size()) {}
+
+	~BenchRingBufferIn() { this->stop(); }
+
+	void processRequest(const xenbench_req& req) override
+	{
+		// copy the payload as a backend does with granted data
+
+		size_t offset = req.offset < mData.size() ? req.offset : 0;
+		size_t size = req.size < mData.size() - offset ?
+					  req.size : mData.size() - offset;
+
+		memcpy(mCopy.data(), &mData[offset], size);
+
+		uint32_t checksum = 0;
+
+		for (size_t i = 0; i < size; i++)
+		{
+			checksum += mCopy[i];
+		}
+
+		xenbench_rsp rsp {};
+
+		rsp.seq = req.seq;
+		rsp.checksum = checksum;
+
+		this->sendResponse(rsp);
+	}
+
+private:
+
+	const vector<uint8_t>& mData;
+	vector<uint8_t> mCopy;
+};
+
+static mutex sMutex;
+static condition_variable sCondVar;
+static bool sNotified = false;
+
+static void onBackendNotification()
+{
+	unique_lock<mutex> lock(sMutex);
+
+	sNotified = true;
+
+	sCondVar.notify_one();
+}
+
+static bool waitBackendNotification()
+{
+	unique_lock<mutex> lock(sMutex);
+
+	if (!sCondVar.wait_for(lock, milliseconds(1000), [] { return sNotified; }))
+	{
+		return false;
+	}
+
+	sNotified = false;
+
+	return true;
+}
+
+static void printMetrics(const RingMetrics& metrics, uint64_t numSignals)
+{
+	cout << "Frontend notifications: " << numSignals
+		 << ", received by backend: " << metrics.numIndications
+		 << ", backend notifications: " << metrics.numNotifications
+		 << endl;
+
+	cout << "Batches: " << metrics.numBatches << ", overflows: "
+		 << metrics.numOverflows << endl;
+}
+
+template<typename RingBufferIn>
+static bool runInBenchmark(size_t depth, size_t size, size_t numRequests,
+						   size_t batchSize, const string& dispatch)
+{
+	vector<uint8_t> data(size ? size : 1);
+
+	for (size_t i = 0; i < data.size(); i++)
+	{
+		data[i] = i;
+	}
+
+	RingBufferIn ringBuffer(data);
+
+	ringBuffer.setResponseBatchSize(batchSize);
+
+	auto port = XenEvtchnMock::getLastBoundPort();
+
+	XenEvtchnMock::setNotifyCbk(port, onBackendNotification);
+
+	xen_bench_front_ring ring;
+	auto sring = static_cast<xen_bench_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	ringBuffer.start();
+
+	if (depth > RING_SIZE(&ring))
+	{
+		depth = RING_SIZE(&ring);
+	}
+
+	cout << "In ring, depth: " << depth << ", request size: " << size
+		 << ", requests: " << numRequests
+		 << ", response batch: " << batchSize
+		 << ", dispatch: " << dispatch << endl;
+
+	vector<steady_clock::time_point> submitTimes(numRequests);
+	vector<nanoseconds> latencies;
+
+	latencies.reserve(numRequests);
+
+	size_t numSent = 0;
+	size_t numDone = 0;
+	uint64_t numSignals = 0;
+
+	auto start = steady_clock::now();
+
+	while (numDone < numRequests)
+	{
+		bool pushed = false;
+
+		while (numSent - numDone < depth && numSent < numRequests)
+		{
+			auto req = RING_GET_REQUEST(&ring, ring.req_prod_pvt++);
+
+			req->seq = numSent;
+			req->offset = 0;
+			req->size = size;
+
+			submitTimes[numSent++] = steady_clock::now();
+
+			pushed = true;
+		}
+
+		if (pushed)
+		{
+			int notify;
+
+			RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+			if (notify)
+			{
+				XenEvtchnMock::signalPort(port);
+
+				numSignals++;
+			}
+		}
+
+		int numPending = 0;
+
+		do
+		{
+			auto rp = ring.sring->rsp_prod;
+
+			xen_rmb();
+
+			for (auto i = ring.rsp_cons; i != rp; i++)
+			{
+				auto rsp = RING_GET_RESPONSE(&ring, i);
+
+				latencies.push_back(steady_clock::now() -
+									submitTimes[rsp->seq]);
+
+				numDone++;
+			}
+
+			ring.rsp_cons = rp;
+
+			RING_FINAL_CHECK_FOR_RESPONSES(&ring, numPending);
+		}
+		while (numPending);
+
+		// submit more requests if there is a free slot, otherwise sleep
+		// until the backend notifies
+
+		bool canSubmit = numSent - numDone < depth && numSent < numRequests;
+
+		if (numDone < numRequests && !canSubmit && !waitBackendNotification())
+		{
+			cout << "Timeout waiting for responses" << endl;
+
+			return false;
+		}
+	}
+
+	auto elapsed = steady_clock::now() - start;
+
+	ringBuffer.stop();
+
+	printThroughput("Requests", numRequests, elapsed);
+	printMetrics(ringBuffer.getMetrics(), numSignals);
+	printLatency("Request", latencies);
+
+	return true;
+}
+
+/*******************************************************************************
+ * Output ring buffer
+ ******************************************************************************/
+
+typedef RingBufferOutBase<xenbench_event_page, xenbench_evt>
+	BenchRingBufferOut;
+
+static bool runOutBenchmark(size_t numProducers, size_t numEvents)
+{
+	BenchRingBufferOut ringBuffer(cDomId, cPort, cRef,
+								  XENBENCH_EVENT_RING_OFFS,
+								  XENBENCH_EVENT_RING_SIZE);
+
+	ringBuffer.setOverflowPolicy(OverflowPolicy::BLOCK, 0, milliseconds(1000));
+
+	auto port = XenEvtchnMock::getLastBoundPort();
+	auto page = static_cast<xenbench_event_page*>(
+			XenGnttabMock::getLastBuffer());
+	auto events = reinterpret_cast<xenbench_evt*>(
+			static_cast<uint8_t*>(XenGnttabMock::getLastBuffer()) +
+			XENBENCH_EVENT_RING_OFFS);
+	uint32_t ringSize = XENBENCH_EVENT_RING_SIZE / sizeof(xenbench_evt);
+
+	ringBuffer.start();
+
+	cout << "Out ring, producers: " << numProducers
+		 << ", events: " << numEvents << ", ring size: " << ringSize << endl;
+
+	vector<steady_clock::time_point> sendTimes(numEvents);
+	vector<nanoseconds> latencies;
+
+	latencies.reserve(numEvents);
+
+	atomic<size_t> nextSeq(0);
+	atomic<size_t> numFailed(0);
+	uint64_t numSignals = 0;
+
+	auto start = steady_clock::now();
+
+	vector<thread> producers;
+
+	for (size_t i = 0; i < numProducers; i++)
+	{
+		producers.push_back(thread([&] {
+			size_t seq;
+
+			while ((seq = nextSeq++) < numEvents)
+			{
+				sendTimes[seq] = steady_clock::now();
+
+				if (!ringBuffer.sendEvent({ seq, seq }))
+				{
+					numFailed++;
+				}
+			}
+		}));
+	}
+
+	// frontend consumes events and notifies the backend about free space
+
+	auto deadline = steady_clock::now() + milliseconds(1000);
+
+	while (latencies.size() + numFailed < numEvents)
+	{
+		auto cons = page->in_cons;
+		auto prod = page->in_prod;
+
+		xen_rmb();
+
+		if (cons == prod)
+		{
+			if (steady_clock::now() > deadline)
+			{
+				break;
+			}
+
+			std::this_thread::yield();
+
+			continue;
+		}
+
+		for (; cons != prod; cons++)
+		{
+			auto& event = events[cons % ringSize];
+
+			latencies.push_back(steady_clock::now() - sendTimes[event.seq]);
+		}
+
+		xen_mb();
+
+		page->in_cons = cons;
+
+		XenEvtchnMock::signalPort(port);
+
+		numSignals++;
+
+		deadline = steady_clock::now() + milliseconds(1000);
+	}
+
+	auto elapsed = steady_clock::now() - start;
+
+	for (auto& producer : producers)
+	{
+		producer.join();
+	}
+
+	ringBuffer.stop();
+
+	printThroughput("Events", latencies.size(), elapsed);
+	printMetrics(ringBuffer.getMetrics(), numSignals);
+	printLatency("Event", latencies);
+
+	if (latencies.size() + numFailed < numEvents)
+	{
+		cout << "Timeout waiting for events" << endl;
+
+		return false;
+	}
+
+	return true;
+}
+
+/*******************************************************************************
+ * Main
+ ******************************************************************************/
+
+int main(int argc, char* argv[])
+{
+	Log::setLogLevel(LogLevel::logERROR);
+	Log::setLogMask("*:Error");
+
+	auto mode = getStringOption(argc, argv, "--mode", "all");
+	auto depth = getOption(argc, argv, "--depth", 32);
+	auto size = getOption(argc, argv, "--size", 512);
+	auto numRequests = getOption(argc, argv, "--requests", 100000);
+	auto batch = getOption(argc, argv, "--batch", 0);
+	auto numProducers = getOption(argc, argv, "--producers", 1);
+	auto dispatch = getStringOption(argc, argv, "--dispatch", "virtual");
+
+	bool result = true;
+
+	if (mode == "all" || mode == "in")
+	{
+		if (dispatch == "static")
+		{
+			result = runInBenchmark<BenchRingBufferIn<true>>(
+					depth, size, numRequests, batch, dispatch) && result;
+		}
+		else
+		{
+			result = runInBenchmark<BenchRingBufferIn<false>>(
+					depth, size, numRequests, batch, dispatch) && result;
+		}
+	}
+
+	if (mode == "all" || mode == "out")
+	{
+		result = runOutBenchmark(numProducers ? numProducers : 1,
+								 numRequests) && result;
+	}
+
+	return result ? 0 : 1;
+}
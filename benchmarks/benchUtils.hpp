@@ -0,0 +1,117 @@
+/*
+ *  Benchmark helpers
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef BENCHMARKS_BENCHUTILS_HPP_
+#define BENCHMARKS_BENCHUTILS_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// @cond HIDDEN_SYMBOLS
+
+/**
+ * Returns value of the command line option "--name value"
+ */
+inline unsigned long getOption(int argc, char* argv[], const char* name,
+							   unsigned long defaultValue)
+{
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (strcmp(argv[i], name) == 0)
+		{
+			return strtoul(argv[i + 1], nullptr, 0);
+		}
+	}
+
+	return defaultValue;
+}
+
+/**
+ * Returns string value of the command line option "--name value"
+ */
+inline std::string getStringOption(int argc, char* argv[], const char* name,
+								   const std::string& defaultValue)
+{
+	for (int i = 1; i < argc - 1; i++)
+	{
+		if (strcmp(argv[i], name) == 0)
+		{
+			return argv[i + 1];
+		}
+	}
+
+	return defaultValue;
+}
+
+/**
+ * Prints latency percentiles of the samples in us
+ */
+inline void printLatency(const std::string& name,
+						 std::vector<std::chrono::nanoseconds>& samples)
+{
+	using namespace std::chrono;
+
+	if (samples.empty())
+	{
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	auto percentile = [&samples](double value) {
+		auto index = static_cast<size_t>(samples.size() * value / 100.0);
+
+		if (index >= samples.size())
+		{
+			index = samples.size() - 1;
+		}
+
+		return duration_cast<duration<double, std::micro>>(
+				samples[index]).count();
+	};
+
+	std::cout << name << " latency, us: p50 " << percentile(50)
+			  << ", p99 " << percentile(99)
+			  << ", p99.9 " << percentile(99.9)
+			  << ", max " << percentile(100) << std::endl;
+}
+
+/**
+ * Prints throughput
+ */
+inline void printThroughput(const std::string& name, uint64_t count,
+							std::chrono::nanoseconds elapsed)
+{
+	using namespace std::chrono;
+
+	auto seconds = duration_cast<duration<double>>(elapsed).count();
+
+	std::cout << name << ": " << count << " in " << seconds << " s, "
+			  << (seconds > 0 ? count / seconds : 0) << " per s" << std::endl;
+}
+
+/// @endcond
+
+#endif /* BENCHMARKS_BENCHUTILS_HPP_ */
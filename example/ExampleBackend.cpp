@@ -130,7 +130,8 @@ void ExampleBackend::onNewFrontend(domid_t domId, uint16_t devId)
 
 	// create new example frontend handler
 	addFrontendHandler(FrontendHandlerPtr(
-			new ExampleFrontendHandler(getDeviceName(), domId)));
+			new ExampleFrontendHandler(getDeviceName(), domId,
+									   getXenStore())));
 }
 //! [onNewFrontend]
 
@@ -74,8 +74,11 @@ class ExampleFrontendHandler : public XenBackend::FrontendHandlerBase
 {
 public:
 
-	ExampleFrontendHandler(const std::string& devName, domid_t feDomId) :
-		FrontendHandlerBase("FrontendHandler", "example_dev", 0, feDomId),
+	// Share the backend xen store connection and watch thread
+	ExampleFrontendHandler(const std::string& devName, domid_t feDomId,
+						   XenBackend::XenStore& xenStore) :
+		FrontendHandlerBase("FrontendHandler", "example_dev", 0, feDomId, 0,
+							xenStore),
 		mLog("FrontendHandler")
 	{
 		LOG(mLog, DEBUG) << "Create example frontend handler, dom id: "
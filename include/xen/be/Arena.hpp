@@ -0,0 +1,192 @@
+/*
+ *  Request arena
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_ARENA_HPP_
+#define XENBE_ARENA_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Exception.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Fixed-size block allocator.
+ * All blocks are allocated when the arena is created, so allocating and
+ * freeing a block doesn't call the heap. It is intended for per request
+ * scratch memory: one block per request which may be in flight. Blocks may be
+ * allocated and freed from any thread.
+ *
+ * The arena covers the request memory only. When the ring is processed by
+ * a worker pool, each ring indication still allocates a task node in
+ * WorkerQueue::post() and may allocate a queue entry in
+ * WorkerPool::schedule().
+ *
+ * @code
+ * Arena arena(256, 32);
+ *
+ * auto context = arena.create<RequestContext>(req);
+ *
+ * ...
+ *
+ * arena.destroy(context);
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+class Arena
+{
+public:
+
+	/**
+	 * @param[in] blockSize block size, it is rounded up to the max alignment
+	 * @param[in] numBlocks number of blocks
+	 */
+	Arena(size_t blockSize, size_t numBlocks);
+	Arena(const Arena&) = delete;
+	Arena& operator=(Arena const&) = delete;
+
+	/**
+	 * Allocates one block
+	 * @param[in] size required size, should not exceed the block size
+	 * @return pointer to the block
+	 */
+	void* allocate(size_t size);
+
+	/**
+	 * Frees the block
+	 * @param[in] block pointer returned by allocate()
+	 */
+	void deallocate(void* block);
+
+	/**
+	 * Creates the object in a block
+	 * @param[in] args constructor arguments
+	 */
+	template<typename T, typename... Args>
+	T* create(Args&&... args)
+	{
+		auto block = allocate(sizeof(T));
+
+		try
+		{
+			return new (block) T(std::forward<Args>(args)...);
+		}
+		catch(...)
+		{
+			deallocate(block);
+
+			throw;
+		}
+	}
+
+	/**
+	 * Destroys the object created by create()
+	 * @param[in] object object
+	 */
+	template<typename T>
+	void destroy(T* object)
+	{
+		if (object)
+		{
+			object->~T();
+
+			deallocate(object);
+		}
+	}
+
+	/**
+	 * Returns block size
+	 */
+	size_t getBlockSize() const { return mBlockSize; }
+
+	/**
+	 * Returns number of blocks
+	 */
+	size_t getNumBlocks() const { return mNumBlocks; }
+
+	/**
+	 * Returns number of free blocks
+	 */
+	size_t getNumFreeBlocks();
+
+private:
+
+	size_t mBlockSize;
+	size_t mNumBlocks;
+	std::unique_ptr<char[]> mBuffer;
+	std::vector<void*> mFreeBlocks;
+	std::mutex mMutex;
+};
+
+typedef std::shared_ptr<Arena> ArenaPtr;
+
+/***************************************************************************//**
+ * Standard allocator which takes memory from the arena.
+ * Each allocation takes one block, so it fits containers with reserved
+ * storage, such as std::vector, and std::allocate_shared(). Allocation of more
+ * than one block throws.
+ * @ingroup backend
+ ******************************************************************************/
+template<typename T>
+class ArenaAllocator
+{
+public:
+
+	typedef T value_type;
+
+	explicit ArenaAllocator(Arena& arena) : mArena(&arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : mArena(other.mArena) {}
+
+	T* allocate(size_t n)
+	{
+		return static_cast<T*>(mArena->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, size_t) { mArena->deallocate(p); }
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const
+	{
+		return mArena == other.mArena;
+	}
+
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const
+	{
+		return mArena != other.mArena;
+	}
+
+private:
+
+	template<typename U> friend class ArenaAllocator;
+
+	Arena* mArena;
+};
+
+}
+
+#endif /* XENBE_ARENA_HPP_ */
@@ -24,16 +24,25 @@
 #define XENBE_BACKENDBASE_HPP_
 
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "Exception.hpp"
 #include "FrontendHandlerBase.hpp"
+#include "WorkerPool.hpp"
 #include "XenStore.hpp"
 #include "XenStat.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 
 namespace XenBackend {
 
@@ -51,6 +60,39 @@ class BackendException : public Exception
 	using Exception::Exception;
 };
 
+/**
+ * Aggregated statistics of the backend.
+ * @ingroup backend
+ */
+struct BackendStats
+{
+	//! number of frontend handlers
+	size_t numFrontends;
+	//! number of frontends in XenbusStateConnected state
+	size_t numConnected;
+	//! requests per second since the previous stats request
+	double requestsPerSecond;
+	//! sum of metrics of all frontends
+	RingMetrics metrics;
+};
+
+/**
+ * Result of the backend shutdown.
+ * @ingroup backend
+ */
+struct ShutdownResult
+{
+	//! domain and device id of the frontend
+	typedef std::pair<domid_t, uint16_t> FrontendId;
+
+	//! number of frontends stopped within the timeout
+	size_t numStopped;
+	//! frontends which failed to stop
+	std::vector<FrontendId> failed;
+	//! frontends which are not stopped within the timeout
+	std::vector<FrontendId> timedOut;
+};
+
 /***************************************************************************//**
  * Base class for a backend implementation.
  *
@@ -83,6 +125,15 @@ class BackendException : public Exception
  * When the backend instance is created, it should be started by calling start()
  * method. The backend will process frontends till stop() method is called.
  *
+ * A backend which handles many frontends may be stopped with shutdown().
+ * It stops the backend and tears down all frontends in parallel, but waits
+ * for them not longer than the given timeout.
+ *
+ * The backend statistics can be read with getStats() or published to Xen store
+ * periodically with setStatsInterval(). The statistics are published under
+ * <domain path>/backend-stats/<device name>, outside of the watched backend
+ * device path.
+ *
  * @snippet ExampleBackend.cpp main
  *
  * @ingroup backend
@@ -108,6 +159,27 @@ public:
 	 */
 	void stop();
 
+	/**
+	 * Default max number of workers which stop frontends on shutdown
+	 */
+	static const size_t cDefaultShutdownWorkers = 32;
+
+	/**
+	 * Stops the backend and all frontends. The frontends are stopped in
+	 * parallel by the worker pool set with setWorkerPool() or by up to
+	 * maxWorkers own threads. Frontends which are not stopped within
+	 * the timeout are reported in the result and continue stopping in
+	 * background. As frontend handlers may use the backend xen store (see
+	 * getXenStore()), the backend destructor waits for them. A caller which
+	 * can't wait for stuck frontends should exit the process without deleting
+	 * the backend.
+	 * @param[in] timeout    max time to wait for the frontends
+	 * @param[in] maxWorkers max number of own workers
+	 * @return shutdown result
+	 */
+	ShutdownResult shutdown(std::chrono::milliseconds timeout,
+							size_t maxWorkers = cDefaultShutdownWorkers);
+
 	/**
 	 * Waits for backend is finished.
 	 */
@@ -123,6 +195,60 @@ public:
 	 */
 	domid_t getDomId() const { return mDomId; }
 
+	/**
+	 * Returns reference to the xen store instance of the backend. It may be
+	 * passed to frontend handlers in order to share one xen store connection
+	 * and watch thread between all frontends of the backend.
+	 */
+	XenStore& getXenStore() { return mXenStore; }
+
+	/**
+	 * Sets worker pool which brings up and tears down frontends in parallel.
+	 * onNewFrontend() and the frontend teardown are executed by the pool,
+	 * while events of one frontend are executed in order. The number of
+	 * frontends handled in parallel is bounded by the number of workers.
+	 * Should be called before start().
+	 * @param[in] workerPool worker pool
+	 */
+	void setWorkerPool(WorkerPoolPtr workerPool) { mWorkerPool = workerPool; }
+
+	/**
+	 * Sets attributes of threads created by the backend: the xen store thread
+	 * and threads of frontend handlers which have no own attributes.
+	 * Should be called before start().
+	 * @param[in] threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes);
+
+	/**
+	 * Sets coalesce window of the xen store watches which detect frontends,
+	 * thus bursts of xen store changes during domain creation result in one
+	 * read of the domain and device lists. Frontend state watches are not
+	 * coalesced. Should be called before start().
+	 * @param[in] window coalesce window, 0 disables coalescing
+	 */
+	void setWatchCoalesceWindow(std::chrono::milliseconds window)
+	{
+		mWatchCoalesceWindow = window;
+	}
+
+	/**
+	 * Returns aggregated statistics of all frontends
+	 */
+	BackendStats getStats();
+
+	/**
+	 * Enables periodic publishing of the backend statistics to
+	 * <domain path>/backend-stats/<device name>. Statistics are collected
+	 * from counters of the frontends, so the request processing is not
+	 * affected. The timer only schedules publishing, the xen store
+	 * transaction runs in the worker pool set with setWorkerPool() before
+	 * this call or in own thread. Publishing keeps own requests per second
+	 * baseline, thus it doesn't interfere with getStats() callers.
+	 * @param[in] interval publishing interval, 0 disables publishing
+	 */
+	void setStatsInterval(std::chrono::milliseconds interval);
+
 protected:
 
 	/**
@@ -146,9 +272,29 @@ private:
 	domid_t mDomId;
 	std::string mDeviceName;
 	std::string mFrontendsPath;
+	std::string mStatsPath;
 	XenStore mXenStore;
-	std::list<domid_t> mDomainList;
-	std::list<FrontendHandlerPtr> mFrontendHandlers;
+	// last seen snapshot of domains and their devices
+	std::unordered_map<domid_t, std::unordered_set<uint16_t>> mDomainList;
+	std::unordered_map<uint32_t, FrontendHandlerPtr> mFrontendHandlers;
+	std::unordered_set<uint32_t> mFailedFrontends;
+
+	WorkerPoolPtr mWorkerPool;
+	std::unordered_map<uint32_t, WorkerQueuePtr> mQueues;
+	std::vector<std::thread> mShutdownThreads;
+	ThreadAttributes mThreadAttributes;
+	std::chrono::milliseconds mWatchCoalesceWindow;
+
+	std::unique_ptr<Timer> mStatsTimer;
+	std::unique_ptr<AsyncContext> mStatsContext;
+	std::atomic_bool mStatsPending;
+	uint64_t mLastNumRequests;
+	std::chrono::steady_clock::time_point mLastStatsTime;
+	uint64_t mPublishNumRequests;
+	std::chrono::steady_clock::time_point mPublishStatsTime;
+	std::mutex mStatsMutex;
+
+	std::mutex mMutex;
 
 	Log mLog;
 
@@ -156,8 +302,29 @@ private:
 	void deviceListChanged(const std::string& path, domid_t domId);
 	void frontendPathChanged(const std::string& path, domid_t domId,
 							 uint16_t devId);
+	void addDomain(domid_t domId);
+	void removeDomain(domid_t domId);
+	void newFrontend(domid_t domId, uint16_t devId);
+	void removeFrontendHandler(domid_t domId, uint16_t devId);
+	void runTask(domid_t domId, uint16_t devId, WorkerQueue::Task task);
+	void postShutdownTask(uint32_t key, WorkerQueue::Task task,
+						  std::function<void(uint32_t)> onFailed);
+	void waitTasks();
 	FrontendHandlerPtr getFrontendHandler(domid_t domId, uint16_t devId);
 	void onError(const std::exception& e);
+	BackendStats getStats(uint64_t& lastNumRequests,
+						  std::chrono::steady_clock::time_point& lastTime);
+	void postStats();
+	void publishStats();
+	void stopStats();
+	void removeStats();
+
+	static bool parseId(const std::string& str, unsigned long& id);
+
+	static uint32_t getKey(domid_t domId, uint16_t devId)
+	{
+		return (static_cast<uint32_t>(domId) << 16) | devId;
+	}
 };
 
 }
@@ -21,6 +21,7 @@
 #ifndef XENBE_FRONTENDHANDLERBASE_HPP_
 #define XENBE_FRONTENDHANDLERBASE_HPP_
 
+#include <chrono>
 #include <list>
 #include <memory>
 #include <mutex>
@@ -34,9 +35,11 @@ extern "C" {
 
 #include "RingBufferBase.hpp"
 #include "XenEvtchn.hpp"
+#include "XenGnttab.hpp"
 #include "Exception.hpp"
 #include "XenStore.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 
 namespace XenBackend {
 
@@ -114,6 +117,32 @@ class XenStore;
  *
  * @snippet ExampleBackend.cpp onBind
  *
+ * If the warm reconnect is enabled with setWarmReconnect(), the ring buffers
+ * are not deleted when the connected frontend restarts (goes to
+ * XenbusStateInitialising). They are stopped and kept till the next onBind().
+ * The same grant reference numbers don't prove that the frontend still uses
+ * the same pages, for example after kexec. So the kept ring buffers are
+ * reused only if the frontend confirms it: the backend writes a new value
+ * to the ring-generation entry of the backend path when the ring buffers are
+ * kept, and the frontend which has kept the ring pages writes this value to
+ * the ring-kept entry of the frontend path before going to
+ * XenbusStateInitialised. In this case the client may take the kept ring
+ * buffer with takeRingBuffer() instead of creating new one, thus the ring is
+ * not unmapped and mapped again. The event channel is always bound again:
+ *
+ * @code
+ * auto ringBuffer = takeRingBuffer(port, ref);
+ *
+ * if (!ringBuffer)
+ * {
+ *     ringBuffer.reset(new MyRingBuffer(getDomId(), port, ref));
+ * }
+ *
+ * addRingBuffer(ringBuffer);
+ * @endcode
+ *
+ * Kept ring buffers which are not taken in onBind() are deleted.
+ *
  * @ingroup backend
  ******************************************************************************/
 class FrontendHandlerBase
@@ -130,6 +159,22 @@ public:
 	FrontendHandlerBase(const std::string& name, const std::string& devName,
 						domid_t beDomId, domid_t feDomId, uint16_t devId = 0);
 
+	/**
+	 * Creates the frontend handler which shares the xen store connection and
+	 * the watch thread with other users, for example the backend
+	 * (see BackendBase::getXenStore()). The xen store should be started by
+	 * the owner and should outlive the frontend handler.
+	 * @param[in] name                optional frontend name
+	 * @param[in] devName             device name
+	 * @param[in] beDomId             backend domain id
+	 * @param[in] feDomId             frontend domain id
+	 * @param[in] devId               frontend device id
+	 * @param[in] xenStore            shared xen store
+	 */
+	FrontendHandlerBase(const std::string& name, const std::string& devName,
+						domid_t beDomId, domid_t feDomId, uint16_t devId,
+						XenStore& xenStore);
+
 	virtual ~FrontendHandlerBase();
 
 	/**
@@ -157,6 +202,69 @@ public:
 	 */
 	XenStore& getXenStore() {  return mXenStore; }
 
+	/**
+	 * Returns grant table mapping cache of the frontend. The cache is cleared
+	 * when the frontend is closed.
+	 */
+	XenGnttabCache& getGnttabCache() { return mGnttabCache; }
+
+	/**
+	 * Sets unmap queue which tears down grant mappings of the frontend
+	 * in background. The queue is flushed when the frontend is closed.
+	 * @param[in] unmapQueue unmap queue
+	 */
+	void setUnmapQueue(XenGnttabUnmapQueuePtr unmapQueue);
+
+	/**
+	 * Sets worker pool which executes asynchronous calls of the frontend
+	 * handler, such as closing on error, instead of own thread.
+	 * Should be called before start().
+	 * @param[in] workerPool worker pool
+	 */
+	void setWorkerPool(WorkerPoolPtr workerPool);
+
+	/**
+	 * Sets attributes of threads created by the frontend handler: own xen
+	 * store, asynchronous calls and event channels of ring buffers which have
+	 * no own attributes. Should be called before start().
+	 * @param[in] threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes);
+
+	/**
+	 * Returns attributes of threads created by the frontend handler
+	 */
+	const ThreadAttributes& getThreadAttributes() const
+	{
+		return mThreadAttributes;
+	}
+
+	/**
+	 * Enables or disables keeping ring buffers when the frontend restarts.
+	 * @param[in] warmReconnect if <i>true</i> the ring buffers may be reused
+	 * by takeRingBuffer() in next onBind()
+	 */
+	void setWarmReconnect(bool warmReconnect)
+	{
+		mWarmReconnect = warmReconnect;
+	}
+
+	/**
+	 * Returns metrics of all ring buffers of the frontend summed up
+	 */
+	RingMetrics getMetrics();
+
+	/**
+	 * Returns number of ring buffers of the frontend
+	 */
+	size_t getNumRingBuffers();
+
+	/**
+	 * Enables periodic dump of the frontend metrics to the log
+	 * @param[in] interval dump interval, 0 disables the dump
+	 */
+	void setMetricsDumpInterval(std::chrono::milliseconds interval);
+
 	/**
 	 * Returns current backend state.
 	 */
@@ -192,8 +300,36 @@ protected:
 	/**
 	 * Adds new ring buffer to the frontend handler.
 	 * @param[in] ringBuffer the ring buffer instance
+	 * @param[in] workerPool worker pool to process the ring buffer requests,
+	 * if it is not set the requests are processed by the event channel thread
 	 */
-	void addRingBuffer(RingBufferPtr ringBuffer);
+	void addRingBuffer(RingBufferPtr ringBuffer,
+					   WorkerPoolPtr workerPool = nullptr);
+
+	/**
+	 * Takes the ring buffer kept since the frontend restart. The ring buffer
+	 * is taken only if the frontend has confirmed that the ring pages are
+	 * kept (see the class description). The ring buffer is reset and should
+	 * be added again with addRingBuffer().
+	 * @param[in] port event channel port number
+	 * @param[in] refs grant table references of the ring pages
+	 * @return the ring buffer or nullptr if there is no kept ring buffer
+	 * with the same port and references
+	 */
+	RingBufferPtr takeRingBuffer(evtchn_port_t port,
+								 const std::vector<grant_ref_t>& refs);
+
+	/**
+	 * Takes the single page ring buffer kept since the frontend restart.
+	 * @param[in] port event channel port number
+	 * @param[in] ref  grant table reference
+	 * @return the ring buffer or nullptr if there is no kept ring buffer
+	 * with the same port and reference
+	 */
+	RingBufferPtr takeRingBuffer(evtchn_port_t port, grant_ref_t ref)
+	{
+		return takeRingBuffer(port, std::vector<grant_ref_t>{ref});
+	}
 
 	/**
 	 * Sets backend state.
@@ -201,6 +337,26 @@ protected:
 	 */
 	void setBackendState(xenbus_state state);
 
+	/**
+	 * Publishes max ring page order supported by the backend
+	 * (max-ring-page-order entry of the backend path).
+	 * @param[in] order max ring page order
+	 */
+	void setMaxRingPageOrder(unsigned int order);
+
+	/**
+	 * Reads ring buffer references from the frontend path.
+	 * If the frontend provides ring-page-order entry, the references are
+	 * read from <prefix>0 ... <prefix>N entries, otherwise single reference
+	 * is read from <prefix> entry.
+	 * @param[in] maxOrder max ring page order supported by the backend
+	 * @param[in] prefix   name of the ring reference entry
+	 * @return grant references of the ring pages
+	 */
+	std::vector<grant_ref_t> readRingRefs(unsigned int maxOrder = 0,
+										  const std::string& prefix =
+												  "ring-ref");
+
 	/**
 	 * Called when the frontend state changed to XenbusStateUnknown
 	 */
@@ -260,12 +416,22 @@ private:
 	xenbus_state mBackendState;
 	xenbus_state mFrontendState;
 
-	XenStore mXenStore;
+	std::unique_ptr<XenStore> mOwnXenStore;
+	XenStore& mXenStore;
 
 	std::string mXsBackendPath;
 	std::string mXsFrontendPath;
 
 	std::vector<RingBufferPtr> mRingBuffers;
+	std::vector<RingBufferPtr> mKeptRingBuffers;
+	bool mWarmReconnect;
+	unsigned int mRingGeneration;
+	std::mutex mRingMutex;
+	ThreadAttributes mThreadAttributes;
+	std::unique_ptr<Timer> mMetricsTimer;
+
+	XenGnttabCache mGnttabCache;
+	XenGnttabUnmapQueuePtr mUnmapQueue;
 
 	std::mutex mMutex;
 
@@ -275,13 +441,17 @@ private:
 
 	void initXenStorePathes();
 	void init();
-	void release();
+	void release(bool keepRingBuffers);
+	void releaseKeptRingBuffers();
+	bool isRingKept();
+	void bindFrontend();
 	void frontendStateChanged();
 	void backendStateChanged();
 	void onFrontendStateChanged(xenbus_state state);
 	void onBackendStateChanged(xenbus_state state);
 	void onError(const std::exception& e);
-	void close(xenbus_state stateAfterClose);
+	void close(xenbus_state stateAfterClose, bool keepRingBuffers = false);
+	void dumpMetrics();
 };
 
 typedef std::shared_ptr<FrontendHandlerBase> FrontendHandlerPtr;
@@ -22,15 +22,20 @@
 #define XENBE_LOG_HPP_
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "Config.hpp"
+
 /***************************************************************************//**
  * @defgroup log Backend log
  *
@@ -75,20 +80,41 @@
  * 07.11.16 16:46:54.029 | MyModule | DBG - This is debug log
  * @endcode
  *
+ * By default lines are written and flushed by the logging thread. Calling
+ * XenBackend::Log::setAsync() moves writing to a separate writer thread: the
+ * logging thread only queues the line, the writer outputs queued lines in
+ * batches with one flush per batch. If the queue is full, new lines are
+ * dropped and the number of dropped lines is reported in the log.
+ *
  ******************************************************************************/
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? \
 					  strrchr(__FILE__, '/') + 1 : __FILE__)
 
+/**
+ * @def XENBE_LOG_LEVEL
+ * Compile-time maximum log level (0 - DISABLE ... 4 - DEBUG). Log statements
+ * above this level are removed from the code. It is set by the LOG_LEVEL
+ * build option in the installed Config.hpp, thus the library and the
+ * application headers are compiled with the same level.
+ * @ingroup log
+ */
+
 /**
  * @def LOG(instance, level)
- * Displays log with defined level.
+ * Displays log with defined level. The level is checked before the log line
+ * is created, thus the stream operands are not evaluated for disabled levels.
  * @param[in] instance log instance (XenBackend::Log) or <i>const char*</i> or
  *                         <i>nullptr</i>
  * @param[in] level    log level
  * @ingroup log
  */
 #define LOG(instance, level) \
+	(static_cast<int>(XenBackend::LogLevel::log ## level) > XENBE_LOG_LEVEL || \
+	 !XenBackend::LogLine::isEnabled(instance, \
+									 XenBackend::LogLevel::log ## level)) ? \
+	(void) 0 : \
+	XenBackend::LogVoid() & \
 	XenBackend::LogLine().get(instance, __FILENAME__, __LINE__, \
 							  XenBackend::LogLevel::log ## level)
 
@@ -108,7 +134,7 @@
 #else
 
 #define DLOG(instance, level) \
-	true ? (void) 0 : XenBackend::LogVoid() & LOG(instance, level)
+	true ? (void) 0 : LOG(instance, level)
 
 #endif
 
@@ -133,6 +159,74 @@ public:
 };
 /// @endcond
 
+/***************************************************************************//**
+ * Log output. Writes log lines either synchronously or by a writer thread.
+ * @ingroup log
+ ******************************************************************************/
+class LogSink
+{
+public:
+
+	//! Default maximum number of queued lines in asynchronous mode
+	static const size_t cDefaultMaxLines = 4096;
+
+	/**
+	 * Returns the sink instance
+	 */
+	static LogSink& getInstance();
+
+	/**
+	 * Enables or disables asynchronous mode. When it is disabled, all queued
+	 * lines are written before return.
+	 * @param[in] async    enables asynchronous mode
+	 * @param[in] maxLines maximum number of queued lines
+	 */
+	void setAsync(bool async, size_t maxLines = cDefaultMaxLines);
+
+	/**
+	 * Writes or queues the log line
+	 * @param[in] line log line without end of line
+	 */
+	void write(std::string&& line);
+
+	/**
+	 * Waits until all queued lines are written and flushes the output
+	 */
+	void flush();
+
+	/**
+	 * Sets stream buffer to write log
+	 * @param[in] streamBuffer stream buffer
+	 */
+	void setStreamBuffer(std::streambuf* streamBuffer);
+
+	/**
+	 * Returns total number of dropped lines
+	 */
+	size_t getNumDropped() const { return mNumDropped; }
+
+private:
+
+	bool mAsync;
+	bool mTerminate;
+	bool mWriting;
+	size_t mMaxLines;
+	std::atomic<size_t> mNumDropped;
+	size_t mNumReported;
+	std::vector<std::string> mLines;
+	std::thread mThread;
+
+	std::mutex mMutex;
+	std::mutex mOutputMutex;
+	std::condition_variable mCondVar;
+
+	LogSink();
+	~LogSink();
+
+	void stop();
+	void run();
+	void writeLines(const std::vector<std::string>& lines);
+};
 
 /***************************************************************************//**
  * Log instance.
@@ -261,17 +355,43 @@ public:
 	}
 
 	/**
-	 * Sets file to write log
-	 * @param[in] fileName file name
+	 * Sets stream buffer to write log
+	 * @param[in] streamBuffer stream buffer
 	 */
 	static void setStreamBuffer(std::streambuf* streamBuffer)
 	{
-		getOutputStream().rdbuf(streamBuffer);
+		LogSink::getInstance().setStreamBuffer(streamBuffer);
+	}
+
+	/**
+	 * Enables or disables asynchronous log writing
+	 * @param[in] async    enables asynchronous mode
+	 * @param[in] maxLines maximum number of lines waiting for writing, new
+	 *                     lines are dropped above this limit
+	 */
+	static void setAsync(bool async,
+						 size_t maxLines = LogSink::cDefaultMaxLines)
+	{
+		LogSink::getInstance().setAsync(async, maxLines);
+	}
+
+	/**
+	 * Waits until all pending lines are written
+	 */
+	static void flush() { LogSink::getInstance().flush(); }
+
+	/**
+	 * Returns number of lines dropped in asynchronous mode
+	 */
+	static size_t getNumDropped()
+	{
+		return LogSink::getInstance().getNumDropped();
 	}
 
 private:
 
 	friend class LogLine;
+	friend class LogSink;
 
 	std::string mName;
 	LogLevel mLevel;
@@ -391,15 +511,22 @@ class LogLine
 {
 public:
 
-	virtual ~LogLine()
+	static bool isEnabled(const Log& log, LogLevel level)
 	{
-		static std::mutex sMutex;
+		return level <= log.mLevel && log.mLevel > LogLevel::logDISABLE;
+	}
 
+	static bool isEnabled(const char*, LogLevel level)
+	{
+		return level <= Log::getLogLevel() &&
+			   Log::getLogLevel() > LogLevel::logDISABLE;
+	}
+
+	virtual ~LogLine()
+	{
 		if (mCurrentLevel <= mSetLevel && mSetLevel > LogLevel::logDISABLE)
 		{
-			std::lock_guard<std::mutex> lock(sMutex);
-
-			Log::getOutputStream() << mStream.str() << std::endl;
+			LogSink::getInstance().write(mStream.str());
 		}
 	}
 
@@ -0,0 +1,252 @@
+/*
+ *  Performance metrics
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_METRICS_HPP_
+#define XENBE_METRICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Event counter.
+ * The counter is updated with relaxed atomic operations, thus it may be
+ * updated from the hot path and read from any thread.
+ * @ingroup backend
+ ******************************************************************************/
+class Counter
+{
+public:
+
+	Counter() : mValue(0) {}
+
+	/**
+	 * Increments the counter
+	 * @param[in] value value to add
+	 */
+	void inc(uint64_t value = 1)
+	{
+		mValue.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Returns current value
+	 */
+	uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+
+	std::atomic<uint64_t> mValue;
+};
+
+/***************************************************************************//**
+ * Latency histogram.
+ * Bucket N counts latencies below 2^(N + 1) us, the last bucket counts all
+ * greater latencies.
+ * @ingroup backend
+ ******************************************************************************/
+class LatencyHistogram
+{
+public:
+
+	//! Number of histogram buckets
+	static const size_t cNumBuckets = 24;
+
+	/**
+	 * Histogram values
+	 */
+	struct Snapshot
+	{
+		//! number of records
+		uint64_t count;
+		//! sum of all latencies in us
+		uint64_t sumUs;
+		//! number of records per bucket
+		std::array<uint64_t, cNumBuckets> buckets;
+
+		/**
+		 * Returns upper bound of the bucket which contains the percentile
+		 * @param[in] percentile percentile from 0 to 100
+		 * @return latency in us
+		 */
+		uint64_t getPercentile(double percentile) const
+		{
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			uint64_t threshold = std::ceil(count * percentile / 100.0);
+			uint64_t sum = 0;
+
+			for (size_t i = 0; i < cNumBuckets; i++)
+			{
+				sum += buckets[i];
+
+				if (sum >= threshold)
+				{
+					return getBucketLimit(i);
+				}
+			}
+
+			return getBucketLimit(cNumBuckets - 1);
+		}
+
+		/**
+		 * Returns average latency in us
+		 */
+		uint64_t getAverage() const { return count ? sumUs / count : 0; }
+
+		/**
+		 * Adds values of other histogram
+		 */
+		Snapshot& operator+=(const Snapshot& other)
+		{
+			count += other.count;
+			sumUs += other.sumUs;
+
+			for (size_t i = 0; i < cNumBuckets; i++)
+			{
+				buckets[i] += other.buckets[i];
+			}
+
+			return *this;
+		}
+	};
+
+	LatencyHistogram() : mCount(0), mSumUs(0)
+	{
+		for (auto& bucket : mBuckets)
+		{
+			bucket = 0;
+		}
+	}
+
+	/**
+	 * Records the latency
+	 * @param[in] latency latency
+	 */
+	void record(std::chrono::nanoseconds latency)
+	{
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+				latency).count();
+
+		if (us < 0)
+		{
+			us = 0;
+		}
+
+		mBuckets[getBucket(us)].fetch_add(1, std::memory_order_relaxed);
+		mSumUs.fetch_add(us, std::memory_order_relaxed);
+		mCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Returns histogram values
+	 */
+	Snapshot get() const
+	{
+		Snapshot snapshot;
+
+		snapshot.count = mCount.load(std::memory_order_relaxed);
+		snapshot.sumUs = mSumUs.load(std::memory_order_relaxed);
+
+		for (size_t i = 0; i < cNumBuckets; i++)
+		{
+			snapshot.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+		}
+
+		return snapshot;
+	}
+
+	/**
+	 * Returns upper bound of the bucket in us
+	 * @param[in] bucket bucket index
+	 */
+	static uint64_t getBucketLimit(size_t bucket)
+	{
+		return 2ull << bucket;
+	}
+
+private:
+
+	std::atomic<uint64_t> mCount;
+	std::atomic<uint64_t> mSumUs;
+	std::array<std::atomic<uint64_t>, cNumBuckets> mBuckets;
+
+	static size_t getBucket(uint64_t us)
+	{
+		size_t bucket = us < 2 ? 0 : 63 - __builtin_clzll(us);
+
+		return bucket < cNumBuckets ? bucket : cNumBuckets - 1;
+	}
+};
+
+/**
+ * Ring buffer metrics.
+ * @ingroup backend
+ */
+struct RingMetrics
+{
+	//! number of notifications received from the frontend
+	uint64_t numIndications;
+	//! number of notifications sent to the frontend
+	uint64_t numNotifications;
+	//! number of received requests
+	uint64_t numRequests;
+	//! number of sent responses
+	uint64_t numResponses;
+	//! number of request batches drained from the ring
+	uint64_t numBatches;
+	//! number of sent events
+	uint64_t numEvents;
+	//! number of events dropped or put to the backlog when the ring is full
+	uint64_t numOverflows;
+	//! number of times request consuming stopped at the in-flight limit
+	uint64_t numThrottles;
+	//! request batch processing latency
+	LatencyHistogram::Snapshot latency;
+
+	/**
+	 * Adds metrics of other ring buffer
+	 */
+	RingMetrics& operator+=(const RingMetrics& other)
+	{
+		numIndications += other.numIndications;
+		numNotifications += other.numNotifications;
+		numRequests += other.numRequests;
+		numResponses += other.numResponses;
+		numBatches += other.numBatches;
+		numEvents += other.numEvents;
+		numOverflows += other.numOverflows;
+		numThrottles += other.numThrottles;
+		latency += other.latency;
+
+		return *this;
+	}
+};
+
+}
+
+#endif /* XENBE_METRICS_HPP_ */
@@ -21,17 +21,31 @@
 #ifndef XENBE_RINGBUFFERBASE_HPP_
 #define XENBE_RINGBUFFERBASE_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 extern "C" {
 #include <xenctrl.h>
 #include <xen/io/ring.h>
 }
 
+#include "Arena.hpp"
 #include "XenEvtchn.hpp"
 #include "Exception.hpp"
 #include "XenGnttab.hpp"
+#include "WorkerPool.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
 
 namespace XenBackend {
 
@@ -58,6 +72,32 @@ public:
 	 * @param ref   grant table reference
 	 */
 	RingBufferBase(domid_t domId, evtchn_port_t port, grant_ref_t ref);
+
+	/**
+	 * @param loop  event channel loop which handles the ring notifications
+	 * @param domId frontend domain id
+	 * @param port  event channel port number
+	 * @param ref   grant table reference
+	 */
+	RingBufferBase(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+				   grant_ref_t ref);
+
+	/**
+	 * @param domId frontend domain id
+	 * @param port  event channel port number
+	 * @param refs  grant table references of the ring pages
+	 */
+	RingBufferBase(domid_t domId, evtchn_port_t port,
+				   const std::vector<grant_ref_t>& refs);
+
+	/**
+	 * @param loop  event channel loop which handles the ring notifications
+	 * @param domId frontend domain id
+	 * @param port  event channel port number
+	 * @param refs  grant table references of the ring pages
+	 */
+	RingBufferBase(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+				   const std::vector<grant_ref_t>& refs);
 	virtual ~RingBufferBase();
 
 	/**
@@ -70,15 +110,32 @@ public:
 	 */
 	void stop();
 
+	/**
+	 * Resets the ring state, so the ring buffer may be reused after
+	 * the frontend has reinitialized the shared ring in the same pages and
+	 * allocated the event channel with the same port. The event channel is
+	 * bound again as the frontend port is new. Should be called when the ring
+	 * buffer is stopped.
+	 * @return <i>false</i> if the ring buffer can't be reset, for example
+	 * it has pending responses
+	 */
+	bool reset();
+
 	/**
 	 * Returns event channel port.
 	 */
 	evtchn_port_t getPort() const { return mPort; }
 
 	/**
-	 * Returns grant table reference.
+	 * Returns grant table reference. For multi-page ring returns reference of
+	 * the first page.
+	 */
+	grant_ref_t getRef() const { return mRefs.empty() ? 0 : mRefs[0]; }
+
+	/**
+	 * Returns grant table references of all ring pages.
 	 */
-	grant_ref_t getRef() const { return mRef; }
+	const std::vector<grant_ref_t>& getRefs() const { return mRefs; }
 
 	/**
 	 * Sets error callback
@@ -86,6 +143,64 @@ public:
 	 */
 	void setErrorCallback(ErrorCallback errorCallback);
 
+	/**
+	 * Sets worker pool which processes the ring buffer indications.
+	 * If the worker pool is set, onReceiveIndication() is called from the pool
+	 * worker instead of the event channel thread. Indications of one ring
+	 * buffer are processed in order. Should be called before start().
+	 * @param workerPool worker pool
+	 */
+	void setWorkerPool(WorkerPoolPtr workerPool);
+
+	/**
+	 * Sets attributes of the event channel thread. Should be called before
+	 * start(). The attributes are not used if the ring buffer is handled by
+	 * XenEvtchnLoop.
+	 * @param threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes)
+	{
+		mEventChannel.setThreadAttributes(threadAttributes);
+	}
+
+	/**
+	 * Returns attributes of the event channel thread
+	 */
+	const ThreadAttributes& getThreadAttributes() const
+	{
+		return mEventChannel.getThreadAttributes();
+	}
+
+	/**
+	 * Keeps the event channel masked while the indication is handled, thus
+	 * the frontend notifications received while the ring is drained are
+	 * merged into one. If the worker pool is set, the event channel is
+	 * unmasked when the indication is queued to the pool. Should be called
+	 * before start().
+	 * @param[in] deferredUnmask enables deferred unmask
+	 */
+	void setDeferredUnmask(bool deferredUnmask)
+	{
+		mEventChannel.setDeferredUnmask(deferredUnmask);
+	}
+
+	/**
+	 * Sets minimal interval between notifications sent to the frontend.
+	 * Notifications requested within the interval are delayed and merged.
+	 * Should be called before start().
+	 * @param[in] interval notify interval, 0 disables the limit
+	 */
+	void setMinNotifyInterval(std::chrono::microseconds interval)
+	{
+		mEventChannel.setMinNotifyInterval(interval);
+	}
+
+	/**
+	 * Returns ring buffer metrics. Derived classes add own counters to
+	 * the event channel ones.
+	 */
+	virtual RingMetrics getMetrics() const;
+
 protected:
 
 	/**
@@ -95,6 +210,34 @@ protected:
 	 */
 	virtual void onReceiveIndication() = 0;
 
+	/**
+	 * Is called by reset() to reset the ring indexes and other state of
+	 * the derived class.
+	 * @return <i>false</i> if the state can't be reset
+	 */
+	virtual bool onReset() { return true; }
+
+	/**
+	 * Calls onReceiveIndication() without the event channel notification,
+	 * for example when the ring processing was suspended and may continue.
+	 * If the worker pool is set, the call is queued to the pool. Otherwise it
+	 * is done in the calling thread, or repeated by the thread which is
+	 * processing the indication at the moment. May be called from any thread.
+	 */
+	void resumeIndication();
+
+	/**
+	 * Reads the value from the shared memory exactly once. Should be used to
+	 * get scalar fields of the requests accessed in place, so the frontend
+	 * can't change the value between the check and the use.
+	 * @param value value to read
+	 */
+	template<typename T>
+	static T readOnce(const T& value)
+	{
+		return *static_cast<const volatile T*>(&value);
+	}
+
 	/**
 	 * Event channel.
 	 */
@@ -110,9 +253,19 @@ protected:
 private:
 
 	evtchn_port_t mPort;
-	grant_ref_t mRef;
+	std::vector<grant_ref_t> mRefs;
+
+	WorkerPoolPtr mWorkerPool;
+	WorkerQueuePtr mQueue;
+	std::atomic_bool mIndicationPending;
+	std::atomic_bool mStarted;
+	std::atomic<int> mNumRuns;
+	ErrorCallback mErrorCallback;
 
 	void onIndication();
+	void runIndication();
+	void processIndication();
+	void onProcessError(const std::exception& e);
 };
 
 /***************************************************************************//**
@@ -130,6 +283,63 @@ private:
  * In order to create the in ring buffer the client should implement a class
  * inherited from RingBufferInBase and override processRequest() method.
  *
+ * Backends which want to coalesce requests may override processRequests()
+ * instead. It receives all requests available in the ring at once.
+ *
+ * By default each response is pushed to the ring by sendResponse(). If the
+ * response batch size is set with setResponseBatchSize(), responses sent while
+ * requests are processed are pushed with one ring update and at most one
+ * notification per batch. Responses may also be queued explicitly with
+ * queueResponse() and published with flushResponses().
+ *
+ * If the in place mode is enabled with setInPlace(), processRequestInPlace()
+ * is called with the request located in the shared ring instead of the copy.
+ * The response may be constructed directly in the ring slot with
+ * constructResponse().
+ *
+ * Requests may be completed asynchronously. processRequest() calls
+ * deferResponse() and returns without sending the response. The returned
+ * ResponseToken may be completed later from any thread, all functions which
+ * put responses to the ring are synchronized. Tokens should be completed
+ * before the ring buffer is deleted.
+ *
+ * The number of requests consumed from the ring but not responded yet is
+ * limited by the ring size or by setMaxInFlightRequests(). When the limit is
+ * reached, the ring stops consuming requests and doesn't ask the frontend for
+ * notifications, thus the frontend sees the ring full. The processing resumes
+ * when a response is sent.
+ *
+ * Per request scratch memory may be taken from the arena enabled with
+ * setArenaBlockSize(). The arena has one block per ring slot, thus each
+ * request in flight may keep one block without heap allocations. Dispatching
+ * the ring indications to a worker pool still allocates per indication.
+ *
+ * For latency critical rings the poll budget may be set with setPollBudget().
+ * In this case, when all requests are processed, the ring keeps polling for new
+ * requests during the budget before it enables the frontend notifications
+ * again. The frontend doesn't notify the backend while the ring is polled.
+ * Polling occupies the thread which handles the ring (event channel thread or
+ * worker pool worker).
+ *
+ * If the derived class is passed as the Handler argument, the request
+ * functions are called directly instead of the virtual dispatch, so they may
+ * be inlined into the ring drain loop. In this case the overridden
+ * processRequest(), processRequests() or processRequestInPlace() should be
+ * accessible from the base class, e.g. public:
+ *
+ * @code
+ * class BlkRingBuffer final : public RingBufferInBase<blkif_back_ring,
+ *                                                     blkif_sring,
+ *                                                     blkif_request,
+ *                                                     blkif_response,
+ *                                                     BlkRingBuffer>
+ * {
+ * public:
+ *
+ *     void processRequest(const blkif_request& req) override;
+ * };
+ * @endcode
+ *
  * @snippet ExampleBackend.hpp ExampleInRingBuffer
  *
  * processRequest():
@@ -138,11 +348,67 @@ private:
  *
  * @ingroup backend
  ******************************************************************************/
-template<typename Ring, typename Page, typename Req, typename Rsp>
+template<typename Ring, typename Page, typename Req, typename Rsp,
+		 typename Handler = void>
 class RingBufferInBase : public RingBufferBase
 {
 public:
 
+	/**
+	 * Polling statistics
+	 */
+	struct PollStats
+	{
+		//! number of indications received from the event channel
+		uint64_t numIndications;
+		//! number of times new requests were found while polling
+		uint64_t numPollHits;
+		//! number of times the poll budget expired
+		uint64_t numPollMisses;
+	};
+
+	/**
+	 * Token of the request which response is sent asynchronously.
+	 * The token is returned by deferResponse() and should be completed once.
+	 */
+	class ResponseToken
+	{
+	public:
+
+		ResponseToken() : mRing(nullptr) {}
+
+		/**
+		 * Returns <i>true</i> if the token is not completed
+		 */
+		bool isValid() const { return mRing != nullptr; }
+
+		/**
+		 * Sends the response of the request. May be called from any thread.
+		 * @param[in] rsp response
+		 */
+		void complete(const Rsp& rsp)
+		{
+			if (!mRing)
+			{
+				throw RingBufferException("Invalid response token", EINVAL);
+			}
+
+			auto ring = mRing;
+
+			mRing = nullptr;
+
+			ring->completeResponse(rsp);
+		}
+
+	private:
+
+		friend class RingBufferInBase;
+
+		explicit ResponseToken(RingBufferInBase* ring) : mRing(ring) {}
+
+		RingBufferInBase* mRing;
+	};
+
 	/**
 	 * @param[in] domId    frontend domain id
 	 * @param[in] port     event channel port number
@@ -151,174 +417,1251 @@ public:
 	 */
 	RingBufferInBase(domid_t domId, evtchn_port_t port,
 					 grant_ref_t ref, int size = XC_PAGE_SIZE) :
-		RingBufferBase(domId, port, ref)
+		RingBufferBase(domId, port, ref),
+		mResponseBatchSize(0),
+		mNumQueuedResponses(0),
+		mNumPendingResponses(0),
+		mMaxInFlightRequests(0),
+		mThrottled(false),
+		mProcessing(false),
+		mInPlace(false),
+		mPollBudget(0),
+		mNumIndications(0),
+		mNumPollHits(0),
+		mNumPollMisses(0)
 	{
 		BACK_RING_INIT(&mRing, static_cast<Page*>(mBuffer.get()), size);
-	}
 
-protected:
+		mRequests.reserve(RING_SIZE(&mRing));
+	}
 
 	/**
-	 * Processes frontend requests.
-	 * This function is called when the request from the frontend is received
-	 * and should be implemented in a derived class.
-	 * @param req request
+	 * @param[in] loop     event channel loop which handles the notifications
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] ref      ring buffer ref number
+	 * @param[in] size ring buffer size
 	 */
-	virtual void processRequest(const Req& req) = 0;
+	RingBufferInBase(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+					 grant_ref_t ref, int size = XC_PAGE_SIZE) :
+		RingBufferBase(loop, domId, port, ref),
+		mResponseBatchSize(0),
+		mNumQueuedResponses(0),
+		mNumPendingResponses(0),
+		mMaxInFlightRequests(0),
+		mThrottled(false),
+		mProcessing(false),
+		mInPlace(false),
+		mPollBudget(0),
+		mNumIndications(0),
+		mNumPollHits(0),
+		mNumPollMisses(0)
+	{
+		BACK_RING_INIT(&mRing, static_cast<Page*>(mBuffer.get()), size);
+
+		mRequests.reserve(RING_SIZE(&mRing));
+	}
 
 	/**
-	 * Sends the response to the frontend
-	 * @param rsp response
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] refs     ring buffer ref numbers, the ring size is number of
+	 * refs multiplied by page size
 	 */
-	void sendResponse(const Rsp& rsp)
+	RingBufferInBase(domid_t domId, evtchn_port_t port,
+					 const std::vector<grant_ref_t>& refs) :
+		RingBufferBase(domId, port, refs),
+		mResponseBatchSize(0),
+		mNumQueuedResponses(0),
+		mNumPendingResponses(0),
+		mMaxInFlightRequests(0),
+		mThrottled(false),
+		mProcessing(false),
+		mInPlace(false),
+		mPollBudget(0),
+		mNumIndications(0),
+		mNumPollHits(0),
+		mNumPollMisses(0)
 	{
-		bool notify = false;
-
-		*RING_GET_RESPONSE(&mRing, mRing.rsp_prod_pvt) = rsp;
+		BACK_RING_INIT(&mRing, static_cast<Page*>(mBuffer.get()),
+					   mBuffer.size());
 
-		mRing.rsp_prod_pvt++;
+		mRequests.reserve(RING_SIZE(&mRing));
+	}
 
-		RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&mRing, notify);
+	/**
+	 * @param[in] loop     event channel loop which handles the notifications
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] refs     ring buffer ref numbers, the ring size is number of
+	 * refs multiplied by page size
+	 */
+	RingBufferInBase(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+					 const std::vector<grant_ref_t>& refs) :
+		RingBufferBase(loop, domId, port, refs),
+		mResponseBatchSize(0),
+		mNumQueuedResponses(0),
+		mNumPendingResponses(0),
+		mMaxInFlightRequests(0),
+		mThrottled(false),
+		mProcessing(false),
+		mInPlace(false),
+		mPollBudget(0),
+		mNumIndications(0),
+		mNumPollHits(0),
+		mNumPollMisses(0)
+	{
+		BACK_RING_INIT(&mRing, static_cast<Page*>(mBuffer.get()),
+					   mBuffer.size());
 
-		if (notify)
-		{
-			mEventChannel.notify();
-		}
+		mRequests.reserve(RING_SIZE(&mRing));
 	}
 
-private:
+	/**
+	 * Sets number of responses which are pushed to the ring at once while
+	 * requests are processed. Remaining responses are pushed when all
+	 * available requests are processed.
+	 * @param[in] size batch size, 0 disables response batching
+	 */
+	void setResponseBatchSize(size_t size) { mResponseBatchSize = size; }
 
-	Ring mRing;
+	/**
+	 * Enables or disables in place request processing
+	 * @param[in] inPlace if <i>true</i> processRequestInPlace() is called
+	 * instead of processRequests()
+	 */
+	void setInPlace(bool inPlace) { mInPlace = inPlace; }
 
-	void onReceiveIndication()
+	/**
+	 * Sets time during which the ring is polled for new requests before
+	 * the frontend notifications are enabled
+	 * @param[in] budget poll budget, 0 disables polling
+	 */
+	void setPollBudget(std::chrono::microseconds budget)
 	{
-		int numPendingRequests = 0;
+		mPollBudget = budget;
+	}
 
-		do {
-			Req req;
+	/**
+	 * Sets maximum number of requests consumed from the ring and not responded
+	 * yet. The number is limited by the ring size anyway.
+	 * @param[in] maxRequests maximum number of requests, 0 sets the ring size
+	 */
+	void setMaxInFlightRequests(size_t maxRequests)
+	{
+		mMaxInFlightRequests = maxRequests;
+	}
 
-			auto rc = mRing.req_cons;
-			auto rp = mRing.sring->req_prod;
+	/**
+	 * Creates the arena with one block of the given size per ring slot.
+	 * Should be called before start().
+	 * @param[in] blockSize arena block size
+	 */
+	void setArenaBlockSize(size_t blockSize)
+	{
+		mArena.reset(new Arena(blockSize, RING_SIZE(&mRing)));
+	}
 
-			xen_rmb();
+	/**
+	 * Returns number of requests consumed from the ring and not responded yet
+	 */
+	size_t getNumInFlightRequests()
+	{
+		std::lock_guard<std::mutex> lock(mResponseMutex);
 
-			if (RING_REQUEST_PROD_OVERFLOW(&mRing, rp))
-			{
-				throw RingBufferException("Ring buffer producer overflow", EIO);
-			}
+		return mRing.req_cons - mRing.rsp_prod_pvt;
+	}
 
-			while (rc != rp)
-			{
+	/**
+	 * Returns number of deferred responses which are not completed yet
+	 */
+	size_t getNumPendingResponses() const { return mNumPendingResponses; }
 
-				if (RING_REQUEST_CONS_OVERFLOW(&mRing, rc))
-				{
-					throw RingBufferException("Ring buffer consumer overflow", EIO);
-				}
+	/**
+	 * Returns polling statistics
+	 */
+	PollStats getPollStats() const
+	{
+		return { mNumIndications, mNumPollHits, mNumPollMisses };
+	}
 
-				req = *RING_GET_REQUEST(&mRing, rc);
+	/**
+	 * Returns ring buffer metrics
+	 */
+	RingMetrics getMetrics() const override
+	{
+		auto metrics = RingBufferBase::getMetrics();
 
-				mRing.req_cons = ++rc;
+		metrics.numRequests = mNumRequests.get();
+		metrics.numResponses = mNumResponses.get();
+		metrics.numBatches = mNumBatches.get();
+		metrics.numThrottles = mNumThrottles.get();
+		metrics.latency = mLatency.get();
 
-				xen_mb();
+		return metrics;
+	}
 
-				processRequest(req);
-			}
+protected:
 
-			RING_FINAL_CHECK_FOR_REQUESTS(&mRing, numPendingRequests);
-		}
-		while (numPendingRequests);
+	/**
+	 * Processes frontend requests.
+	 * This function is called when the request from the frontend is received
+	 * and should be implemented in a derived class unless processRequests()
+	 * or processRequestInPlace() is overridden. If the Handler argument is
+	 * passed, missing overrides are reported at compile time. With the
+	 * virtual dispatch they can't be detected, so the default implementation
+	 * throws ENOSYS and the ring is stopped with an error on the first
+	 * request.
+	 * @param req request
+	 */
+	virtual void processRequest(const Req& req)
+	{
+		throw RingBufferException("Request processing is not implemented",
+								  ENOSYS);
 	}
-};
 
-/***************************************************************************//**
- * Base class to create the custom output ring buffer (for sending events to
- * the frontend).
- * RingBufferOutBase is a template with arguments taken from PV driver protocol.
- * The arguments of the template are structures described the ring buffer and
- * events to be sent to the frontend. Also the out ring buffer takes a remote
- * event channel number, a grant reference on which the ring buffer is
- * mapped and offset where the events are stored in the ring buffer. Xen event
- * channel is used to notify the frontend that a new event is available in
- * the ring buffer.
- *
- * The out ring buffer can be instantiated directly, no need to implement a
- * class inherited from RingBufferOutBase.
- *
- * @snippet ExampleBackend.hpp ExampleOutRingBuffer
- *
- *The client should call sendEvent() method to send an event to the frontend:
- *
- * @snippet ExampleBackend.cpp onSomeEvent
- *
- * @ingroup backend
- ******************************************************************************/
-template<typename Page,typename Event>
-class RingBufferOutBase : public RingBufferBase
-{
-public:
+	/**
+	 * Processes batch of frontend requests.
+	 * This function is called with all requests read from the ring at once.
+	 * The requests are already consumed from the ring, so the buffer is valid
+	 * only till the function returns. By default processRequest() is called
+	 * for each request.
+	 * @param reqs  requests
+	 * @param count number of requests
+	 */
+	virtual void processRequests(const Req* reqs, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			dispatchRequest(reqs[i], IsVirtual());
+		}
+	}
 
 	/**
-	 * @param[in] domId    frontend domain id
-	 * @param[in] port     event channel port number
-	 * @param[in] ref      ring buffer ref number
-	 * @param[in] offset   start of the ring buffer inside mapped page
-	 * @param[in] size     size of the ring buffer
+	 * Processes frontend request located in the shared ring.
+	 * The frontend may change the request while it is processed, thus
+	 * the fields should be read once with readOnce() and validated before use.
+	 * The request and the response share the same ring slots, so the request
+	 * fields should be read before the response is constructed.
+	 * By default the request is copied and processRequests() is called.
+	 * @param req request in the ring
 	 */
-	RingBufferOutBase(domid_t domId, evtchn_port_t port, grant_ref_t ref,
-					  int offset, size_t size) :
-		RingBufferBase(domId, port, ref),
-		mPage(static_cast<Page*>(mBuffer.get())),
-		mEventBuffer(reinterpret_cast<Event*>(
-				static_cast<uint8_t*>(mBuffer.get()) + offset)),
-		mNumEvents(size/sizeof(Event))
+	virtual void processRequestInPlace(const Req& req)
 	{
-		mPage->in_prod = mPage->in_cons;
+		Req copy = req;
 
-		xen_wmb();
+		dispatchRequests(&copy, 1, IsVirtual());
 	}
 
 	/**
-	 * Sends the event to the frontend
-	 * @param event event to the frontend
+	 * Sends the response to the frontend. May be called from any thread.
+	 * @param rsp response
 	 */
-	void sendEvent(const Event& event)
+	void sendResponse(const Rsp& rsp)
 	{
-		std::lock_guard<std::mutex> lock(mMutex);
+		std::unique_lock<std::mutex> lock(mResponseMutex);
 
-		if (static_cast<int>(mPage->in_prod - mPage->in_cons) >= mNumEvents)
-		{
-			LOG(mLog, WARNING) << "Ring buffer overflow, port: " << getPort()
-							   <<", prod: " << mPage->in_prod
-							   << ", cons: " << mPage->in_cons;
+		putResponse(rsp);
+		commitResponse();
 
-			return;
-		}
+		resumeIfThrottled(lock);
+	}
 
-		LOG(mLog, DEBUG) << "Send event, port: " << getPort()
-						 <<", prod: " << mPage->in_prod
-						 << ", cons: " << mPage->in_cons
-						 << ", num events: " << mNumEvents;
+	/**
+	 * Constructs the response directly in the ring slot and sends it to
+	 * the frontend. May be called from any thread.
+	 * @param construct functor which fills the response: void(Rsp&)
+	 */
+	template<typename F>
+	void constructResponse(F construct)
+	{
+		std::unique_lock<std::mutex> lock(mResponseMutex);
+
+		construct(*RING_GET_RESPONSE(&mRing, mRing.rsp_prod_pvt));
 
-		mEventBuffer[mPage->in_prod % mNumEvents] = event;
+		mRing.rsp_prod_pvt++;
 
-		mPage->in_prod++;
+		mNumQueuedResponses++;
+		mNumResponses.inc();
 
-		xen_wmb();
+		commitResponse();
 
-		mEventChannel.notify();
+		resumeIfThrottled(lock);
 	}
 
-protected:
+	/**
+	 * Puts the response to the ring without making it visible to the frontend
+	 * @param rsp response
+	 */
+	void queueResponse(const Rsp& rsp)
+	{
+		std::unique_lock<std::mutex> lock(mResponseMutex);
 
-	void onReceiveIndication() {}
+		putResponse(rsp);
 
-private:
+		resumeIfThrottled(lock);
+	}
 
-	Page* mPage;
-	Event* mEventBuffer;
-	int mNumEvents;
+	/**
+	 * Pushes queued responses and notifies the frontend if required
+	 */
+	void flushResponses()
+	{
+		std::lock_guard<std::mutex> lock(mResponseMutex);
+
+		pushResponses();
+	}
+
+	/**
+	 * Returns the request arena. The arena should be enabled by
+	 * setArenaBlockSize().
+	 */
+	Arena& getArena()
+	{
+		if (!mArena)
+		{
+			throw RingBufferException("Arena is not enabled", EPERM);
+		}
+
+		return *mArena;
+	}
+
+	/**
+	 * Defers the response of the request being processed. The response
+	 * is sent when the returned token is completed.
+	 * @return response token
+	 */
+	ResponseToken deferResponse()
+	{
+		mNumPendingResponses++;
+
+		return ResponseToken(this);
+	}
+
+	bool onReset() override
+	{
+		std::lock_guard<std::mutex> lock(mResponseMutex);
+
+		// tokens in flight refer to the old ring indexes
+
+		if (mNumPendingResponses)
+		{
+			return false;
+		}
+
+		mRing.req_cons = 0;
+		mRing.rsp_prod_pvt = 0;
+
+		mRequests.clear();
+		mNumQueuedResponses = 0;
+		mThrottled = false;
+
+		return true;
+	}
+
+private:
+
+	typedef std::integral_constant<bool, std::is_void<Handler>::value>
+			IsVirtual;
+	typedef typename std::conditional<IsVirtual::value, RingBufferInBase,
+									  Handler>::type HandlerType;
+
+	// true for the request functions which are not overridden by the handler
+
+	template<typename F>
+	struct IsDefault : std::false_type {};
+
+	template<typename... Args>
+	struct IsDefault<void (RingBufferInBase::*)(Args...)> : std::true_type {};
+
+	Ring mRing;
+	std::vector<Req> mRequests;
+	size_t mResponseBatchSize;
+	size_t mNumQueuedResponses;
+	std::atomic<size_t> mNumPendingResponses;
+	size_t mMaxInFlightRequests;
+	bool mThrottled;
+	std::atomic_bool mProcessing;
+	bool mInPlace;
+	std::chrono::microseconds mPollBudget;
+	std::atomic<uint64_t> mNumIndications;
+	std::atomic<uint64_t> mNumPollHits;
+	std::atomic<uint64_t> mNumPollMisses;
+	Counter mNumRequests;
+	Counter mNumResponses;
+	Counter mNumBatches;
+	Counter mNumThrottles;
+	LatencyHistogram mLatency;
+	std::mutex mResponseMutex;
+	std::unique_ptr<Arena> mArena;
+
+	void completeResponse(const Rsp& rsp)
+	{
+		sendResponse(rsp);
+
+		mNumPendingResponses--;
+	}
+
+	// qualified calls of the handler functions are not virtual
+
+	void dispatchRequest(const Req& req, std::true_type)
+	{
+		processRequest(req);
+	}
+
+	void dispatchRequest(const Req& req, std::false_type)
+	{
+		static_assert(
+			!IsDefault<decltype(&HandlerType::processRequest)>::value ||
+			!IsDefault<decltype(&HandlerType::processRequests)>::value ||
+			!IsDefault<decltype(&HandlerType::processRequestInPlace)>::value,
+			"Handler should override processRequest(), processRequests() "
+			"or processRequestInPlace()");
+
+		static_cast<HandlerType*>(this)->HandlerType::processRequest(req);
+	}
+
+	void dispatchRequests(const Req* reqs, size_t count, std::true_type)
+	{
+		processRequests(reqs, count);
+	}
+
+	void dispatchRequests(const Req* reqs, size_t count, std::false_type)
+	{
+		static_cast<HandlerType*>(this)->HandlerType::processRequests(reqs,
+																	  count);
+	}
+
+	void dispatchInPlace(const Req& req, std::true_type)
+	{
+		processRequestInPlace(req);
+	}
+
+	void dispatchInPlace(const Req& req, std::false_type)
+	{
+		static_cast<HandlerType*>(this)->HandlerType::processRequestInPlace(
+				req);
+	}
+
+	void resumeIfThrottled(std::unique_lock<std::mutex>& lock)
+	{
+		if (!mThrottled)
+		{
+			return;
+		}
+
+		mThrottled = false;
+
+		lock.unlock();
+
+		resumeIndication();
+	}
+
+	RING_IDX getNumFreeSlots(RING_IDX rc)
+	{
+		std::lock_guard<std::mutex> lock(mResponseMutex);
+
+		RING_IDX maxRequests = RING_SIZE(&mRing);
+
+		if (mMaxInFlightRequests && mMaxInFlightRequests < maxRequests)
+		{
+			maxRequests = mMaxInFlightRequests;
+		}
+
+		RING_IDX numInFlight = rc - mRing.rsp_prod_pvt;
+
+		if (numInFlight >= maxRequests)
+		{
+			// the flag is set under the lock to not miss the response which
+			// frees the slot
+
+			mThrottled = true;
+
+			mNumThrottles.inc();
+
+			return 0;
+		}
+
+		return maxRequests - numInFlight;
+	}
+
+	void putResponse(const Rsp& rsp)
+	{
+		*RING_GET_RESPONSE(&mRing, mRing.rsp_prod_pvt) = rsp;
+
+		mRing.rsp_prod_pvt++;
+
+		mNumQueuedResponses++;
+		mNumResponses.inc();
+	}
+
+	void pushResponses()
+	{
+		if (!mNumQueuedResponses)
+		{
+			return;
+		}
+
+		bool notify = false;
+		auto numResponses = mNumQueuedResponses;
+
+		mNumQueuedResponses = 0;
+
+		RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(&mRing, notify);
+
+		XENBE_TRACE(RESPONSES_PUSHED, getPort(), numResponses);
+
+		if (notify)
+		{
+			mEventChannel.notify();
+
+			XENBE_TRACE(RESPONSES_NOTIFIED, getPort(), numResponses);
+		}
+	}
+
+	bool pollRequests()
+	{
+		using namespace std::chrono;
+
+		// req_event is not updated while polling, so the frontend doesn't
+		// notify us
+
+		auto end = steady_clock::now() + mPollBudget;
+
+		do
+		{
+			if (readOnce(mRing.sring->req_prod) != mRing.req_cons)
+			{
+				mNumPollHits++;
+
+				return true;
+			}
+		}
+		while (steady_clock::now() < end);
+
+		mNumPollMisses++;
+
+		return false;
+	}
+
+	void commitResponse()
+	{
+		// responses completed while requests are processed are pushed
+		// with the batch, flushResponses() after processing pushes the rest
+
+		if (!mProcessing || mNumQueuedResponses >= mResponseBatchSize)
+		{
+			pushResponses();
+		}
+	}
+
+	void processInPlace(RING_IDX rc, RING_IDX rp)
+	{
+		while (rc != rp)
+		{
+			if (RING_REQUEST_CONS_OVERFLOW(&mRing, rc))
+			{
+				throw RingBufferException("Ring buffer consumer overflow", EIO);
+			}
+
+			dispatchInPlace(*RING_GET_REQUEST(&mRing, rc++), IsVirtual());
+
+			mRing.req_cons = rc;
+		}
+	}
+
+	void onReceiveIndication()
+	{
+		int numPendingRequests = 0;
+
+		mNumIndications++;
+
+		do {
+			auto rc = mRing.req_cons;
+			auto rp = mRing.sring->req_prod;
+
+			xen_rmb();
+
+			if (RING_REQUEST_PROD_OVERFLOW(&mRing, rp))
+			{
+				throw RingBufferException("Ring buffer producer overflow", EIO);
+			}
+
+			bool limited = false;
+
+			if (rc != rp)
+			{
+				// don't ask for notifications when the in-flight limit is
+				// reached, the processing is resumed by a response
+
+				auto numFreeSlots = getNumFreeSlots(rc);
+
+				if (numFreeSlots == 0)
+				{
+					break;
+				}
+
+				if (rp - rc > numFreeSlots)
+				{
+					rp = rc + numFreeSlots;
+
+					limited = true;
+				}
+			}
+
+			bool hasRequests = rc != rp;
+
+			auto startTime = hasRequests ?
+					std::chrono::steady_clock::now() :
+					std::chrono::steady_clock::time_point();
+
+			if (rc != rp && mInPlace)
+			{
+				auto numRequests = rp - rc;
+
+				mNumRequests.inc(numRequests);
+
+				XENBE_TRACE(REQUESTS_DEQUEUED, getPort(), numRequests);
+
+				mProcessing = mResponseBatchSize != 0;
+
+				XENBE_TRACE(PROCESS_ENTER, getPort(), numRequests);
+
+				try
+				{
+					processInPlace(rc, rp);
+				}
+				catch(...)
+				{
+					mProcessing = false;
+
+					throw;
+				}
+
+				mProcessing = false;
+
+				XENBE_TRACE(PROCESS_EXIT, getPort(), numRequests);
+
+				xen_mb();
+
+				flushResponses();
+			}
+			else if (rc != rp)
+			{
+				mRequests.clear();
+
+				while (rc != rp)
+				{
+					if (RING_REQUEST_CONS_OVERFLOW(&mRing, rc))
+					{
+						throw RingBufferException("Ring buffer consumer overflow",
+												  EIO);
+					}
+
+					mRequests.push_back(*RING_GET_REQUEST(&mRing, rc++));
+				}
+
+				mRing.req_cons = rc;
+
+				xen_mb();
+
+				mNumRequests.inc(mRequests.size());
+
+				XENBE_TRACE(REQUESTS_DEQUEUED, getPort(), mRequests.size());
+
+				mProcessing = mResponseBatchSize != 0;
+
+				XENBE_TRACE(PROCESS_ENTER, getPort(), mRequests.size());
+
+				try
+				{
+					dispatchRequests(mRequests.data(), mRequests.size(),
+									 IsVirtual());
+				}
+				catch(...)
+				{
+					mProcessing = false;
+
+					throw;
+				}
+
+				mProcessing = false;
+
+				XENBE_TRACE(PROCESS_EXIT, getPort(), mRequests.size());
+
+				flushResponses();
+			}
+
+			if (hasRequests)
+			{
+				mNumBatches.inc();
+				mLatency.record(std::chrono::steady_clock::now() - startTime);
+			}
+
+			if (limited)
+			{
+				numPendingRequests = 1;
+
+				continue;
+			}
+
+			if (mPollBudget.count() && pollRequests())
+			{
+				numPendingRequests = 1;
+
+				continue;
+			}
+
+			RING_FINAL_CHECK_FOR_REQUESTS(&mRing, numPendingRequests);
+		}
+		while (numPendingRequests);
+	}
+};
+
+/**
+ * Defines what the output ring buffer does with new events when it is full.
+ * Events are dropped only from the local backlog and never from the ring,
+ * thus DROP_OLDEST and BACKLOG require non zero backlog size.
+ * @ingroup backend
+ */
+enum class OverflowPolicy
+{
+	DROP_NEWEST,	//!< new event is dropped
+	DROP_OLDEST,	//!< new event is put to the backlog, the oldest event in
+					//!< the backlog is dropped when the backlog is full
+	BLOCK,			//!< sender waits for free space until timeout expires
+	BACKLOG			//!< new event is put to the backlog, new event is dropped
+					//!< when the backlog is full
+};
+
+/***************************************************************************//**
+ * Base class to create the custom output ring buffer (for sending events to
+ * the frontend).
+ * RingBufferOutBase is a template with arguments taken from PV driver protocol.
+ * The arguments of the template are structures described the ring buffer and
+ * events to be sent to the frontend. Also the out ring buffer takes a remote
+ * event channel number, a grant reference on which the ring buffer is
+ * mapped and offset where the events are stored in the ring buffer. Xen event
+ * channel is used to notify the frontend that a new event is available in
+ * the ring buffer.
+ *
+ * The out ring buffer can be instantiated directly, no need to implement a
+ * class inherited from RingBufferOutBase.
+ *
+ * @snippet ExampleBackend.hpp ExampleOutRingBuffer
+ *
+ *The client should call sendEvent() method to send an event to the frontend:
+ *
+ * @snippet ExampleBackend.cpp onSomeEvent
+ *
+ * By default the event is dropped if the ring is full. Other behavior may be
+ * selected with setOverflowPolicy(). The events put to the backlog are moved
+ * to the ring when the frontend notifies that it has consumed events. As
+ * event ring frontends usually don't notify when they consume events, the
+ * backlog is also drained every millisecond by TimerService while it is not
+ * empty. Events already published to the ring belong to the frontend and are
+ * never dropped.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+template<typename Page,typename Event>
+class RingBufferOutBase : public RingBufferBase
+{
+public:
+
+	/**
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] ref      ring buffer ref number
+	 * @param[in] offset   start of the ring buffer inside mapped page
+	 * @param[in] size     size of the ring buffer
+	 */
+	RingBufferOutBase(domid_t domId, evtchn_port_t port, grant_ref_t ref,
+					  int offset, size_t size) :
+		RingBufferBase(domId, port, ref),
+		mPage(static_cast<Page*>(mBuffer.get())),
+		mEventBuffer(reinterpret_cast<Event*>(
+				static_cast<uint8_t*>(mBuffer.get()) + offset)),
+		mNumEvents(size/sizeof(Event))
+	{
+		init();
+	}
+
+	/**
+	 * @param[in] loop     event channel loop which handles the notifications
+	 * @param[in] domId    frontend domain id
+	 * @param[in] port     event channel port number
+	 * @param[in] ref      ring buffer ref number
+	 * @param[in] offset   start of the ring buffer inside mapped page
+	 * @param[in] size     size of the ring buffer
+	 */
+	RingBufferOutBase(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+					  grant_ref_t ref, int offset, size_t size) :
+		RingBufferBase(loop, domId, port, ref),
+		mPage(static_cast<Page*>(mBuffer.get())),
+		mEventBuffer(reinterpret_cast<Event*>(
+				static_cast<uint8_t*>(mBuffer.get()) + offset)),
+		mNumEvents(size/sizeof(Event))
+	{
+		init();
+	}
+
+	/**
+	 * Overflow statistics
+	 */
+	struct OverflowStats
+	{
+		//! number of dropped events
+		uint64_t numDropped;
+		//! number of events put to the backlog
+		uint64_t numSpilled;
+	};
+
+	/**
+	 * Sets overflow policy. Should be called before sending events.
+	 * @param[in] policy      overflow policy
+	 * @param[in] backlogSize max number of events in the backlog, shall not be
+	 * 0 for OverflowPolicy::DROP_OLDEST and OverflowPolicy::BACKLOG
+	 * @param[in] timeout     max time to wait for free space for
+	 * OverflowPolicy::BLOCK
+	 */
+	void setOverflowPolicy(OverflowPolicy policy, size_t backlogSize = 0,
+						   std::chrono::milliseconds timeout =
+								   std::chrono::milliseconds(0))
+	{
+		if (backlogSize == 0 && (policy == OverflowPolicy::DROP_OLDEST ||
+								 policy == OverflowPolicy::BACKLOG))
+		{
+			throw RingBufferException("Overflow policy requires backlog",
+									  EINVAL);
+		}
+
+		if (backlogSize && !mDrainTimer)
+		{
+			mDrainTimer.reset(new Timer([this] { onDrainTimer(); }, true));
+		}
+
+		mPolicy = policy;
+		mMaxBacklogSize = backlogSize;
+		mTimeout = timeout;
+	}
+
+	/**
+	 * Returns overflow statistics
+	 */
+	OverflowStats getOverflowStats() const
+	{
+		return { mNumDropped, mNumSpilled };
+	}
+
+	/**
+	 * Returns ring buffer metrics
+	 */
+	RingMetrics getMetrics() const override
+	{
+		auto metrics = RingBufferBase::getMetrics();
+
+		metrics.numEvents = mNumSentEvents.get();
+		metrics.numOverflows = mNumDropped + mNumSpilled;
+
+		return metrics;
+	}
+
+	/**
+	 * Sends the event to the frontend.
+	 * Can be called from different threads concurrently.
+	 * @param event event to the frontend
+	 * @return <i>true</i> if the event is sent or put to the backlog
+	 */
+	bool sendEvent(const Event& event)
+	{
+		uint32_t start = 0;
+
+		if (mBacklogSize != 0 || !reserve(1, start))
+		{
+			return handleOverflow([&event](Event& slot) { slot = event; });
+		}
+
+		DLOG(mLog, DEBUG) << "Send event, port: " << getPort()
+						  << ", prod: " << start
+						  << ", num events: " << mNumEvents;
+
+		mEventBuffer[getIndex(start)] = event;
+
+		publish(start, 1);
+
+		return true;
+	}
+
+	/**
+	 * Sends the events to the frontend with one producer update and one
+	 * notification.
+	 * Can be called from different threads concurrently.
+	 * @param events events to the frontend
+	 * @param count  number of events
+	 * @return number of events sent or put to the backlog
+	 */
+	size_t sendEvents(const Event* events, size_t count)
+	{
+		uint32_t start = 0;
+		uint32_t numReserved = 0;
+
+		if (mBacklogSize == 0)
+		{
+			numReserved = reserve(count, start);
+		}
+
+		for (uint32_t i = 0; i < numReserved; i++)
+		{
+			mEventBuffer[getIndex(start + i)] = events[i];
+		}
+
+		if (numReserved)
+		{
+			publish(start, numReserved);
+		}
+
+		size_t numSent = numReserved;
+
+		for (size_t i = numReserved; i < count; i++)
+		{
+			auto& event = events[i];
+
+			if (handleOverflow([&event](Event& slot) { slot = event; }))
+			{
+				numSent++;
+			}
+		}
+
+		return numSent;
+	}
+
+	/**
+	 * Constructs the event with the functor and sends it to the frontend.
+	 * Can be called from different threads concurrently. The event is built
+	 * before a ring slot is reserved, so if the functor throws, the ring
+	 * is left untouched and no partial data is exposed to the frontend.
+	 * @param construct functor which fills the event: void(Event&)
+	 * @return <i>true</i> if the event is sent or put to the backlog
+	 */
+	template<typename F>
+	bool constructEvent(F construct)
+	{
+		Event event {};
+
+		construct(event);
+
+		return sendEvent(event);
+	}
+
+protected:
+
+	void onReceiveIndication()
+	{
+		if (mBacklogSize)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			drainBacklog();
+		}
+
+		if (mPolicy == OverflowPolicy::BLOCK)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			mCondVar.notify_all();
+		}
+	}
+
+	bool onReset() override
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mBacklog.clear();
+		mBacklogSize = 0;
+
+		mPage->in_prod = mPage->in_cons;
+
+		mReserved = mPage->in_prod;
+		mPublished = mPage->in_prod;
+
+		xen_wmb();
+
+		return true;
+	}
+
+private:
+
+	Page* mPage;
+	Event* mEventBuffer;
+	uint32_t mNumEvents;
+	uint32_t mMask;
+
+	// producers reserve slots by moving mReserved and publish them in
+	// the reservation order by moving mPublished and in_prod
+
+	std::atomic<uint32_t> mReserved;
+	std::atomic<uint32_t> mPublished;
+
+	OverflowPolicy mPolicy;
+	size_t mMaxBacklogSize;
+	std::chrono::milliseconds mTimeout;
+
+	std::deque<Event> mBacklog;
+	std::atomic<size_t> mBacklogSize;
+
+	std::atomic<uint64_t> mNumDropped;
+	std::atomic<uint64_t> mNumSpilled;
+	std::atomic<int64_t> mLastOverflowLog;
+	Counter mNumSentEvents;
 
 	std::mutex mMutex;
+	std::condition_variable mCondVar;
+
+	// drains the backlog while it is not empty, declared after the members
+	// used by the callback to be deleted first
+	std::unique_ptr<Timer> mDrainTimer;
+	bool mDrainScheduled;
+
+	void init()
+	{
+		mMask = (mNumEvents & (mNumEvents - 1)) == 0 ? mNumEvents - 1 : 0;
+
+		mPage->in_prod = mPage->in_cons;
+
+		mReserved = mPage->in_prod;
+		mPublished = mPage->in_prod;
+
+		mPolicy = OverflowPolicy::DROP_NEWEST;
+		mMaxBacklogSize = 0;
+		mTimeout = std::chrono::milliseconds(0);
+		mBacklogSize = 0;
+		mNumDropped = 0;
+		mNumSpilled = 0;
+		mLastOverflowLog = 0;
+		mDrainScheduled = false;
+
+		xen_wmb();
+	}
+
+	void onDrainTimer()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		drainBacklog();
+
+		if (mBacklog.empty() && mDrainScheduled)
+		{
+			mDrainTimer->stop();
+
+			mDrainScheduled = false;
+		}
+	}
+
+	uint32_t getIndex(uint32_t index) const
+	{
+		return mMask ? index & mMask : index % mNumEvents;
+	}
+
+	uint32_t reserve(size_t count, uint32_t& start)
+	{
+		uint32_t numReserved = 0;
+
+		start = mReserved.load(std::memory_order_relaxed);
+
+		do
+		{
+			uint32_t numUsed = start - readOnce(mPage->in_cons);
+			uint32_t numFree = numUsed < mNumEvents ? mNumEvents - numUsed : 0;
+
+			numReserved = count < numFree ? count : numFree;
+
+			if (numReserved == 0)
+			{
+				return 0;
+			}
+		}
+		while (!mReserved.compare_exchange_weak(start, start + numReserved));
+
+		return numReserved;
+	}
+
+	void publish(uint32_t start, uint32_t count)
+	{
+		while (mPublished.load(std::memory_order_acquire) != start)
+		{
+			std::this_thread::yield();
+		}
+
+		xen_wmb();
+
+		mPage->in_prod = start + count;
+
+		mPublished.store(start + count, std::memory_order_release);
+
+		xen_wmb();
+
+		mNumSentEvents.inc(count);
+
+		mEventChannel.notify();
+	}
+
+	template<typename F>
+	bool handleOverflow(F construct)
+	{
+		switch(mPolicy)
+		{
+		case OverflowPolicy::BLOCK:
+
+			return waitAndSend(construct);
+
+		case OverflowPolicy::BACKLOG:
+		case OverflowPolicy::DROP_OLDEST:
+
+			return spill(construct);
+
+		default:
+
+			drop();
+
+			return false;
+		}
+	}
+
+	template<typename F>
+	bool waitAndSend(F construct)
+	{
+		using namespace std::chrono;
+
+		uint32_t start = 0;
+
+		auto end = steady_clock::now() + mTimeout;
+
+		// the frontend may not notify when it consumes events, so check
+		// the ring periodically
+
+		while (!reserve(1, start))
+		{
+			auto now = steady_clock::now();
+
+			if (now >= end)
+			{
+				drop();
+
+				return false;
+			}
+
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			mCondVar.wait_for(lock, std::min<steady_clock::duration>(
+					end - now, milliseconds(1)));
+		}
+
+		construct(mEventBuffer[getIndex(start)]);
+
+		publish(start, 1);
+
+		return true;
+	}
+
+	template<typename F>
+	bool spill(F construct)
+	{
+		Event event;
+
+		construct(event);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		drainBacklog();
+
+		uint32_t start = 0;
+
+		if (mBacklog.empty() && reserve(1, start))
+		{
+			mEventBuffer[getIndex(start)] = event;
+
+			publish(start, 1);
+
+			return true;
+		}
+
+		if (mBacklog.size() >= mMaxBacklogSize)
+		{
+			drop();
+
+			if (mPolicy != OverflowPolicy::DROP_OLDEST || mBacklog.empty())
+			{
+				return false;
+			}
+
+			mBacklog.pop_front();
+		}
+
+		mBacklog.push_back(event);
+
+		mBacklogSize = mBacklog.size();
+
+		mNumSpilled++;
+
+		// the frontend may not notify when it consumes events
+
+		if (!mDrainScheduled)
+		{
+			mDrainTimer->start(std::chrono::milliseconds(1));
+
+			mDrainScheduled = true;
+		}
+
+		return true;
+	}
+
+	void drainBacklog()
+	{
+		while (!mBacklog.empty())
+		{
+			uint32_t start = 0;
+
+			auto numReserved = reserve(mBacklog.size(), start);
+
+			if (numReserved == 0)
+			{
+				break;
+			}
+
+			for (uint32_t i = 0; i < numReserved; i++)
+			{
+				mEventBuffer[getIndex(start + i)] = mBacklog.front();
+
+				mBacklog.pop_front();
+			}
+
+			publish(start, numReserved);
+		}
+
+		mBacklogSize = mBacklog.size();
+	}
+
+	void drop()
+	{
+		using namespace std::chrono;
+
+		mNumDropped++;
+
+		// log overflow not more than once per second
+
+		auto now = duration_cast<milliseconds>(
+				steady_clock::now().time_since_epoch()).count();
+		auto last = mLastOverflowLog.load();
+
+		if (now - last >= 1000 &&
+			mLastOverflowLog.compare_exchange_strong(last, now))
+		{
+			LOG(mLog, WARNING) << "Ring buffer overflow, port: " << getPort()
+							   << ", dropped: " << mNumDropped
+							   << ", spilled: " << mNumSpilled;
+		}
+	}
 };
 
 typedef std::shared_ptr<RingBufferBase> RingBufferPtr;
@@ -0,0 +1,174 @@
+/*
+ *  Request tracing
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_TRACE_HPP_
+#define XENBE_TRACE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#define XENBE_TRACE_NONE   0
+#define XENBE_TRACE_USDT   1
+#define XENBE_TRACE_MEMORY 2
+
+#include "Config.hpp"
+
+#if XENBE_TRACE_MODE == XENBE_TRACE_USDT
+#include <sys/sdt.h>
+#endif
+
+namespace XenBackend {
+
+/**
+ * Tracepoints of the request lifecycle.
+ * @ingroup backend
+ */
+enum class TracePoint : uint32_t
+{
+	EVENT_RECEIVED,		//!< event channel notification is received,
+						//!< arg: local port
+	REQUESTS_DEQUEUED,	//!< requests are read from the ring,
+						//!< arg: number of requests
+	PROCESS_ENTER,		//!< requests processing is started,
+						//!< arg: number of requests
+	PROCESS_EXIT,		//!< requests processing is finished,
+						//!< arg: number of requests
+	RESPONSES_PUSHED,	//!< responses are made visible to the frontend,
+						//!< arg: number of responses
+	RESPONSES_NOTIFIED	//!< frontend is notified about responses,
+						//!< arg: number of responses
+};
+
+/**
+ * Recorded tracepoint.
+ * @ingroup backend
+ */
+struct TraceEntry
+{
+	//! steady clock time in nanoseconds
+	uint64_t time;
+	//! tracepoint
+	TracePoint point;
+	//! event channel port
+	uint32_t port;
+	//! tracepoint argument
+	uint32_t arg;
+};
+
+/***************************************************************************//**
+ * In-memory ring of tracepoints.
+ * The tracepoints are recorded by XENBE_TRACE() when the library is built with
+ * the memory trace mode. When the buffer is full, the oldest entries are
+ * overwritten. Recording doesn't take locks, thus it may be used in the hot
+ * path. Entries which are being overwritten while they are read are skipped.
+ * @ingroup backend
+ ******************************************************************************/
+class TraceBuffer
+{
+public:
+
+	//! Number of entries in the buffer, should be power of two
+	static const size_t cNumEntries = 65536;
+
+	TraceBuffer(const TraceBuffer&) = delete;
+	TraceBuffer& operator=(TraceBuffer const&) = delete;
+
+	/**
+	 * Returns the buffer instance
+	 */
+	static TraceBuffer& getInstance();
+
+	/**
+	 * Records the tracepoint
+	 * @param[in] point tracepoint
+	 * @param[in] port  event channel port
+	 * @param[in] arg   tracepoint argument
+	 */
+	void record(TracePoint point, uint32_t port, uint32_t arg)
+	{
+		using namespace std::chrono;
+
+		auto index = mNext.fetch_add(1, std::memory_order_relaxed);
+		auto& slot = mEntries[index & (cNumEntries - 1)];
+
+		// the sequence is invalidated while the entry is written
+
+		slot.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.entry.time = duration_cast<nanoseconds>(
+				steady_clock::now().time_since_epoch()).count();
+		slot.entry.point = point;
+		slot.entry.port = port;
+		slot.entry.arg = arg;
+
+		slot.sequence.store(index + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Returns recorded entries from the oldest to the newest
+	 * @param[out] entries recorded entries
+	 */
+	void getEntries(std::vector<TraceEntry>& entries) const;
+
+	/**
+	 * Removes all recorded entries
+	 */
+	void clear();
+
+private:
+
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence;
+		TraceEntry entry;
+	};
+
+	std::atomic<uint64_t> mFirst;
+	std::atomic<uint64_t> mNext;
+	std::vector<Slot> mEntries;
+
+	TraceBuffer();
+};
+
+}
+
+/**
+ * Records the request lifecycle tracepoint.
+ * Depending on XENBE_TRACE_MODE it does nothing, fires the USDT probe
+ * xenbe:POINT or records the entry to TraceBuffer.
+ * @ingroup backend
+ */
+#if XENBE_TRACE_MODE == XENBE_TRACE_USDT
+#define XENBE_TRACE(point, port, arg) \
+	DTRACE_PROBE2(xenbe, point, port, arg)
+#elif XENBE_TRACE_MODE == XENBE_TRACE_MEMORY
+#define XENBE_TRACE(point, port, arg) \
+	XenBackend::TraceBuffer::getInstance().record( \
+			XenBackend::TracePoint::point, port, arg)
+#else
+// arguments are not evaluated, sizeof only prevents unused variable warnings
+#define XENBE_TRACE(point, port, arg) \
+	((void)sizeof(port), (void)sizeof(arg))
+#endif
+
+#endif /* XENBE_TRACE_HPP_ */
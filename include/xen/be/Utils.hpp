@@ -21,11 +21,15 @@
 #ifndef XENBE_UTILS_HPP_
 #define XENBE_UTILS_HPP_
 
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <list>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <poll.h>
 #include <unistd.h>
@@ -35,6 +39,8 @@ extern "C" {
 #include <xen/io/xenbus.h>
 }
 
+#include "WorkerPool.hpp"
+
 namespace XenBackend {
 
 /***************************************************************************//**
@@ -67,19 +73,91 @@ public:
 };
 
 /***************************************************************************//**
- * Class to poll file descriptor.
+ * Attributes of threads created by the library.
+ *
+ * Only set attributes are applied: the thread keeps inherited CPU affinity if
+ * the CPU list is empty and inherited scheduling if the policy is negative.
+ *
+ * @code
+ * ThreadAttributes attributes;
+ *
+ * attributes.name = "netback";
+ * attributes.cpus = ThreadAttributes::getNodeCpus(1);
+ *
+ * backend.setThreadAttributes(attributes);
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+struct ThreadAttributes
+{
+	//! thread name, truncated to 15 characters
+	std::string name;
+	//! CPUs the thread is allowed to run on
+	std::vector<int> cpus;
+	//! scheduling policy: SCHED_OTHER, SCHED_FIFO, SCHED_RR etc.
+	int policy;
+	//! scheduling priority of the policy
+	int priority;
+
+	ThreadAttributes() : policy(-1), priority(0) {}
+
+	/**
+	 * Returns <i>true</i> if no attribute is set
+	 */
+	bool empty() const { return name.empty() && cpus.empty() && policy < 0; }
+
+	/**
+	 * Applies the attributes to the thread
+	 * @param[in] thread thread
+	 */
+	void apply(std::thread& thread) const;
+
+	/**
+	 * Applies the attributes to the started thread. Unlike apply() it doesn't
+	 * throw: the attributes which can't be applied are logged and skipped, so
+	 * the thread keeps running with default ones. Used for threads started by
+	 * the library objects which should be usable anyway.
+	 * @param[in] thread thread
+	 * @return <i>true</i> if all attributes are applied
+	 */
+	bool tryApply(std::thread& thread) const noexcept;
+
+	/**
+	 * Returns CPUs of the NUMA node
+	 * @param[in] node NUMA node
+	 */
+	static std::vector<int> getNodeCpus(int node);
+};
+
+/***************************************************************************//**
+ * Class to poll file descriptors.
+ *
+ * The PollFd class is based on epoll and also opens an additional eventfd.
+ * On poll() method it waits for both: the registered file descriptors and the
+ * internal eventfd. The eventfd breaks poll() when stop() method is invoked.
+ * It is used to unblock poll() when an object using PollFd is been deleted.
  *
- * The PollFd class also opens an additional pipe. On poll() method it waits
- * for both: the defined file descriptor and the internal pipe file descriptor.
- * The internal pipe file descriptor breaks poll() when stop() method is
- * invoked. It is used to unblock poll() when an object using PollFd is been
- * deleted.
+ * PollFd may wait for one file descriptor passed to the constructor or for
+ * many file descriptors added by addFd() with per descriptor callbacks, thus
+ * one thread may serve several event sources.
  * @ingroup backend
  ******************************************************************************/
 class PollFd
 {
 public:
 
+	/**
+	 * Callback which is called when the file descriptor is ready
+	 * @param fd      file descriptor
+	 * @param revents occurred events (same as in system poll function)
+	 */
+	typedef std::function<void(int fd, short int revents)> Callback;
+
+	/**
+	 * Creates poll without file descriptors, they should be added by addFd()
+	 */
+	PollFd();
+
 	/**
 	 * @param fd     file descriptor
 	 * @param events events to poll (same as in system poll function)
@@ -88,12 +166,39 @@ public:
 	~PollFd();
 
 	/**
-	 * Polls the file descriptors for defined events
+	 * Adds file descriptor to poll
+	 * @param fd       file descriptor
+	 * @param events   events to poll (same as in system poll function)
+	 * @param callback callback called from poll() when the events occurred
+	 */
+	void addFd(int fd, short int events, Callback callback);
+
+	/**
+	 * Removes file descriptor added by addFd(). If callbacks are being called
+	 * by poll() in another thread, waits until they are finished, thus the
+	 * callback is not called after this method returns. Called from a
+	 * callback, it returns immediately.
+	 * @param fd file descriptor
+	 */
+	void removeFd(int fd);
+
+	/**
+	 * Polls the file descriptors for defined events. Callbacks of ready file
+	 * descriptors are called from this method.
 	 * @return <i>true</i> if one of defined events occurred and <i>false</i>
 	 * if the method was interrupted by calling stop()
 	 */
 	bool poll();
 
+	/**
+	 * Polls the file descriptors for defined events during the timeout.
+	 * @param timeout max time to wait in milliseconds, negative value waits
+	 * infinitely
+	 * @return <i>true</i> if one of defined events occurred or the timeout
+	 * expired and <i>false</i> if the method was interrupted by calling stop()
+	 */
+	bool poll(int timeout);
+
 	/**
 	 * Stops polling
 	 */
@@ -101,29 +206,30 @@ public:
 
 private:
 
-	enum PipeType
-	{
-		READ = 0,
-		WRITE = 1
-	};
+	static const int cMaxEvents = 16;
 
-	enum PollIndex
-	{
-		FILE = 0,
-		PIPE = 1
-	};
+	int mEpollFd;
+	int mEventFd;
+	int mFd;
 
-	pollfd mFds[2];
-	int mPipeFds[2];
+	std::unordered_map<int, Callback> mCallbacks;
+	bool mDispatching;
+	std::thread::id mDispatchThread;
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
 
-	void init(int fd, short int events);
+	void init();
 	void release();
+	void ctlFd(int op, int fd, short int events);
+	void endDispatch();
 };
 
 /***************************************************************************//**
  * Implements asynchronous context
  *
- * This class allows to call a function asynchronously.
+ * This class allows to call a function asynchronously. The functions are
+ * called one by one either by own thread, which is created on the first call,
+ * or by a serial queue of the worker pool set by setWorkerPool().
  *
  * @ingroup backend
  ******************************************************************************/
@@ -136,6 +242,21 @@ public:
 	AsyncContext();
 	~AsyncContext();
 
+	/**
+	 * Sets worker pool which executes the functions instead of own thread.
+	 * Should be called before the first call(). As stop() waits for the
+	 * pending functions, it should not be called from a worker of the same
+	 * pool if all other workers may be blocked.
+	 * @param workerPool worker pool
+	 */
+	void setWorkerPool(WorkerPoolPtr workerPool);
+
+	/**
+	 * Sets attributes of own thread. Should be called before the first call().
+	 * @param threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes);
+
 	/**
 	 * Stops async thread
 	 */
@@ -153,16 +274,86 @@ private:
 	std::mutex mMutex;
 	std::condition_variable mCondVar;
 	std::thread mThread;
+	ThreadAttributes mThreadAttributes;
+	WorkerQueuePtr mQueue;
 
 	std::list<AsyncCall> mAsyncCalls;
 
 	void run();
 };
 
+class Timer;
+
+/***************************************************************************//**
+ * Shared timer service
+ *
+ * Runs all timers in one thread. Timers are kept in the hashed wheel of
+ * 1 ms slots, so starting and stopping a timer takes constant time. Occupied
+ * slots are tracked by a bitmap, which lets the thread sleep until the next
+ * occupied slot instead of waking up on each tick.
+ *
+ * @ingroup backend
+ ******************************************************************************/
+class TimerService
+{
+public:
+
+	/**
+	 * Returns the service instance
+	 */
+	static TimerService& getInstance();
+
+	/**
+	 * Applies attributes to the service thread
+	 * @param threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes);
+
+	TimerService(const TimerService&) = delete;
+	TimerService& operator=(TimerService const&) = delete;
+	~TimerService();
+
+private:
+
+	friend class Timer;
+
+	typedef std::chrono::steady_clock Clock;
+	typedef std::list<Timer*> TimerList;
+
+	static const size_t cNumSlots = 1024;
+	static const size_t cSlotsPerWord = 64;
+
+	TimerService();
+
+	Clock::time_point mStartTime;
+	uint64_t mCurrentTick;
+	size_t mNumTimers;
+	bool mTerminate;
+	Timer* mRunningTimer;
+
+	std::vector<TimerList> mSlots;
+	std::vector<uint64_t> mUsedSlots;
+	TimerList mDueTimers;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::condition_variable mDoneCondVar;
+	std::thread mThread;
+
+	uint64_t getTick(Clock::time_point time) const;
+	uint64_t getNextTick() const;
+	void add(Timer* timer, uint64_t expiry);
+	void remove(Timer* timer);
+	void processSlot(size_t slot, uint64_t tick);
+	void fireDueTimers(std::unique_lock<std::mutex>& lock);
+	void run();
+};
+
 /***************************************************************************//**
  * Implements timer
  *
- * This class allows to call event in scheduled time or periodically
+ * This class allows to call event in scheduled time or periodically. The
+ * callback is called by the TimerService thread, so it should not block.
  *
  * @ingroup backend
  ******************************************************************************/
@@ -181,23 +372,23 @@ public:
 	void start(std::chrono::milliseconds time);
 
 	/**
-	 * Stops timer
+	 * Stops timer. When it returns the callback is not executed anymore
+	 * unless it is called from the callback.
 	 */
 	void stop();
 
 private:
 
+	friend class TimerService;
+
 	Callback mCallback;
 	std::chrono::milliseconds mTime;
 	bool mPeriodic;
+	bool mStarted;
 
-	bool mTerminate;
-	std::thread mThread;
-	std::mutex mMutex;
-	std::mutex mItfMutex;
-	std::condition_variable mCondVar;
-
-	void run();
+	uint64_t mExpiry;
+	TimerService::TimerList* mList;
+	TimerService::TimerList::iterator mPosition;
 };
 
 }
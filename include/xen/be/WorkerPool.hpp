@@ -0,0 +1,176 @@
+/*
+ *  Worker pool
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_WORKERPOOL_HPP_
+#define XENBE_WORKERPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Exception.hpp"
+#include "Log.hpp"
+
+namespace XenBackend {
+
+class WorkerPool;
+
+/***************************************************************************//**
+ * Serial queue of the worker pool.
+ * Tasks posted to the same queue are executed one by one in the posting order.
+ * Tasks of different queues may be executed in parallel by different workers.
+ * @ingroup backend
+ ******************************************************************************/
+class WorkerQueue : public std::enable_shared_from_this<WorkerQueue>
+{
+public:
+
+	typedef std::function<void()> Task;
+
+	WorkerQueue(const WorkerQueue&) = delete;
+	WorkerQueue& operator=(WorkerQueue const&) = delete;
+
+	/**
+	 * Posts the task to the queue
+	 * @param task task to execute
+	 */
+	void post(Task task);
+
+	/**
+	 * Waits until all posted tasks are executed. Returns immediately if it is
+	 * called from a task of this queue.
+	 */
+	void wait();
+
+	/**
+	 * Checks if there are no tasks waiting for execution. The task which is
+	 * being executed is not counted.
+	 */
+	bool isEmpty();
+
+private:
+
+	friend class WorkerPool;
+
+	WorkerQueue(WorkerPool& pool, size_t worker);
+
+	WorkerPool& mPool;
+	size_t mWorker;
+	bool mScheduled;
+	std::thread::id mRunningThread;
+	std::list<Task> mTasks;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+
+	void run();
+};
+
+typedef std::shared_ptr<WorkerQueue> WorkerQueuePtr;
+
+/***************************************************************************//**
+ * Fixed pool of worker threads.
+ *
+ * Each worker has own list of ready queues. The queue is assigned to a worker
+ * when it is created and is scheduled on this worker when a task is posted.
+ * A worker which has nothing to do takes ready queues from other workers, thus
+ * independent queues are spread over all workers while tasks of one queue are
+ * kept in order.
+ *
+ * @code
+ * WorkerPoolPtr pool(new WorkerPool(4));
+ *
+ * auto queue = pool->createQueue();
+ *
+ * queue->post([] { doSomething(); });
+ * queue->post([] { doSomethingAfter(); });
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup backend
+ ******************************************************************************/
+class WorkerPool
+{
+public:
+
+	/**
+	 * @param[in] numWorkers number of worker threads, if 0 is passed the
+	 * number of CPUs is used
+	 * @param[in] pinWorkers if <i>true</i> each worker is bound to one CPU
+	 */
+	explicit WorkerPool(size_t numWorkers = 0, bool pinWorkers = false);
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(WorkerPool const&) = delete;
+	~WorkerPool();
+
+	/**
+	 * Creates new serial queue
+	 */
+	WorkerQueuePtr createQueue();
+
+	/**
+	 * Returns number of workers
+	 */
+	size_t getNumWorkers() const { return mWorkers.size(); }
+
+	/**
+	 * Executes all scheduled tasks and stops workers
+	 */
+	void stop();
+
+private:
+
+	friend class WorkerQueue;
+
+	struct Worker
+	{
+		std::thread thread;
+		std::mutex mutex;
+		std::deque<WorkerQueuePtr> queues;
+	};
+
+	std::vector<std::unique_ptr<Worker>> mWorkers;
+	std::atomic<size_t> mNextWorker;
+	size_t mNumScheduled;
+	size_t mNumActive;
+	bool mTerminate;
+	Log mLog;
+
+	std::mutex mMutex;
+	std::condition_variable mCondVar;
+
+	void init(size_t numWorkers, bool pinWorkers);
+	void schedule(WorkerQueuePtr queue);
+	WorkerQueuePtr getQueue(size_t worker);
+	void run(size_t worker);
+};
+
+typedef std::shared_ptr<WorkerPool> WorkerPoolPtr;
+
+}
+
+#endif /* XENBE_WORKERPOOL_HPP_ */
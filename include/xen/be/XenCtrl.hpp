@@ -56,7 +56,8 @@ public:
 	~XenInterface();
 
 	/**
-	 * Returns all domains info
+	 * Returns all domains info. The content of <i>infos</i> is replaced but
+	 * its capacity is reused.
 	 * @param[out] infos
 	 */
 	void getDomainsInfo(std::vector<xc_domaininfo_t>& infos);
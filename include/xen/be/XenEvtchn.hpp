@@ -22,8 +22,11 @@
 #define XENBE_XENEVTCHN_HPP_
 
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 
 extern "C" {
 #include <xenctrl.h>
@@ -32,6 +35,7 @@ extern "C" {
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 #include "Utils.hpp"
 
 namespace XenBackend {
@@ -50,6 +54,82 @@ class XenEvtchnException : public Exception
 	using Exception::Exception;
 };
 
+class XenEvtchn;
+
+/***************************************************************************//**
+ * Shared event channel loop.
+ * XenEvtchnLoop keeps one event channel handle and one thread which waits for
+ * all ports bound on this handle. When a port is notified, the loop gets it
+ * with xenevtchn_pending() and calls the callback of the XenEvtchn instance
+ * the port belongs to. It allows to handle many event channels without
+ * creating a thread per channel.
+ *
+ * The loop thread is started when the first event channel is started and
+ * stopped when the loop is deleted. Event channels keep the loop alive, thus
+ * the loop can be released by its creator at any time. The last event channel
+ * may also be deleted from its own callback, then the loop thread finishes
+ * after the callback returns.
+ *
+ * @code
+ * XenEvtchnLoopPtr loop(new XenEvtchnLoop());
+ *
+ * XenEvtchn eventChannel1(loop, domId1, port1, eventChannelCbk1);
+ * XenEvtchn eventChannel2(loop, domId2, port2, eventChannelCbk2);
+ *
+ * eventChannel1.start();
+ * eventChannel2.start();
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenEvtchnLoop
+{
+public:
+
+	XenEvtchnLoop();
+	XenEvtchnLoop(const XenEvtchnLoop&) = delete;
+	XenEvtchnLoop& operator=(XenEvtchnLoop const&) = delete;
+	~XenEvtchnLoop();
+
+	/**
+	 * Sets attributes of the loop thread. Should be called before the first
+	 * event channel is started.
+	 * @param[in] threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes);
+
+private:
+
+	friend class XenEvtchn;
+
+	xenevtchn_handle *mHandle;
+	bool mStarted;
+	Log mLog;
+
+	std::recursive_mutex mMutex;
+	std::mutex mItfMutex;
+	std::thread mThread;
+	ThreadAttributes mThreadAttributes;
+	std::unique_ptr<PollFd> mPollFd;
+	// set by the destructor called from the loop thread
+	bool* mDeletedFlag;
+
+	std::unordered_map<evtchn_port_t, XenEvtchn*> mChannels;
+
+	void init();
+	void release();
+	void addChannel(XenEvtchn* channel);
+	void removeChannel(XenEvtchn* channel);
+	void stop();
+	void eventThread();
+	void processEvent(std::shared_ptr<XenEvtchnLoop>& self);
+	void onError(const std::exception& e);
+};
+
+typedef std::shared_ptr<XenEvtchnLoop> XenEvtchnLoopPtr;
+
 /***************************************************************************//**
  * Implements xen event channel.
  * XenEvtchn instance binds port and waits for the bound channel is notified.
@@ -69,6 +149,22 @@ class XenEvtchnException : public Exception
  * ...
  *
  * @endcode
+ *
+ * By default each XenEvtchn instance opens its own event channel handle and
+ * waits for notifications in its own thread. If XenEvtchnLoop is passed to
+ * the constructor, the port is bound on the loop handle and notifications are
+ * handled by the loop thread.
+ *
+ * The port is masked when the notification is received. By default it is
+ * unmasked before the callback is called. If deferred unmask is enabled with
+ * setDeferredUnmask(), the port stays masked till the callback returns, thus
+ * notifications sent by the remote side meanwhile are merged into one.
+ *
+ * The rate of own notifications may be limited with setMinNotifyInterval().
+ * A notification requested within the interval after the previous one is
+ * delayed till the interval expires and merged with other notifications
+ * requested meanwhile. Delayed notifications are sent by TimerService, so the
+ * delay is rounded up to milliseconds.
  * @ingroup xen
  ******************************************************************************/
 class XenEvtchn
@@ -80,6 +176,19 @@ public:
 	 */
 	typedef std::function<void()> Callback;
 
+	/**
+	 * Event channel metrics
+	 */
+	struct Metrics
+	{
+		//! number of received notifications
+		uint64_t numReceived;
+		//! number of sent notifications
+		uint64_t numSent;
+		//! number of notifications delayed by the notify interval
+		uint64_t numDeferred;
+	};
+
 	/**
 	 * @param[in] domId domain id
 	 * @param[in] port  event channel port number
@@ -89,6 +198,17 @@ public:
 	 */
 	XenEvtchn(domid_t domId, evtchn_port_t port, Callback callback,
 			  ErrorCallback errorCallback = nullptr);
+
+	/**
+	 * @param[in] loop  event channel loop which handles the notifications
+	 * @param[in] domId domain id
+	 * @param[in] port  event channel port number
+	 * @param[in] callback callback which is called when the notification is
+	 * received
+	 * @param[in] errorCallback callback which is called when an error occurs
+	 */
+	XenEvtchn(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+			  Callback callback, ErrorCallback errorCallback = nullptr);
 	XenEvtchn(const XenEvtchn&) = delete;
 	XenEvtchn& operator=(XenEvtchn const&) = delete;
 	~XenEvtchn();
@@ -108,6 +228,13 @@ public:
 	 */
 	void notify();
 
+	/**
+	 * Unbinds the local port and binds the remote port again, for example
+	 * when the frontend has allocated the remote port after restart.
+	 * Should be called when the event channel is stopped.
+	 */
+	void rebind();
+
 	/**
 	 * Returns event channel port
 	 */
@@ -119,22 +246,87 @@ public:
 	 */
 	void setErrorCallback(ErrorCallback errorCallback);
 
+	/**
+	 * Sets attributes of own event channel thread. Should be called before
+	 * start(). The attributes are not used if the event channel is handled
+	 * by XenEvtchnLoop.
+	 * @param[in] threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes)
+	{
+		mThreadAttributes = threadAttributes;
+	}
+
+	/**
+	 * Enables or disables keeping the port masked while the callback runs.
+	 * Should be called before start().
+	 * @param[in] deferredUnmask if <i>true</i> the port is unmasked after
+	 * the callback returns, the callback should check for work it could miss
+	 * after that, as ring buffers do with RING_FINAL_CHECK_FOR_REQUESTS
+	 */
+	void setDeferredUnmask(bool deferredUnmask)
+	{
+		mDeferredUnmask = deferredUnmask;
+	}
+
+	/**
+	 * Sets minimal interval between own notifications.
+	 * Should be called before the first notify().
+	 * @param[in] interval notify interval, 0 sends each notification at once
+	 */
+	void setMinNotifyInterval(std::chrono::microseconds interval);
+
+	/**
+	 * Returns attributes of own event channel thread
+	 */
+	const ThreadAttributes& getThreadAttributes() const
+	{
+		return mThreadAttributes;
+	}
+
+	/**
+	 * Returns event channel metrics
+	 */
+	Metrics getMetrics() const
+	{
+		return { mNumReceived.get(), mNumSent.get(), mNumDeferred.get() };
+	}
+
 private:
 
+	friend class XenEvtchnLoop;
+
+	XenEvtchnLoopPtr mLoop;
+	domid_t mDomId;
+	evtchn_port_t mRemotePort;
 	xenevtchn_port_or_error_t mPort;
 	xenevtchn_handle *mHandle;
 	Callback mCallback;
 	ErrorCallback mErrorCallback;
 	std::atomic_bool mStarted;
+	bool mDeferredUnmask;
+	Counter mNumReceived;
+	Counter mNumSent;
+	Counter mNumDeferred;
 	Log mLog;
 
 	std::mutex mMutex;
 	std::thread mThread;
+	ThreadAttributes mThreadAttributes;
 	std::unique_ptr<PollFd> mPollFd;
 
+	std::chrono::microseconds mMinNotifyInterval;
+	std::chrono::steady_clock::time_point mLastNotifyTime;
+	bool mNotifyPending;
+	std::unique_ptr<Timer> mNotifyTimer;
+	std::mutex mNotifyMutex;
+
 	void init(domid_t domId, evtchn_port_t port);
 	void release();
+	void sendNotify();
+	void onNotifyTimer();
 	void eventThread();
+	void onError(const std::exception& e);
 };
 
 }
@@ -0,0 +1,203 @@
+/*
+ *  Xen gntalloc wrapper
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_XENGNTALLOC_HPP_
+#define XENBE_XENGNTALLOC_HPP_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <xenctrl.h>
+#include <xengnttab.h>
+}
+
+#include "Exception.hpp"
+#include "Log.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exception generated by XenGntalloc.
+ * @ingroup xen
+ ******************************************************************************/
+class XenGntallocException : public Exception
+{
+	using Exception::Exception;
+};
+
+/***************************************************************************//**
+ * Keeps common grant share handle.
+ * @ingroup xen
+ ******************************************************************************/
+class XenGntshr
+{
+private:
+
+	friend class XenGntallocBuffer;
+
+	XenGntshr();
+	XenGntshr(const XenGntshr&) = delete;
+	XenGntshr& operator=(XenGntshr const&) = delete;
+	~XenGntshr();
+
+	/**
+	 * Returns the instance shared by all grant share users
+	 */
+	static XenGntshr& getInstance();
+
+	xengntshr_handle* mHandle;
+};
+
+/***************************************************************************//**
+ * Backend allocated grant buffer.
+ * XenGntallocBuffer allocates local pages and grants them to the frontend
+ * domain when constructed. The grant references should be passed to the
+ * frontend according to the protocol. The pages are unshared when the buffer
+ * is destroyed.
+ * @code
+ * XenGntallocBuffer buffer(domId, numPages);
+ *
+ * xenStore.writeUint(path, buffer.getRefs()[0]);
+ *
+ * memcpy(buffer.get(), data, size);
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGntallocBuffer
+{
+public:
+
+	/**
+	 * @param[in] domId    domain id to grant the pages to
+	 * @param[in] count    number of pages
+	 * @param[in] writable if <i>true</i> the domain can write to the pages
+	 */
+	XenGntallocBuffer(domid_t domId, size_t count, bool writable = true);
+	XenGntallocBuffer(const XenGntallocBuffer&) = delete;
+	XenGntallocBuffer& operator=(XenGntallocBuffer const&) = delete;
+	~XenGntallocBuffer();
+
+	/**
+	 * Returns pointer to the allocated buffer.
+	 */
+	void* get() const { return mBuffer; }
+
+	/**
+	 * Returns size of the allocated buffer.
+	 */
+	size_t size() const { return mRefs.size() * XC_PAGE_SIZE; }
+
+	/**
+	 * Returns grant references of the buffer pages.
+	 */
+	const std::vector<grant_ref_t>& getRefs() const { return mRefs; }
+
+	/**
+	 * Returns domain id the buffer is granted to.
+	 */
+	domid_t getDomId() const { return mDomId; }
+
+private:
+
+	void* mBuffer;
+	xengntshr_handle* mHandle;
+	domid_t mDomId;
+	std::vector<grant_ref_t> mRefs;
+	Log mLog;
+
+	void init(size_t count, bool writable);
+	void release();
+};
+
+typedef std::shared_ptr<XenGntallocBuffer> XenGntallocBufferPtr;
+
+/***************************************************************************//**
+ * Pool of backend allocated grant buffers.
+ * Buffers are allocated and granted once and reused. The buffer taken from
+ * the pool with get() returns back to the pool when it is released.
+ * @code
+ * XenGntallocPoolPtr pool(new XenGntallocPool(domId, 4, numPages));
+ *
+ * auto buffer = pool->get();
+ *
+ * if (buffer)
+ * {
+ *     renderFrame(buffer->get());
+ *     sendFrame(buffer->getRefs());
+ * }
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGntallocPool : public std::enable_shared_from_this<XenGntallocPool>
+{
+public:
+
+	/**
+	 * @param[in] domId      domain id to grant the pages to
+	 * @param[in] numBuffers number of buffers in the pool
+	 * @param[in] numPages   number of pages in each buffer
+	 * @param[in] writable   if <i>true</i> the domain can write to the pages
+	 */
+	XenGntallocPool(domid_t domId, size_t numBuffers, size_t numPages,
+					bool writable = true);
+	XenGntallocPool(const XenGntallocPool&) = delete;
+	XenGntallocPool& operator=(XenGntallocPool const&) = delete;
+
+	/**
+	 * Returns free buffer from the pool or nullptr if there is no free buffer
+	 */
+	XenGntallocBufferPtr get();
+
+	/**
+	 * Returns all buffers of the pool (e.g. to pass their refs to
+	 * the frontend).
+	 */
+	const std::vector<XenGntallocBufferPtr>& getBuffers() const
+	{
+		return mBuffers;
+	}
+
+	/**
+	 * Returns number of free buffers
+	 */
+	size_t getNumFree() const;
+
+private:
+
+	std::vector<XenGntallocBufferPtr> mBuffers;
+	std::list<XenGntallocBuffer*> mFreeBuffers;
+
+	mutable std::mutex mMutex;
+
+	void put(XenGntallocBuffer* buffer);
+};
+
+typedef std::shared_ptr<XenGntallocPool> XenGntallocPoolPtr;
+
+}
+
+#endif /* XENBE_XENGNTALLOC_HPP_ */
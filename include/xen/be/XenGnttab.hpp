@@ -21,15 +21,25 @@
 #ifndef XENBE_XENGNTTAB_HPP_
 #define XENBE_XENGNTTAB_HPP_
 
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include <sys/mman.h>
 
 extern "C" {
 #include <xenctrl.h>
 #include <xengnttab.h>
+#include <xen/grant_table.h>
 }
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 
 namespace XenBackend {
 
@@ -51,6 +61,10 @@ class XenGnttab
 private:
 
 	friend class XenGnttabBuffer;
+	friend class XenGnttabCopy;
+	friend class XenGnttabSgBuffer;
+	friend class XenGnttabDmaBufExporter;
+	friend class XenGnttabDmaBufImporter;
 
 	XenGnttab();
 	XenGnttab(const XenGnttab&) = delete;
@@ -63,6 +77,11 @@ private:
 	 */
 	xengnttab_handle* getHandle() const { return mHandle; }
 
+	/**
+	 * Returns the instance shared by all grant table users
+	 */
+	static XenGnttab& getInstance();
+
 	xengnttab_handle* mHandle;
 };
 
@@ -126,6 +145,351 @@ private:
 	void release();
 };
 
+typedef std::shared_ptr<XenGnttabBuffer> XenGnttabBufferPtr;
+
+/***************************************************************************//**
+ * Scatter-gather grant table buffer.
+ * XenGnttabSgBuffer maps a batch of independent grant references, which may
+ * belong to different domains, with one call and provides the list of page
+ * pointers. All pages are unmapped with one call when the buffer is destroyed.
+ * @code
+ * XenGnttabSgBuffer buffer(domId, refs);
+ *
+ * for (size_t i = 0; i < buffer.getNumPages(); i++)
+ * {
+ *     memcpy(buffer.getPage(i), data[i], XC_PAGE_SIZE);
+ * }
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabSgBuffer
+{
+public:
+
+	/**
+	 * @param[in] domId domain id
+	 * @param[in] refs  grant reference ids
+	 * @param[in] prot  same flag as in mmap()
+	 */
+	XenGnttabSgBuffer(domid_t domId, const std::vector<grant_ref_t>& refs,
+					  int prot = PROT_READ | PROT_WRITE);
+
+	/**
+	 * @param[in] domIds domain ids, one per reference
+	 * @param[in] refs   grant reference ids
+	 * @param[in] prot   same flag as in mmap()
+	 */
+	XenGnttabSgBuffer(const std::vector<domid_t>& domIds,
+					  const std::vector<grant_ref_t>& refs,
+					  int prot = PROT_READ | PROT_WRITE);
+	XenGnttabSgBuffer(const XenGnttabSgBuffer&) = delete;
+	XenGnttabSgBuffer& operator=(XenGnttabSgBuffer const&) = delete;
+	~XenGnttabSgBuffer();
+
+	/**
+	 * Returns pointer to the mapped page.
+	 * @param[in] index index of the page
+	 */
+	void* getPage(size_t index) const { return mPages.at(index); }
+
+	/**
+	 * Returns pointers to all mapped pages.
+	 */
+	const std::vector<void*>& getPages() const { return mPages; }
+
+	/**
+	 * Returns number of mapped pages.
+	 */
+	size_t getNumPages() const { return mPages.size(); }
+
+private:
+
+	void* mBuffer;
+	xengnttab_handle* mHandle;
+	std::vector<void*> mPages;
+	Log mLog;
+
+	void init(const std::vector<domid_t>& domIds,
+			  const std::vector<grant_ref_t>& refs, int prot);
+	void release();
+};
+
+/***************************************************************************//**
+ * Grant table copy.
+ * Collects copy segments between local buffers and foreign pages and performs
+ * them with one xengnttab_grant_copy() call. It is an alternative to mapping
+ * for small and medium payloads.
+ * @code
+ * XenGnttabCopy copy;
+ *
+ * copy.addFromForeign(domId, ref1, offset1, localBuffer1, len1);
+ * copy.addFromForeign(domId, ref2, 0, localBuffer2, len2);
+ *
+ * copy.copy();
+ *
+ * if (copy.getNumFailed())
+ * {
+ *     ...
+ * }
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabCopy
+{
+public:
+
+	XenGnttabCopy();
+	XenGnttabCopy(const XenGnttabCopy&) = delete;
+	XenGnttabCopy& operator=(XenGnttabCopy const&) = delete;
+
+	/**
+	 * Adds segment which copies data from the local buffer to the foreign
+	 * page. The segment should not cross the page boundary.
+	 * @param[in] domId  domain id
+	 * @param[in] ref    grant reference id of the foreign page
+	 * @param[in] offset offset inside the foreign page
+	 * @param[in] src    local buffer
+	 * @param[in] len    number of bytes to copy
+	 * @return index of the segment
+	 */
+	size_t addToForeign(domid_t domId, grant_ref_t ref, uint16_t offset,
+						const void* src, uint16_t len);
+
+	/**
+	 * Adds segment which copies data from the foreign page to the local
+	 * buffer. The segment should not cross the page boundary.
+	 * @param[in] domId  domain id
+	 * @param[in] ref    grant reference id of the foreign page
+	 * @param[in] offset offset inside the foreign page
+	 * @param[in] dst    local buffer
+	 * @param[in] len    number of bytes to copy
+	 * @return index of the segment
+	 */
+	size_t addFromForeign(domid_t domId, grant_ref_t ref, uint16_t offset,
+						  void* dst, uint16_t len);
+
+	/**
+	 * Performs all added segments.
+	 * Throws XenGnttabException if the copy can't be performed. In case of
+	 * particular segment failed, its status is set accordingly.
+	 */
+	void copy();
+
+	/**
+	 * Returns status of the segment after copy (GNTST_okay on success)
+	 * @param[in] index index of the segment
+	 */
+	int16_t getStatus(size_t index) const { return mSegments.at(index).status; }
+
+	/**
+	 * Returns number of failed segments after copy
+	 */
+	size_t getNumFailed() const { return mNumFailed; }
+
+	/**
+	 * Returns number of segments
+	 */
+	size_t size() const { return mSegments.size(); }
+
+	/**
+	 * Removes all segments
+	 */
+	void clear();
+
+private:
+
+	xengnttab_handle* mHandle;
+	std::vector<xengnttab_grant_copy_segment_t> mSegments;
+	size_t mNumFailed;
+	Log mLog;
+
+	void checkSegment(uint16_t offset, uint16_t len);
+};
+
+/***************************************************************************//**
+ * Deferred unmap queue.
+ * Buffers mapped through the queue are not unmapped by the thread which
+ * releases the last reference. Instead they are collected and unmapped in
+ * batches by the queue thread. If the number of pages waiting for unmap
+ * exceeds the limit, the releasing thread unmaps the buffer itself.
+ * @code
+ * XenGnttabUnmapQueuePtr queue(new XenGnttabUnmapQueue());
+ *
+ * auto buffer = queue->map(domId, ref);
+ *
+ * ...
+ *
+ * buffer.reset();
+ *
+ * queue->flush();
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabUnmapQueue :
+		public std::enable_shared_from_this<XenGnttabUnmapQueue>
+{
+public:
+
+	/**
+	 * @param[in] maxPages max number of pages waiting for unmap
+	 */
+	explicit XenGnttabUnmapQueue(size_t maxPages = cDefaultMaxPages);
+	XenGnttabUnmapQueue(const XenGnttabUnmapQueue&) = delete;
+	XenGnttabUnmapQueue& operator=(XenGnttabUnmapQueue const&) = delete;
+	~XenGnttabUnmapQueue();
+
+	/**
+	 * Maps the buffer which is unmapped by the queue when released
+	 * @param[in] domId domain id
+	 * @param[in] refs  array of grant reference ids
+	 * @param[in] count number of grant reference ids
+	 * @param[in] prot  same flag as in mmap()
+	 */
+	XenGnttabBufferPtr map(domid_t domId, const grant_ref_t* refs,
+						   size_t count, int prot = PROT_READ | PROT_WRITE);
+
+	/**
+	 * Maps the buffer which is unmapped by the queue when released
+	 * @param[in] domId domain id
+	 * @param[in] ref   grant reference id
+	 * @param[in] prot  same flag as in mmap()
+	 */
+	XenGnttabBufferPtr map(domid_t domId, grant_ref_t ref,
+						   int prot = PROT_READ | PROT_WRITE)
+	{
+		return map(domId, &ref, 1, prot);
+	}
+
+	/**
+	 * Waits until all released buffers are unmapped
+	 */
+	void flush();
+
+	/**
+	 * Returns number of pages waiting for unmap
+	 */
+	size_t getNumPendingPages() const;
+
+	//! Default max number of pages waiting for unmap
+	static const size_t cDefaultMaxPages = 1024;
+
+private:
+
+	size_t mMaxPages;
+	size_t mNumPendingPages;
+	bool mTerminate;
+	std::list<XenGnttabBuffer*> mBuffers;
+	Log mLog;
+
+	std::thread mThread;
+	mutable std::mutex mMutex;
+	std::condition_variable mCondVar;
+	std::condition_variable mFlushCondVar;
+
+	void release(XenGnttabBuffer* buffer);
+	void run();
+};
+
+typedef std::shared_ptr<XenGnttabUnmapQueue> XenGnttabUnmapQueuePtr;
+
+/***************************************************************************//**
+ * Cache of single page grant table mappings.
+ * Keeps mapped pages of the frontend to avoid map and unmap on each request
+ * (persistent grants). The mappings are refcounted: a page evicted from the
+ * cache is unmapped when the last user releases it.
+ * @code
+ * XenGnttabCache cache(1024);
+ *
+ * auto buffer = cache.get(domId, ref);
+ *
+ * memcpy(buffer->get(), data, size);
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabCache
+{
+public:
+
+	/**
+	 * @param[in] maxPages max number of pages kept in the cache
+	 * @param[in] prot     same flag as in mmap()
+	 */
+	explicit XenGnttabCache(size_t maxPages = cDefaultMaxPages,
+							int prot = PROT_READ | PROT_WRITE);
+	XenGnttabCache(const XenGnttabCache&) = delete;
+	XenGnttabCache& operator=(XenGnttabCache const&) = delete;
+
+	/**
+	 * Returns mapped page. Maps the page if it is not in the cache.
+	 * @param[in] domId domain id
+	 * @param[in] ref   grant reference id
+	 */
+	XenGnttabBufferPtr get(domid_t domId, grant_ref_t ref);
+
+	/**
+	 * Sets unmap queue which is used to map the cached pages
+	 * @param[in] unmapQueue unmap queue
+	 */
+	void setUnmapQueue(XenGnttabUnmapQueuePtr unmapQueue);
+
+	/**
+	 * Removes pages of the domain from the cache
+	 * @param[in] domId domain id
+	 */
+	void invalidate(domid_t domId);
+
+	/**
+	 * Removes all pages from the cache
+	 */
+	void clear();
+
+	/**
+	 * Returns number of pages in the cache
+	 */
+	size_t size() const;
+
+	/**
+	 * Returns number of requests served from the cache
+	 */
+	uint64_t getNumHits() const { return mNumHits.get(); }
+
+	/**
+	 * Returns number of requests which required mapping
+	 */
+	uint64_t getNumMisses() const { return mNumMisses.get(); }
+
+	//! Default max number of cached pages
+	static const size_t cDefaultMaxPages = 1024;
+
+private:
+
+	typedef uint64_t Key;
+	typedef std::pair<Key, XenGnttabBufferPtr> Entry;
+
+	size_t mMaxPages;
+	int mProt;
+	Counter mNumHits;
+	Counter mNumMisses;
+
+	std::list<Entry> mLru;
+	std::unordered_map<Key, std::list<Entry>::iterator> mEntries;
+
+	XenGnttabUnmapQueuePtr mUnmapQueue;
+
+	mutable std::mutex mMutex;
+
+	static Key getKey(domid_t domId, grant_ref_t ref)
+	{
+		return (static_cast<Key>(domId) << 32) | ref;
+	}
+};
+
 }
 
 #endif /* XENBE_XENGNTTAB_HPP_ */
@@ -0,0 +1,136 @@
+/*
+ *  Xen gnttab dma-buf wrapper
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#ifndef XENBE_XENGNTTABDMABUF_HPP_
+#define XENBE_XENGNTTABDMABUF_HPP_
+
+#include <vector>
+
+#include "XenGnttab.hpp"
+
+namespace XenBackend {
+
+/***************************************************************************//**
+ * Exports grant references as dma-buf.
+ * XenGnttabDmaBufExporter maps the frontend grant references and exports them
+ * as dma-buf file descriptor which can be passed to DRM, V4L2 or other drivers
+ * without copying the data. When the exporter is destroyed it closes
+ * the descriptor and waits until the dma-buf is released by all users.
+ * Available if the library is built with WITH_DMABUF option.
+ * @code
+ * XenGnttabDmaBufExporter dmaBuf(domId, refs);
+ *
+ * drmPrimeFDToHandle(drmFd, dmaBuf.getFd(), &handle);
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabDmaBufExporter
+{
+public:
+
+	/**
+	 * @param[in] domId   domain id
+	 * @param[in] refs    grant reference ids
+	 * @param[in] flags   gntdev dma-buf flags (GNTDEV_DMA_FLAG_...)
+	 * @param[in] timeout time in ms to wait for dma-buf release when
+	 * the exporter is destroyed
+	 */
+	XenGnttabDmaBufExporter(domid_t domId, const std::vector<grant_ref_t>& refs,
+							uint32_t flags = 0, uint32_t timeout = cWaitTimeoutMs);
+	XenGnttabDmaBufExporter(const XenGnttabDmaBufExporter&) = delete;
+	XenGnttabDmaBufExporter& operator=(XenGnttabDmaBufExporter const&) = delete;
+	~XenGnttabDmaBufExporter();
+
+	/**
+	 * Returns dma-buf file descriptor.
+	 */
+	int getFd() const { return mFd; }
+
+	/**
+	 * Returns exported grant references.
+	 */
+	const std::vector<grant_ref_t>& getRefs() const { return mRefs; }
+
+	//! Default time to wait for dma-buf release
+	static const uint32_t cWaitTimeoutMs = 3000;
+
+private:
+
+	xengnttab_handle* mHandle;
+	int mFd;
+	uint32_t mTimeout;
+	std::vector<grant_ref_t> mRefs;
+	Log mLog;
+
+	void init(domid_t domId, uint32_t flags);
+	void release();
+};
+
+/***************************************************************************//**
+ * Imports dma-buf as grant references.
+ * XenGnttabDmaBufImporter grants the pages of the local dma-buf to
+ * the frontend domain. The grant references should be passed to the
+ * frontend according to the protocol. The pages are unshared when
+ * the importer is destroyed.
+ * Available if the library is built with WITH_DMABUF option.
+ * @ingroup xen
+ ******************************************************************************/
+class XenGnttabDmaBufImporter
+{
+public:
+
+	/**
+	 * @param[in] domId domain id to grant the pages to
+	 * @param[in] fd    dma-buf file descriptor
+	 * @param[in] count number of pages of the dma-buf
+	 */
+	XenGnttabDmaBufImporter(domid_t domId, int fd, size_t count);
+	XenGnttabDmaBufImporter(const XenGnttabDmaBufImporter&) = delete;
+	XenGnttabDmaBufImporter& operator=(XenGnttabDmaBufImporter const&) = delete;
+	~XenGnttabDmaBufImporter();
+
+	/**
+	 * Returns dma-buf file descriptor.
+	 */
+	int getFd() const { return mFd; }
+
+	/**
+	 * Returns grant references of the dma-buf pages.
+	 */
+	const std::vector<grant_ref_t>& getRefs() const { return mRefs; }
+
+private:
+
+	xengnttab_handle* mHandle;
+	int mFd;
+	bool mImported;
+	std::vector<grant_ref_t> mRefs;
+	Log mLog;
+
+	void init(domid_t domId, size_t count);
+	void release();
+};
+
+}
+
+#endif /* XENBE_XENGNTTABDMABUF_HPP_ */
@@ -21,10 +21,15 @@
 #ifndef XENBE_XENSTAT_HPP_
 #define XENBE_XENSTAT_HPP_
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "Exception.hpp"
 #include "XenCtrl.hpp"
+#include "XenStore.hpp"
 #include "Log.hpp"
 
 namespace XenBackend {
@@ -38,32 +43,145 @@ class XenStatException : public Exception
 	using Exception::Exception;
 };
 
+/***************************************************************************//**
+ * Resource statistics of one domain.
+ * @ingroup xen
+ ******************************************************************************/
+struct DomainStats
+{
+	//! domain id
+	domid_t domId;
+	//! XEN_DOMINF_* flags
+	uint32_t flags;
+	//! total CPU time in ns
+	uint64_t cpuTime;
+	//! CPU usage since the previous snapshot, 100 per one physical CPU
+	double cpuUsage;
+	//! current number of memory pages
+	uint64_t totPages;
+	//! maximum number of memory pages
+	uint64_t maxPages;
+	//! number of shared pages
+	uint64_t sharedPages;
+	//! number of paged out pages
+	uint64_t pagedPages;
+	//! change of the current number of pages since the previous stats
+	int64_t totPagesDelta;
+	//! number of online vCPUs
+	uint32_t numOnlineVcpus;
+	//! maximum vCPU id
+	uint32_t maxVcpuId;
+};
+
 /***************************************************************************//**
  * Provides different Xen domains statistics.
+ *
+ * Domains info is kept in a snapshot which is refreshed not more often than the
+ * refresh interval. The default interval is 0 i.e. each request reads actual
+ * domains info.
+ *
+ * Domain stats rates are calculated between the snapshots seen by two
+ * getDomainStats() calls, so other requests which refresh the snapshot don't
+ * shift the rates baseline. Rates are zero for the first call and for new
+ * domains.
+ *
+ * Instead of polling, the client may set the domains changed callback. It is
+ * called on @introduceDomain and @releaseDomain XenStore events with the list
+ * of added and removed domains.
  * @ingroup xen
  ******************************************************************************/
 class XenStat
 {
 public:
-	XenStat();
+
+	/**
+	 * Callback which is called when the domains are introduced or released
+	 * @param added   ids of new domains
+	 * @param removed ids of removed domains
+	 */
+	typedef std::function<void(const std::vector<domid_t>& added,
+							   const std::vector<domid_t>& removed)>
+		DomainsChangedCallback;
+
+	/**
+	 * @param refreshInterval minimal interval between domains info updates
+	 */
+	explicit XenStat(std::chrono::milliseconds refreshInterval =
+					 std::chrono::milliseconds(0));
 	~XenStat();
 
+	/**
+	 * Sets minimal interval between domains info updates
+	 * @param refreshInterval refresh interval
+	 */
+	void setRefreshInterval(std::chrono::milliseconds refreshInterval);
+
+	/**
+	 * Drops the domains info snapshot. The next request reads actual info.
+	 */
+	void invalidate();
+
 	/**
 	 * Returns running domain ids.
 	 */
 	std::vector<domid_t> getRunningDoms();
 
+	/**
+	 * Gets running domain ids into the provided vector
+	 * @param[out] domIds running domain ids
+	 */
+	void getRunningDoms(std::vector<domid_t>& domIds);
+
 	/**
 	 * Returns existing domain ids.
 	 */
 	std::vector<domid_t> getExistingDoms();
 
+	/**
+	 * Gets existing domain ids into the provided vector
+	 * @param[out] domIds existing domain ids
+	 */
+	void getExistingDoms(std::vector<domid_t>& domIds);
+
+	/**
+	 * Gets resource statistics of all existing domains into the provided
+	 * vector
+	 * @param[out] stats domain statistics sorted by domain id
+	 */
+	void getDomainStats(std::vector<DomainStats>& stats);
+
+	/**
+	 * Sets the domains changed callback. Passing <i>nullptr</i> removes
+	 * the callback. Shall not be called from the callback itself.
+	 * @param callback callback
+	 */
+	void setDomainsChangedCallback(DomainsChangedCallback callback);
+
 private:
 
 	XenInterface mInterface;
+	std::chrono::milliseconds mRefreshInterval;
+	std::chrono::steady_clock::time_point mUpdateTime;
+	bool mValid;
+	std::vector<xc_domaininfo_t> mDomInfos;
+
+	// snapshots owned by getDomainStats() for rates calculation
+	std::chrono::steady_clock::time_point mStatsTime;
+	std::chrono::steady_clock::time_point mPrevStatsTime;
+	std::vector<xc_domaininfo_t> mStatsDomInfos;
+	std::vector<xc_domaininfo_t> mPrevStatsDomInfos;
+
+	std::unique_ptr<XenStore> mXenStore;
+	DomainsChangedCallback mCallback;
+	std::vector<domid_t> mKnownDoms;
+	std::vector<domid_t> mCurrentDoms;
+
+	std::mutex mMutex;
 	Log mLog;
-};
 
+	void update();
+	void domainsChanged();
+};
 }
 
 #endif /* XENBE_XENSTAT_HPP_ */
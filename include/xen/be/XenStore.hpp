@@ -22,12 +22,16 @@
 #define XENBE_XENSTORE_HPP_
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 extern "C" {
@@ -37,6 +41,7 @@ extern "C" {
 
 #include "Exception.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 #include "Utils.hpp"
 
 namespace XenBackend {
@@ -63,6 +68,36 @@ public:
 	 */
 	typedef std::function<void(const std::string& path)> WatchCallback;
 
+	/**
+	 * Callback which performs XS operations within a transaction
+	 */
+	typedef std::function<void(xs_transaction_t transaction)>
+		TransactionCallback;
+
+	/**
+	 * Default max number of transaction retries
+	 */
+	static const unsigned int cDefaultTransactionRetries = 8;
+
+	/**
+	 * Xen store metrics
+	 */
+	struct Metrics
+	{
+		//! number of read requests
+		uint64_t numReads;
+		//! number of write and remove requests
+		uint64_t numWrites;
+		//! number of transaction commits
+		uint64_t numTransactions;
+		//! number of transactions failed due to conflicts
+		uint64_t numConflicts;
+		//! number of received watch events
+		uint64_t numWatchEvents;
+		//! number of watch events merged into pending callbacks
+		uint64_t numCoalescedEvents;
+	};
+
 	/**
 	 * @param errorCallback callback called on XS watches error
 	 */
@@ -79,85 +114,239 @@ public:
 
 	/**
 	 * Read XS entry as integer.
-	 * @param[in] path path to the entry
+	 * @param[in] path        path to the entry
+	 * @param[in] transaction transaction to read within
 	 * @return integer value
 	 */
-	int readInt(const std::string& path);
+	int readInt(const std::string& path,
+				xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Read XS entry as unsigned integer.
-	 * @param[in] path path to the entry
+	 * @param[in] path        path to the entry
+	 * @param[in] transaction transaction to read within
 	 * @return integer value
 	 */
-	unsigned int readUint(const std::string& path);
+	unsigned int readUint(const std::string& path,
+						  xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Read XS entry as string.
-	 * @param[in] path path to the entry
+	 * @param[in] path        path to the entry
+	 * @param[in] transaction transaction to read within
 	 * @return string value
 	 */
-	std::string readString(const std::string& path);
+	std::string readString(const std::string& path,
+						   xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Read XS entry as integer if it exists.
+	 * @param[in]  path        path to the entry
+	 * @param[out] value       integer value
+	 * @param[in]  transaction transaction to read within
+	 * @return <i>false</i> if the entry doesn't exist
+	 */
+	bool tryReadInt(const std::string& path, int& value,
+					xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Read XS entry as unsigned integer if it exists.
+	 * @param[in]  path        path to the entry
+	 * @param[out] value       unsigned value
+	 * @param[in]  transaction transaction to read within
+	 * @return <i>false</i> if the entry doesn't exist
+	 */
+	bool tryReadUint(const std::string& path, unsigned int& value,
+					 xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Read XS entry as string if it exists.
+	 * @param[in]  path        path to the entry
+	 * @param[out] value       string value
+	 * @param[in]  transaction transaction to read within
+	 * @return <i>false</i> if the entry doesn't exist
+	 */
+	bool tryReadString(const std::string& path, std::string& value,
+					   xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Reads several XS entries as strings. If no transaction is passed, the
+	 * entries are read within own transaction, so the result is consistent.
+	 * @param[in] paths       paths to the entries
+	 * @param[in] transaction transaction to read within
+	 * @return string values in the order of the paths
+	 */
+	std::vector<std::string> readMany(const std::vector<std::string>& paths,
+									  xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Writes integer value into XS entry.
-	 * @param path  path to the entry
-	 * @param value integer value
+	 * @param path        path to the entry
+	 * @param value       integer value
+	 * @param transaction transaction to write within
 	 */
-	void writeInt(const std::string& path, int value);
+	void writeInt(const std::string& path, int value,
+				  xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Writes unsigned value into XS entry.
-	 * @param path  path to the entry
-	 * @param value unsigned value
+	 * @param path        path to the entry
+	 * @param value       unsigned value
+	 * @param transaction transaction to write within
 	 */
-	void writeUint(const std::string& path, unsigned int value);
+	void writeUint(const std::string& path, unsigned int value,
+				   xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Read XS entry as string.
-	 * @param path path to the entry
-	 * @param value string value
+	 * @param path        path to the entry
+	 * @param value       string value
+	 * @param transaction transaction to write within
 	 */
-	void writeString(const std::string& path, const std::string& value);
+	void writeString(const std::string& path, const std::string& value,
+					 xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Removes XS entry.
-	 * @param path path to the entry
+	 * @param path        path to the entry
+	 * @param transaction transaction to remove within
 	 */
-	void removePath(const std::string& path);
+	void removePath(const std::string& path,
+					xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Checks if XS entry exists.
-	 * @param path path to the entry
+	 * @param path        path to the entry
+	 * @param transaction transaction to check within
 	 * @return <i>true</i> if the entry exists
 	 */
-	bool checkIfExist(const std::string& path);
+	bool checkIfExist(const std::string& path,
+					  xs_transaction_t transaction = XBT_NULL);
 
 	/**
 	 * Reads XS directory
-	 * @param path path to the directory
+	 * @param path        path to the directory
+	 * @param transaction transaction to read within
 	 * @return string vector of directory items
 	 */
-	std::vector<std::string> readDirectory(const std::string& path);
+	std::vector<std::string> readDirectory(const std::string& path,
+							xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Reads XS directory if it exists.
+	 * @param[in]  path        path to the directory
+	 * @param[out] items       directory items
+	 * @param[in]  transaction transaction to read within
+	 * @return <i>false</i> if the directory doesn't exist
+	 */
+	bool tryReadDirectory(const std::string& path,
+						  std::vector<std::string>& items,
+						  xs_transaction_t transaction = XBT_NULL);
+
+	/**
+	 * Starts XS transaction.
+	 * @return transaction
+	 */
+	xs_transaction_t beginTransaction();
+
+	/**
+	 * Commits XS transaction.
+	 * @param transaction transaction to commit
+	 * @return <i>false</i> if the transaction conflicts with other changes
+	 * and should be repeated
+	 */
+	bool commitTransaction(xs_transaction_t transaction);
+
+	/**
+	 * Aborts XS transaction.
+	 * @param transaction transaction to abort
+	 */
+	void abortTransaction(xs_transaction_t transaction);
+
+	/**
+	 * Executes the callback within XS transaction. If the transaction
+	 * conflicts with other changes, it is repeated up to maxRetries times.
+	 * If the callback throws, the transaction is aborted.
+	 * @param callback   callback which performs XS operations
+	 * @param maxRetries max number of retries
+	 */
+	void runTransaction(TransactionCallback callback,
+						unsigned int maxRetries = cDefaultTransactionRetries);
 
 	/**
 	 * Sets watch for XS entry change.
+	 * If the coalesce window is set, the callback is called once when
+	 * the window, started by the first event, expires. Events received within
+	 * the window are merged into this call. It is suited for callbacks which
+	 * read the current state, such as directory lists.
+	 * @param path       path to the entry
+	 * @param callback   callback which will be called when the entry is
+	 * changed
+	 * @param coalesceWindow coalesce window, 0 calls the callback on each
+	 * event
+	 */
+	void setWatch(const std::string& path, WatchCallback callback,
+				  std::chrono::milliseconds coalesceWindow =
+						  std::chrono::milliseconds(0));
+
+	/**
+	 * Sets watch for XS entry change without own xs watch. The callback is
+	 * called when the entry or its children are changed and the change is
+	 * reported by a watch set with setWatch() for one of the parent entries.
+	 * Contrary to setWatch(), the callback is not called on registration.
 	 * @param path       path to the entry
 	 * @param callback   callback which will be called when the entry is
 	 * changed
+	 * @param coalesceWindow coalesce window, see setWatch()
 	 */
-	void setWatch(const std::string& path, WatchCallback callback);
+	void setChildWatch(const std::string& path, WatchCallback callback,
+					   std::chrono::milliseconds coalesceWindow =
+							   std::chrono::milliseconds(0));
 
 	/**
-	 * Clears watch for XS entry change.
+	 * Clears watch for XS entry change. If the watch callback is being called
+	 * by the watches thread, waits for its completion, so the callback
+	 * context may be deleted after the return. It doesn't wait if it is called
+	 * from a watch callback.
 	 * @param path path to the entry.
 	 */
 	void clearWatch(const std::string& path);
 
 	/**
-	 * Clears all watches.
+	 * Clears all watches and watch listeners and waits for the watch callback
+	 * being called.
 	 */
 	void clearWatches();
 
+	/**
+	 * Adds listener of XS entry change. Contrary to setWatch(), many
+	 * listeners may watch the same path, also together with the watch set by
+	 * setWatch(), and they don't replace each other. One xs watch is shared
+	 * by all of them. The callback is called for the changes reported for
+	 * the path, without coalescing.
+	 * @param path     path to the entry
+	 * @param callback callback which will be called when the entry is
+	 * changed
+	 * @return listener id which should be passed to removeWatchListener()
+	 */
+	uint64_t addWatchListener(const std::string& path, WatchCallback callback);
+
+	/**
+	 * Removes the watch listener. Waits for the listener callback like
+	 * clearWatch() does.
+	 * @param id listener id returned by addWatchListener()
+	 */
+	void removeWatchListener(uint64_t id);
+
+	/**
+	 * Sets attributes of the watches thread. Should be called before start().
+	 * @param threadAttributes thread attributes
+	 */
+	void setThreadAttributes(const ThreadAttributes& threadAttributes)
+	{
+		mThreadAttributes = threadAttributes;
+	}
+
 	/**
 	 * Starts handling watches.
 	 */
@@ -168,18 +357,83 @@ public:
 	 */
 	void stop();
 
+	/**
+	 * Returns xen store metrics
+	 */
+	Metrics getMetrics() const
+	{
+		return { mNumReads.get(), mNumWrites.get(), mNumTransactions.get(),
+				 mNumConflicts.get(), mNumWatchEvents.get(),
+				 mNumCoalescedEvents.get() };
+	}
+
 private:
 
 	xs_handle*	mXsHandle;
 	ErrorCallback mErrorCallback;
 	std::atomic_bool mStarted;
+	Counter mNumReads;
+	Counter mNumWrites;
+	Counter mNumTransactions;
+	Counter mNumConflicts;
+	Counter mNumWatchEvents;
+	Counter mNumCoalescedEvents;
 	Log mLog;
 
-	std::unordered_map<std::string, WatchCallback> mWatches;
+	struct WatchNode
+	{
+		WatchNode() : ownWatch(false), coalesceWindow(0) {}
+
+		std::string path;
+		WatchCallback callback;
+		bool ownWatch;
+		std::chrono::milliseconds coalesceWindow;
+		std::unordered_map<std::string, std::unique_ptr<WatchNode>> children;
+	};
+
+	struct WatchEntry
+	{
+		std::string path;
+		WatchCallback callback;
+		std::chrono::milliseconds coalesceWindow;
+		// listener id or 0 for the watch set by setWatch()
+		uint64_t listener;
+	};
+
+	struct WatchListener
+	{
+		std::string path;
+		WatchCallback callback;
+	};
+
+	struct PendingWatch
+	{
+		WatchCallback callback;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	typedef std::vector<WatchEntry> WatchCallbacks;
+
+	// watched paths are kept in the trie of path components, so the watch
+	// event is dispatched to the token and child watches in one pass
+	WatchNode mWatches;
+	std::unordered_map<std::string, bool> mWatchPaths;
+	std::unordered_map<std::string, PendingWatch> mPendingWatches;
+	std::unordered_map<uint64_t, WatchListener> mListeners;
+	// number of listeners per path
+	std::unordered_map<std::string, size_t> mListenerPaths;
+	uint64_t mNextListener;
 
 	std::thread mThread;
+	ThreadAttributes mThreadAttributes;
 	std::mutex mMutex;
 
+	// the watch which callback is being called by the watches thread
+	bool mDispatching;
+	std::string mDispatchingPath;
+	uint64_t mDispatchingListener;
+	std::condition_variable mDispatchCondVar;
+
 	std::unique_ptr<PollFd> mPollFd;
 
 	void init();
@@ -187,7 +441,122 @@ private:
 
 	void watchesThread();
 	std::string readXsWatch(std::string& token);
-	WatchCallback getWatchCallback(const std::string& path);
+	void addWatch(const std::string& path, WatchCallback callback,
+				  bool ownWatch, std::chrono::milliseconds coalesceWindow);
+	void removeWatch(const std::string& path);
+	WatchCallbacks getWatchCallbacks(const std::string& path,
+									 const std::string& token);
+	void dispatchWatch(const WatchEntry& watch, const std::string& path);
+	void runWatch(const WatchEntry& watch);
+	void endDispatch();
+	void waitDispatch(std::unique_lock<std::mutex>& lock,
+					  const std::string& path, uint64_t listener = 0);
+	bool isXsWatched(const std::string& path) const;
+	WatchCallbacks getExpiredWatches();
+	int getPollTimeout();
+	static std::vector<std::string> splitPath(const std::string& path);
+};
+
+/***************************************************************************//**
+ * Read-through cache of XS entries.
+ *
+ * Caches entries of the XS subtree which are read on demand. The subtree is
+ * watched and all cached entries are dropped when any entry of the subtree is
+ * changed, so it is suited for rarely changed entries such as frontend
+ * configuration. Paths outside of the subtree are read from XS directly.
+ * The xen store should be started in order to get watch events.
+ *
+ * The subtree is watched with XenStore::addWatchListener(), so the cache may
+ * be created on the xen store shared with the backend which watches the same
+ * path, e.g. on BackendBase::getXenStore() for the frontend path.
+ *
+ * @code
+ * XenStoreCache cache(backend.getXenStore(), frontendPath);
+ *
+ * auto ref = cache.readUint(frontendPath + "/ring-ref");
+ *
+ * ...
+ *
+ * @endcode
+ * @ingroup xen
+ ******************************************************************************/
+class XenStoreCache
+{
+public:
+
+	/**
+	 * @param[in] xenStore xen store to read entries from
+	 * @param[in] path     path to the cached subtree, it may be watched by
+	 * other users of the xen store as the cache uses a watch listener
+	 */
+	XenStoreCache(XenStore& xenStore, const std::string& path);
+	XenStoreCache(const XenStoreCache&) = delete;
+	XenStoreCache& operator=(XenStoreCache const&) = delete;
+	~XenStoreCache();
+
+	/**
+	 * Read XS entry as integer.
+	 * @param[in] path path to the entry
+	 * @return integer value
+	 */
+	int readInt(const std::string& path);
+
+	/**
+	 * Read XS entry as unsigned integer.
+	 * @param[in] path path to the entry
+	 * @return integer value
+	 */
+	unsigned int readUint(const std::string& path);
+
+	/**
+	 * Read XS entry as string.
+	 * @param[in] path path to the entry
+	 * @return string value
+	 */
+	std::string readString(const std::string& path);
+
+	/**
+	 * Read XS entry as string if it exists. Missing entries are not cached.
+	 * @param[in]  path  path to the entry
+	 * @param[out] value string value
+	 * @return <i>false</i> if the entry doesn't exist
+	 */
+	bool tryReadString(const std::string& path, std::string& value);
+
+	/**
+	 * Removes all entries from the cache
+	 */
+	void invalidate();
+
+	/**
+	 * Returns number of cached entries
+	 */
+	size_t size() const;
+
+	/**
+	 * Returns number of reads served from the cache
+	 */
+	uint64_t getNumHits() const { return mNumHits.get(); }
+
+	/**
+	 * Returns number of reads which required XS access
+	 */
+	uint64_t getNumMisses() const { return mNumMisses.get(); }
+
+private:
+
+	XenStore& mXenStore;
+	std::string mPath;
+	uint64_t mListener;
+	uint64_t mGeneration;
+	Counter mNumHits;
+	Counter mNumMisses;
+
+	std::unordered_map<std::string, std::string> mEntries;
+
+	mutable std::mutex mMutex;
+
+	bool isCached(const std::string& path) const;
 };
 
 }
@@ -0,0 +1,87 @@
+/*
+ *  Request arena
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Arena.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * Arena
+ ******************************************************************************/
+
+Arena::Arena(size_t blockSize, size_t numBlocks) :
+	mBlockSize((blockSize + alignof(std::max_align_t) - 1) &
+			   ~(alignof(std::max_align_t) - 1)),
+	mNumBlocks(numBlocks),
+	mBuffer(new char[mBlockSize * mNumBlocks])
+{
+	mFreeBlocks.reserve(mNumBlocks);
+
+	// blocks are taken from the back, so the first block is used first
+
+	for (size_t i = mNumBlocks; i > 0; i--)
+	{
+		mFreeBlocks.push_back(&mBuffer[(i - 1) * mBlockSize]);
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void* Arena::allocate(size_t size)
+{
+	if (size > mBlockSize)
+	{
+		throw Exception("Allocation exceeds arena block size", EINVAL);
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	if (mFreeBlocks.empty())
+	{
+		throw Exception("Arena is exhausted", ENOMEM);
+	}
+
+	auto block = mFreeBlocks.back();
+
+	mFreeBlocks.pop_back();
+
+	return block;
+}
+
+void Arena::deallocate(void* block)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mFreeBlocks.push_back(block);
+}
+
+size_t Arena::getNumFreeBlocks()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mFreeBlocks.size();
+}
+
+}
@@ -22,19 +22,33 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <thread>
 
 #include "Utils.hpp"
 
 using std::bind;
-using std::find_if;
-using std::list;
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::lock_guard;
 using std::make_pair;
-using std::unique_ptr;
+using std::make_shared;
+using std::min;
+using std::mutex;
 using std::pair;
 using std::placeholders::_1;
 using std::stoi;
 using std::string;
+using std::thread;
 using std::to_string;
+using std::unique_lock;
+using std::unordered_set;
 using std::vector;
 
 namespace XenBackend {
@@ -79,6 +93,12 @@ BackendBase::BackendBase(const string& name, const string& deviceName) :
 	mDomId(0),
 	mDeviceName(deviceName),
 	mXenStore(bind(&BackendBase::onError, this, _1)),
+	mWatchCoalesceWindow(0),
+	mStatsPending(false),
+	mLastNumRequests(0),
+	mLastStatsTime(steady_clock::now()),
+	mPublishNumRequests(0),
+	mPublishStatsTime(mLastStatsTime),
 	mLog(name.empty() ? "Backend" : name)
 {
 	mDomId = mXenStore.readInt("domid");
@@ -86,17 +106,31 @@ BackendBase::BackendBase(const string& name, const string& deviceName) :
 	mFrontendsPath = mXenStore.getDomainPath(mDomId) + "/backend/" +
 					 mDeviceName;
 
+	// stats are kept out of the watched frontends path, so publishing
+	// doesn't trigger the frontend detection
+
+	mStatsPath = mXenStore.getDomainPath(mDomId) + "/backend-stats/" +
+				 mDeviceName;
+
 	LOG(mLog, DEBUG) << "Create backend, device: " << deviceName << ", "
 					 << "dom Id: " << mDomId;
 }
 
 BackendBase::~BackendBase()
 {
+	// frontends which are not stopped by shutdown() in time may still use
+	// the backend xen store
+
+	for (auto& thread : mShutdownThreads)
+	{
+		thread.join();
+	}
+
 	stop();
 
 	for(auto frontend : mFrontendHandlers)
 	{
-		frontend->stop();
+		frontend.second->stop();
 	}
 
 	mFrontendHandlers.clear();
@@ -113,14 +147,287 @@ void BackendBase::start()
 	mXenStore.start();
 
 	mXenStore.setWatch(mFrontendsPath,
-					   bind(&BackendBase::domainListChanged, this, _1));
+					   bind(&BackendBase::domainListChanged, this, _1),
+					   mWatchCoalesceWindow);
 }
 
 void BackendBase::stop()
 {
+	stopStats();
+
 	mXenStore.clearWatches();
 
 	mXenStore.stop();
+
+	waitTasks();
+}
+
+ShutdownResult BackendBase::shutdown(milliseconds timeout, size_t maxWorkers)
+{
+	auto deadline = steady_clock::now() + timeout;
+
+	// no new frontends are detected after the watches are cleared
+
+	stopStats();
+
+	mXenStore.clearWatches();
+
+	mXenStore.stop();
+
+	// the state is shared with the stop tasks as they may outlive the call,
+	// the destructor waits for them since handlers may use the backend store
+
+	struct State
+	{
+		explicit State(const Log& log) : log(log), numStopped(0) {}
+
+		Log log;
+		mutex stateMutex;
+		condition_variable condVar;
+		unordered_set<uint32_t> pending;
+		deque<pair<uint32_t, FrontendHandlerPtr>> frontendHandlers;
+		vector<uint32_t> failed;
+		size_t numStopped;
+	};
+
+	auto state = make_shared<State>(mLog);
+
+	// frontends which are being brought up by the worker pool are looked
+	// up after the bring-up as tasks of one frontend are ordered
+
+	vector<uint32_t> bringUpKeys;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		LOG(mLog, INFO) << "Shutdown, frontends: " << mFrontendHandlers.size();
+
+		for (auto& frontendHandler : mFrontendHandlers)
+		{
+			state->pending.insert(frontendHandler.first);
+			state->frontendHandlers.push_back(frontendHandler);
+		}
+
+		mFrontendHandlers.clear();
+
+		for (auto& queue : mQueues)
+		{
+			if (!state->pending.count(queue.first) &&
+				!mFailedFrontends.count(queue.first))
+			{
+				state->pending.insert(queue.first);
+				bringUpKeys.push_back(queue.first);
+			}
+		}
+	}
+
+	auto stopFrontend = [state](uint32_t key,
+								FrontendHandlerPtr frontendHandler) {
+		bool failed = false;
+
+		try
+		{
+			if (frontendHandler)
+			{
+				frontendHandler->stop();
+			}
+		}
+		catch(const std::exception& e)
+		{
+			LOG(state->log, ERROR) << e.what();
+
+			failed = true;
+		}
+
+		lock_guard<mutex> lock(state->stateMutex);
+
+		if (failed)
+		{
+			state->failed.push_back(key);
+		}
+		else if (frontendHandler)
+		{
+			state->numStopped++;
+		}
+
+		state->pending.erase(key);
+
+		state->condVar.notify_all();
+	};
+
+	auto setFailed = [&state](uint32_t key) {
+		lock_guard<mutex> lock(state->stateMutex);
+
+		state->failed.push_back(key);
+		state->pending.erase(key);
+	};
+
+	if (mWorkerPool)
+	{
+		for (auto& frontendHandler : state->frontendHandlers)
+		{
+			auto key = frontendHandler.first;
+			auto handler = frontendHandler.second;
+
+			postShutdownTask(key, [stopFrontend, key, handler] {
+				stopFrontend(key, handler);
+			}, setFailed);
+		}
+
+		state->frontendHandlers.clear();
+
+		for (auto key : bringUpKeys)
+		{
+			postShutdownTask(key, [this, stopFrontend, key] {
+				FrontendHandlerPtr frontendHandler;
+
+				{
+					lock_guard<mutex> lock(mMutex);
+
+					auto it = mFrontendHandlers.find(key);
+
+					if (it != mFrontendHandlers.end())
+					{
+						frontendHandler = it->second;
+
+						mFrontendHandlers.erase(it);
+					}
+				}
+
+				stopFrontend(key, frontendHandler);
+			}, setFailed);
+		}
+	}
+	else if (!state->frontendHandlers.empty())
+	{
+		// own workers are joined by the destructor
+
+		auto worker = [state, stopFrontend] {
+			while(true)
+			{
+				pair<uint32_t, FrontendHandlerPtr> frontendHandler;
+
+				{
+					lock_guard<mutex> lock(state->stateMutex);
+
+					if (state->frontendHandlers.empty())
+					{
+						return;
+					}
+
+					frontendHandler = state->frontendHandlers.front();
+					state->frontendHandlers.pop_front();
+				}
+
+				stopFrontend(frontendHandler.first, frontendHandler.second);
+			}
+		};
+
+		auto numWorkers = min(state->frontendHandlers.size(),
+							  maxWorkers ? maxWorkers : 1);
+		size_t numStarted = 0;
+
+		try
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			for (; numStarted < numWorkers; numStarted++)
+			{
+				mShutdownThreads.push_back(thread(worker));
+			}
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << e.what();
+		}
+
+		if (numStarted == 0)
+		{
+			lock_guard<mutex> lock(state->stateMutex);
+
+			for (auto& frontendHandler : state->frontendHandlers)
+			{
+				state->failed.push_back(frontendHandler.first);
+				state->pending.erase(frontendHandler.first);
+			}
+
+			state->frontendHandlers.clear();
+		}
+	}
+
+	ShutdownResult result = {};
+
+	unique_lock<mutex> lock(state->stateMutex);
+
+	state->condVar.wait_until(lock, deadline,
+							  [&state] { return state->pending.empty(); });
+
+	auto getId = [](uint32_t key) {
+		return ShutdownResult::FrontendId(key >> 16, key & 0xFFFF);
+	};
+
+	for (auto key : state->failed)
+	{
+		result.failed.push_back(getId(key));
+	}
+
+	for (auto key : state->pending)
+	{
+		LOG(mLog, WARNING) << "Frontend is not stopped in time, domid: "
+						   << (key >> 16) << ", devid: " << (key & 0xFFFF);
+
+		result.timedOut.push_back(getId(key));
+	}
+
+	result.numStopped = state->numStopped;
+
+	return result;
+}
+
+BackendStats BackendBase::getStats()
+{
+	return getStats(mLastNumRequests, mLastStatsTime);
+}
+
+void BackendBase::setThreadAttributes(const ThreadAttributes& threadAttributes)
+{
+	mThreadAttributes = threadAttributes;
+
+	mXenStore.setThreadAttributes(threadAttributes);
+}
+
+void BackendBase::setStatsInterval(milliseconds interval)
+{
+	mStatsTimer.reset();
+	mStatsContext.reset();
+
+	mStatsPending = false;
+
+	if (interval.count())
+	{
+		mStatsContext.reset(new AsyncContext());
+
+		if (mWorkerPool)
+		{
+			mStatsContext->setWorkerPool(mWorkerPool);
+		}
+		else
+		{
+			mStatsContext->setThreadAttributes(mThreadAttributes);
+		}
+
+		{
+			lock_guard<mutex> lock(mStatsMutex);
+
+			mPublishNumRequests = 0;
+			mPublishStatsTime = steady_clock::now();
+		}
+
+		mStatsTimer.reset(new Timer(bind(&BackendBase::postStats, this),
+									true));
+
+		mStatsTimer->start(interval);
+	}
 }
 
 /*******************************************************************************
@@ -142,11 +449,20 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 
 	mXenStore.setWatch(frontendPath,
 					   bind(&BackendBase::frontendPathChanged, this,
-							_1, domId, devId));
+							_1, domId, devId), mWatchCoalesceWindow);
+
+	// attributes set to the frontend handler take precedence
+
+	if (frontendHandler->getThreadAttributes().empty())
+	{
+		frontendHandler->setThreadAttributes(mThreadAttributes);
+	}
 
 	frontendHandler->start();
 
-	mFrontendHandlers.push_back(frontendHandler);
+	lock_guard<mutex> lock(mMutex);
+
+	mFrontendHandlers[getKey(domId, devId)] = frontendHandler;
 }
 
 /*******************************************************************************
@@ -155,41 +471,182 @@ void BackendBase::addFrontendHandler(FrontendHandlerPtr frontendHandler)
 
 void BackendBase::domainListChanged(const string& path)
 {
+	unordered_set<domid_t> domains;
+
 	for (auto domain : mXenStore.readDirectory(path))
 	{
-		domid_t domId = stoi(domain);
+		unsigned long domId;
+
+		// skip not domain entries
 
-		if (find(mDomainList.begin(), mDomainList.end(), domId) ==
-			mDomainList.end())
+		if (parseId(domain, domId))
 		{
-			mXenStore.setWatch(mFrontendsPath + "/" + domain,
-							   bind(&BackendBase::deviceListChanged, this,
-									_1, domId));
+			domains.insert(domId);
+		}
+	}
+
+	// handle only the difference with the last seen list
+
+	vector<domid_t> removed;
+
+	for (auto& domain : mDomainList)
+	{
+		if (domains.find(domain.first) == domains.end())
+		{
+			removed.push_back(domain.first);
+		}
+	}
 
-			mDomainList.push_back(domId);
+	for (auto domId : removed)
+	{
+		removeDomain(domId);
+	}
+
+	for (auto domId : domains)
+	{
+		if (mDomainList.find(domId) == mDomainList.end())
+		{
+			addDomain(domId);
 		}
 	}
 }
 
 void BackendBase::deviceListChanged(const string& path, domid_t domId)
 {
+	vector<string> items;
+
+	if (!mXenStore.tryReadDirectory(path, items))
+	{
+		removeDomain(domId);
+
+		return;
+	}
+
+	auto it = mDomainList.find(domId);
+
+	if (it == mDomainList.end())
+	{
+		return;
+	}
+
+	auto& knownDevices = it->second;
+
+	// forget failed frontends to retry them
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		for (auto failedIt = mFailedFrontends.begin();
+			 failedIt != mFailedFrontends.end();)
+		{
+			if ((*failedIt >> 16) == domId)
+			{
+				knownDevices.erase(*failedIt & 0xFFFF);
+
+				failedIt = mFailedFrontends.erase(failedIt);
+			}
+			else
+			{
+				++failedIt;
+			}
+		}
+	}
+
+	unordered_set<uint16_t> devices;
+
+	for (auto item : items)
+	{
+		devices.insert(stoi(item));
+	}
+
+	for (auto devIt = knownDevices.begin(); devIt != knownDevices.end();)
+	{
+		if (devices.find(*devIt) == devices.end())
+		{
+			removeFrontendHandler(domId, *devIt);
+
+			devIt = knownDevices.erase(devIt);
+		}
+		else
+		{
+			++devIt;
+		}
+	}
+
+	for (auto devId : devices)
+	{
+		if (knownDevices.find(devId) != knownDevices.end())
+		{
+			continue;
+		}
+
+		knownDevices.insert(devId);
+
+		newFrontend(domId, devId);
+	}
+}
+
+void BackendBase::frontendPathChanged(const string& path, domid_t domId,
+									  uint16_t devId)
+{
+	LOG(mLog, DEBUG) << "Frontend path changed: " << path;
+
 	if (!mXenStore.checkIfExist(path))
 	{
-		auto it = find(mDomainList.begin(), mDomainList.end(), domId);
+		removeFrontendHandler(domId, devId);
+
+		auto it = mDomainList.find(domId);
 
 		if (it != mDomainList.end())
 		{
-			mXenStore.clearWatch(path);
-			mDomainList.erase(it);
+			it->second.erase(devId);
 		}
+	}
+}
+
+void BackendBase::addDomain(domid_t domId)
+{
+	auto domainPath = mFrontendsPath + "/" + to_string(domId);
+
+	LOG(mLog, DEBUG) << "New domain found, domid: " << domId;
+
+	// domain path is covered by the frontends path watch, so there is
+	// no need for own xs watch but the device list is read here as
+	// child watches are not triggered on registration
+
+	mXenStore.setChildWatch(domainPath,
+							bind(&BackendBase::deviceListChanged, this,
+								 _1, domId), mWatchCoalesceWindow);
+
+	mDomainList[domId];
+
+	deviceListChanged(domainPath, domId);
+}
+
+void BackendBase::removeDomain(domid_t domId)
+{
+	auto it = mDomainList.find(domId);
 
+	if (it == mDomainList.end())
+	{
 		return;
 	}
 
-	for (auto device : mXenStore.readDirectory(path))
+	LOG(mLog, DEBUG) << "Domain removed, domid: " << domId;
+
+	mXenStore.clearWatch(mFrontendsPath + "/" + to_string(domId));
+
+	for (auto devId : it->second)
 	{
-		uint16_t devId = stoi(device);
+		removeFrontendHandler(domId, devId);
+	}
 
+	mDomainList.erase(it);
+}
+
+void BackendBase::newFrontend(domid_t domId, uint16_t devId)
+{
+	runTask(domId, devId, [this, domId, devId] {
 		try
 		{
 			if (!getFrontendHandler(domId, devId))
@@ -203,20 +660,37 @@ void BackendBase::deviceListChanged(const string& path, domid_t domId)
 		catch(const std::exception& e)
 		{
 			LOG(mLog, ERROR) << e.what();
+
+			// failed frontend is retried on next device list change
+
+			lock_guard<mutex> lock(mMutex);
+
+			mFailedFrontends.insert(getKey(domId, devId));
 		}
-	}
+	});
 }
 
-void BackendBase::frontendPathChanged(const string& path, domid_t domId,
-									  uint16_t devId)
+void BackendBase::removeFrontendHandler(domid_t domId, uint16_t devId)
 {
-	LOG(mLog, DEBUG) << "Frontend path changed: " << path;
+	mXenStore.clearWatch(mFrontendsPath + "/" + to_string(domId) + "/" +
+						 to_string(devId));
 
-	if (!mXenStore.checkIfExist(path))
-	{
-		mXenStore.clearWatch(path);
+	runTask(domId, devId, [this, domId, devId] {
+		auto key = getKey(domId, devId);
+		FrontendHandlerPtr frontendHandler;
+
+		{
+			lock_guard<mutex> lock(mMutex);
+
+			auto it = mFrontendHandlers.find(key);
+
+			if (it != mFrontendHandlers.end())
+			{
+				frontendHandler = it->second;
 
-		auto frontendHandler = getFrontendHandler(domId, devId);
+				mFrontendHandlers.erase(it);
+			}
+		}
 
 		if (frontendHandler)
 		{
@@ -224,23 +698,108 @@ void BackendBase::frontendPathChanged(const string& path, domid_t domId,
 							 << domId << ", devid: " << devId;
 
 			frontendHandler->stop();
+		}
+
+		lock_guard<mutex> lock(mMutex);
+
+		// the queue is kept while tasks of the frontend which appeared
+		// again are waiting in it, otherwise they lose their order
+
+		auto it = mQueues.find(key);
+
+		if (it != mQueues.end() && it->second->isEmpty())
+		{
+			mQueues.erase(it);
+		}
+	});
+}
+
+void BackendBase::runTask(domid_t domId, uint16_t devId,
+						  WorkerQueue::Task task)
+{
+	if (!mWorkerPool)
+	{
+		task();
+
+		return;
+	}
+
+	try
+	{
+		// one queue per frontend keeps its bring-up and teardown in order,
+		// the task is posted under the lock as the removal task erases
+		// the queue when it is empty
+
+		lock_guard<mutex> lock(mMutex);
+
+		auto& queue = mQueues[getKey(domId, devId)];
+
+		if (!queue)
+		{
+			queue = mWorkerPool->createQueue();
+		}
+
+		queue->post(task);
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+}
+
+void BackendBase::postShutdownTask(uint32_t key, WorkerQueue::Task task,
+								   function<void(uint32_t)> onFailed)
+{
+	try
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto& queue = mQueues[key];
+
+		if (!queue)
+		{
+			queue = mWorkerPool->createQueue();
+		}
+
+		queue->post(task);
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << e.what();
+
+		onFailed(key);
+	}
+}
+
+void BackendBase::waitTasks()
+{
+	vector<WorkerQueuePtr> queues;
+
+	{
+		lock_guard<mutex> lock(mMutex);
 
-			mFrontendHandlers.remove(frontendHandler);
+		for (auto& queue : mQueues)
+		{
+			queues.push_back(queue.second);
 		}
 	}
+
+	for (auto& queue : queues)
+	{
+		queue->wait();
+	}
 }
 
 FrontendHandlerPtr BackendBase::getFrontendHandler(domid_t domId,
 												   uint16_t devId)
 {
-	auto it = find_if(mFrontendHandlers.begin(), mFrontendHandlers.end(),
-					  [&](FrontendHandlerPtr frontend) {
-							return (frontend->getDomId() == domId) &&
-								   (frontend->getDevId() == devId); } );
+	lock_guard<mutex> lock(mMutex);
+
+	auto it = mFrontendHandlers.find(getKey(domId, devId));
 
 	if (it != mFrontendHandlers.end())
 	{
-		return *it;
+		return it->second;
 	}
 
 	return FrontendHandlerPtr();
@@ -251,4 +810,146 @@ void BackendBase::onError(const std::exception& e)
 	LOG(mLog, ERROR) << e.what();
 }
 
+BackendStats BackendBase::getStats(uint64_t& lastNumRequests,
+								   steady_clock::time_point& lastTime)
+{
+	BackendStats stats = {};
+
+	vector<FrontendHandlerPtr> frontendHandlers;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		frontendHandlers.reserve(mFrontendHandlers.size());
+
+		for (auto& frontendHandler : mFrontendHandlers)
+		{
+			frontendHandlers.push_back(frontendHandler.second);
+		}
+	}
+
+	for (auto& frontendHandler : frontendHandlers)
+	{
+		stats.numFrontends++;
+
+		if (frontendHandler->getBackendState() == XenbusStateConnected)
+		{
+			stats.numConnected++;
+		}
+
+		stats.metrics += frontendHandler->getMetrics();
+	}
+
+	lock_guard<mutex> lock(mStatsMutex);
+
+	auto now = steady_clock::now();
+	duration<double> elapsed = now - lastTime;
+
+	// removed frontends take their counters away
+
+	if (elapsed.count() > 0 && stats.metrics.numRequests >= lastNumRequests)
+	{
+		stats.requestsPerSecond =
+				(stats.metrics.numRequests - lastNumRequests) /
+				elapsed.count();
+	}
+
+	lastNumRequests = stats.metrics.numRequests;
+	lastTime = now;
+
+	return stats;
+}
+
+void BackendBase::postStats()
+{
+	// the transaction may block and retry, so it is not run on the shared
+	// timer thread. The next period is skipped if publishing is not done yet
+
+	if (!mStatsPending.exchange(true))
+	{
+		mStatsContext->call(bind(&BackendBase::publishStats, this));
+	}
+}
+
+void BackendBase::publishStats()
+{
+	try
+	{
+		auto stats = getStats(mPublishNumRequests, mPublishStatsTime);
+		auto path = mStatsPath + "/";
+
+		// publish all values at once to let readers get consistent set
+
+		mXenStore.runTransaction([&](xs_transaction_t transaction) {
+			mXenStore.writeUint(path + "frontends", stats.numFrontends,
+								transaction);
+			mXenStore.writeUint(path + "connected", stats.numConnected,
+								transaction);
+			mXenStore.writeString(path + "requests",
+								  to_string(stats.metrics.numRequests),
+								  transaction);
+			mXenStore.writeString(path + "responses",
+								  to_string(stats.metrics.numResponses),
+								  transaction);
+			mXenStore.writeString(path + "events",
+								  to_string(stats.metrics.numEvents),
+								  transaction);
+			mXenStore.writeString(path + "overflows",
+								  to_string(stats.metrics.numOverflows),
+								  transaction);
+			mXenStore.writeString(path + "requests-per-sec",
+								  to_string(stats.requestsPerSecond),
+								  transaction);
+			mXenStore.writeString(path + "latency-avg-us",
+								  to_string(stats.metrics.latency.getAverage()),
+								  transaction);
+			mXenStore.writeString(path + "latency-p99-us",
+								  to_string(stats.metrics.latency.
+											getPercentile(99)),
+								  transaction);
+		});
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, ERROR) << "Can't publish stats: " << e.what();
+	}
+
+	mStatsPending = false;
+}
+
+void BackendBase::stopStats()
+{
+	if (mStatsTimer)
+	{
+		mStatsTimer.reset();
+
+		// waits for the publishing in progress
+
+		mStatsContext.reset();
+
+		removeStats();
+	}
+}
+
+void BackendBase::removeStats()
+{
+	try
+	{
+		mXenStore.removePath(mStatsPath);
+	}
+	catch(const std::exception& e)
+	{
+		LOG(mLog, WARNING) << "Can't remove stats: " << e.what();
+	}
+}
+
+bool BackendBase::parseId(const string& str, unsigned long& id)
+{
+	char* end = nullptr;
+
+	id = strtoul(str.c_str(), &end, 10);
+
+	return !str.empty() && *end == '\0';
+}
+
 }
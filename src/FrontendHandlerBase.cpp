@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <random>
 #include <sstream>
 
 extern "C" {
@@ -33,11 +34,13 @@ extern "C" {
 #include "Utils.hpp"
 
 using std::bind;
+using std::chrono::milliseconds;
 using std::find;
 using std::lock_guard;
 using std::make_pair;
 using std::mutex;
 using std::placeholders::_1;
+using std::random_device;
 using std::stoi;
 using std::string;
 using std::stringstream;
@@ -61,7 +64,10 @@ FrontendHandlerBase::FrontendHandlerBase(const string& name,
 	mDevName(devName),
 	mBackendState(XenbusStateUnknown),
 	mFrontendState(XenbusStateUnknown),
-	mXenStore(bind(&FrontendHandlerBase::onError, this, _1)),
+	mOwnXenStore(new XenStore(bind(&FrontendHandlerBase::onError, this, _1))),
+	mXenStore(*mOwnXenStore),
+	mWarmReconnect(false),
+	mRingGeneration(random_device()()),
 	mLog(name.empty() ? "FrontendHandler" : name)
 {
 	LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
@@ -70,6 +76,27 @@ FrontendHandlerBase::FrontendHandlerBase(const string& name,
 	init();
 }
 
+FrontendHandlerBase::FrontendHandlerBase(const string& name,
+										 const string& devName,
+										 domid_t beDomId, domid_t feDomId,
+										 uint16_t devId, XenStore& xenStore) :
+	mBeDomId(beDomId),
+	mFeDomId(feDomId),
+	mDevId(devId),
+	mDevName(devName),
+	mBackendState(XenbusStateUnknown),
+	mFrontendState(XenbusStateUnknown),
+	mXenStore(xenStore),
+	mWarmReconnect(false),
+	mRingGeneration(random_device()()),
+	mLog(name.empty() ? "FrontendHandler" : name)
+{
+	LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
+					 << "Create frontend handler on shared xen store";
+
+	init();
+}
+
 FrontendHandlerBase::~FrontendHandlerBase()
 {
 	stop();
@@ -82,6 +109,65 @@ FrontendHandlerBase::~FrontendHandlerBase()
  * Public
  ******************************************************************************/
 
+void FrontendHandlerBase::setUnmapQueue(XenGnttabUnmapQueuePtr unmapQueue)
+{
+	mUnmapQueue = unmapQueue;
+
+	mGnttabCache.setUnmapQueue(unmapQueue);
+}
+
+void FrontendHandlerBase::setWorkerPool(WorkerPoolPtr workerPool)
+{
+	mAsyncContext.setWorkerPool(workerPool);
+}
+
+void FrontendHandlerBase::setThreadAttributes(
+		const ThreadAttributes& threadAttributes)
+{
+	mThreadAttributes = threadAttributes;
+
+	mAsyncContext.setThreadAttributes(threadAttributes);
+
+	if (mOwnXenStore)
+	{
+		mOwnXenStore->setThreadAttributes(threadAttributes);
+	}
+}
+
+RingMetrics FrontendHandlerBase::getMetrics()
+{
+	lock_guard<mutex> lock(mRingMutex);
+
+	RingMetrics metrics = {};
+
+	for (auto& ringBuffer : mRingBuffers)
+	{
+		metrics += ringBuffer->getMetrics();
+	}
+
+	return metrics;
+}
+
+size_t FrontendHandlerBase::getNumRingBuffers()
+{
+	lock_guard<mutex> lock(mRingMutex);
+
+	return mRingBuffers.size();
+}
+
+void FrontendHandlerBase::setMetricsDumpInterval(milliseconds interval)
+{
+	mMetricsTimer.reset();
+
+	if (interval.count())
+	{
+		mMetricsTimer.reset(new Timer(
+				bind(&FrontendHandlerBase::dumpMetrics, this), true));
+
+		mMetricsTimer->start(interval);
+	}
+}
+
 void FrontendHandlerBase::start()
 {
 	lock_guard<mutex> lock(mMutex);
@@ -92,14 +178,27 @@ void FrontendHandlerBase::start()
 	mXenStore.setWatch(mBeStatePath,
 					   bind(&FrontendHandlerBase::backendStateChanged, this));
 
-	mXenStore.start();
+	// shared xen store is started by its owner
+
+	if (mOwnXenStore)
+	{
+		mXenStore.start();
+	}
 }
 
 void FrontendHandlerBase::stop()
 {
-	mXenStore.clearWatches();
+	mMetricsTimer.reset();
 
-	mXenStore.stop();
+	// clear only own watches as the xen store may be shared
+
+	mXenStore.clearWatch(mFeStatePath);
+	mXenStore.clearWatch(mBeStatePath);
+
+	if (mOwnXenStore)
+	{
+		mXenStore.stop();
+	}
 
 	lock_guard<mutex> lock(mMutex);
 
@@ -112,7 +211,8 @@ void FrontendHandlerBase::stop()
  * Protected
  ******************************************************************************/
 
-void FrontendHandlerBase::addRingBuffer(RingBufferPtr ringBuffer)
+void FrontendHandlerBase::addRingBuffer(RingBufferPtr ringBuffer,
+										WorkerPoolPtr workerPool)
 {
 	LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
 					<< "Add ring buffer, ref: "
@@ -120,11 +220,147 @@ void FrontendHandlerBase::addRingBuffer(RingBufferPtr ringBuffer)
 					<< ringBuffer->getPort();
 
 	ringBuffer->setErrorCallback(bind(&FrontendHandlerBase::onError, this, _1));
+
+	if (workerPool)
+	{
+		ringBuffer->setWorkerPool(workerPool);
+	}
+
+	// attributes set to the ring buffer take precedence
+
+	if (ringBuffer->getThreadAttributes().empty())
+	{
+		ringBuffer->setThreadAttributes(mThreadAttributes);
+	}
+
 	ringBuffer->start();
 
+	lock_guard<mutex> lock(mRingMutex);
+
 	mRingBuffers.push_back(ringBuffer);
 }
 
+RingBufferPtr FrontendHandlerBase::takeRingBuffer(evtchn_port_t port,
+												 const vector<grant_ref_t>& refs)
+{
+	if (!isRingKept())
+	{
+		return nullptr;
+	}
+
+	lock_guard<mutex> lock(mRingMutex);
+
+	for (auto it = mKeptRingBuffers.begin(); it != mKeptRingBuffers.end(); it++)
+	{
+		auto ringBuffer = *it;
+
+		if (ringBuffer->getPort() != port || ringBuffer->getRefs() != refs)
+		{
+			continue;
+		}
+
+		mKeptRingBuffers.erase(it);
+
+		bool isReset = false;
+
+		try
+		{
+			isReset = ringBuffer->reset();
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << Utils::logDomId(mFeDomId, mDevId) << e.what();
+		}
+
+		if (!isReset)
+		{
+			LOG(mLog, WARNING) << Utils::logDomId(mFeDomId, mDevId)
+							   << "Can't reuse ring buffer, ref: "
+							   << ringBuffer->getRef() << ", port: " << port;
+
+			return nullptr;
+		}
+
+		LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
+						<< "Reuse ring buffer, ref: "
+						<< ringBuffer->getRef() << ", port: " << port;
+
+		return ringBuffer;
+	}
+
+	return nullptr;
+}
+
+void FrontendHandlerBase::setMaxRingPageOrder(unsigned int order)
+{
+	LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
+					 << "Set max ring page order: " << order;
+
+	mXenStore.writeUint(mXsBackendPath + "/max-ring-page-order", order);
+}
+
+vector<grant_ref_t> FrontendHandlerBase::readRingRefs(unsigned int maxOrder,
+													  const string& prefix)
+{
+	vector<grant_ref_t> refs;
+	unsigned int order = 0;
+
+	auto orderPath = mXsFrontendPath + "/ring-page-order";
+
+	// the common single page ring is read without a transaction: the
+	// frontend publishes its ring before switching to Initialised, so the
+	// absent order can't change under us and one ref is read atomically
+
+	if (!mXenStore.tryReadUint(orderPath, order))
+	{
+		refs.push_back(mXenStore.readUint(mXsFrontendPath + "/" + prefix));
+
+		LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
+						 << "Read ring refs, order: " << order;
+
+		return refs;
+	}
+
+	// read order and refs within one transaction to get consistent values
+
+	mXenStore.runTransaction([&](xs_transaction_t transaction) {
+		refs.clear();
+
+		if (!mXenStore.tryReadUint(orderPath, order, transaction))
+		{
+			order = 0;
+
+			refs.push_back(mXenStore.readUint(mXsFrontendPath + "/" + prefix,
+											  transaction));
+
+			return;
+		}
+
+		if (order > maxOrder)
+		{
+			throw FrontendHandlerException("Invalid ring page order: " +
+										   to_string(order), EINVAL);
+		}
+
+		vector<string> paths;
+
+		for (unsigned int i = 0; i < (1u << order); i++)
+		{
+			paths.push_back(mXsFrontendPath + "/" + prefix + to_string(i));
+		}
+
+		for (auto& value : mXenStore.readMany(paths, transaction))
+		{
+			refs.push_back(stoul(value));
+		}
+	});
+
+	LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
+					 << "Read ring refs, order: " << order;
+
+	return refs;
+}
+
 void FrontendHandlerBase::setBackendState(xenbus_state state)
 {
 	if (state == mBackendState)
@@ -160,7 +396,7 @@ void FrontendHandlerBase::onStateInitializing()
 		LOG(mLog, WARNING) << Utils::logDomId(mFeDomId, mDevId)
 						   << "Frontend restarted";
 
-		close(XenbusStateInitWait);
+		close(XenbusStateInitWait, mWarmReconnect);
 	}
 
 	if (mBackendState == XenbusStateInitialising ||
@@ -180,9 +416,7 @@ void FrontendHandlerBase::onStateInitialized()
 	if (mBackendState == XenbusStateInitialising ||
 		mBackendState == XenbusStateInitWait)
 	{
-		onBind();
-
-		setBackendState(XenbusStateConnected);
+		bindFrontend();
 	}
 }
 
@@ -191,9 +425,7 @@ void FrontendHandlerBase::onStateConnected()
 	if (mBackendState == XenbusStateInitialising ||
 		mBackendState == XenbusStateInitWait)
 	{
-		onBind();
-
-		setBackendState(XenbusStateConnected);
+		bindFrontend();
 	}
 }
 
@@ -253,9 +485,11 @@ void FrontendHandlerBase::init()
 {
 	initXenStorePathes();
 
-	if (mXenStore.checkIfExist(mBeStatePath))
+	int state;
+
+	if (mXenStore.tryReadInt(mBeStatePath, state))
 	{
-		mBackendState = static_cast<xenbus_state>(mXenStore.readInt(mBeStatePath));
+		mBackendState = static_cast<xenbus_state>(state);
 
 		if (mBackendState != XenbusStateClosed)
 		{
@@ -270,66 +504,182 @@ void FrontendHandlerBase::init()
 	mBackendState = XenbusStateUnknown;
 }
 
-void FrontendHandlerBase::release()
+void FrontendHandlerBase::release(bool keepRingBuffers)
 {
+	vector<RingBufferPtr> ringBuffers;
+
+	{
+		lock_guard<mutex> lock(mRingMutex);
+
+		ringBuffers.swap(mRingBuffers);
+	}
+
 	// stop is required to prevent calling processRequest during deletion
 
-	for(auto ringBuffer : mRingBuffers)
+	for(auto ringBuffer : ringBuffers)
 	{
 		ringBuffer->stop();
 	}
 
-	mRingBuffers.clear();
+	releaseKeptRingBuffers();
+
+	if (keepRingBuffers && !ringBuffers.empty())
+	{
+		// new generation lets the frontend confirm that it keeps the pages
+		// of this connection
+
+		try
+		{
+			mRingGeneration++;
+
+			mXenStore.writeUint(mXsBackendPath + "/ring-generation",
+								mRingGeneration);
+
+			lock_guard<mutex> lock(mRingMutex);
+
+			mKeptRingBuffers.swap(ringBuffers);
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mLog, ERROR) << Utils::logDomId(mFeDomId, mDevId) << e.what();
+		}
+	}
+
+	ringBuffers.clear();
+
+	mGnttabCache.clear();
+
+	if (mUnmapQueue)
+	{
+		mUnmapQueue->flush();
+	}
 }
 
-void FrontendHandlerBase::frontendStateChanged()
+void FrontendHandlerBase::releaseKeptRingBuffers()
 {
-	lock_guard<mutex> lock(mMutex);
+	vector<RingBufferPtr> ringBuffers;
 
-	if (!mXenStore.checkIfExist(mFeStatePath))
 	{
-		return;
+		lock_guard<mutex> lock(mRingMutex);
+
+		ringBuffers.swap(mKeptRingBuffers);
 	}
 
-	auto state = static_cast<xenbus_state>(mXenStore.readInt(mFeStatePath));
+	if (!ringBuffers.empty())
+	{
+		LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
+						 << "Release kept ring buffers: " << ringBuffers.size();
+	}
+}
 
-	if (state == mFrontendState)
+bool FrontendHandlerBase::isRingKept()
+{
 	{
-		return;
+		lock_guard<mutex> lock(mRingMutex);
+
+		if (mKeptRingBuffers.empty())
+		{
+			return false;
+		}
 	}
 
-	mFrontendState = state;
+	unsigned int generation = 0;
 
-	LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
-					<< "Frontend state changed to: "
-					<< Utils::logState(state);
+	if (!mXenStore.tryReadUint(mXsFrontendPath + "/ring-kept", generation) ||
+		generation != mRingGeneration)
+	{
+		LOG(mLog, DEBUG) << Utils::logDomId(mFeDomId, mDevId)
+						 << "Ring pages are not kept by the frontend";
 
-	onFrontendStateChanged(mFrontendState);
+		return false;
+	}
+
+	return true;
 }
 
-void FrontendHandlerBase::backendStateChanged()
+void FrontendHandlerBase::bindFrontend()
+{
+	onBind();
+
+	// kept ring buffers not taken by onBind() are not used anymore
+
+	releaseKeptRingBuffers();
+
+	setBackendState(XenbusStateConnected);
+}
+
+void FrontendHandlerBase::frontendStateChanged()
 {
 	lock_guard<mutex> lock(mMutex);
 
-	if (!mXenStore.checkIfExist(mBeStatePath))
+	// errors are handled here as the watch thread may be shared with
+	// other frontends
+
+	try
 	{
-		return;
-	}
+		int value;
 
-	auto state = static_cast<xenbus_state>(mXenStore.readInt(mBeStatePath));
+		if (!mXenStore.tryReadInt(mFeStatePath, value))
+		{
+			return;
+		}
 
-	if (state == mBackendState)
+		auto state = static_cast<xenbus_state>(value);
+
+		if (state == mFrontendState)
+		{
+			return;
+		}
+
+		mFrontendState = state;
+
+		LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
+						<< "Frontend state changed to: "
+						<< Utils::logState(state);
+
+		onFrontendStateChanged(mFrontendState);
+	}
+	catch(const std::exception& e)
 	{
-		return;
+		onError(e);
 	}
+}
 
-	mBackendState = state;
+void FrontendHandlerBase::backendStateChanged()
+{
+	lock_guard<mutex> lock(mMutex);
 
-	LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
-					<< "Backend state changed to: "
-					<< Utils::logState(state);
+	// errors are handled here as the watch thread may be shared with
+	// other frontends
+
+	try
+	{
+		int value;
+
+		if (!mXenStore.tryReadInt(mBeStatePath, value))
+		{
+			return;
+		}
+
+		auto state = static_cast<xenbus_state>(value);
 
-	onBackendStateChanged(mBackendState);
+		if (state == mBackendState)
+		{
+			return;
+		}
+
+		mBackendState = state;
+
+		LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
+						<< "Backend state changed to: "
+						<< Utils::logState(state);
+
+		onBackendStateChanged(mBackendState);
+	}
+	catch(const std::exception& e)
+	{
+		onError(e);
+	}
 }
 
 void FrontendHandlerBase::onFrontendStateChanged(xenbus_state state)
@@ -374,12 +724,13 @@ void FrontendHandlerBase::onError(const std::exception& e)
 	LOG(mLog, ERROR) << Utils::logDomId(mFeDomId, mDevId) << e.what();
 
 	mAsyncContext.call(bind(&FrontendHandlerBase::close, this,
-					   XenbusStateClosed));
+					   XenbusStateClosed, false));
 }
 
-void FrontendHandlerBase::close(xenbus_state stateAfterClose)
+void FrontendHandlerBase::close(xenbus_state stateAfterClose,
+								bool keepRingBuffers)
 {
-	LOG(mLog, INFO) << "Close";
+	LOG(mLog, INFO) << "Close" << (keepRingBuffers ? ", keep ring buffers" : "");
 
 	if (mBackendState != XenbusStateClosed)
 	{
@@ -388,11 +739,28 @@ void FrontendHandlerBase::close(xenbus_state stateAfterClose)
 
 	onClosing();
 
-	release();
+	release(keepRingBuffers);
 
 	setBackendState(XenbusStateClosed);
 
 	setBackendState(stateAfterClose);
 }
 
+void FrontendHandlerBase::dumpMetrics()
+{
+	auto metrics = getMetrics();
+
+	LOG(mLog, INFO) << Utils::logDomId(mFeDomId, mDevId)
+					<< "Metrics, requests: " << metrics.numRequests
+					<< ", responses: " << metrics.numResponses
+					<< ", events: " << metrics.numEvents
+					<< ", batches: " << metrics.numBatches
+					<< ", indications: " << metrics.numIndications
+					<< ", notifications: " << metrics.numNotifications
+					<< ", overflows: " << metrics.numOverflows
+					<< ", avg latency: " << metrics.latency.getAverage()
+					<< " us, p99 latency: "
+					<< metrics.latency.getPercentile(99) << " us";
+}
+
 }
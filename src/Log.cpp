@@ -0,0 +1,234 @@
+/*
+ *  Log sink
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Log.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * LogSink
+ ******************************************************************************/
+
+LogSink::LogSink() :
+	mAsync(false),
+	mTerminate(false),
+	mWriting(false),
+	mMaxLines(cDefaultMaxLines),
+	mNumDropped(0),
+	mNumReported(0)
+{
+	// create the output stream before the sink to destroy it after
+
+	Log::getOutputStream();
+}
+
+LogSink::~LogSink()
+{
+	stop();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+LogSink& LogSink::getInstance()
+{
+	static LogSink sInstance;
+
+	return sInstance;
+}
+
+void LogSink::setAsync(bool async, size_t maxLines)
+{
+	if (!async)
+	{
+		stop();
+
+		return;
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	mMaxLines = maxLines;
+
+	if (!mAsync)
+	{
+		mAsync = true;
+		mTerminate = false;
+
+		mThread = thread(&LogSink::run, this);
+	}
+}
+
+void LogSink::write(string&& line)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (!mAsync)
+	{
+		lock.unlock();
+
+		lock_guard<mutex> outputLock(mOutputMutex);
+
+		Log::getOutputStream() << line << std::endl;
+
+		return;
+	}
+
+	if (mLines.size() >= mMaxLines)
+	{
+		mNumDropped++;
+
+		return;
+	}
+
+	mLines.push_back(std::move(line));
+
+	if (mLines.size() == 1)
+	{
+		mCondVar.notify_all();
+	}
+}
+
+void LogSink::flush()
+{
+	{
+		unique_lock<mutex> lock(mMutex);
+
+		mCondVar.wait(lock, [this] { return mLines.empty() && !mWriting; });
+	}
+
+	lock_guard<mutex> lock(mOutputMutex);
+
+	Log::getOutputStream().flush();
+}
+
+void LogSink::setStreamBuffer(std::streambuf* streamBuffer)
+{
+	lock_guard<mutex> lock(mOutputMutex);
+
+	Log::getOutputStream().rdbuf(streamBuffer);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void LogSink::stop()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+
+	vector<string> lines;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		// lines could be queued while the writer was exiting
+
+		mAsync = false;
+
+		lines.swap(mLines);
+	}
+
+	if (!lines.empty())
+	{
+		writeLines(lines);
+	}
+}
+
+void LogSink::run()
+{
+	vector<string> lines;
+
+	unique_lock<mutex> lock(mMutex);
+
+	while(true)
+	{
+		mCondVar.wait(lock, [this] { return !mLines.empty() || mTerminate; });
+
+		if (mLines.empty())
+		{
+			break;
+		}
+
+		// take the whole queue at once, the loggers continue with the empty
+		// vector which keeps the capacity of the previous batch
+
+		lines.swap(mLines);
+
+		mWriting = true;
+
+		auto numDropped = mNumDropped - mNumReported;
+
+		mNumReported += numDropped;
+
+		lock.unlock();
+
+		if (numDropped)
+		{
+			lines.push_back(std::to_string(numDropped) +
+							" log lines dropped");
+		}
+
+		writeLines(lines);
+
+		lines.clear();
+
+		lock.lock();
+
+		mWriting = false;
+
+		mCondVar.notify_all();
+	}
+}
+
+void LogSink::writeLines(const vector<string>& lines)
+{
+	lock_guard<mutex> lock(mOutputMutex);
+
+	auto& output = Log::getOutputStream();
+
+	for(const auto& line : lines)
+	{
+		output << line << '\n';
+	}
+
+	output.flush();
+}
+
+}
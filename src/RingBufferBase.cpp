@@ -23,6 +23,7 @@
 #include "Log.hpp"
 
 using std::bind;
+using std::vector;
 
 namespace XenBackend {
 
@@ -32,14 +33,46 @@ namespace XenBackend {
 
 RingBufferBase::RingBufferBase(domid_t domId, evtchn_port_t port,
 							   grant_ref_t ref) :
-	mEventChannel(domId, port, [this] { onReceiveIndication(); }),
-	mBuffer(domId, ref, PROT_READ | PROT_WRITE),
+	RingBufferBase(domId, port, vector<grant_ref_t>{ref})
+{
+}
+
+RingBufferBase::RingBufferBase(domid_t domId, evtchn_port_t port,
+							   const vector<grant_ref_t>& refs) :
+	mEventChannel(domId, port, [this] { onIndication(); }),
+	mBuffer(domId, refs.data(), refs.size(), PROT_READ | PROT_WRITE),
 	mLog("RingBuffer"),
 	mPort(port),
-	mRef(ref)
+	mRefs(refs),
+	mIndicationPending(false),
+	mStarted(false),
+	mNumRuns(0)
 {
 	LOG(mLog, DEBUG) << "Create ring buffer, port: " << mPort
-					 << ", ref: " << mRef;
+					 << ", ref: " << getRef() << ", num refs: " << mRefs.size();
+}
+
+RingBufferBase::RingBufferBase(XenEvtchnLoopPtr loop, domid_t domId,
+							   evtchn_port_t port, grant_ref_t ref) :
+	RingBufferBase(loop, domId, port, vector<grant_ref_t>{ref})
+{
+}
+
+RingBufferBase::RingBufferBase(XenEvtchnLoopPtr loop, domid_t domId,
+							   evtchn_port_t port,
+							   const vector<grant_ref_t>& refs) :
+	mEventChannel(loop, domId, port, [this] { onIndication(); }),
+	mBuffer(domId, refs.data(), refs.size(), PROT_READ | PROT_WRITE),
+	mLog("RingBuffer"),
+	mPort(port),
+	mRefs(refs),
+	mIndicationPending(false),
+	mStarted(false),
+	mNumRuns(0)
+{
+	LOG(mLog, DEBUG) << "Create ring buffer, port: " << mPort
+					 << ", ref: " << getRef() << ", num refs: " << mRefs.size()
+					 << ", shared loop";
 }
 
 RingBufferBase::~RingBufferBase()
@@ -47,7 +80,7 @@ RingBufferBase::~RingBufferBase()
 	stop();
 
 	LOG(mLog, DEBUG) << "Delete ring buffer, port: " << mPort
-					 << ", ref: " << mRef;
+					 << ", ref: " << getRef();
 }
 
 /*******************************************************************************
@@ -57,16 +90,178 @@ RingBufferBase::~RingBufferBase()
 void RingBufferBase::start()
 {
 	mEventChannel.start();
+
+	mStarted = true;
 }
 
 void RingBufferBase::stop()
 {
+	mStarted = false;
+
 	mEventChannel.stop();
+
+	if (mQueue)
+	{
+		mQueue->wait();
+	}
+}
+
+bool RingBufferBase::reset()
+{
+	if (mStarted)
+	{
+		throw RingBufferException("Can't reset started ring buffer", EPERM);
+	}
+
+	LOG(mLog, DEBUG) << "Reset ring buffer, port: " << mPort
+					 << ", ref: " << getRef();
+
+	if (!onReset())
+	{
+		return false;
+	}
+
+	mEventChannel.rebind();
+
+	return true;
 }
 
 void RingBufferBase::setErrorCallback(ErrorCallback errorCallback)
 {
+	mErrorCallback = errorCallback;
+
 	mEventChannel.setErrorCallback(errorCallback);
 }
 
+void RingBufferBase::setWorkerPool(WorkerPoolPtr workerPool)
+{
+	mWorkerPool = workerPool;
+
+	if (mWorkerPool)
+	{
+		mQueue = mWorkerPool->createQueue();
+	}
+	else
+	{
+		mQueue.reset();
+	}
+}
+
+RingMetrics RingBufferBase::getMetrics() const
+{
+	RingMetrics metrics = {};
+
+	auto evtchnMetrics = mEventChannel.getMetrics();
+
+	metrics.numIndications = evtchnMetrics.numReceived;
+	metrics.numNotifications = evtchnMetrics.numSent;
+
+	return metrics;
+}
+
+/*******************************************************************************
+ * Protected
+ ******************************************************************************/
+
+void RingBufferBase::resumeIndication()
+{
+	if (!mStarted)
+	{
+		return;
+	}
+
+	if (mQueue)
+	{
+		onIndication();
+
+		return;
+	}
+
+	try
+	{
+		runIndication();
+	}
+	catch(const std::exception& e)
+	{
+		onProcessError(e);
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void RingBufferBase::onIndication()
+{
+	if (!mQueue)
+	{
+		runIndication();
+
+		return;
+	}
+
+	// onReceiveIndication() drains the ring, thus there is no need to queue
+	// next indication until the previous one is started
+
+	if (!mIndicationPending.exchange(true))
+	{
+		mQueue->post([this] { processIndication(); });
+	}
+}
+
+void RingBufferBase::runIndication()
+{
+	// only one thread processes the ring, others let it repeat the processing
+
+	if (mNumRuns++ != 0)
+	{
+		return;
+	}
+
+	try
+	{
+		do
+		{
+			mNumRuns = 1;
+
+			onReceiveIndication();
+		}
+		while (--mNumRuns != 0);
+	}
+	catch(...)
+	{
+		mNumRuns = 0;
+
+		throw;
+	}
+}
+
+void RingBufferBase::processIndication()
+{
+	mIndicationPending = false;
+
+	try
+	{
+		onReceiveIndication();
+	}
+	catch(const std::exception& e)
+	{
+		onProcessError(e);
+	}
+}
+
+void RingBufferBase::onProcessError(const std::exception& e)
+{
+	mEventChannel.stop();
+
+	if (mErrorCallback)
+	{
+		mErrorCallback(e);
+	}
+	else
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+}
+
 }
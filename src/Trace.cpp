@@ -0,0 +1,97 @@
+/*
+ *  Request tracing
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "Trace.hpp"
+
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * TraceBuffer
+ ******************************************************************************/
+
+const size_t TraceBuffer::cNumEntries;
+
+TraceBuffer::TraceBuffer() :
+	mFirst(0),
+	mNext(0),
+	mEntries(cNumEntries)
+{
+	for (auto& slot : mEntries)
+	{
+		slot.sequence = 0;
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+TraceBuffer& TraceBuffer::getInstance()
+{
+	static TraceBuffer sInstance;
+
+	return sInstance;
+}
+
+void TraceBuffer::getEntries(vector<TraceEntry>& entries) const
+{
+	entries.clear();
+
+	auto next = mNext.load(std::memory_order_acquire);
+	auto first = mFirst.load(std::memory_order_relaxed);
+
+	if (next - first > cNumEntries)
+	{
+		first = next - cNumEntries;
+	}
+
+	entries.reserve(next - first);
+
+	for (auto index = first; index < next; index++)
+	{
+		auto& slot = mEntries[index & (cNumEntries - 1)];
+
+		if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+		{
+			continue;
+		}
+
+		auto entry = slot.entry;
+
+		// skip the entry if it was overwritten while copying
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (slot.sequence.load(std::memory_order_relaxed) == index + 1)
+		{
+			entries.push_back(entry);
+		}
+	}
+}
+
+void TraceBuffer::clear()
+{
+	mFirst.store(mNext.load(std::memory_order_acquire),
+				 std::memory_order_relaxed);
+}
+
+}
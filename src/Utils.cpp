@@ -20,17 +20,31 @@
 
 #include "Utils.hpp"
 
+#include <algorithm>
 #include <cstring>
+#include <fstream>
+#include <sstream>
 #include <vector>
 
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
 #include "Exception.hpp"
+#include "Log.hpp"
 #include "Version.hpp"
 
+using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 using std::cv_status;
 using std::function;
+using std::getline;
+using std::ifstream;
+using std::istringstream;
 using std::lock_guard;
+using std::make_pair;
 using std::mutex;
+using std::pair;
 using std::string;
 using std::thread;
 using std::to_string;
@@ -71,15 +85,201 @@ string Utils::getVersion()
 	return VERSION;
 }
 
+/*******************************************************************************
+ * ThreadAttributes
+ ******************************************************************************/
+
+namespace {
+
+void setThreadName(pthread_t handle, const string& name)
+{
+	// thread names are limited to 16 bytes including terminating null
+
+	auto ret = pthread_setname_np(handle, name.substr(0, 15).c_str());
+
+	if (ret != 0)
+	{
+		throw Exception("Can't set thread name: " + name, ret);
+	}
+}
+
+void setThreadCpus(pthread_t handle, const vector<int>& cpus)
+{
+	cpu_set_t cpuSet;
+
+	CPU_ZERO(&cpuSet);
+
+	for (auto cpu : cpus)
+	{
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+		{
+			throw Exception("Invalid thread CPU: " + to_string(cpu), EINVAL);
+		}
+
+		CPU_SET(cpu, &cpuSet);
+	}
+
+	auto ret = pthread_setaffinity_np(handle, sizeof(cpuSet), &cpuSet);
+
+	if (ret != 0)
+	{
+		throw Exception("Can't set thread affinity", ret);
+	}
+}
+
+void setThreadScheduling(pthread_t handle, int policy, int priority)
+{
+	sched_param param = {};
+
+	param.sched_priority = priority;
+
+	auto ret = pthread_setschedparam(handle, policy, &param);
+
+	if (ret != 0)
+	{
+		throw Exception("Can't set thread scheduling, policy: " +
+						to_string(policy) + ", priority: " +
+						to_string(priority), ret);
+	}
+}
+
+}
+
+void ThreadAttributes::apply(thread& thread) const
+{
+	auto handle = thread.native_handle();
+
+	if (!name.empty())
+	{
+		setThreadName(handle, name);
+	}
+
+	if (!cpus.empty())
+	{
+		setThreadCpus(handle, cpus);
+	}
+
+	if (policy >= 0)
+	{
+		setThreadScheduling(handle, policy, priority);
+	}
+}
+
+bool ThreadAttributes::tryApply(thread& thread) const noexcept
+{
+	auto handle = thread.native_handle();
+	vector<function<void()>> setters;
+
+	if (!name.empty())
+	{
+		setters.push_back([&] { setThreadName(handle, name); });
+	}
+
+	if (!cpus.empty())
+	{
+		setters.push_back([&] { setThreadCpus(handle, cpus); });
+	}
+
+	if (policy >= 0)
+	{
+		setters.push_back([&] {
+			setThreadScheduling(handle, policy, priority); });
+	}
+
+	bool result = true;
+
+	for (auto& setter : setters)
+	{
+		try
+		{
+			setter();
+		}
+		catch(const std::exception& e)
+		{
+			Log log("ThreadAttributes");
+
+			LOG(log, WARNING) << e.what();
+
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+vector<int> ThreadAttributes::getNodeCpus(int node)
+{
+	auto path = "/sys/devices/system/node/node" + to_string(node) +
+				"/cpulist";
+
+	ifstream file(path);
+	string cpuList;
+
+	if (!file || !getline(file, cpuList))
+	{
+		throw Exception("Can't read NUMA node CPUs: " + path, ENOENT);
+	}
+
+	// the list has format: 0-3,8,10-11
+
+	vector<int> cpus;
+	istringstream stream(cpuList);
+	string range;
+
+	while (getline(stream, range, ','))
+	{
+		if (range.empty())
+		{
+			continue;
+		}
+
+		auto dash = range.find('-');
+
+		int first = stoi(range.substr(0, dash));
+		int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+
+		for (auto cpu = first; cpu <= last; cpu++)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+
+	return cpus;
+}
+
 /*******************************************************************************
  * PollFd
  ******************************************************************************/
 
-PollFd::PollFd(int fd, short int events)
+PollFd::PollFd() :
+	mEpollFd(-1),
+	mEventFd(-1),
+	mFd(-1),
+	mDispatching(false)
 {
 	try
 	{
-		init(fd, events);
+		init();
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+PollFd::PollFd(int fd, short int events) :
+	mEpollFd(-1),
+	mEventFd(-1),
+	mFd(fd),
+	mDispatching(false)
+{
+	try
+	{
+		init();
+
+		ctlFd(EPOLL_CTL_ADD, fd, events);
 	}
 	catch(const std::exception& e)
 	{
@@ -94,89 +294,206 @@ PollFd::~PollFd()
 	release();
 }
 
+void PollFd::addFd(int fd, short int events, Callback callback)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	ctlFd(EPOLL_CTL_ADD, fd, events);
+
+	mCallbacks[fd] = callback;
+}
+
+void PollFd::removeFd(int fd)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (mCallbacks.erase(fd))
+	{
+		epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+
+	// the callback of the removed descriptor may be running in poll()
+
+	if (mDispatchThread != std::this_thread::get_id())
+	{
+		mCondVar.wait(lock, [this] { return !mDispatching; });
+	}
+}
+
 bool PollFd::poll()
 {
-	mFds[PollIndex::FILE].revents = 0;
-	mFds[PollIndex::PIPE].revents = 0;
+	return poll(-1);
+}
+
+bool PollFd::poll(int timeout)
+{
+	epoll_event events[cMaxEvents];
 
-	if (::poll(mFds, 2, -1) < 0)
+	auto num = epoll_wait(mEpollFd, events, cMaxEvents, timeout);
+
+	if (num < 0)
 	{
 		if (errno != EINTR)
 		{
 			throw Exception("Error polling files", errno);
 		}
+
+		num = 0;
 	}
 
-	if (mFds[PollIndex::PIPE].revents & POLLIN)
+	vector<pair<Callback, epoll_event>> callbacks;
+
+	for (int i = 0; i < num; i++)
 	{
-		uint8_t data;
+		auto fd = events[i].data.fd;
 
-		if (read(mFds[PollIndex::PIPE].fd, &data, sizeof(data)) < 0)
+		if (fd == mEventFd)
 		{
-			throw Exception("Error reading pipe", errno);
-		}
+			eventfd_t data;
 
-		return false;
-	}
+			if (eventfd_read(mEventFd, &data) < 0)
+			{
+				throw Exception("Error reading eventfd", errno);
+			}
 
-	if (mFds[PollIndex::FILE].revents & (~mFds[PollIndex::FILE].events))
-	{
-		if (mFds[PollIndex::FILE].revents & POLLERR)
+			return false;
+		}
+
+		if (fd == mFd)
 		{
-			throw Exception("Poll error condition", EPERM);
+			if (events[i].events & EPOLLERR)
+			{
+				throw Exception("Poll error condition", EPERM);
+			}
+
+			if (events[i].events & EPOLLHUP)
+			{
+				throw Exception("Poll hang up", EPERM);
+			}
+
+			continue;
 		}
 
-		if (mFds[PollIndex::FILE].revents & POLLHUP)
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mCallbacks.find(fd);
+
+		if (it != mCallbacks.end() && it->second)
 		{
-			throw Exception("Poll hang up", EPERM);
+			callbacks.push_back(make_pair(it->second, events[i]));
 		}
+	}
+
+	if (callbacks.empty())
+	{
+		return true;
+	}
+
+	// callbacks are called without lock to allow them changing the poll set,
+	// removeFd() from other threads waits for the dispatch end
+
+	unique_lock<mutex> lock(mMutex);
 
-		if (mFds[PollIndex::FILE].revents & POLLNVAL)
+	mDispatching = true;
+	mDispatchThread = std::this_thread::get_id();
+
+	try
+	{
+		for (auto& callback : callbacks)
 		{
-			throw Exception("Poll invalid request", EINVAL);
+			auto fd = callback.second.data.fd;
+
+			// a callback may remove the descriptor of the next one
+
+			if (!mCallbacks.count(fd))
+			{
+				continue;
+			}
+
+			lock.unlock();
+
+			callback.first(fd, static_cast<short int>(callback.second.events));
+
+			lock.lock();
 		}
 	}
+	catch(...)
+	{
+		if (!lock)
+		{
+			lock.lock();
+		}
+
+		endDispatch();
+
+		throw;
+	}
+
+	endDispatch();
 
 	return true;
 }
 
 void PollFd::stop()
 {
-	uint8_t data = 0xFF;
-
-	if (write(mPipeFds[PipeType::WRITE], &data, sizeof(data)) < 0)
+	if (eventfd_write(mEventFd, 1) < 0)
 	{
-		throw Exception("Error writing pipe", errno);
+		throw Exception("Error writing eventfd", errno);
 	}
 }
 
-void PollFd::init(int fd, short int events)
+void PollFd::endDispatch()
 {
-	mPipeFds[PipeType::READ] = -1;
-	mPipeFds[PipeType::WRITE] = -1;
+	mDispatching = false;
+	mDispatchThread = thread::id();
 
-	if (pipe(mPipeFds) < 0)
+	mCondVar.notify_all();
+}
+
+void PollFd::init()
+{
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (mEpollFd < 0)
 	{
-		throw Exception("Can't create pipe", errno);
+		throw Exception("Can't create epoll", errno);
 	}
 
-	mFds[PollIndex::FILE].fd = fd;
-	mFds[PollIndex::FILE].events = events;
+	mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 
-	mFds[PollIndex::PIPE].fd = mPipeFds[PipeType::READ];
-	mFds[PollIndex::PIPE].events = POLLIN;
+	if (mEventFd < 0)
+	{
+		throw Exception("Can't create eventfd", errno);
+	}
+
+	ctlFd(EPOLL_CTL_ADD, mEventFd, POLLIN);
 }
 
 void PollFd::release()
 {
-	if (mPipeFds[PipeType::READ] >= 0)
+	if (mEventFd >= 0)
+	{
+		close(mEventFd);
+	}
+
+	if (mEpollFd >= 0)
 	{
-		close(mPipeFds[PipeType::READ]);
+		close(mEpollFd);
 	}
+}
+
+void PollFd::ctlFd(int op, int fd, short int events)
+{
+	epoll_event event = {};
 
-	if (mPipeFds[PipeType::WRITE] >= 0)
+	// poll and epoll event flags have the same values
+
+	event.events = static_cast<uint16_t>(events);
+	event.data.fd = fd;
+
+	if (epoll_ctl(mEpollFd, op, fd, &event) < 0)
 	{
-		close(mPipeFds[PipeType::WRITE]);
+		throw Exception("Can't add fd to epoll", errno);
 	}
 }
 
@@ -187,7 +504,6 @@ void PollFd::release()
 AsyncContext::AsyncContext() :
 	mTerminate(false)
 {
-	mThread = thread(&AsyncContext::run, this);
 }
 
 AsyncContext::~AsyncContext()
@@ -195,6 +511,20 @@ AsyncContext::~AsyncContext()
 	stop();
 }
 
+void AsyncContext::setWorkerPool(WorkerPoolPtr workerPool)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mQueue = workerPool ? workerPool->createQueue() : nullptr;
+}
+
+void AsyncContext::setThreadAttributes(const ThreadAttributes& threadAttributes)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mThreadAttributes = threadAttributes;
+}
+
 void AsyncContext::stop()
 {
 	{
@@ -209,14 +539,42 @@ void AsyncContext::stop()
 	{
 		mThread.join();
 	}
+
+	if (mQueue)
+	{
+		mQueue->wait();
+	}
 }
 
 void AsyncContext::call(AsyncCall f)
 {
 	unique_lock<mutex> lock(mMutex);
 
+	if (mQueue)
+	{
+		// posted under the lock, otherwise stop() may finish waiting for
+		// the queue between the check and the post. The task is never run
+		// inline by post(), so it doesn't take the lock from here
+
+		if (!mTerminate)
+		{
+			mQueue->post(f);
+		}
+
+		return;
+	}
+
 	mAsyncCalls.push_back(f);
 
+	// the thread is created on demand, so idle context costs no thread
+
+	if (!mThread.joinable() && !mTerminate)
+	{
+		mThread = thread(&AsyncContext::run, this);
+
+		mThreadAttributes.tryApply(mThread);
+	}
+
 	mCondVar.notify_all();
 }
 
@@ -246,74 +604,301 @@ void AsyncContext::run()
 }
 
 /*******************************************************************************
- * Timer
+ * TimerService
  ******************************************************************************/
 
-Timer::Timer(function<void()> callback, bool periodic) :
-	mCallback(callback),
-	mPeriodic(periodic),
-	mTerminate(true)
+TimerService::TimerService() :
+	mStartTime(Clock::now()),
+	mCurrentTick(0),
+	mNumTimers(0),
+	mTerminate(false),
+	mRunningTimer(nullptr),
+	mSlots(cNumSlots),
+	mUsedSlots(cNumSlots / cSlotsPerWord, 0)
 {
+	mThread = thread(&TimerService::run, this);
 }
 
-Timer::~Timer()
+TimerService::~TimerService()
 {
-	stop();
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
 }
 
-void Timer::start(milliseconds time)
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+TimerService& TimerService::getInstance()
+{
+	static TimerService sInstance;
+
+	return sInstance;
+}
+
+void TimerService::setThreadAttributes(const ThreadAttributes& threadAttributes)
 {
-	lock_guard<mutex> lock(mItfMutex);
+	lock_guard<mutex> lock(mMutex);
 
-	if (mTerminate)
+	threadAttributes.apply(mThread);
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+uint64_t TimerService::getTick(Clock::time_point time) const
+{
+	return duration_cast<milliseconds>(time - mStartTime).count();
+}
+
+uint64_t TimerService::getNextTick() const
+{
+	// find first used slot after the current tick using the bitmap
+
+	auto first = (mCurrentTick + 1) % cNumSlots;
+
+	for (size_t distance = 0; distance < cNumSlots;)
 	{
-		mTime = time;
+		auto slot = (first + distance) % cNumSlots;
+		auto shift = slot % cSlotsPerWord;
+		auto bits = mUsedSlots[slot / cSlotsPerWord] >> shift;
 
-		mTerminate = false;
+		if (bits)
+		{
+			distance += __builtin_ctzll(bits);
 
-		mThread = thread(&Timer::run, this);
+			if (distance < cNumSlots)
+			{
+				return mCurrentTick + 1 + distance;
+			}
+
+			break;
+		}
+
+		distance += cSlotsPerWord - shift;
+	}
+
+	return mCurrentTick + cNumSlots;
+}
+
+void TimerService::add(Timer* timer, uint64_t expiry)
+{
+	auto slot = expiry % cNumSlots;
+
+	timer->mExpiry = expiry;
+	timer->mList = &mSlots[slot];
+	timer->mPosition = mSlots[slot].insert(mSlots[slot].end(), timer);
+
+	mUsedSlots[slot / cSlotsPerWord] |= 1ull << (slot % cSlotsPerWord);
+
+	mNumTimers++;
+
+	mCondVar.notify_all();
+}
+
+void TimerService::remove(Timer* timer)
+{
+	if (!timer->mList)
+	{
+		return;
+	}
+
+	if (timer->mList != &mDueTimers)
+	{
+		auto slot = timer->mExpiry % cNumSlots;
+
+		timer->mList->erase(timer->mPosition);
+
+		if (timer->mList->empty())
+		{
+			mUsedSlots[slot / cSlotsPerWord] &= ~(1ull << (slot % cSlotsPerWord));
+		}
 	}
 	else
 	{
-		throw Exception("Timer is already started", EPERM);
+		timer->mList->erase(timer->mPosition);
 	}
+
+	timer->mList = nullptr;
+
+	mNumTimers--;
 }
 
-void Timer::stop()
+void TimerService::processSlot(size_t slot, uint64_t tick)
 {
-	lock_guard<mutex> lock(mItfMutex);
+	auto& timers = mSlots[slot];
 
-	if (mPeriodic)
+	for (auto it = timers.begin(); it != timers.end();)
 	{
-		unique_lock<mutex> lock(mMutex);
+		auto timer = *it++;
 
-		mTerminate = true;
+		// timers of next wheel rounds are kept in the slot
 
-		mCondVar.notify_all();
+		if (timer->mExpiry <= tick)
+		{
+			mDueTimers.splice(mDueTimers.end(), timers, timer->mPosition);
+
+			timer->mList = &mDueTimers;
+		}
 	}
 
-	if (mThread.joinable())
+	if (timers.empty())
 	{
-		mThread.join();
+		mUsedSlots[slot / cSlotsPerWord] &= ~(1ull << (slot % cSlotsPerWord));
 	}
 }
 
-void Timer::run()
+void TimerService::fireDueTimers(unique_lock<mutex>& lock)
+{
+	while(!mDueTimers.empty())
+	{
+		auto timer = mDueTimers.front();
+
+		remove(timer);
+
+		timer->mStarted = timer->mPeriodic;
+
+		mRunningTimer = timer;
+
+		lock.unlock();
+
+		if (timer->mCallback)
+		{
+			timer->mCallback();
+		}
+
+		lock.lock();
+
+		mRunningTimer = nullptr;
+
+		// periodic timer is restarted if it is not stopped by the callback
+
+		if (timer->mPeriodic && timer->mStarted && !timer->mList)
+		{
+			auto expiry = timer->mExpiry +
+						  std::max<uint64_t>(timer->mTime.count(), 1);
+
+			add(timer, std::max(expiry, mCurrentTick + 1));
+		}
+
+		mDoneCondVar.notify_all();
+	}
+}
+
+void TimerService::run()
 {
 	unique_lock<mutex> lock(mMutex);
 
-	do
+	mCurrentTick = getTick(Clock::now());
+
+	while(!mTerminate)
 	{
-		if (!mCondVar.wait_for(lock, mTime, [this]
-							   { return static_cast<bool>(mTerminate); }))
+		if (mNumTimers == 0)
+		{
+			mCondVar.wait(lock, [this] { return mTerminate || mNumTimers; });
+
+			continue;
+		}
+
+		auto nextTick = getNextTick();
+
+		if (mCondVar.wait_until(lock, mStartTime + milliseconds(nextTick)) !=
+			cv_status::timeout)
+		{
+			// new timer may be earlier, recalculate
+
+			continue;
+		}
+
+		auto tick = getTick(Clock::now());
+
+		if (tick - mCurrentTick >= cNumSlots)
+		{
+			for (size_t slot = 0; slot < cNumSlots; slot++)
+			{
+				processSlot(slot, tick);
+			}
+		}
+		else
 		{
-			if (mCallback)
+			for (auto t = mCurrentTick + 1; t <= tick; t++)
 			{
-				mCallback();
+				processSlot(t % cNumSlots, tick);
 			}
 		}
+
+		mCurrentTick = tick;
+
+		fireDueTimers(lock);
+	}
+}
+
+/*******************************************************************************
+ * Timer
+ ******************************************************************************/
+
+Timer::Timer(function<void()> callback, bool periodic) :
+	mCallback(callback),
+	mPeriodic(periodic),
+	mStarted(false),
+	mExpiry(0),
+	mList(nullptr)
+{
+}
+
+Timer::~Timer()
+{
+	stop();
+}
+
+void Timer::start(milliseconds time)
+{
+	auto& service = TimerService::getInstance();
+
+	lock_guard<mutex> lock(service.mMutex);
+
+	if (mStarted)
+	{
+		throw Exception("Timer is already started", EPERM);
+	}
+
+	mTime = time;
+	mStarted = true;
+
+	auto expiry = service.getTick(TimerService::Clock::now()) +
+				  std::max<uint64_t>(time.count(), 1);
+
+	service.add(this, std::max(expiry, service.mCurrentTick + 1));
+}
+
+void Timer::stop()
+{
+	auto& service = TimerService::getInstance();
+
+	unique_lock<mutex> lock(service.mMutex);
+
+	mStarted = false;
+
+	service.remove(this);
+
+	// wait for the callback if it is running in the service thread
+
+	if (std::this_thread::get_id() != service.mThread.get_id())
+	{
+		service.mDoneCondVar.wait(lock, [this, &service]
+								  { return service.mRunningTimer != this; });
 	}
-	while(!mTerminate && mPeriodic);
 }
 
 }
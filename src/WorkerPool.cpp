@@ -0,0 +1,350 @@
+/*
+ *  Worker pool
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "WorkerPool.hpp"
+
+#include <pthread.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::unique_ptr;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * WorkerQueue
+ ******************************************************************************/
+
+WorkerQueue::WorkerQueue(WorkerPool& pool, size_t worker) :
+	mPool(pool),
+	mWorker(worker),
+	mScheduled(false)
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void WorkerQueue::post(Task task)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	// list iterators stay valid, so exactly this task is removed on failure
+	// even if other producers appended tasks meanwhile
+
+	auto it = mTasks.insert(mTasks.end(), task);
+
+	if (!mScheduled)
+	{
+		mScheduled = true;
+
+		lock.unlock();
+
+		try
+		{
+			mPool.schedule(shared_from_this());
+		}
+		catch(const std::exception&)
+		{
+			lock.lock();
+
+			mTasks.erase(it);
+			mScheduled = false;
+
+			throw;
+		}
+	}
+}
+
+void WorkerQueue::wait()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	if (mRunningThread == std::this_thread::get_id())
+	{
+		return;
+	}
+
+	mCondVar.wait(lock, [this] { return !mScheduled; });
+}
+
+bool WorkerQueue::isEmpty()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mTasks.empty();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void WorkerQueue::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mRunningThread = std::this_thread::get_id();
+
+	// execute only tasks posted before the run to let other queues go
+
+	auto numTasks = mTasks.size();
+
+	while(numTasks-- && !mTasks.empty())
+	{
+		auto task = mTasks.front();
+
+		mTasks.pop_front();
+
+		lock.unlock();
+
+		try
+		{
+			task();
+		}
+		catch(const std::exception& e)
+		{
+			LOG(mPool.mLog, ERROR) << e.what();
+		}
+
+		lock.lock();
+	}
+
+	mRunningThread = thread::id();
+
+	if (mTasks.empty())
+	{
+		mScheduled = false;
+
+		mCondVar.notify_all();
+	}
+	else
+	{
+		lock.unlock();
+
+		mPool.schedule(shared_from_this());
+	}
+}
+
+/*******************************************************************************
+ * WorkerPool
+ ******************************************************************************/
+
+WorkerPool::WorkerPool(size_t numWorkers, bool pinWorkers) :
+	mNextWorker(0),
+	mNumScheduled(0),
+	mNumActive(0),
+	mTerminate(false),
+	mLog("WorkerPool")
+{
+	try
+	{
+		init(numWorkers, pinWorkers);
+	}
+	catch(const std::exception& e)
+	{
+		stop();
+
+		throw;
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+WorkerQueuePtr WorkerPool::createQueue()
+{
+	auto worker = mNextWorker++ % mWorkers.size();
+
+	return WorkerQueuePtr(new WorkerQueue(*this, worker));
+}
+
+void WorkerPool::stop()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	for (auto& worker : mWorkers)
+	{
+		if (worker->thread.joinable())
+		{
+			worker->thread.join();
+		}
+	}
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void WorkerPool::init(size_t numWorkers, bool pinWorkers)
+{
+	auto numCpus = thread::hardware_concurrency();
+
+	if (numCpus == 0)
+	{
+		numCpus = 1;
+	}
+
+	if (numWorkers == 0)
+	{
+		numWorkers = numCpus;
+	}
+
+	for (size_t i = 0; i < numWorkers; i++)
+	{
+		mWorkers.push_back(unique_ptr<Worker>(new Worker()));
+	}
+
+	for (size_t i = 0; i < numWorkers; i++)
+	{
+		mWorkers[i]->thread = thread(&WorkerPool::run, this, i);
+
+		if (pinWorkers)
+		{
+			cpu_set_t cpuSet;
+
+			CPU_ZERO(&cpuSet);
+			CPU_SET(i % numCpus, &cpuSet);
+
+			auto ret = pthread_setaffinity_np(
+					mWorkers[i]->thread.native_handle(),
+					sizeof(cpuSet), &cpuSet);
+
+			if (ret != 0)
+			{
+				throw Exception("Can't set worker affinity", ret);
+			}
+		}
+	}
+
+	LOG(mLog, DEBUG) << "Create worker pool, workers: " << numWorkers;
+}
+
+void WorkerPool::schedule(WorkerQueuePtr queue)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		// workers exit when the pool is terminated and there are no active
+		// queues, so nothing can be scheduled after that
+
+		if (mTerminate && mNumActive == 0)
+		{
+			throw Exception("Worker pool is stopped", EPERM);
+		}
+
+		auto& worker = mWorkers[queue->mWorker];
+
+		lock_guard<mutex> workerLock(worker->mutex);
+
+		worker->queues.push_back(queue);
+
+		mNumScheduled++;
+		mNumActive++;
+	}
+
+	mCondVar.notify_one();
+}
+
+WorkerQueuePtr WorkerPool::getQueue(size_t worker)
+{
+	WorkerQueuePtr queue;
+
+	// own queues are taken from the front, others from the back
+
+	for (size_t i = 0; i < mWorkers.size() && !queue; i++)
+	{
+		auto& current = mWorkers[(worker + i) % mWorkers.size()];
+
+		lock_guard<mutex> lock(current->mutex);
+
+		if (!current->queues.empty())
+		{
+			if (i == 0)
+			{
+				queue = current->queues.front();
+				current->queues.pop_front();
+			}
+			else
+			{
+				queue = current->queues.back();
+				current->queues.pop_back();
+			}
+		}
+	}
+
+	return queue;
+}
+
+void WorkerPool::run(size_t worker)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	while(true)
+	{
+		mCondVar.wait(lock, [this] {
+			return mNumScheduled || (mTerminate && mNumActive == 0); });
+
+		if (mNumScheduled == 0)
+		{
+			break;
+		}
+
+		lock.unlock();
+
+		auto queue = getQueue(worker);
+
+		lock.lock();
+
+		if (!queue)
+		{
+			continue;
+		}
+
+		mNumScheduled--;
+
+		lock.unlock();
+
+		queue->run();
+
+		lock.lock();
+
+		if (--mNumActive == 0 && mTerminate)
+		{
+			mCondVar.notify_all();
+		}
+	}
+}
+
+}
@@ -54,34 +54,37 @@ XenInterface::~XenInterface()
 
 void XenInterface::getDomainsInfo(vector<xc_domaininfo_t>& infos)
 {
-	vector<xc_domaininfo_t> domainInfo(cDomInfoChunkSize);
-
 	int newDomains = cDomInfoChunkSize;
 	int startDomain = 0;
+	size_t numDomains = 0;
 
-	infos.clear();
+	// chunks are read directly into the output vector: the caller may keep
+	// the vector between calls to avoid reallocation on each poll
 
 	while(newDomains == cDomInfoChunkSize)
 	{
+		infos.resize(numDomains + cDomInfoChunkSize);
+
 		newDomains = xc_domain_getinfolist(mHandle, startDomain,
 										   cDomInfoChunkSize,
-										   domainInfo.data());
+										   &infos[numDomains]);
 
 		if (newDomains < 0)
 		{
+			infos.clear();
+
 			throw XenCtrlException("Can't get domain info", errno);
 		}
 
-		if (newDomains)
-		{
-			startDomain = domainInfo[newDomains - 1].domain + 1;
-		}
+		numDomains += newDomains;
 
-		for(auto i = 0; i < newDomains; i++)
+		if (newDomains)
 		{
-			infos.push_back(domainInfo[i]);
+			startDomain = infos[numDomains - 1].domain + 1;
 		}
 	}
+
+	infos.resize(numDomains);
 }
 
 /*******************************************************************************
@@ -22,25 +22,321 @@
 
 #include <poll.h>
 
+#include "Trace.hpp"
+
+using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
 using std::mutex;
+using std::recursive_mutex;
 using std::thread;
 using std::to_string;
 
 namespace XenBackend {
 
+/*******************************************************************************
+ * XenEvtchnLoop
+ ******************************************************************************/
+
+XenEvtchnLoop::XenEvtchnLoop() :
+	mHandle(nullptr),
+	mStarted(false),
+	mLog("XenEvtchnLoop"),
+	mDeletedFlag(nullptr)
+{
+	try
+	{
+		init();
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+XenEvtchnLoop::~XenEvtchnLoop()
+{
+	if (mDeletedFlag && std::this_thread::get_id() == mThread.get_id())
+	{
+		*mDeletedFlag = true;
+	}
+
+	stop();
+	release();
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+void XenEvtchnLoop::setThreadAttributes(
+		const ThreadAttributes& threadAttributes)
+{
+	lock_guard<mutex> lock(mItfMutex);
+
+	mThreadAttributes = threadAttributes;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenEvtchnLoop::init()
+{
+	mHandle = xenevtchn_open(nullptr, 0);
+
+	if (!mHandle)
+	{
+		throw XenEvtchnException("Can't open event channel", errno);
+	}
+
+	mPollFd.reset(new PollFd(xenevtchn_fd(mHandle), POLLIN));
+
+	DLOG(mLog, DEBUG) << "Create event channel loop";
+}
+
+void XenEvtchnLoop::release()
+{
+	if (mHandle)
+	{
+		xenevtchn_close(mHandle);
+
+		DLOG(mLog, DEBUG) << "Delete event channel loop";
+	}
+}
+
+void XenEvtchnLoop::addChannel(XenEvtchn* channel)
+{
+	{
+		lock_guard<mutex> lock(mItfMutex);
+
+		if (!mStarted)
+		{
+			DLOG(mLog, DEBUG) << "Start event channel loop";
+
+			mStarted = true;
+
+			mThread = thread(&XenEvtchnLoop::eventThread, this);
+
+			mThreadAttributes.tryApply(mThread);
+		}
+	}
+
+	lock_guard<recursive_mutex> lock(mMutex);
+
+	mChannels[channel->mPort] = channel;
+}
+
+void XenEvtchnLoop::removeChannel(XenEvtchn* channel)
+{
+	// waits for the callback of the channel is finished
+
+	lock_guard<recursive_mutex> lock(mMutex);
+
+	auto it = mChannels.find(channel->mPort);
+
+	if (it != mChannels.end() && it->second == channel)
+	{
+		mChannels.erase(it);
+	}
+}
+
+void XenEvtchnLoop::stop()
+{
+	lock_guard<mutex> lock(mItfMutex);
+
+	if (!mStarted)
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Stop event channel loop";
+
+	if (mPollFd)
+	{
+		mPollFd->stop();
+	}
+
+	// the last reference may be released by the loop thread, which can't
+	// join itself. It finishes without touching the loop
+
+	if (mThread.joinable())
+	{
+		if (std::this_thread::get_id() == mThread.get_id())
+		{
+			mThread.detach();
+		}
+		else
+		{
+			mThread.join();
+		}
+	}
+
+	mStarted = false;
+}
+
+void XenEvtchnLoop::eventThread()
+{
+	bool deleted = false;
+
+	mDeletedFlag = &deleted;
+
+	try
+	{
+		while(mPollFd->poll())
+		{
+			// the callback may release the last reference to the loop.
+			// Own reference defers deleting till the mutex is unlocked
+
+			XenEvtchnLoopPtr self;
+
+			processEvent(self);
+
+			self.reset();
+
+			if (deleted)
+			{
+				return;
+			}
+		}
+	}
+	catch(const std::exception& e)
+	{
+		if (!deleted)
+		{
+			onError(e);
+		}
+	}
+}
+
+void XenEvtchnLoop::processEvent(XenEvtchnLoopPtr& self)
+{
+	auto port = xenevtchn_pending(mHandle);
+
+	if (port < 0)
+	{
+		throw XenEvtchnException("Can't get pending port", errno);
+	}
+
+	lock_guard<recursive_mutex> lock(mMutex);
+
+	auto it = mChannels.find(port);
+
+	bool deferredUnmask = it != mChannels.end() &&
+						  it->second->mDeferredUnmask;
+
+	if (!deferredUnmask && xenevtchn_unmask(mHandle, port) < 0)
+	{
+		throw XenEvtchnException("Can't unmask event channel", errno);
+	}
+
+	if (it == mChannels.end())
+	{
+		DLOG(mLog, DEBUG) << "Event for not started port: " << port;
+
+		return;
+	}
+
+	auto channel = it->second;
+
+	self = channel->mLoop;
+
+	DLOG(mLog, DEBUG) << "Event received, port: " << port;
+
+	XENBE_TRACE(EVENT_RECEIVED, port, port);
+
+	channel->mNumReceived.inc();
+
+	try
+	{
+		if (channel->mCallback)
+		{
+			channel->mCallback();
+		}
+
+		if (deferredUnmask && xenevtchn_unmask(mHandle, port) < 0)
+		{
+			throw XenEvtchnException("Can't unmask event channel",
+									 errno);
+		}
+	}
+	catch(const std::exception& e)
+	{
+		// the channel is not handled anymore as it is done when
+		// the channel has own thread
+
+		removeChannel(channel);
+
+		channel->onError(e);
+	}
+}
+
+void XenEvtchnLoop::onError(const std::exception& e)
+{
+	lock_guard<recursive_mutex> lock(mMutex);
+
+	if (mChannels.empty())
+	{
+		LOG(mLog, ERROR) << e.what();
+	}
+
+	for (auto channel : mChannels)
+	{
+		channel.second->onError(e);
+	}
+
+	mChannels.clear();
+}
+
 /*******************************************************************************
  * XenEvtchn
  ******************************************************************************/
 
 XenEvtchn::XenEvtchn(domid_t domId, evtchn_port_t port, Callback callback,
 					 ErrorCallback errorCallback) :
+	mDomId(domId),
+	mRemotePort(port),
 	mPort(-1),
 	mHandle(nullptr),
 	mCallback(callback),
 	mErrorCallback(errorCallback),
 	mStarted(false),
-	mLog("XenEvtchn")
+	mDeferredUnmask(false),
+	mLog("XenEvtchn"),
+	mMinNotifyInterval(0),
+	mNotifyPending(false)
+{
+	try
+	{
+		init(domId, port);
+	}
+	catch(const std::exception& e)
+	{
+		release();
+
+		throw;
+	}
+}
+
+XenEvtchn::XenEvtchn(XenEvtchnLoopPtr loop, domid_t domId, evtchn_port_t port,
+					 Callback callback, ErrorCallback errorCallback) :
+	mLoop(loop),
+	mDomId(domId),
+	mRemotePort(port),
+	mPort(-1),
+	mHandle(nullptr),
+	mCallback(callback),
+	mErrorCallback(errorCallback),
+	mStarted(false),
+	mDeferredUnmask(false),
+	mLog("XenEvtchn"),
+	mMinNotifyInterval(0),
+	mNotifyPending(false)
 {
 	try
 	{
@@ -75,7 +371,16 @@ void XenEvtchn::start()
 
 	mStarted = true;
 
-	mThread = thread(&XenEvtchn::eventThread, this);
+	if (mLoop)
+	{
+		mLoop->addChannel(this);
+	}
+	else
+	{
+		mThread = thread(&XenEvtchn::eventThread, this);
+
+		mThreadAttributes.tryApply(mThread);
+	}
 }
 
 void XenEvtchn::stop()
@@ -87,14 +392,29 @@ void XenEvtchn::stop()
 
 	DLOG(mLog, DEBUG) << "Stop event channel, port: " << mPort;
 
+	if (mLoop)
+	{
+		mLoop->removeChannel(this);
+	}
+
 	if (mPollFd)
 	{
 		mPollFd->stop();
 	}
 
+	// the last reference may be released by the loop thread, which can't
+	// join itself. It finishes without touching the loop
+
 	if (mThread.joinable())
 	{
-		mThread.join();
+		if (std::this_thread::get_id() == mThread.get_id())
+		{
+			mThread.detach();
+		}
+		else
+		{
+			mThread.join();
+		}
 	}
 
 	mStarted = false;
@@ -102,11 +422,81 @@ void XenEvtchn::stop()
 
 void XenEvtchn::notify()
 {
-	DLOG(mLog, DEBUG) << "Notify event channel, port: " << mPort;
+	if (!mMinNotifyInterval.count())
+	{
+		sendNotify();
 
-	if (xenevtchn_notify(mHandle, mPort) < 0)
+		return;
+	}
+
+	lock_guard<mutex> lock(mNotifyMutex);
+
+	if (mNotifyPending)
 	{
-		throw XenEvtchnException("Can't notify event channel", errno);
+		mNumDeferred.inc();
+
+		return;
+	}
+
+	auto now = steady_clock::now();
+	auto elapsed = now - mLastNotifyTime;
+
+	if (elapsed >= mMinNotifyInterval)
+	{
+		mLastNotifyTime = now;
+
+		sendNotify();
+
+		return;
+	}
+
+	// round the remaining time up as the timer has milliseconds resolution
+
+	auto delay = duration_cast<milliseconds>(mMinNotifyInterval - elapsed +
+											 milliseconds(1) -
+											 steady_clock::duration(1));
+
+	mNotifyTimer->start(delay);
+
+	mNotifyPending = true;
+
+	mNumDeferred.inc();
+}
+
+void XenEvtchn::rebind()
+{
+	if (mStarted)
+	{
+		throw XenEvtchnException("Can't rebind started event channel", EPERM);
+	}
+
+	if (mPort != -1)
+	{
+		xenevtchn_unbind(mHandle, mPort);
+	}
+
+	mPort = xenevtchn_bind_interdomain(mHandle, mDomId, mRemotePort);
+
+	if (mPort == -1)
+	{
+		throw XenEvtchnException("Can't bind event channel: " +
+								 to_string(mRemotePort), errno);
+	}
+
+	DLOG(mLog, DEBUG) << "Rebind event channel, dom: " << mDomId
+					  << ", remote port: " << mRemotePort << ", local port: "
+					  << mPort;
+}
+
+void XenEvtchn::setMinNotifyInterval(microseconds interval)
+{
+	lock_guard<mutex> lock(mNotifyMutex);
+
+	mMinNotifyInterval = interval;
+
+	if (mMinNotifyInterval.count() && !mNotifyTimer)
+	{
+		mNotifyTimer.reset(new Timer(bind(&XenEvtchn::onNotifyTimer, this)));
 	}
 }
 
@@ -123,7 +513,14 @@ void XenEvtchn::setErrorCallback(ErrorCallback errorCallback)
 
 void XenEvtchn::init(domid_t domId, evtchn_port_t port)
 {
-	mHandle = xenevtchn_open(nullptr, 0);
+	if (mLoop)
+	{
+		mHandle = mLoop->mHandle;
+	}
+	else
+	{
+		mHandle = xenevtchn_open(nullptr, 0);
+	}
 
 	if (!mHandle)
 	{
@@ -138,7 +535,10 @@ void XenEvtchn::init(domid_t domId, evtchn_port_t port)
 								 errno);
 	}
 
-	mPollFd.reset(new PollFd(xenevtchn_fd(mHandle), POLLIN));
+	if (!mLoop)
+	{
+		mPollFd.reset(new PollFd(xenevtchn_fd(mHandle), POLLIN));
+	}
 
 	DLOG(mLog, DEBUG) << "Create event channel, dom: " << domId
 					  << ", remote port: " << port << ", local port: "
@@ -147,6 +547,10 @@ void XenEvtchn::init(domid_t domId, evtchn_port_t port)
 
 void XenEvtchn::release()
 {
+	// the timer callback uses the handle
+
+	mNotifyTimer.reset();
+
 	if (mPort != -1)
 	{
 		xenevtchn_unbind(mHandle, mPort);
@@ -154,12 +558,49 @@ void XenEvtchn::release()
 
 	if (mHandle)
 	{
-		xenevtchn_close(mHandle);
+		if (!mLoop)
+		{
+			xenevtchn_close(mHandle);
+		}
 
 		DLOG(mLog, DEBUG) << "Delete event channel, port: " << mPort;
 	}
 }
 
+void XenEvtchn::sendNotify()
+{
+	DLOG(mLog, DEBUG) << "Notify event channel, port: " << mPort;
+
+	if (xenevtchn_notify(mHandle, mPort) < 0)
+	{
+		throw XenEvtchnException("Can't notify event channel", errno);
+	}
+
+	mNumSent.inc();
+}
+
+void XenEvtchn::onNotifyTimer()
+{
+	lock_guard<mutex> lock(mNotifyMutex);
+
+	if (!mNotifyPending)
+	{
+		return;
+	}
+
+	mNotifyPending = false;
+	mLastNotifyTime = steady_clock::now();
+
+	try
+	{
+		sendNotify();
+	}
+	catch(const std::exception& e)
+	{
+		onError(e);
+	}
+}
+
 void XenEvtchn::eventThread()
 {
 	try
@@ -173,7 +614,7 @@ void XenEvtchn::eventThread()
 				throw XenEvtchnException("Can't get pending port", errno);
 			}
 
-			if (xenevtchn_unmask(mHandle, port) < 0)
+			if (!mDeferredUnmask && xenevtchn_unmask(mHandle, port) < 0)
 			{
 				throw XenEvtchnException("Can't unmask event channel", errno);
 			}
@@ -187,21 +628,35 @@ void XenEvtchn::eventThread()
 
 			DLOG(mLog, DEBUG) << "Event received, port: " << mPort;
 
+			XENBE_TRACE(EVENT_RECEIVED, mPort, mPort);
+
+			mNumReceived.inc();
+
 			mCallback();
+
+			if (mDeferredUnmask && xenevtchn_unmask(mHandle, port) < 0)
+			{
+				throw XenEvtchnException("Can't unmask event channel", errno);
+			}
 		}
 	}
 	catch(const std::exception& e)
 	{
-		lock_guard<mutex> lock(mMutex);
+		onError(e);
+	}
+}
 
-		if (mErrorCallback)
-		{
-			mErrorCallback(e);
-		}
-		else
-		{
-			LOG(mLog, ERROR) << e.what();
-		}
+void XenEvtchn::onError(const std::exception& e)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mErrorCallback)
+	{
+		mErrorCallback(e);
+	}
+	else
+	{
+		LOG(mLog, ERROR) << e.what();
 	}
 }
 
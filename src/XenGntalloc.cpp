@@ -0,0 +1,172 @@
+/*
+ *  Xen gntalloc wrapper
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "XenGntalloc.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * XenGntshr
+ ******************************************************************************/
+
+XenGntshr::XenGntshr()
+{
+	mHandle = xengntshr_open(nullptr, 0);
+
+	if (!mHandle)
+	{
+		throw XenGntallocException("Can't open xc grant share", errno);
+	}
+}
+
+XenGntshr::~XenGntshr()
+{
+	if (mHandle)
+	{
+		xengntshr_close(mHandle);
+	}
+}
+
+XenGntshr& XenGntshr::getInstance()
+{
+	static XenGntshr gntshr;
+
+	return gntshr;
+}
+
+/*******************************************************************************
+ * XenGntallocBuffer
+ ******************************************************************************/
+
+XenGntallocBuffer::XenGntallocBuffer(domid_t domId, size_t count,
+									 bool writable) :
+	mBuffer(nullptr),
+	mHandle(nullptr),
+	mDomId(domId),
+	mLog("XenGntallocBuffer")
+{
+	init(count, writable);
+}
+
+XenGntallocBuffer::~XenGntallocBuffer()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGntallocBuffer::init(size_t count, bool writable)
+{
+	if (count == 0)
+	{
+		throw XenGntallocException("Wrong number of pages", EINVAL);
+	}
+
+	mHandle = XenGntshr::getInstance().mHandle;
+
+	mRefs.resize(count);
+
+	mBuffer = xengntshr_share_pages(mHandle, mDomId, count, mRefs.data(),
+									writable);
+
+	if (!mBuffer)
+	{
+		throw XenGntallocException("Can't share pages", errno);
+	}
+
+	DLOG(mLog, DEBUG) << "Create grant alloc buffer, dom: " << mDomId
+					  << ", count: " << count << ", ref: " << mRefs[0];
+}
+
+void XenGntallocBuffer::release()
+{
+	DLOG(mLog, DEBUG) << "Delete grant alloc buffer";
+
+	if (mBuffer)
+	{
+		xengntshr_unshare(mHandle, mBuffer, mRefs.size());
+	}
+}
+
+/*******************************************************************************
+ * XenGntallocPool
+ ******************************************************************************/
+
+XenGntallocPool::XenGntallocPool(domid_t domId, size_t numBuffers,
+								 size_t numPages, bool writable)
+{
+	for (size_t i = 0; i < numBuffers; i++)
+	{
+		mBuffers.emplace_back(new XenGntallocBuffer(domId, numPages,
+													writable));
+
+		mFreeBuffers.push_back(mBuffers.back().get());
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+XenGntallocBufferPtr XenGntallocPool::get()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	if (mFreeBuffers.empty())
+	{
+		return nullptr;
+	}
+
+	auto buffer = mFreeBuffers.front();
+
+	mFreeBuffers.pop_front();
+
+	// the buffer keeps the pool alive till it is returned
+
+	auto self = shared_from_this();
+
+	return XenGntallocBufferPtr(buffer, [self](XenGntallocBuffer* buffer)
+								{ self->put(buffer); });
+}
+
+size_t XenGntallocPool::getNumFree() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mFreeBuffers.size();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGntallocPool::put(XenGntallocBuffer* buffer)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mFreeBuffers.push_back(buffer);
+}
+
+}
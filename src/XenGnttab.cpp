@@ -20,6 +20,13 @@
 
 #include "XenGnttab.hpp"
 
+using std::list;
+using std::lock_guard;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
 namespace XenBackend {
 
 /*******************************************************************************
@@ -44,6 +51,13 @@ XenGnttab::~XenGnttab()
 	}
 }
 
+XenGnttab& XenGnttab::getInstance()
+{
+	static XenGnttab gnttab;
+
+	return gnttab;
+}
+
 /*******************************************************************************
  * XenGnttabBuffer
  ******************************************************************************/
@@ -73,9 +87,7 @@ XenGnttabBuffer::~XenGnttabBuffer()
 void XenGnttabBuffer::init(domid_t domId, const grant_ref_t* refs,
 						   size_t count, int prot)
 {
-	static XenGnttab gnttab;
-
-	mHandle = gnttab.getHandle();
+	mHandle = XenGnttab::getInstance().getHandle();
 	mBuffer = nullptr;
 	mCount = count;
 
@@ -85,7 +97,7 @@ void XenGnttabBuffer::init(domid_t domId, const grant_ref_t* refs,
 
 	mBuffer = xengnttab_map_domain_grant_refs(mHandle, count, domId,
 											  const_cast<grant_ref_t*>(refs),
-											  PROT_READ | PROT_WRITE);
+											  prot);
 
 	if (!mBuffer)
 	{
@@ -104,4 +116,405 @@ void XenGnttabBuffer::release()
 	}
 }
 
+/*******************************************************************************
+ * XenGnttabSgBuffer
+ ******************************************************************************/
+
+XenGnttabSgBuffer::XenGnttabSgBuffer(domid_t domId,
+									 const vector<grant_ref_t>& refs,
+									 int prot) :
+	XenGnttabSgBuffer(vector<domid_t>(refs.size(), domId), refs, prot)
+{
+}
+
+XenGnttabSgBuffer::XenGnttabSgBuffer(const vector<domid_t>& domIds,
+									 const vector<grant_ref_t>& refs,
+									 int prot) :
+	mBuffer(nullptr),
+	mHandle(XenGnttab::getInstance().getHandle()),
+	mLog("XenGnttabSgBuffer")
+{
+	init(domIds, refs, prot);
+}
+
+XenGnttabSgBuffer::~XenGnttabSgBuffer()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGnttabSgBuffer::init(const vector<domid_t>& domIds,
+							 const vector<grant_ref_t>& refs, int prot)
+{
+	if (domIds.size() != refs.size() || refs.empty())
+	{
+		throw XenGnttabException("Wrong number of refs", EINVAL);
+	}
+
+	DLOG(mLog, DEBUG) << "Create scatter-gather buffer, count: "
+					  << refs.size();
+
+	vector<uint32_t> xenDomIds(domIds.begin(), domIds.end());
+
+	mBuffer = xengnttab_map_grant_refs(mHandle, refs.size(), xenDomIds.data(),
+									   const_cast<grant_ref_t*>(refs.data()),
+									   prot);
+
+	if (!mBuffer)
+	{
+		throw XenGnttabException("Can't map buffer", errno);
+	}
+
+	for (size_t i = 0; i < refs.size(); i++)
+	{
+		mPages.push_back(static_cast<uint8_t*>(mBuffer) + i * XC_PAGE_SIZE);
+	}
+}
+
+void XenGnttabSgBuffer::release()
+{
+	DLOG(mLog, DEBUG) << "Delete scatter-gather buffer";
+
+	if (mBuffer)
+	{
+		xengnttab_unmap(mHandle, mBuffer, mPages.size());
+	}
+}
+
+/*******************************************************************************
+ * XenGnttabCopy
+ ******************************************************************************/
+
+XenGnttabCopy::XenGnttabCopy() :
+	mHandle(XenGnttab::getInstance().getHandle()),
+	mNumFailed(0),
+	mLog("XenGnttabCopy")
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+size_t XenGnttabCopy::addToForeign(domid_t domId, grant_ref_t ref,
+								   uint16_t offset, const void* src,
+								   uint16_t len)
+{
+	checkSegment(offset, len);
+
+	xengnttab_grant_copy_segment_t seg {};
+
+	seg.source.virt = const_cast<void*>(src);
+	seg.dest.foreign.ref = ref;
+	seg.dest.foreign.offset = offset;
+	seg.dest.foreign.domid = domId;
+	seg.len = len;
+	seg.flags = GNTCOPY_dest_gref;
+
+	mSegments.push_back(seg);
+
+	return mSegments.size() - 1;
+}
+
+size_t XenGnttabCopy::addFromForeign(domid_t domId, grant_ref_t ref,
+									 uint16_t offset, void* dst, uint16_t len)
+{
+	checkSegment(offset, len);
+
+	xengnttab_grant_copy_segment_t seg {};
+
+	seg.source.foreign.ref = ref;
+	seg.source.foreign.offset = offset;
+	seg.source.foreign.domid = domId;
+	seg.dest.virt = dst;
+	seg.len = len;
+	seg.flags = GNTCOPY_source_gref;
+
+	mSegments.push_back(seg);
+
+	return mSegments.size() - 1;
+}
+
+void XenGnttabCopy::copy()
+{
+	mNumFailed = 0;
+
+	if (mSegments.empty())
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Copy segments: " << mSegments.size();
+
+	if (xengnttab_grant_copy(mHandle, mSegments.size(), mSegments.data()) < 0)
+	{
+		throw XenGnttabException("Can't copy grant refs", errno);
+	}
+
+	for (auto& seg : mSegments)
+	{
+		if (seg.status != GNTST_okay)
+		{
+			mNumFailed++;
+		}
+	}
+
+	if (mNumFailed)
+	{
+		LOG(mLog, WARNING) << "Failed segments: " << mNumFailed
+						   << " of " << mSegments.size();
+	}
+}
+
+void XenGnttabCopy::clear()
+{
+	mSegments.clear();
+
+	mNumFailed = 0;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGnttabCopy::checkSegment(uint16_t offset, uint16_t len)
+{
+	if (offset + len > XC_PAGE_SIZE)
+	{
+		throw XenGnttabException("Segment crosses page boundary", EINVAL);
+	}
+}
+
+/*******************************************************************************
+ * XenGnttabUnmapQueue
+ ******************************************************************************/
+
+XenGnttabUnmapQueue::XenGnttabUnmapQueue(size_t maxPages) :
+	mMaxPages(maxPages),
+	mNumPendingPages(0),
+	mTerminate(false),
+	mLog("XenGnttabUnmapQueue")
+{
+	mThread = thread(&XenGnttabUnmapQueue::run, this);
+}
+
+XenGnttabUnmapQueue::~XenGnttabUnmapQueue()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mTerminate = true;
+
+		mCondVar.notify_all();
+	}
+
+	if (mThread.joinable())
+	{
+		mThread.join();
+	}
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+XenGnttabBufferPtr XenGnttabUnmapQueue::map(domid_t domId,
+											const grant_ref_t* refs,
+											size_t count, int prot)
+{
+	// the buffer keeps the queue alive till it is released
+
+	auto self = shared_from_this();
+
+	return XenGnttabBufferPtr(new XenGnttabBuffer(domId, refs, count, prot),
+							  [self](XenGnttabBuffer* buffer)
+							  { self->release(buffer); });
+}
+
+void XenGnttabUnmapQueue::flush()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	mCondVar.notify_all();
+
+	mFlushCondVar.wait(lock, [this] { return mNumPendingPages == 0; });
+}
+
+size_t XenGnttabUnmapQueue::getNumPendingPages() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mNumPendingPages;
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGnttabUnmapQueue::release(XenGnttabBuffer* buffer)
+{
+	auto numPages = buffer->size() / XC_PAGE_SIZE;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mTerminate && mNumPendingPages + numPages <= mMaxPages)
+		{
+			mBuffers.push_back(buffer);
+
+			mNumPendingPages += numPages;
+
+			mCondVar.notify_all();
+
+			return;
+		}
+	}
+
+	DLOG(mLog, DEBUG) << "Queue is full, unmap in place";
+
+	delete buffer;
+}
+
+void XenGnttabUnmapQueue::run()
+{
+	unique_lock<mutex> lock(mMutex);
+
+	while(true)
+	{
+		mCondVar.wait(lock, [this] { return mTerminate || !mBuffers.empty(); });
+
+		list<XenGnttabBuffer*> buffers;
+
+		buffers.swap(mBuffers);
+
+		lock.unlock();
+
+		size_t numPages = 0;
+
+		for (auto buffer : buffers)
+		{
+			numPages += buffer->size() / XC_PAGE_SIZE;
+
+			delete buffer;
+		}
+
+		DLOG(mLog, DEBUG) << "Unmap buffers: " << buffers.size()
+						  << ", pages: " << numPages;
+
+		lock.lock();
+
+		mNumPendingPages -= numPages;
+
+		mFlushCondVar.notify_all();
+
+		if (mTerminate && mBuffers.empty())
+		{
+			break;
+		}
+	}
+}
+
+/*******************************************************************************
+ * XenGnttabCache
+ ******************************************************************************/
+
+XenGnttabCache::XenGnttabCache(size_t maxPages, int prot) :
+	mMaxPages(maxPages),
+	mProt(prot)
+{
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+XenGnttabBufferPtr XenGnttabCache::get(domid_t domId, grant_ref_t ref)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	auto key = getKey(domId, ref);
+	auto it = mEntries.find(key);
+
+	if (it != mEntries.end())
+	{
+		mNumHits.inc();
+
+		mLru.splice(mLru.begin(), mLru, it->second);
+
+		return it->second->second;
+	}
+
+	mNumMisses.inc();
+
+	XenGnttabBufferPtr buffer;
+
+	if (mUnmapQueue)
+	{
+		buffer = mUnmapQueue->map(domId, ref, mProt);
+	}
+	else
+	{
+		buffer.reset(new XenGnttabBuffer(domId, ref, mProt));
+	}
+
+	if (mMaxPages == 0)
+	{
+		return buffer;
+	}
+
+	while (mLru.size() >= mMaxPages)
+	{
+		mEntries.erase(mLru.back().first);
+		mLru.pop_back();
+	}
+
+	mLru.push_front(Entry(key, buffer));
+	mEntries[key] = mLru.begin();
+
+	return buffer;
+}
+
+void XenGnttabCache::setUnmapQueue(XenGnttabUnmapQueuePtr unmapQueue)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mUnmapQueue = unmapQueue;
+}
+
+void XenGnttabCache::invalidate(domid_t domId)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	for (auto it = mLru.begin(); it != mLru.end();)
+	{
+		if ((it->first >> 32) == domId)
+		{
+			mEntries.erase(it->first);
+			it = mLru.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void XenGnttabCache::clear()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mEntries.clear();
+	mLru.clear();
+}
+
+size_t XenGnttabCache::size() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mLru.size();
+}
+
 }
@@ -0,0 +1,154 @@
+/*
+ *  Xen gnttab dma-buf wrapper
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "XenGnttabDmaBuf.hpp"
+
+#include <unistd.h>
+
+using std::vector;
+
+namespace XenBackend {
+
+/*******************************************************************************
+ * XenGnttabDmaBufExporter
+ ******************************************************************************/
+
+XenGnttabDmaBufExporter::XenGnttabDmaBufExporter(domid_t domId,
+												 const vector<grant_ref_t>& refs,
+												 uint32_t flags,
+												 uint32_t timeout) :
+	mHandle(XenGnttab::getInstance().getHandle()),
+	mFd(-1),
+	mTimeout(timeout),
+	mRefs(refs),
+	mLog("XenGnttabDmaBufExporter")
+{
+	init(domId, flags);
+}
+
+XenGnttabDmaBufExporter::~XenGnttabDmaBufExporter()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGnttabDmaBufExporter::init(domid_t domId, uint32_t flags)
+{
+	if (mRefs.empty())
+	{
+		throw XenGnttabException("Wrong number of refs", EINVAL);
+	}
+
+	uint32_t fd = 0;
+
+	if (xengnttab_dmabuf_exp_from_refs(mHandle, domId, flags, mRefs.size(),
+									   mRefs.data(), &fd) < 0)
+	{
+		throw XenGnttabException("Can't export dma-buf", errno);
+	}
+
+	mFd = fd;
+
+	DLOG(mLog, DEBUG) << "Export dma-buf, dom: " << domId << ", fd: " << mFd
+					  << ", count: " << mRefs.size();
+}
+
+void XenGnttabDmaBufExporter::release()
+{
+	if (mFd < 0)
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Release exported dma-buf, fd: " << mFd;
+
+	auto fd = mFd;
+
+	close(mFd);
+
+	if (xengnttab_dmabuf_exp_wait_released(mHandle, fd, mTimeout) < 0)
+	{
+		LOG(mLog, ERROR) << "Exported dma-buf is not released, fd: " << fd;
+	}
+}
+
+/*******************************************************************************
+ * XenGnttabDmaBufImporter
+ ******************************************************************************/
+
+XenGnttabDmaBufImporter::XenGnttabDmaBufImporter(domid_t domId, int fd,
+												 size_t count) :
+	mHandle(XenGnttab::getInstance().getHandle()),
+	mFd(fd),
+	mImported(false),
+	mLog("XenGnttabDmaBufImporter")
+{
+	init(domId, count);
+}
+
+XenGnttabDmaBufImporter::~XenGnttabDmaBufImporter()
+{
+	release();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenGnttabDmaBufImporter::init(domid_t domId, size_t count)
+{
+	if (count == 0)
+	{
+		throw XenGnttabException("Wrong number of pages", EINVAL);
+	}
+
+	mRefs.resize(count);
+
+	if (xengnttab_dmabuf_imp_to_refs(mHandle, domId, mFd, count,
+									 mRefs.data()) < 0)
+	{
+		throw XenGnttabException("Can't import dma-buf", errno);
+	}
+
+	mImported = true;
+
+	DLOG(mLog, DEBUG) << "Import dma-buf, dom: " << domId << ", fd: " << mFd
+					  << ", count: " << count;
+}
+
+void XenGnttabDmaBufImporter::release()
+{
+	if (!mImported)
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Release imported dma-buf, fd: " << mFd;
+
+	if (xengnttab_dmabuf_imp_release(mHandle, mFd) < 0)
+	{
+		LOG(mLog, ERROR) << "Can't release imported dma-buf, fd: " << mFd;
+	}
+}
+
+}
@@ -20,6 +20,18 @@
 
 #include "XenStat.hpp"
 
+#include <algorithm>
+#include <iterator>
+
+using std::back_inserter;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::set_difference;
+using std::unique_ptr;
 using std::vector;
 
 namespace XenBackend {
@@ -28,7 +40,9 @@ namespace XenBackend {
  * XenStat
  ******************************************************************************/
 
-XenStat::XenStat() :
+XenStat::XenStat(milliseconds refreshInterval) :
+	mRefreshInterval(refreshInterval),
+	mValid(false),
 	mLog("XenStat")
 {
 	LOG(mLog, DEBUG) << "Create xen stat";
@@ -36,6 +50,8 @@ XenStat::XenStat() :
 
 XenStat::~XenStat()
 {
+	mXenStore.reset();
+
 	LOG(mLog, DEBUG) << "Delete xen stat";
 }
 
@@ -43,39 +59,248 @@ XenStat::~XenStat()
  * Public
  ******************************************************************************/
 
+void XenStat::setRefreshInterval(milliseconds refreshInterval)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mRefreshInterval = refreshInterval;
+}
+
+void XenStat::invalidate()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mValid = false;
+}
+
 vector<domid_t> XenStat::getRunningDoms()
 {
 	vector<domid_t> runningDomains;
 
-	vector<xc_domaininfo_t> domInfos;
+	getRunningDoms(runningDomains);
+
+	return runningDomains;
+}
+
+void XenStat::getRunningDoms(vector<domid_t>& domIds)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	update();
 
-	mInterface.getDomainsInfo(domInfos);
+	domIds.clear();
 
-	for(auto info : domInfos)
+	for(const auto& info : mDomInfos)
 	{
 		if (info.flags & XEN_DOMINF_running)
 		{
-			runningDomains.push_back(info.domain);
+			domIds.push_back(info.domain);
 		}
 	}
-
-	return runningDomains;
 }
 
 vector<domid_t> XenStat::getExistingDoms()
 {
 	vector<domid_t> existingDomains;
 
-	vector<xc_domaininfo_t> domInfos;
+	getExistingDoms(existingDomains);
+
+	return existingDomains;
+}
+
+void XenStat::getExistingDoms(vector<domid_t>& domIds)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	update();
 
-	mInterface.getDomainsInfo(domInfos);
+	domIds.clear();
 
-	for(auto info : domInfos)
+	for(const auto& info : mDomInfos)
 	{
-		existingDomains.push_back(info.domain);
+		domIds.push_back(info.domain);
 	}
+}
 
-	return existingDomains;
+void XenStat::getDomainStats(vector<DomainStats>& stats)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	update();
+
+	// the baseline is moved only when the snapshot is refreshed, thus
+	// subsequent calls within the refresh interval return the same rates
+
+	if (mStatsDomInfos.empty() || mStatsTime != mUpdateTime)
+	{
+		mPrevStatsDomInfos.swap(mStatsDomInfos);
+		mPrevStatsTime = mStatsTime;
+
+		mStatsDomInfos = mDomInfos;
+		mStatsTime = mUpdateTime;
+	}
+
+	stats.resize(mStatsDomInfos.size());
+
+	auto elapsed = duration_cast<nanoseconds>(
+			mStatsTime - mPrevStatsTime).count();
+
+	auto prev = mPrevStatsDomInfos.begin();
+
+	for(size_t i = 0; i < mStatsDomInfos.size(); i++)
+	{
+		const auto& info = mStatsDomInfos[i];
+		auto& stat = stats[i];
+
+		stat.domId = info.domain;
+		stat.flags = info.flags;
+		stat.cpuTime = info.cpu_time;
+		stat.cpuUsage = 0.0;
+		stat.totPages = info.tot_pages;
+		stat.maxPages = info.max_pages;
+		stat.sharedPages = info.shr_pages;
+		stat.pagedPages = info.paged_pages;
+		stat.totPagesDelta = 0;
+		stat.numOnlineVcpus = info.nr_online_vcpus;
+		stat.maxVcpuId = info.max_vcpu_id;
+
+		// both snapshots are sorted by domain id
+
+		while(prev != mPrevStatsDomInfos.end() && prev->domain < info.domain)
+		{
+			prev++;
+		}
+
+		if (prev == mPrevStatsDomInfos.end() || prev->domain != info.domain)
+		{
+			continue;
+		}
+
+		if (elapsed > 0 && info.cpu_time >= prev->cpu_time)
+		{
+			stat.cpuUsage = 100.0 * (info.cpu_time - prev->cpu_time) / elapsed;
+		}
+
+		stat.totPagesDelta = static_cast<int64_t>(info.tot_pages) -
+							 static_cast<int64_t>(prev->tot_pages);
+	}
+}
+
+void XenStat::setDomainsChangedCallback(DomainsChangedCallback callback)
+{
+	// stop the store without the lock as its thread may wait for it
+
+	mXenStore.reset();
+
+	if (!callback)
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mCallback = nullptr;
+
+		return;
+	}
+
+	unique_ptr<XenStore> xenStore(new XenStore());
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		mCallback = callback;
+
+		mValid = false;
+
+		update();
+
+		mKnownDoms.clear();
+
+		for(const auto& info : mDomInfos)
+		{
+			mKnownDoms.push_back(info.domain);
+		}
+	}
+
+	xenStore->setWatch("@introduceDomain",
+					   [this](const std::string&) { domainsChanged(); });
+	xenStore->setWatch("@releaseDomain",
+					   [this](const std::string&) { domainsChanged(); });
+
+	xenStore->start();
+
+	mXenStore = std::move(xenStore);
+
+	LOG(mLog, DEBUG) << "Watch domains";
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+void XenStat::update()
+{
+	auto now = steady_clock::now();
+
+	if (mValid && now - mUpdateTime < mRefreshInterval)
+	{
+		return;
+	}
+
+	mValid = false;
+
+	mInterface.getDomainsInfo(mDomInfos);
+
+	mUpdateTime = now;
+	mValid = true;
+}
+
+void XenStat::domainsChanged()
+{
+	vector<domid_t> added, removed;
+	DomainsChangedCallback callback;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		if (!mCallback)
+		{
+			return;
+		}
+
+		mValid = false;
+
+		update();
+
+		mCurrentDoms.clear();
+
+		for(const auto& info : mDomInfos)
+		{
+			mCurrentDoms.push_back(info.domain);
+		}
+
+		// domains info is sorted by domain id
+
+		set_difference(mCurrentDoms.begin(), mCurrentDoms.end(),
+					   mKnownDoms.begin(), mKnownDoms.end(),
+					   back_inserter(added));
+
+		set_difference(mKnownDoms.begin(), mKnownDoms.end(),
+					   mCurrentDoms.begin(), mCurrentDoms.end(),
+					   back_inserter(removed));
+
+		mKnownDoms.swap(mCurrentDoms);
+
+		callback = mCallback;
+	}
+
+	if (added.empty() && removed.empty())
+	{
+		return;
+	}
+
+	DLOG(mLog, DEBUG) << "Domains changed, added: " << added.size()
+					  << ", removed: " << removed.size();
+
+	callback(added, removed);
 }
 
 }
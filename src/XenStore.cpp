@@ -19,13 +19,19 @@
  */
 #include "XenStore.hpp"
 
+#include <algorithm>
 #include <poll.h>
 
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::equal;
 using std::lock_guard;
 using std::mutex;
 using std::string;
 using std::thread;
 using std::to_string;
+using std::unique_lock;
 using std::vector;
 
 namespace XenBackend {
@@ -38,7 +44,10 @@ XenStore::XenStore(ErrorCallback errorCallback) :
 	mXsHandle(nullptr),
 	mErrorCallback(errorCallback),
 	mStarted(false),
-	mLog("XenStore")
+	mLog("XenStore"),
+	mNextListener(0),
+	mDispatching(false),
+	mDispatchingListener(0)
 {
 	try
 	{
@@ -81,111 +90,203 @@ string XenStore::getDomainPath(domid_t domId)
 	return result;
 }
 
-int XenStore::readInt(const string& path)
+int XenStore::readInt(const string& path, xs_transaction_t transaction)
 {
-	int result = stoi(readString(path));
+	int result = stoi(readString(path, transaction));
 
 	LOG(mLog, DEBUG) << "Read int " << path << " : " << result;
 
 	return result;
 }
 
-unsigned int XenStore::readUint(const string& path)
+unsigned int XenStore::readUint(const string& path,
+							   xs_transaction_t transaction)
 {
-	unsigned int result = stoul(readString(path));
+	unsigned int result = stoul(readString(path, transaction));
 
 	LOG(mLog, DEBUG) << "Read unsigned int " << path << " : " << result;
 
 	return result;
 }
 
-string XenStore::readString(const string& path)
+string XenStore::readString(const string& path, xs_transaction_t transaction)
+{
+	string result;
+
+	if (!tryReadString(path, result, transaction))
+	{
+		throw XenStoreException("Can't read from: " + path, errno);
+	}
+
+	return result;
+}
+
+bool XenStore::tryReadInt(const string& path, int& value,
+						  xs_transaction_t transaction)
+{
+	string result;
+
+	if (!tryReadString(path, result, transaction))
+	{
+		return false;
+	}
+
+	value = stoi(result);
+
+	return true;
+}
+
+bool XenStore::tryReadUint(const string& path, unsigned int& value,
+						   xs_transaction_t transaction)
+{
+	string result;
+
+	if (!tryReadString(path, result, transaction))
+	{
+		return false;
+	}
+
+	value = stoul(result);
+
+	return true;
+}
+
+bool XenStore::tryReadString(const string& path, string& value,
+							 xs_transaction_t transaction)
 {
 	unsigned length;
-	auto pData = static_cast<char*>(xs_read(mXsHandle, XBT_NULL, path.c_str(),
-											&length));
+	auto pData = static_cast<char*>(xs_read(mXsHandle, transaction,
+											path.c_str(), &length));
+
+	mNumReads.inc();
 
 	if (!pData)
 	{
-		throw XenStoreException("Can't read from: " + path, errno);
+		return false;
 	}
 
-	string result(pData);
+	value.assign(pData, length);
 
 	free(pData);
 
-	LOG(mLog, DEBUG) << "Read string " << path << " : " << result;
+	LOG(mLog, DEBUG) << "Read string " << path << " : " << value;
+
+	return true;
+}
+
+vector<string> XenStore::readMany(const vector<string>& paths,
+								  xs_transaction_t transaction)
+{
+	vector<string> result;
+
+	if (transaction != XBT_NULL)
+	{
+		result.reserve(paths.size());
+
+		for (auto& path : paths)
+		{
+			result.push_back(readString(path, transaction));
+		}
+
+		return result;
+	}
+
+	runTransaction([this, &paths, &result](xs_transaction_t transaction) {
+		result = readMany(paths, transaction);
+	});
 
 	return result;
 }
 
-void XenStore::writeInt(const string& path, int value)
+void XenStore::writeInt(const string& path, int value,
+						xs_transaction_t transaction)
 {
 	auto strValue = to_string(value);
 
 	LOG(mLog, DEBUG) << "Write int " << path << " : " << value;
 
-	writeString(path, strValue);
+	writeString(path, strValue, transaction);
 }
 
-void XenStore::writeUint(const string& path, unsigned int value)
+void XenStore::writeUint(const string& path, unsigned int value,
+						 xs_transaction_t transaction)
 {
 	auto strValue = to_string(value);
 
 	LOG(mLog, DEBUG) << "Write uint " << path << " : " << value;
 
-	writeString(path, strValue);
+	writeString(path, strValue, transaction);
 }
 
-void XenStore::writeString(const string& path, const string& value)
+void XenStore::writeString(const string& path, const string& value,
+						   xs_transaction_t transaction)
 {
 	LOG(mLog, DEBUG) << "Write string " << path << " : " << value;
 
-	if (!xs_write(mXsHandle, XBT_NULL, path.c_str(), value.c_str(),
+	mNumWrites.inc();
+
+	if (!xs_write(mXsHandle, transaction, path.c_str(), value.c_str(),
 				  value.length()))
 	{
 		throw XenStoreException("Can't write value to " + path, errno);
 	}
 }
 
-void XenStore::removePath(const string& path)
+void XenStore::removePath(const string& path, xs_transaction_t transaction)
 {
 	LOG(mLog, DEBUG) << "Remove path " << path;
 
-	if (!xs_rm(mXsHandle, XBT_NULL, path.c_str()))
+	mNumWrites.inc();
+
+	if (!xs_rm(mXsHandle, transaction, path.c_str()))
 	{
 		throw XenStoreException("Can't remove path " + path, errno);
 	}
 }
 
-vector<string> XenStore::readDirectory(const string& path)
+vector<string> XenStore::readDirectory(const string& path,
+									   xs_transaction_t transaction)
+{
+	vector<string> result;
+
+	tryReadDirectory(path, result, transaction);
+
+	return result;
+}
+
+bool XenStore::tryReadDirectory(const string& path, vector<string>& items,
+								xs_transaction_t transaction)
 {
 	unsigned int num;
-	auto items = xs_directory(mXsHandle, XBT_NULL, path.c_str(), &num);
+	auto result = xs_directory(mXsHandle, transaction, path.c_str(), &num);
 
-	if (items && num)
-	{
-		vector<string> result;
+	mNumReads.inc();
 
-		result.reserve(num);
+	items.clear();
 
-		for(unsigned int i = 0; i < num; i++)
-		{
-			result.push_back(items[i]);
-		}
+	if (!result)
+	{
+		return false;
+	}
 
-		free(items);
+	items.reserve(num);
 
-		return result;
+	for(unsigned int i = 0; i < num; i++)
+	{
+		items.push_back(result[i]);
 	}
 
-	return vector<string>();
+	free(result);
+
+	return true;
 }
 
-bool XenStore::checkIfExist(const string& path)
+bool XenStore::checkIfExist(const string& path, xs_transaction_t transaction)
 {
 	unsigned length;
-	auto pData = xs_read(mXsHandle, XBT_NULL, path.c_str(), &length);
+	auto pData = xs_read(mXsHandle, transaction, path.c_str(), &length);
+
+	mNumReads.inc();
 
 	if (!pData)
 	{
@@ -197,52 +298,223 @@ bool XenStore::checkIfExist(const string& path)
 	return true;
 }
 
-void XenStore::setWatch(const string& path, WatchCallback callback)
+xs_transaction_t XenStore::beginTransaction()
+{
+	auto transaction = xs_transaction_start(mXsHandle);
+
+	if (transaction == XBT_NULL)
+	{
+		throw XenStoreException("Can't start transaction", errno);
+	}
+
+	DLOG(mLog, DEBUG) << "Begin transaction: " << transaction;
+
+	return transaction;
+}
+
+bool XenStore::commitTransaction(xs_transaction_t transaction)
+{
+	DLOG(mLog, DEBUG) << "Commit transaction: " << transaction;
+
+	mNumTransactions.inc();
+
+	if (!xs_transaction_end(mXsHandle, transaction, false))
+	{
+		if (errno == EAGAIN)
+		{
+			mNumConflicts.inc();
+
+			return false;
+		}
+
+		throw XenStoreException("Can't commit transaction", errno);
+	}
+
+	return true;
+}
+
+void XenStore::abortTransaction(xs_transaction_t transaction)
+{
+	DLOG(mLog, DEBUG) << "Abort transaction: " << transaction;
+
+	if (!xs_transaction_end(mXsHandle, transaction, true))
+	{
+		LOG(mLog, ERROR) << "Failed to abort transaction: " << transaction;
+	}
+}
+
+void XenStore::runTransaction(TransactionCallback callback,
+							  unsigned int maxRetries)
+{
+	for (unsigned int i = 0; i <= maxRetries; i++)
+	{
+		auto transaction = beginTransaction();
+
+		try
+		{
+			callback(transaction);
+		}
+		catch(const std::exception& e)
+		{
+			abortTransaction(transaction);
+
+			throw;
+		}
+
+		if (commitTransaction(transaction))
+		{
+			return;
+		}
+
+		LOG(mLog, DEBUG) << "Transaction conflict, retry: " << i + 1;
+	}
+
+	throw XenStoreException("Transaction retries exceeded", EAGAIN);
+}
+
+void XenStore::setWatch(const string& path, WatchCallback callback,
+						milliseconds coalesceWindow)
 {
 	lock_guard<mutex> lock(mMutex);
 
 	LOG(mLog, DEBUG) << "Set watch: " << path;
 
-	if (!xs_watch(mXsHandle, path.c_str(), path.c_str()))
+	// xenstored rejects the second xs watch with the same path and token
+
+	if (!isXsWatched(path) && !xs_watch(mXsHandle, path.c_str(), path.c_str()))
 	{
 		throw XenStoreException("Can't set xs watch for " + path, errno);
 	}
 
-	mWatches[path] = callback;
+	addWatch(path, callback, true, coalesceWindow);
 }
 
-void XenStore::clearWatch(const string& path)
+void XenStore::setChildWatch(const string& path, WatchCallback callback,
+							 milliseconds coalesceWindow)
 {
 	lock_guard<mutex> lock(mMutex);
 
+	LOG(mLog, DEBUG) << "Set child watch: " << path;
+
+	addWatch(path, callback, false, coalesceWindow);
+}
+
+void XenStore::clearWatch(const string& path)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	auto it = mWatchPaths.find(path);
+
+	if (it == mWatchPaths.end())
+	{
+		return;
+	}
+
 	LOG(mLog, DEBUG) << "Clear watch: " << path;
 
-	if (!xs_unwatch(mXsHandle, path.c_str(), path.c_str()))
+	if (it->second && !mListenerPaths.count(path) &&
+		!xs_unwatch(mXsHandle, path.c_str(), path.c_str()))
 	{
 		LOG(mLog, ERROR) << "Failed to clear watch: " << path;
 	}
 
-	mWatches.erase(path);
+	removeWatch(path);
+
+	mPendingWatches.erase(path);
+
+	waitDispatch(lock, path);
 }
 
 void XenStore::clearWatches()
 {
-	lock_guard<mutex> lock(mMutex);
+	unique_lock<mutex> lock(mMutex);
 
-	if (mWatches.size())
+	if (mWatchPaths.size() || mListeners.size())
 	{
 		LOG(mLog, DEBUG) << "Clear watches";
 
-		for (auto watch : mWatches)
+		for (auto watch : mWatchPaths)
 		{
-			if (!xs_unwatch(mXsHandle, watch.first.c_str(), watch.first.c_str()))
+			if (watch.second && !xs_unwatch(mXsHandle, watch.first.c_str(),
+											watch.first.c_str()))
 			{
 				LOG(mLog, ERROR) << "Failed to clear watch: " << watch.first;
 			}
 		}
 
-		mWatches.clear();
+		for (auto listenerPath : mListenerPaths)
+		{
+			auto it = mWatchPaths.find(listenerPath.first);
+
+			if ((it == mWatchPaths.end() || !it->second) &&
+				!xs_unwatch(mXsHandle, listenerPath.first.c_str(),
+							listenerPath.first.c_str()))
+			{
+				LOG(mLog, ERROR) << "Failed to clear watch: "
+								 << listenerPath.first;
+			}
+		}
+
+		mWatchPaths.clear();
+		mPendingWatches.clear();
+		mListeners.clear();
+		mListenerPaths.clear();
+		mWatches.children.clear();
+		mWatches.callback = nullptr;
+	}
+
+	waitDispatch(lock, "");
+}
+
+uint64_t XenStore::addWatchListener(const string& path,
+									WatchCallback callback)
+{
+	lock_guard<mutex> lock(mMutex);
+
+	LOG(mLog, DEBUG) << "Add watch listener: " << path;
+
+	if (!isXsWatched(path) && !xs_watch(mXsHandle, path.c_str(), path.c_str()))
+	{
+		throw XenStoreException("Can't set xs watch for " + path, errno);
+	}
+
+	auto id = ++mNextListener;
+
+	mListeners[id] = { path, callback };
+	mListenerPaths[path]++;
+
+	return id;
+}
+
+void XenStore::removeWatchListener(uint64_t id)
+{
+	unique_lock<mutex> lock(mMutex);
+
+	auto it = mListeners.find(id);
+
+	if (it == mListeners.end())
+	{
+		return;
+	}
+
+	auto path = it->second.path;
+
+	LOG(mLog, DEBUG) << "Remove watch listener: " << path;
+
+	mListeners.erase(it);
+
+	if (--mListenerPaths[path] == 0)
+	{
+		mListenerPaths.erase(path);
+
+		if (!isXsWatched(path) &&
+			!xs_unwatch(mXsHandle, path.c_str(), path.c_str()))
+		{
+			LOG(mLog, ERROR) << "Failed to clear watch: " << path;
+		}
 	}
+
+	waitDispatch(lock, path, id);
 }
 
 void XenStore::start()
@@ -257,6 +529,8 @@ void XenStore::start()
 	mStarted = true;
 
 	mThread = thread(&XenStore::watchesThread, this);
+
+	mThreadAttributes.tryApply(mThread);
 }
 
 void XenStore::stop()
@@ -312,9 +586,10 @@ void XenStore::release()
 string XenStore::readXsWatch(string& token)
 {
 	string path;
-	unsigned int num;
 
-	auto result = xs_read_watch(mXsHandle, &num);
+	// doesn't block as the poll may return on the coalesce timeout
+
+	auto result = xs_check_watch(mXsHandle);
 
 	if (result)
 	{
@@ -327,32 +602,339 @@ string XenStore::readXsWatch(string& token)
 	return path;
 }
 
-XenStore::WatchCallback XenStore::getWatchCallback(const string& path)
+vector<string> XenStore::splitPath(const string& path)
+{
+	vector<string> result;
+
+	size_t begin = 0;
+
+	// leading empty component distinguishes absolute paths from relative
+
+	if (!path.empty() && path[0] == '/')
+	{
+		result.push_back("");
+		begin = 1;
+	}
+
+	while (begin < path.length())
+	{
+		auto end = path.find('/', begin);
+
+		if (end == string::npos)
+		{
+			end = path.length();
+		}
+
+		if (end > begin)
+		{
+			result.push_back(path.substr(begin, end - begin));
+		}
+
+		begin = end + 1;
+	}
+
+	return result;
+}
+
+void XenStore::addWatch(const string& path, WatchCallback callback,
+						bool ownWatch, milliseconds coalesceWindow)
+{
+	auto node = &mWatches;
+
+	for (auto& component : splitPath(path))
+	{
+		auto& child = node->children[component];
+
+		if (!child)
+		{
+			child.reset(new WatchNode());
+		}
+
+		node = child.get();
+	}
+
+	node->path = path;
+	node->callback = callback;
+	node->ownWatch = ownWatch;
+	node->coalesceWindow = coalesceWindow;
+
+	mWatchPaths[path] = ownWatch;
+}
+
+void XenStore::removeWatch(const string& path)
+{
+	vector<WatchNode*> nodes = { &mWatches };
+
+	auto components = splitPath(path);
+
+	for (auto& component : components)
+	{
+		auto it = nodes.back()->children.find(component);
+
+		if (it == nodes.back()->children.end())
+		{
+			return;
+		}
+
+		nodes.push_back(it->second.get());
+	}
+
+	auto node = nodes.back();
+
+	node->callback = nullptr;
+	node->ownWatch = false;
+
+	mWatchPaths.erase(path);
+
+	// remove nodes which are not used anymore
+
+	for (size_t i = components.size(); i > 0; i--)
+	{
+		if (nodes[i]->callback || !nodes[i]->children.empty())
+		{
+			break;
+		}
+
+		nodes[i - 1]->children.erase(components[i - 1]);
+	}
+}
+
+XenStore::WatchCallbacks XenStore::getWatchCallbacks(const string& path,
+													 const string& token)
 {
 	lock_guard<mutex> lock(mMutex);
 
-	WatchCallback callback = nullptr;
-/*
-	auto result = find_if(mWatches.begin(), mWatches.end(),
-						  [&path] (const pair<string, WatchCallback> &val)
-						  { return path.compare(0, val.first.length(),
-						                           val.first) == 0; });
-*/
-	auto result = mWatches.find(path);
+	WatchCallbacks callbacks;
+
+	auto components = splitPath(path);
+	auto tokenComponents = splitPath(token);
+	auto tokenDepth = tokenComponents.size();
+
+	// the watch may be triggered for the token path itself when its parent
+	// is removed
+
+	if (components.size() < tokenDepth ||
+		!equal(tokenComponents.begin(), tokenComponents.end(),
+			   components.begin()))
+	{
+		components = tokenComponents;
+	}
+
+	auto node = &mWatches;
+
+	for (size_t i = 0; i < components.size(); i++)
+	{
+		auto it = node->children.find(components[i]);
+
+		if (it == node->children.end())
+		{
+			break;
+		}
+
+		node = it->second.get();
+
+		if (i + 1 < tokenDepth)
+		{
+			continue;
+		}
+
+		if (i + 1 == tokenDepth)
+		{
+			if (node->path != token || !node->callback)
+			{
+				break;
+			}
+		}
+		else if (node->ownWatch)
+		{
+			// child entries of own watch are handled by its events
+
+			break;
+		}
+
+		if (node->callback)
+		{
+			callbacks.push_back({node->path, node->callback,
+								 node->coalesceWindow, 0});
+		}
+	}
+
+	// listeners are notified by the events of own xs watch only
+
+	if (mListenerPaths.count(token))
+	{
+		for (auto& listener : mListeners)
+		{
+			if (listener.second.path == token)
+			{
+				callbacks.push_back({token, listener.second.callback,
+									 milliseconds(0), listener.first});
+			}
+		}
+	}
+
+	return callbacks;
+}
+
+void XenStore::dispatchWatch(const WatchEntry& watch, const string& path)
+{
+	if (watch.coalesceWindow.count())
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mPendingWatches.find(watch.path);
+
+		if (it != mPendingWatches.end())
+		{
+			mNumCoalescedEvents.inc();
+
+			return;
+		}
+
+		mPendingWatches[watch.path] = { watch.callback,
+										steady_clock::now() +
+										watch.coalesceWindow };
+
+		return;
+	}
+
+	LOG(mLog, DEBUG) << "Watch triggered: " << watch.path
+					 << ", path: " << path;
+
+	runWatch(watch);
+}
+
+void XenStore::runWatch(const WatchEntry& watch)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		// the watch may be cleared after its callback is taken
+
+		if (watch.listener ? !mListeners.count(watch.listener) :
+			mWatchPaths.find(watch.path) == mWatchPaths.end())
+		{
+			return;
+		}
+
+		mDispatchingPath = watch.path;
+		mDispatchingListener = watch.listener;
+		mDispatching = true;
+	}
+
+	try
+	{
+		watch.callback(watch.path);
+	}
+	catch(...)
+	{
+		endDispatch();
+
+		throw;
+	}
+
+	endDispatch();
+}
+
+void XenStore::endDispatch()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mDispatching = false;
+	mDispatchingPath.clear();
+	mDispatchingListener = 0;
+
+	mDispatchCondVar.notify_all();
+}
+
+void XenStore::waitDispatch(unique_lock<mutex>& lock, const string& path,
+							uint64_t listener)
+{
+	// the callback may clear own watch
+
+	if (std::this_thread::get_id() == mThread.get_id())
+	{
+		return;
+	}
+
+	mDispatchCondVar.wait(lock, [this, &path, listener] {
+		return !mDispatching || (!path.empty() &&
+			   (mDispatchingPath != path || mDispatchingListener != listener));
+	});
+}
+
+bool XenStore::isXsWatched(const string& path) const
+{
+	auto it = mWatchPaths.find(path);
+
+	return (it != mWatchPaths.end() && it->second) ||
+		   mListenerPaths.count(path);
+}
+
+XenStore::WatchCallbacks XenStore::getExpiredWatches()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	WatchCallbacks callbacks;
+
+	auto now = steady_clock::now();
+
+	for (auto it = mPendingWatches.begin(); it != mPendingWatches.end();)
+	{
+		if (it->second.deadline <= now)
+		{
+			callbacks.push_back({it->first, it->second.callback,
+								 milliseconds(0), 0});
+
+			it = mPendingWatches.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+
+	return callbacks;
+}
+
+int XenStore::getPollTimeout()
+{
+	lock_guard<mutex> lock(mMutex);
 
-	if (result != mWatches.end())
+	if (mPendingWatches.empty())
 	{
-		callback = result->second;
+		return -1;
 	}
 
-	return callback;
+	auto deadline = mPendingWatches.begin()->second.deadline;
+
+	for (auto& pending : mPendingWatches)
+	{
+		if (pending.second.deadline < deadline)
+		{
+			deadline = pending.second.deadline;
+		}
+	}
+
+	auto now = steady_clock::now();
+
+	if (deadline <= now)
+	{
+		return 0;
+	}
+
+	// round up to not wake up before the deadline
+
+	return duration_cast<milliseconds>(deadline - now +
+									   milliseconds(1) -
+									   steady_clock::duration(1)).count();
 }
 
 void XenStore::watchesThread()
 {
 	try
 	{
-		while(mPollFd->poll())
+		while(mPollFd->poll(getPollTimeout()))
 		{
 			string token;
 
@@ -360,15 +942,21 @@ void XenStore::watchesThread()
 
 			if (!token.empty())
 			{
-				auto callback = getWatchCallback(token);
+				mNumWatchEvents.inc();
 
-				if (callback)
+				for (auto& watch : getWatchCallbacks(path, token))
 				{
-					LOG(mLog, DEBUG) << "Watch triggered: " << token;
-
-					callback(token);
+					dispatchWatch(watch, path);
 				}
 			}
+
+			for (auto& watch : getExpiredWatches())
+			{
+				LOG(mLog, DEBUG) << "Coalesced watch triggered: "
+								 << watch.path;
+
+				runWatch(watch);
+			}
 		}
 	}
 	catch(const std::exception& e)
@@ -384,4 +972,123 @@ void XenStore::watchesThread()
 	}
 }
 
+/*******************************************************************************
+ * XenStoreCache
+ ******************************************************************************/
+
+XenStoreCache::XenStoreCache(XenStore& xenStore, const string& path) :
+	mXenStore(xenStore),
+	mPath(path),
+	mListener(0),
+	mGeneration(0)
+{
+	mListener = mXenStore.addWatchListener(mPath,
+										   [this] (const string&) {
+		invalidate();
+	});
+}
+
+XenStoreCache::~XenStoreCache()
+{
+	mXenStore.removeWatchListener(mListener);
+}
+
+/*******************************************************************************
+ * Public
+ ******************************************************************************/
+
+int XenStoreCache::readInt(const string& path)
+{
+	return stoi(readString(path));
+}
+
+unsigned int XenStoreCache::readUint(const string& path)
+{
+	return stoul(readString(path));
+}
+
+string XenStoreCache::readString(const string& path)
+{
+	string result;
+
+	if (!tryReadString(path, result))
+	{
+		throw XenStoreException("Can't read from: " + path, errno);
+	}
+
+	return result;
+}
+
+bool XenStoreCache::tryReadString(const string& path, string& value)
+{
+	if (!isCached(path))
+	{
+		return mXenStore.tryReadString(path, value);
+	}
+
+	uint64_t generation;
+
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mEntries.find(path);
+
+		if (it != mEntries.end())
+		{
+			mNumHits.inc();
+
+			value = it->second;
+
+			return true;
+		}
+
+		mNumMisses.inc();
+
+		generation = mGeneration;
+	}
+
+	if (!mXenStore.tryReadString(path, value))
+	{
+		return false;
+	}
+
+	lock_guard<mutex> lock(mMutex);
+
+	// don't store the value if the subtree was changed during reading
+
+	if (generation == mGeneration)
+	{
+		mEntries[path] = value;
+	}
+
+	return true;
+}
+
+void XenStoreCache::invalidate()
+{
+	lock_guard<mutex> lock(mMutex);
+
+	mGeneration++;
+
+	mEntries.clear();
+}
+
+size_t XenStoreCache::size() const
+{
+	lock_guard<mutex> lock(mMutex);
+
+	return mEntries.size();
+}
+
+/*******************************************************************************
+ * Private
+ ******************************************************************************/
+
+bool XenStoreCache::isCached(const string& path) const
+{
+	return path.compare(0, mPath.length(), mPath) == 0 &&
+		   (path.length() == mPath.length() || path[mPath.length()] == '/' ||
+			mPath.back() == '/');
+}
+
 }
@@ -104,11 +104,21 @@ void XenCtrlMock::addDomInfo(const xc_domaininfo_t& info)
 	if (it != sDomInfos.end())
 	{
 		*it = info;
+
+		return;
 	}
 
 	sDomInfos.push_back(info);
 }
 
+void XenCtrlMock::removeDomInfo(domid_t domId)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	sDomInfos.remove_if([&domId](const xc_domaininfo_t& item)
+						{ return item.domain == domId; });
+}
+
 int XenCtrlMock::getDomInfos(domid_t firstDom, unsigned int maxDoms,
 							 xc_domaininfo_t* info)
 {
@@ -118,12 +128,7 @@ int XenCtrlMock::getDomInfos(domid_t firstDom, unsigned int maxDoms,
 
 	auto it = find_if(sDomInfos.begin(), sDomInfos.end(),
 					 [&firstDom](const xc_domaininfo_t& item)
-					 { return item.domain == firstDom; });
-
-	if (it == sDomInfos.end())
-	{
-		it = sDomInfos.begin();
-	}
+					 { return item.domain >= firstDom; });
 
 	for(; it != sDomInfos.end(); it++)
 	{
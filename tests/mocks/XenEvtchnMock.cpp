@@ -125,6 +125,8 @@ int xenevtchn_unmask(xenevtchn_handle* xce, evtchn_port_t port)
 		return -1;
 	}
 
+	xce->mock->unmask(port);
+
 	return 0;
 }
 
@@ -169,6 +171,13 @@ void XenEvtchnMock::signalPort(evtchn_port_t port)
 
 	auto client = getClientByPort(port);
 
+	if (client->mMaskedPorts.count(port))
+	{
+		client->mHeldPorts.insert(port);
+
+		return;
+	}
+
 	client->mSignaledPorts.push_back(port);
 
 	client->mPipe.write();
@@ -243,9 +252,25 @@ evtchn_port_t XenEvtchnMock::getPendingPort()
 
 	mPipe.read();
 
+	mMaskedPorts.insert(port);
+
 	return port;
 }
 
+void XenEvtchnMock::unmask(evtchn_port_t port)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	mMaskedPorts.erase(port);
+
+	if (mHeldPorts.erase(port))
+	{
+		mSignaledPorts.push_back(port);
+
+		mPipe.write();
+	}
+}
+
 /*******************************************************************************
  * Private
 
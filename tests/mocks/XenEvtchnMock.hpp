@@ -24,6 +24,7 @@
 #include <functional>
 #include <list>
 #include <mutex>
+#include <unordered_set>
 
 extern "C" {
 #include <xenctrl.h>
@@ -73,6 +74,7 @@ public:
 	void unbind(evtchn_port_t port);
 	void notifyPort(evtchn_port_t port);
 	evtchn_port_t getPendingPort();
+	void unmask(evtchn_port_t port);
 
 private:
 
@@ -93,6 +95,10 @@ private:
 	Pipe mPipe;
 
 	std::list<evtchn_port_t> mSignaledPorts;
+	// as the kernel driver does, the port is masked when it is returned by
+	// pending and signals of the masked port are held till it is unmasked
+	std::unordered_set<evtchn_port_t> mMaskedPorts;
+	std::unordered_set<evtchn_port_t> mHeldPorts;
 	std::list<BoundPort> mBoundPorts;
 
 	NotifyCbk mNotifyCbk;
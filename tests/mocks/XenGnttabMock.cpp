@@ -21,10 +21,15 @@
 #include "XenGnttabMock.hpp"
 
 #include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
 
 extern "C" {
 #include <xenctrl.h>
 #include <xengnttab.h>
+#include <xen/grant_table.h>
 }
 
 #include "Exception.hpp"
@@ -32,6 +37,8 @@ extern "C" {
 using std::lock_guard;
 using std::mutex;
 using std::unordered_map;
+using std::unordered_set;
+using std::vector;
 
 using XenBackend::Exception;
 
@@ -86,7 +93,21 @@ void* xengnttab_map_domain_grant_refs(xengnttab_handle* xgt,
 		return nullptr;
 	}
 
-	return xgt->mock->mapGrantRefs(count, domid, refs);
+	return xgt->mock->mapGrantRefs(count, domid, refs, prot);
+}
+
+void* xengnttab_map_grant_refs(xengnttab_handle* xgt,
+							   uint32_t count,
+							   uint32_t *domids,
+							   uint32_t *refs,
+							   int prot)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		return nullptr;
+	}
+
+	return xgt->mock->mapGrantRefs(count, domids[0], refs, prot);
 }
 
 int xengnttab_unmap(xengnttab_handle* xgt, void* start_address, uint32_t count)
@@ -101,6 +122,152 @@ int xengnttab_unmap(xengnttab_handle* xgt, void* start_address, uint32_t count)
 	return 0;
 }
 
+int xengnttab_grant_copy(xengnttab_handle* xgt, uint32_t count,
+						 xengnttab_grant_copy_segment_t* segs)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		errno = EIO;
+
+		return -1;
+	}
+
+	auto invalidRef = XenGnttabMock::getInvalidRef();
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		auto& seg = segs[i];
+
+		if (((seg.flags & GNTCOPY_source_gref) &&
+			 seg.source.foreign.ref == invalidRef) ||
+			((seg.flags & GNTCOPY_dest_gref) &&
+			 seg.dest.foreign.ref == invalidRef))
+		{
+			seg.status = GNTST_bad_gntref;
+
+			continue;
+		}
+
+		uint8_t* src = static_cast<uint8_t*>(seg.source.virt);
+		uint8_t* dst = static_cast<uint8_t*>(seg.dest.virt);
+
+		if (seg.flags & GNTCOPY_source_gref)
+		{
+			src = static_cast<uint8_t*>(XenGnttabMock::getForeignPage(
+					seg.source.foreign.domid, seg.source.foreign.ref)) +
+					seg.source.foreign.offset;
+		}
+
+		if (seg.flags & GNTCOPY_dest_gref)
+		{
+			dst = static_cast<uint8_t*>(XenGnttabMock::getForeignPage(
+					seg.dest.foreign.domid, seg.dest.foreign.ref)) +
+					seg.dest.foreign.offset;
+		}
+
+		memcpy(dst, src, seg.len);
+
+		seg.status = GNTST_okay;
+	}
+
+	return 0;
+}
+
+xengntshr_handle* xengntshr_open(xentoollog_logger* logger,
+								 unsigned open_flags)
+{
+	return xengnttab_open(logger, open_flags);
+}
+
+int xengntshr_close(xengntshr_handle* xgs)
+{
+	return xengnttab_close(xgs);
+}
+
+void* xengntshr_share_pages(xengntshr_handle* xgs, uint32_t domid, int count,
+							uint32_t* refs, int writable)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		return nullptr;
+	}
+
+	return xgs->mock->sharePages(count, domid, refs, writable);
+}
+
+int xengntshr_unshare(xengntshr_handle* xgs, void* start_address,
+					  uint32_t count)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		return -1;
+	}
+
+	xgs->mock->unmapGrantRefs(start_address, count);
+
+	return 0;
+}
+
+#ifdef WITH_DMABUF
+
+int xengnttab_dmabuf_exp_from_refs(xengnttab_handle* xgt, uint32_t domid,
+								   uint32_t flags, uint32_t count,
+								   const uint32_t* refs, uint32_t* fd)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	int newFd = open("/dev/null", O_RDONLY);
+
+	if (newFd < 0)
+	{
+		return -1;
+	}
+
+	*fd = newFd;
+
+	XenGnttabMock::addDmaBuf(newFd);
+
+	return 0;
+}
+
+int xengnttab_dmabuf_exp_wait_released(xengnttab_handle* xgt, uint32_t fd,
+									   uint32_t wait_to_ms)
+{
+	return XenGnttabMock::removeDmaBuf(fd) ? 0 : -1;
+}
+
+int xengnttab_dmabuf_imp_to_refs(xengnttab_handle* xgt, uint32_t domid,
+								 uint32_t fd, uint32_t count, uint32_t* refs)
+{
+	if (XenGnttabMock::getErrorMode())
+	{
+		errno = EINVAL;
+
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		refs[i] = i + 1;
+	}
+
+	XenGnttabMock::addDmaBuf(fd);
+
+	return 0;
+}
+
+int xengnttab_dmabuf_imp_release(xengnttab_handle* xgt, uint32_t fd)
+{
+	return XenGnttabMock::removeDmaBuf(fd) ? 0 : -1;
+}
+
+#endif
+
 /*******************************************************************************
  * XenGnttabMock
  ******************************************************************************/
@@ -109,17 +276,21 @@ mutex XenGnttabMock::sMutex;
 void* XenGnttabMock::sLastMappedAddress = nullptr;
 unordered_map<void*, XenGnttabMock::MapBuffer> XenGnttabMock::sMapBuffers;
 bool XenGnttabMock::sErrorMode = false;
+unordered_map<uint64_t, vector<uint8_t>> XenGnttabMock::sForeignPages;
+uint32_t XenGnttabMock::sInvalidRef = UINT32_MAX;
+uint32_t XenGnttabMock::sNextSharedRef = 1;
+unordered_set<int> XenGnttabMock::sDmaBufs;
 
 /*******************************************************************************
  * Public
  ******************************************************************************/
 
 void* XenGnttabMock::mapGrantRefs(uint32_t count, uint32_t domId,
-								  uint32_t *refs)
+								  uint32_t *refs, int prot)
 {
 	lock_guard<mutex> lock(sMutex);
 
-	MapBuffer buffer = { count, domId, count * XC_PAGE_SIZE };
+	MapBuffer buffer = { count, domId, count * XC_PAGE_SIZE, prot };
 
 	void* address = calloc(1, buffer.size);
 
@@ -130,6 +301,22 @@ void* XenGnttabMock::mapGrantRefs(uint32_t count, uint32_t domId,
 	return address;
 }
 
+void* XenGnttabMock::sharePages(uint32_t count, uint32_t domId, uint32_t* refs,
+								int writable)
+{
+	auto address = mapGrantRefs(count, domId, refs,
+								writable ? PROT_READ | PROT_WRITE : PROT_READ);
+
+	lock_guard<mutex> lock(sMutex);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		refs[i] = sNextSharedRef++;
+	}
+
+	return address;
+}
+
 void XenGnttabMock::unmapGrantRefs(void* address, uint32_t count)
 {
 	lock_guard<mutex> lock(sMutex);
@@ -165,9 +352,58 @@ size_t XenGnttabMock::getMapBufferSize(void* address)
 	return it->second.size;
 }
 
+int XenGnttabMock::getMapBufferProt(void* address)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto it = sMapBuffers.find(address);
+
+	if (it == sMapBuffers.end())
+	{
+		throw Exception("Buffer not found", ENOENT);
+	}
+
+	return it->second.prot;
+}
+
 size_t XenGnttabMock::checkMapBuffers()
 {
 	lock_guard<mutex> lock(sMutex);
 
 	return sMapBuffers.size();
 }
+
+void* XenGnttabMock::getForeignPage(uint32_t domId, uint32_t ref)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	auto& page = sForeignPages[(static_cast<uint64_t>(domId) << 32) | ref];
+
+	if (page.empty())
+	{
+		page.resize(XC_PAGE_SIZE);
+	}
+
+	return page.data();
+}
+
+void XenGnttabMock::addDmaBuf(int fd)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	sDmaBufs.insert(fd);
+}
+
+bool XenGnttabMock::removeDmaBuf(int fd)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	return sDmaBufs.erase(fd) != 0;
+}
+
+size_t XenGnttabMock::getNumDmaBufs()
+{
+	lock_guard<mutex> lock(sMutex);
+
+	return sDmaBufs.size();
+}
@@ -21,8 +21,11 @@
 #ifndef TESTS_MOCKS_XENGNTTABMOCK_HPP_
 #define TESTS_MOCKS_XENGNTTABMOCK_HPP_
 
+#include <cstdint>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class XenGnttabMock
 {
@@ -48,10 +51,32 @@ public:
 	}
 
 	static size_t getMapBufferSize(void* address);
+	static int getMapBufferProt(void* address);
 	static size_t checkMapBuffers();
 
-	void* mapGrantRefs(uint32_t count, uint32_t domId, uint32_t *refs);
+	static void* getForeignPage(uint32_t domId, uint32_t ref);
+
+	static void addDmaBuf(int fd);
+	static bool removeDmaBuf(int fd);
+	static size_t getNumDmaBufs();
+	static void setInvalidRef(uint32_t ref)
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		sInvalidRef = ref;
+	}
+	static uint32_t getInvalidRef()
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		return sInvalidRef;
+	}
+
+	void* mapGrantRefs(uint32_t count, uint32_t domId, uint32_t *refs,
+					   int prot);
 	void unmapGrantRefs(void* address, uint32_t count);
+	void* sharePages(uint32_t count, uint32_t domId, uint32_t* refs,
+					 int writable);
 
 private:
 
@@ -60,12 +85,17 @@ private:
 		uint32_t count;
 		uint32_t domId;
 		size_t size;
+		int prot;
 	};
 
 	static std::mutex sMutex;
 	static bool sErrorMode;
 	static void* sLastMappedAddress;
 	static std::unordered_map<void*, MapBuffer> sMapBuffers;
+	static std::unordered_map<uint64_t, std::vector<uint8_t>> sForeignPages;
+	static uint32_t sInvalidRef;
+	static uint32_t sNextSharedRef;
+	static std::unordered_set<int> sDmaBufs;
 };
 
 #endif /* TESTS_MOCKS_XENGNTTABMOCK_HPP_ */
@@ -21,6 +21,7 @@
 #include "XenStoreMock.hpp"
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 
@@ -32,7 +33,9 @@ extern "C" {
 using std::find;
 using std::list;
 using std::lock_guard;
+using std::make_pair;
 using std::mutex;
+using std::pair;
 using std::string;
 using std::unordered_map;
 using std::vector;
@@ -154,6 +157,13 @@ char **xs_directory(xs_handle* h, xs_transaction_t t,
 		return nullptr;
 	}
 
+	if (!h->mock->readValue(path))
+	{
+		errno = ENOENT;
+
+		return nullptr;
+	}
+
 	auto result = h->mock->readDirectory(path);
 
 	size_t totalLength = 0;
@@ -186,6 +196,33 @@ char **xs_directory(xs_handle* h, xs_transaction_t t,
 	return value;
 }
 
+xs_transaction_t xs_transaction_start(xs_handle* h)
+{
+	if (XenStoreMock::getErrorMode())
+	{
+		return XBT_NULL;
+	}
+
+	return h->mock->startTransaction();
+}
+
+bool xs_transaction_end(xs_handle* h, xs_transaction_t t, bool abort)
+{
+	if (XenStoreMock::getErrorMode())
+	{
+		return false;
+	}
+
+	if (!h->mock->endTransaction(t, abort))
+	{
+		errno = EAGAIN;
+
+		return false;
+	}
+
+	return true;
+}
+
 bool xs_watch(xs_handle* h, const char* path, const char* token)
 {
 	if (XenStoreMock::getErrorMode())
@@ -214,26 +251,28 @@ char **xs_read_watch(struct xs_handle *h, unsigned int *num)
 	}
 
 	char** value = nullptr;
-	string path;
+	string path, token;
 
-	while (h->mock->getChangedEntry(path))
+	if (h->mock->getChangedEntry(path, token))
 	{
-		size_t totalLength = 2 * sizeof(char*) + 2 * (path.length() + 1);
+		size_t totalLength = 2 * sizeof(char*) + path.length() + 1 +
+							 token.length() + 1;
 
 		value = static_cast<char**>(malloc(totalLength));
 		char* pos = reinterpret_cast<char*>(&value[2]);
 
-		value[0] = pos;
+		value[XS_WATCH_PATH] = pos;
+
+		strcpy(pos, path.c_str());
 
-		strcpy(value[0], path.c_str());
+		value[XS_WATCH_TOKEN] = pos + path.length() + 1;
 
-		value[1] = pos + path.length() + 1;
+		strcpy(value[XS_WATCH_TOKEN], token.c_str());
 
-		strcpy(value[1], path.c_str());
+		*num = 2;
 	}
 
 	return value;
-
 }
 
 char** xs_check_watch(xs_handle* h)
@@ -244,20 +283,23 @@ char** xs_check_watch(xs_handle* h)
 	}
 
 	char** value = nullptr;
-	string path;
+	string path, token;
 
-	if (h->mock->getChangedEntry(path))
+	if (h->mock->getChangedEntry(path, token))
 	{
-		size_t totalLength = 2 * sizeof(char*) + path.length() + 1;
+		size_t totalLength = 2 * sizeof(char*) + path.length() + 1 +
+							 token.length() + 1;
 
 		value = static_cast<char**>(malloc(totalLength));
 		char* pos = reinterpret_cast<char*>(&value[2]);
 
-		value[0] = pos;
+		value[XS_WATCH_PATH] = pos;
 
 		strcpy(pos, path.c_str());
 
-		value[1] = nullptr;
+		value[XS_WATCH_TOKEN] = pos + path.length() + 1;
+
+		strcpy(value[XS_WATCH_TOKEN], token.c_str());
 	}
 
 	return value;
@@ -276,8 +318,10 @@ list<XenStoreMock*> XenStoreMock::sClients;
 
 XenStoreMock::Callback XenStoreMock::sCallback;
 mutex XenStoreMock::sMutex;
+int XenStoreMock::sNumConflicts = 0;
 
-XenStoreMock::XenStoreMock()
+XenStoreMock::XenStoreMock() :
+	mNextTransaction(XBT_NULL)
 {
 	sClients.push_back(this);
 }
@@ -312,6 +356,27 @@ const char* XenStoreMock::getDomainPath(unsigned int domId)
 	return nullptr;
 }
 
+xs_transaction_t XenStoreMock::startTransaction()
+{
+	lock_guard<mutex> lock(sMutex);
+
+	return ++mNextTransaction;
+}
+
+bool XenStoreMock::endTransaction(xs_transaction_t t, bool abort)
+{
+	lock_guard<mutex> lock(sMutex);
+
+	if (!abort && sNumConflicts > 0)
+	{
+		sNumConflicts--;
+
+		return false;
+	}
+
+	return true;
+}
+
 void XenStoreMock::writeValue(const string& path, const string& value)
 {
 	lock_guard<mutex> lock(sMutex);
@@ -416,12 +481,21 @@ bool XenStoreMock::watch(const std::string& path)
 {
 	lock_guard<mutex> lock(sMutex);
 
-	if (find(mWatches.begin(), mWatches.end(), path) == mWatches.end())
+	// xenstored rejects the same watch registered twice
+
+	if (find(mWatches.begin(), mWatches.end(), path) != mWatches.end())
 	{
-		mWatches.push_back(path);
+		errno = EEXIST;
+
+		return false;
 	}
 
-	pushWatch(path);
+	mWatches.push_back(path);
+
+	// xenstored fires the watch once it is registered
+
+	mChangedEntries.push_back(make_pair(path, path));
+	mPipe.write();
 
 	return true;
 }
@@ -442,13 +516,14 @@ bool XenStoreMock::unwatch(const std::string& path)
 	return false;
 }
 
-bool XenStoreMock::getChangedEntry(std::string& path)
+bool XenStoreMock::getChangedEntry(string& path, string& token)
 {
 	lock_guard<mutex> lock(sMutex);
 
 	if (mChangedEntries.size())
 	{
-		path = mChangedEntries.front();
+		path = mChangedEntries.front().first;
+		token = mChangedEntries.front().second;
 
 		mChangedEntries.pop_front();
 
@@ -460,15 +535,22 @@ bool XenStoreMock::getChangedEntry(std::string& path)
 	return false;
 }
 
-void XenStoreMock::pushWatch(const std::string& path)
+void XenStoreMock::pushWatch(const string& path)
 {
+	// as xenstored, fire watches set for the path and for its parents
+
 	for(auto client : sClients)
 	{
-		if (find(client->mWatches.begin(), client->mWatches.end(), path) !=
-			client->mWatches.end())
+		for(auto watch : client->mWatches)
 		{
-			client->mChangedEntries.push_back(path);
-			client->mPipe.write();
+			if (path.compare(0, watch.length(), watch) == 0 &&
+				(path.length() == watch.length() ||
+				 path[watch.length()] == '/' || watch.back() == '/'))
+			{
+				client->mChangedEntries.push_back(make_pair(path, watch));
+				client->mPipe.write();
+			}
 		}
 	}
 }
+
@@ -21,11 +21,13 @@
 #ifndef TESTS_MOCKS_XENSTOREMOCK_HPP_
 #define TESTS_MOCKS_XENSTOREMOCK_HPP_
 
+#include <cstdint>
 #include <functional>
 #include <list>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "../../tests/mocks/Pipe.hpp"
@@ -56,10 +58,19 @@ public:
 	static bool deleteEntry(const std::string& path);
 	static std::vector<std::string> readDirectory(const std::string& path);
 
+	static void setTransactionConflicts(int numConflicts)
+	{
+		std::lock_guard<std::mutex> lock(sMutex);
+
+		sNumConflicts = numConflicts;
+	}
+
 	int getFd() const { return mPipe.getFd(); }
+	uint32_t startTransaction();
+	bool endTransaction(uint32_t t, bool abort);
 	bool watch(const std::string& path);
 	bool unwatch(const std::string& path);
-	bool getChangedEntry(std::string& path);
+	bool getChangedEntry(std::string& path, std::string& token);
 
 	typedef std::function<void(const std::string& path,
 							   const std::string& value)> Callback;
@@ -79,11 +90,13 @@ private:
 	static std::unordered_map<std::string, std::string> sEntries;
 	static std::list<XenStoreMock*> sClients;
 	static Callback sCallback;
+	static int sNumConflicts;
 
 	Pipe mPipe;
+	uint32_t mNextTransaction;
 
 	std::list<std::string> mWatches;
-	std::list<std::string> mChangedEntries;
+	std::list<std::pair<std::string, std::string>> mChangedEntries;
 
 	static void pushWatch(const std::string& path);
 };
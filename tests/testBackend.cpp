@@ -2,9 +2,12 @@
 #define CATCH_CONFIG_RUNNER
 #define CATCH_CONFIG_COLOUR_NONE
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <thread>
 
 #include "catch.hpp"
 
@@ -16,16 +19,22 @@
 #include "testBackend.hpp"
 #include "testFrontendHandler.hpp"
 
+using std::atomic_bool;
 using std::chrono::milliseconds;
 using std::condition_variable;
 using std::mutex;
 using std::string;
+using std::thread;
+using std::this_thread::sleep_for;
 using std::to_string;
 using std::unique_lock;
+using std::unique_ptr;
 
 using XenBackend::FrontendHandlerPtr;
 using XenBackend::Log;
 using XenBackend::LogLevel;
+using XenBackend::WorkerPool;
+using XenBackend::WorkerPoolPtr;
 
 static mutex gMutex;
 static condition_variable gCondVar;
@@ -39,6 +48,35 @@ static bool gNewFrontend = false;
 static domid_t gNewFrontDomId = 0;
 static uint16_t gNewFrontDevId = 0;
 
+static mutex gClosingMutex;
+static condition_variable gClosingCondVar;
+static bool gBlockClosing = false;
+static bool gClosingDone = false;
+static bool gSharedStore = false;
+
+// frontend handler which stop may be blocked to simulate a stuck frontend
+
+class StuckFrontendHandler : public TestFrontendHandler
+{
+public:
+
+	using TestFrontendHandler::TestFrontendHandler;
+
+private:
+
+	void onClosing() override
+	{
+		unique_lock<mutex> lock(gClosingMutex);
+
+		gClosingCondVar.wait_for(lock, milliseconds(2000),
+								 [] { return !gBlockClosing; });
+
+		gClosingDone = true;
+
+		gClosingCondVar.notify_all();
+	}
+};
+
 void TestBackend::onNewFrontend(domid_t domId, uint16_t devId)
 {
 	unique_lock<mutex> lock(gMutex);
@@ -47,10 +85,19 @@ void TestBackend::onNewFrontend(domid_t domId, uint16_t devId)
 	gNewFrontDevId = devId;
 
 
-	FrontendHandlerPtr frontendHandler(new TestFrontendHandler(gDevName,
-															   getDomId(),
-															   domId,
-															   devId));
+	FrontendHandlerPtr frontendHandler;
+
+	if (gSharedStore)
+	{
+		frontendHandler.reset(new StuckFrontendHandler(gDevName, getDomId(),
+													   domId, devId,
+													   getXenStore()));
+	}
+	else
+	{
+		frontendHandler.reset(new StuckFrontendHandler(gDevName, getDomId(),
+													   domId, devId));
+	}
 
 	addFrontendHandler(frontendHandler);
 
@@ -107,9 +154,192 @@ TEST_CASE("BackendHandler", "[backendhandler]")
 		REQUIRE(gNewFrontDevId == gFrontDevId);
 	}
 
+	SECTION("Check removing frontend")
+	{
+		REQUIRE(waitForFrontend());
+
+		string bePath = "/local/domain/" + to_string(gDomId) + "/backend/" +
+						gDevName + "/" + to_string(gFrontDomId) + "/" +
+						to_string(gFrontDevId);
+
+		for (auto item : XenStoreMock::readDirectory(bePath))
+		{
+			XenStoreMock::deleteEntry(bePath + "/" + item);
+		}
+
+		sleep_for(milliseconds(100));
+
+		// the frontend should be detected again as new one
+
+		TestFrontendHandler::prepareXenStore(gDevName,
+											 gDomId, gFrontDomId,
+											 gFrontDevId);
+
+		REQUIRE(waitForFrontend());
+	}
+
+	SECTION("Check stats")
+	{
+		REQUIRE(waitForFrontend());
+
+		auto stats = testBackend.getStats();
+
+		REQUIRE(stats.numFrontends == 1);
+
+		testBackend.setStatsInterval(milliseconds(10));
+
+		sleep_for(milliseconds(100));
+
+		string statsPath = "/local/domain/" + to_string(gDomId) +
+						   "/backend-stats/" + gDevName + "/";
+
+		auto value = XenStoreMock::readValue(statsPath + "frontends");
+
+		REQUIRE(value != nullptr);
+		REQUIRE(string(value) == "1");
+		REQUIRE(XenStoreMock::readValue(statsPath + "latency-p99-us"));
+
+		// requests per second is published as floating point value
+
+		value = XenStoreMock::readValue(statsPath + "requests-per-sec");
+
+		REQUIRE(value != nullptr);
+		REQUIRE(string(value).find('.') != string::npos);
+	}
+
+	SECTION("Check shutdown")
+	{
+		REQUIRE(waitForFrontend());
+
+		auto result = testBackend.shutdown(milliseconds(1000));
+
+		REQUIRE(result.numStopped == 1);
+		REQUIRE(result.failed.empty());
+		REQUIRE(result.timedOut.empty());
+		REQUIRE(testBackend.getStats().numFrontends == 0);
+	}
+
 	testBackend.stop();
 }
 
+TEST_CASE("BackendHandlerWorkerPool", "[backendhandler]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	TestFrontendHandler::prepareXenStore(gDevName,
+										 gDomId, gFrontDomId,
+										 gFrontDevId);
+
+	TestBackend testBackend(gDevName);
+
+	gNewFrontend = false;
+	gNewFrontDomId = 0;
+	gNewFrontDevId = 0;
+
+	testBackend.setWorkerPool(WorkerPoolPtr(new WorkerPool(2)));
+
+	testBackend.start();
+
+	REQUIRE(waitForFrontend());
+
+	REQUIRE(gNewFrontDomId == gFrontDomId);
+	REQUIRE(gNewFrontDevId == gFrontDevId);
+
+	// the queue of the removed frontend is dropped, the frontend which
+	// appears again gets new one
+
+	string bePath = "/local/domain/" + to_string(gDomId) + "/backend/" +
+					gDevName + "/" + to_string(gFrontDomId) + "/" +
+					to_string(gFrontDevId);
+
+	for (auto item : XenStoreMock::readDirectory(bePath))
+	{
+		XenStoreMock::deleteEntry(bePath + "/" + item);
+	}
+
+	sleep_for(milliseconds(100));
+
+	REQUIRE(testBackend.getStats().numFrontends == 0);
+
+	TestFrontendHandler::prepareXenStore(gDevName,
+										 gDomId, gFrontDomId,
+										 gFrontDevId);
+
+	REQUIRE(waitForFrontend());
+
+	auto result = testBackend.shutdown(milliseconds(1000));
+
+	REQUIRE(result.numStopped == 1);
+	REQUIRE(result.timedOut.empty());
+}
+
+TEST_CASE("BackendHandlerShutdownTimeout", "[backendhandler]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	TestFrontendHandler::prepareXenStore(gDevName,
+										 gDomId, gFrontDomId,
+										 gFrontDevId);
+
+	// the stuck frontend uses the backend xen store
+
+	gSharedStore = true;
+
+	unique_ptr<TestBackend> testBackend(new TestBackend(gDevName));
+
+	gNewFrontend = false;
+
+	testBackend->start();
+
+	REQUIRE(waitForFrontend());
+
+	{
+		unique_lock<mutex> lock(gClosingMutex);
+
+		gBlockClosing = true;
+		gClosingDone = false;
+	}
+
+	auto result = testBackend->shutdown(milliseconds(100));
+
+	REQUIRE(result.numStopped == 0);
+	REQUIRE(result.timedOut.size() == 1);
+
+	// the destructor waits for the stuck frontend
+
+	atomic_bool deleted(false);
+
+	thread deleteThread([&testBackend, &deleted] {
+		testBackend.reset();
+
+		deleted = true;
+	});
+
+	sleep_for(milliseconds(100));
+
+	REQUIRE_FALSE(deleted);
+
+	{
+		unique_lock<mutex> lock(gClosingMutex);
+
+		gBlockClosing = false;
+
+		gClosingCondVar.notify_all();
+	}
+
+	deleteThread.join();
+
+	REQUIRE(gClosingDone);
+
+	gSharedStore = false;
+}
+
 int main( int argc, char* argv[] )
 {
 	Log::setLogMask("*:Disable");
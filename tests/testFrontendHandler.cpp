@@ -44,6 +44,7 @@ using std::unique_lock;
 using XenBackend::FrontendHandlerBase;
 using XenBackend::RingBufferInBase;
 using XenBackend::RingBufferPtr;
+using XenBackend::XenStore;
 
 static mutex gMutex;
 static condition_variable gCondVar;
@@ -54,6 +55,7 @@ static const char* gDevName = "test_device";
 
 static XenbusState gBeState = XenbusStateUnknown;
 static bool gOnBind = false;
+static bool gRingReused = false;
 static std::list<XenbusState> gBeStates;
 
 TestFrontendHandler::~TestFrontendHandler()
@@ -89,7 +91,14 @@ void TestFrontendHandler::prepareXenStore(const string& devName,
 
 void TestFrontendHandler::onBind()
 {
-	RingBufferPtr ringBuffer(new TestRingBufferIn(gDomId, 12, 165));
+	auto ringBuffer = takeRingBuffer(12, 165);
+
+	gRingReused = ringBuffer != nullptr;
+
+	if (!ringBuffer)
+	{
+		ringBuffer.reset(new TestRingBufferIn(gDomId, 12, 165));
+	}
 
 	addRingBuffer(ringBuffer);
 
@@ -296,3 +305,133 @@ TEST_CASE("FrontendHandler", "[frontendhandler]")
 		frontendHandler.stop();
 	}
 }
+
+TEST_CASE("FrontendHandlerWarmReconnect", "[frontendhandler]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	TestFrontendHandler::prepareXenStore(gDevName, 0, gDomId, gDevId);
+
+	gBeStates.clear();
+	gOnBind = false;
+	gRingReused = false;
+
+	XenStoreMock storeMock;
+
+	TestFrontendHandler frontendHandler(gDevName, 0, gDomId, gDevId);
+
+	auto fePath = frontendHandler.getXsFrontendPath();
+	auto bePath = frontendHandler.getXsBackendPath();
+
+	storeMock.setWriteValueCbk([&] (const string& path, const string& value)
+		{ if (path == bePath + "/state") {
+			backendStateChanged(static_cast<XenbusState>(stoi(value))); }});
+
+	frontendHandler.setWarmReconnect(true);
+	frontendHandler.start();
+
+	storeMock.writeValue(fePath + "/state", to_string(XenbusStateInitialising));
+
+	REQUIRE(waitBeStateChanged());
+	REQUIRE(gBeState == XenbusStateInitWait);
+
+	storeMock.writeValue(fePath + "/state", to_string(XenbusStateInitialised));
+
+	REQUIRE(waitBeStateChanged());
+	REQUIRE(gBeState == XenbusStateConnected);
+	REQUIRE(gOnBind);
+	REQUIRE_FALSE(gRingReused);
+
+	auto restart = [&] {
+		storeMock.writeValue(fePath + "/state",
+							 to_string(XenbusStateInitialising));
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateClosing);
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateClosed);
+
+		REQUIRE(waitBeStateChanged());
+		REQUIRE(gBeState == XenbusStateInitWait);
+
+		REQUIRE(frontendHandler.getNumRingBuffers() == 0);
+
+		gOnBind = false;
+	};
+
+	// frontend restart without confirmation creates new ring buffer
+	restart();
+
+	storeMock.writeValue(fePath + "/state", to_string(XenbusStateInitialised));
+
+	REQUIRE(waitBeStateChanged());
+	REQUIRE(gBeState == XenbusStateConnected);
+	REQUIRE(gOnBind);
+	REQUIRE_FALSE(gRingReused);
+
+	auto buffer = XenGnttabMock::getLastBuffer();
+
+	// frontend confirms that the ring pages are kept
+	restart();
+
+	storeMock.writeValue(fePath + "/ring-kept",
+						 storeMock.readValue(bePath + "/ring-generation"));
+	storeMock.writeValue(fePath + "/state", to_string(XenbusStateInitialised));
+
+	REQUIRE(waitBeStateChanged());
+	REQUIRE(gBeState == XenbusStateConnected);
+	REQUIRE(gOnBind);
+	REQUIRE(gRingReused);
+	REQUIRE(XenGnttabMock::getLastBuffer() == buffer);
+	REQUIRE(frontendHandler.getNumRingBuffers() == 1);
+
+	frontendHandler.stop();
+}
+
+TEST_CASE("FrontendHandlerSharedXenStore", "[frontendhandler]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+	XenStoreMock::setWriteValueCbk(nullptr);
+
+	TestFrontendHandler::prepareXenStore(gDevName, 0, gDomId, gDevId);
+
+	XenStore xenStore;
+
+	string path = "/local/domain/0/shared";
+	bool watchTriggered = false;
+
+	xenStore.setWatch(path, [&watchTriggered] (const string&) {
+		unique_lock<mutex> lock(gMutex);
+
+		watchTriggered = true;
+
+		gCondVar.notify_all();
+	});
+
+	xenStore.start();
+
+	{
+		TestFrontendHandler frontendHandler(gDevName, 0, gDomId, gDevId,
+											xenStore);
+
+		REQUIRE(&frontendHandler.getXenStore() == &xenStore);
+
+		frontendHandler.start();
+		frontendHandler.stop();
+	}
+
+	// watches of other users should be kept and xen store should be running
+
+	XenStoreMock::writeValue(path, "Changed");
+
+	unique_lock<mutex> lock(gMutex);
+
+	REQUIRE(gCondVar.wait_for(lock, milliseconds(1000),
+							  [&watchTriggered] { return watchTriggered; }));
+}
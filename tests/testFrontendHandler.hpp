@@ -33,6 +33,13 @@ public:
 										beDomId, feDomId, devId)
 	{}
 
+	TestFrontendHandler(const std::string& devName,
+						domid_t beDomId, domid_t feDomId, uint16_t devId,
+						XenBackend::XenStore& xenStore) :
+		XenBackend::FrontendHandlerBase("TestFrontend", devName,
+										beDomId, feDomId, devId, xenStore)
+	{}
+
 	~TestFrontendHandler();
 
 	static void prepareXenStore(const std::string& devName,
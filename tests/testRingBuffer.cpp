@@ -20,9 +20,12 @@
 
 #include "testRingBuffer.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include "catch.hpp"
 
@@ -37,6 +40,8 @@ using std::unique_lock;
 
 using XenBackend::RingBufferInBase;
 using XenBackend::RingBufferOutBase;
+using XenBackend::WorkerPool;
+using XenBackend::WorkerPoolPtr;
 
 static domid_t gDomId = 3;
 static evtchn_port_t gPort = 65;
@@ -159,7 +164,7 @@ uint32_t calculateEvent(const xentest_evt& evt)
 }
 
 bool receiveEvent(xentest_event_page* eventPage, xentest_evt* eventBuffer,
-				  xentest_evt& evt)
+				  xentest_evt& evt, bool notify = true)
 {
 	uint32_t numEvents = XENTEST_IN_RING_SIZE / sizeof(xentest_evt);
 
@@ -169,7 +174,10 @@ bool receiveEvent(xentest_event_page* eventPage, xentest_evt* eventBuffer,
 
 		eventPage->in_cons++;
 
-		XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+		if (notify)
+		{
+			XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+		}
 
 		return true;
 	}
@@ -188,6 +196,72 @@ void TestRingBufferIn::processRequest(const xentest_req& req)
 	sendResponse(rsp);
 }
 
+void TestRingBufferInStatic::processRequest(const xentest_req& req)
+{
+	xentest_rsp rsp { req.id };
+
+	rsp.seq = req.seq;
+	rsp.status = 0;
+	rsp.u32data = calculateCommand(req);
+
+	sendResponse(rsp);
+}
+
+void TestRingBufferInBatch::processRequests(const xentest_req* reqs,
+											size_t count)
+{
+	mNumBatches++;
+	mNumRequests += count;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		xentest_rsp rsp { reqs[i].id };
+
+		rsp.seq = reqs[i].seq;
+		rsp.status = 0;
+		rsp.u32data = calculateCommand(reqs[i]);
+
+		sendResponse(rsp);
+	}
+}
+
+void TestRingBufferInPlace::processRequestInPlace(const xentest_req& req)
+{
+	auto seq = readOnce(req.seq);
+	auto value = readOnce(req.op.command2.u64data1);
+
+	constructResponse([seq, value](xentest_rsp& rsp) {
+		rsp.seq = seq;
+		rsp.status = 0;
+		rsp.u32data = value;
+	});
+}
+
+void TestRingBufferInAsync::processRequest(const xentest_req& req)
+{
+	xentest_rsp rsp { req.id };
+
+	rsp.seq = req.seq;
+	rsp.status = 0;
+	rsp.u32data = calculateCommand(req);
+
+	std::lock_guard<mutex> lock(mMutex);
+
+	mResponses.push_back(PendingResponse(deferResponse(), rsp));
+}
+
+std::vector<TestRingBufferInAsync::PendingResponse>
+TestRingBufferInAsync::takeResponses()
+{
+	std::lock_guard<mutex> lock(mMutex);
+
+	std::vector<PendingResponse> responses;
+
+	responses.swap(mResponses);
+
+	return responses;
+}
+
 void errorCallback(const std::exception& e)
 {
 	gError = true;
@@ -256,6 +330,15 @@ TEST_CASE("RingBufferIn", "[ringbuffer]")
 				REQUIRE_FALSE(gError);
 			}
 		}
+
+		auto metrics = ringBuffer.getMetrics();
+
+		REQUIRE(metrics.numRequests == 3000);
+		REQUIRE(metrics.numResponses == 3000);
+		REQUIRE(metrics.numBatches >= 1);
+		REQUIRE(metrics.numBatches <= 3000);
+		REQUIRE(metrics.latency.count == metrics.numBatches);
+		REQUIRE(metrics.numIndications >= 1);
 	}
 
 	SECTION("Check overflow")
@@ -271,6 +354,499 @@ TEST_CASE("RingBufferIn", "[ringbuffer]")
 	}
 }
 
+TEST_CASE("RingBufferInStatic", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestRingBufferInStatic ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_command1_req cmd1 {32, 32};
+	xentest_req req {XENTEST_CMD1};
+	req.op.command1 = cmd1;
+
+	for(int i = 0; i < 1000; i++)
+	{
+		req.seq = i;
+
+		sendReq(req, ring);
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+
+		REQUIRE(req.seq == rsp.seq);
+		REQUIRE(calculateCommand(req) == rsp.u32data);
+
+		REQUIRE_FALSE(gError);
+	}
+
+	REQUIRE(ringBuffer.getMetrics().numRequests == 1000);
+}
+
+TEST_CASE("RingBufferInMultiPage", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	std::vector<grant_ref_t> refs {gRef, gRef + 1, gRef + 2, gRef + 3};
+
+	TestRingBufferIn ringBuffer(gDomId, gPort, refs);
+
+	ringBuffer.setErrorCallback(errorCallback);
+
+	REQUIRE(ringBuffer.getRef() == gRef);
+	REQUIRE(ringBuffer.getRefs() == refs);
+
+	ringBuffer.start();
+
+	REQUIRE(XenGnttabMock::getMapBufferSize(XenGnttabMock::getLastBuffer()) ==
+			refs.size() * XC_PAGE_SIZE);
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, refs.size() * XC_PAGE_SIZE);
+
+	REQUIRE(RING_SIZE(&ring) > __CONST_RING_SIZE(xen_test, XC_PAGE_SIZE));
+
+	xentest_req req {XENTEST_CMD2};
+
+	for(int i = 0; i < 1000; i++)
+	{
+		req.seq = i;
+		req.op.command2.u64data1 = i;
+
+		sendReq(req, ring);
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+
+		REQUIRE(req.seq == rsp.seq);
+		REQUIRE(calculateCommand(req) == rsp.u32data);
+
+		REQUIRE_FALSE(gError);
+	}
+}
+
+TEST_CASE("RingBufferInWorkerPool", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	WorkerPoolPtr workerPool(new WorkerPool(2));
+
+	TestRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.setWorkerPool(workerPool);
+
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+
+	SECTION("Send and receive")
+	{
+		for(int i = 0; i < 1000; i++)
+		{
+			req.seq = i;
+			req.op.command2.u64data1 = i;
+
+			sendReq(req, ring);
+
+			xentest_rsp rsp {};
+
+			REQUIRE(receiveResp(rsp, ring));
+
+			REQUIRE(req.seq == rsp.seq);
+			REQUIRE(calculateCommand(req) == rsp.u32data);
+
+			REQUIRE_FALSE(gError);
+		}
+	}
+
+	SECTION("Check overflow")
+	{
+		sring->req_prod = ring.nr_ents + 1;
+
+		XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+		sleep_for(milliseconds(100));
+
+		REQUIRE(gError);
+	}
+}
+
+TEST_CASE("RingBufferInBatch", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestRingBufferInBatch ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	const int cNumRequests = 16;
+
+	xentest_req req {XENTEST_CMD2};
+
+	// put all requests to the ring and notify once
+	for (int i = 0; i < cNumRequests; i++)
+	{
+		req.seq = i;
+		req.op.command2.u64data1 = i;
+
+		*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+		ring.req_prod_pvt++;
+	}
+
+	RING_PUSH_REQUESTS(&ring);
+
+	XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+	xentest_rsp rsp {};
+
+	do
+	{
+		REQUIRE(receiveResp(rsp, ring));
+	}
+	while(rsp.seq != cNumRequests - 1);
+
+	REQUIRE(rsp.seq == cNumRequests - 1);
+	REQUIRE(ringBuffer.getNumBatches() == 1);
+	REQUIRE(ringBuffer.getNumRequests() == cNumRequests);
+	REQUIRE_FALSE(gError);
+}
+
+TEST_CASE("RingBufferInBatchResponses", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestRingBufferInBatch ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.setResponseBatchSize(64);
+
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	const int cNumRequests = 16;
+
+	xentest_req req {XENTEST_CMD2};
+
+	// put all requests to the ring and notify once
+	for (int i = 0; i < cNumRequests; i++)
+	{
+		req.seq = i;
+		req.op.command2.u64data1 = i;
+
+		*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+		ring.req_prod_pvt++;
+	}
+
+	RING_PUSH_REQUESTS(&ring);
+
+	XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+
+	xentest_rsp rsp {};
+
+	// all responses should be pushed at once
+	REQUIRE(receiveResp(rsp, ring));
+
+	REQUIRE(rsp.seq == cNumRequests - 1);
+	REQUIRE(ringBuffer.getNumBatches() == 1);
+	REQUIRE(ringBuffer.getNumRequests() == cNumRequests);
+	REQUIRE_FALSE(gError);
+}
+
+TEST_CASE("RingBufferInPlace", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestRingBufferInPlace ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+
+	for(int i = 0; i < 1000; i++)
+	{
+		req.seq = i;
+		req.op.command2.u64data1 = i;
+
+		sendReq(req, ring);
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+
+		REQUIRE(req.seq == rsp.seq);
+		REQUIRE(calculateCommand(req) == rsp.u32data);
+
+		REQUIRE_FALSE(gError);
+	}
+}
+
+static void takeResponses(TestRingBufferInAsync& ringBuffer,
+						  std::vector<TestRingBufferInAsync::PendingResponse>&
+								responses, size_t count)
+{
+	for (int i = 0; i < 1000 && responses.size() < count; i++)
+	{
+		auto taken = ringBuffer.takeResponses();
+
+		responses.insert(responses.end(), taken.begin(), taken.end());
+
+		if (responses.size() < count)
+		{
+			sleep_for(milliseconds(1));
+		}
+	}
+}
+
+TEST_CASE("RingBufferInAsync", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestRingBufferInAsync ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+
+	std::vector<TestRingBufferInAsync::PendingResponse> responses;
+
+	SECTION("Complete from other thread")
+	{
+		ringBuffer.start();
+
+		XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+									respNotification);
+
+		for(int i = 0; i < 3; i++)
+		{
+			req.seq = i;
+			req.op.command2.u64data1 = i * 10;
+
+			sendReq(req, ring);
+		}
+
+		takeResponses(ringBuffer, responses, 3);
+
+		REQUIRE(responses.size() == 3);
+		REQUIRE(ringBuffer.getNumPendingResponses() == 3);
+		REQUIRE(ring.sring->rsp_prod == 0);
+
+		// complete in reverse order from another thread
+
+		std::thread completeThread([&responses] {
+			for (auto it = responses.rbegin(); it != responses.rend(); ++it)
+			{
+				it->first.complete(it->second);
+			}
+		});
+
+		completeThread.join();
+
+		REQUIRE(ringBuffer.getNumPendingResponses() == 0);
+		REQUIRE_FALSE(responses[0].first.isValid());
+		REQUIRE_THROWS(responses[0].first.complete(responses[0].second));
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+		REQUIRE(ring.rsp_cons == 3);
+		REQUIRE(rsp.seq == 0);
+		REQUIRE(rsp.u32data == 0);
+		REQUIRE(RING_GET_RESPONSE(&ring, 0)->seq == 2);
+		REQUIRE(RING_GET_RESPONSE(&ring, 0)->u32data == 20);
+	}
+
+	SECTION("Check in-flight limit")
+	{
+		ringBuffer.setMaxInFlightRequests(2);
+		ringBuffer.start();
+
+		for(int i = 0; i < 5; i++)
+		{
+			req.seq = i;
+
+			sendReq(req, ring);
+		}
+
+		takeResponses(ringBuffer, responses, 2);
+
+		// let the ring consume more requests if it would
+
+		sleep_for(milliseconds(20));
+
+		takeResponses(ringBuffer, responses, 2);
+
+		REQUIRE(responses.size() == 2);
+		REQUIRE(ringBuffer.getNumInFlightRequests() == 2);
+		REQUIRE(ringBuffer.getMetrics().numThrottles >= 1);
+
+		// each completed response lets one more request in
+
+		for (size_t i = 0; i < 5; i++)
+		{
+			responses[i].first.complete(responses[i].second);
+
+			takeResponses(ringBuffer, responses, std::min<size_t>(i + 3, 5));
+
+			REQUIRE(responses.size() == std::min<size_t>(i + 3, 5));
+		}
+
+		REQUIRE(ringBuffer.getNumInFlightRequests() == 0);
+		REQUIRE(ring.sring->rsp_prod == 5);
+		REQUIRE(RING_GET_RESPONSE(&ring, 4)->seq == 4);
+	}
+
+	REQUIRE_FALSE(gError);
+}
+
+TEST_CASE("RingBufferInPolling", "[ringbuffer]")
+{
+	XenEvtchnMock::setErrorMode(false);
+	XenGnttabMock::setErrorMode(false);
+
+	gError = false;
+
+	TestRingBufferIn ringBuffer(gDomId, gPort, gRef);
+
+	ringBuffer.setErrorCallback(errorCallback);
+	ringBuffer.setPollBudget(std::chrono::microseconds(500000));
+
+	ringBuffer.start();
+
+	XenEvtchnMock::setNotifyCbk(XenEvtchnMock::getLastBoundPort(),
+								respNotification);
+
+	xen_test_front_ring ring;
+	auto sring = static_cast<xen_test_sring*>(XenGnttabMock::getLastBuffer());
+
+	SHARED_RING_INIT(sring);
+	FRONT_RING_INIT(&ring, sring, XC_PAGE_SIZE);
+
+	xentest_req req {XENTEST_CMD2};
+
+	for(int i = 0; i < 10; i++)
+	{
+		req.seq = i;
+		req.op.command2.u64data1 = i;
+
+		*RING_GET_REQUEST(&ring, ring.req_prod_pvt) = req;
+
+		ring.req_prod_pvt++;
+
+		int notify;
+
+		RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&ring, notify);
+
+		// only first request should require the notification
+		REQUIRE(notify == (i == 0));
+
+		if (notify)
+		{
+			XenEvtchnMock::signalPort(XenEvtchnMock::getLastBoundPort());
+		}
+
+		xentest_rsp rsp {};
+
+		REQUIRE(receiveResp(rsp, ring));
+
+		REQUIRE(req.seq == rsp.seq);
+		REQUIRE_FALSE(gError);
+	}
+
+	auto stats = ringBuffer.getPollStats();
+
+	REQUIRE(stats.numIndications == 1);
+	REQUIRE(stats.numPollHits == 9);
+}
+
 TEST_CASE("RingBufferOut", "[ringbuffer]")
 {
 	XenEvtchnMock::setErrorMode(false);
@@ -331,6 +907,284 @@ TEST_CASE("RingBufferOut", "[ringbuffer]")
 			}
 		}
 
+		auto metrics = ringBuffer.getMetrics();
+
+		REQUIRE(metrics.numEvents == 3000);
+		REQUIRE(metrics.numNotifications == 3000);
+		REQUIRE(metrics.numOverflows == 0);
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Send batch")
+	{
+		for(int i = 0; i < 1000; i++)
+		{
+			for(int j = 0; j < 3; j++)
+			{
+				events[j].seq = seqNumber++;
+			}
+
+			REQUIRE(ringBuffer.sendEvents(events, 3) == 3);
+
+			for(int j = 0; j < 3; j++)
+			{
+				xentest_evt receivedEvt {};
+
+				REQUIRE(receiveEvent(eventPage, eventBuffer, receivedEvt));
+
+				REQUIRE(events[j].seq == receivedEvt.seq);
+				REQUIRE(calculateEvent(events[j]) ==
+						calculateEvent(receivedEvt));
+			}
+		}
+
+		// overflow
+		std::vector<xentest_evt> batch(XENTEST_IN_RING_LEN + 1,
+									   events[0]);
+
+		REQUIRE(ringBuffer.sendEvents(batch.data(), batch.size()) ==
+				XENTEST_IN_RING_LEN);
+		REQUIRE_FALSE(ringBuffer.sendEvent(events[0]));
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Send from multiple producers")
+	{
+		const int cNumThreads = 4;
+		const int cNumEvents = 1000;
+
+		std::vector<std::thread> threads;
+
+		for (int i = 0; i < cNumThreads; i++)
+		{
+			threads.push_back(std::thread([&ringBuffer, i] {
+				for (int j = 0; j < cNumEvents; j++)
+				{
+					xentest_evt evt {XENTEST_EVT2};
+
+					evt.seq = j;
+					evt.op.event2.u64data1 = i;
+
+					while(!ringBuffer.sendEvent(evt))
+					{
+						sleep_for(milliseconds(1));
+					}
+				}
+			}));
+		}
+
+		std::vector<int> nextSeq(cNumThreads, 0);
+		int numReceived = 0;
+
+		while (numReceived < cNumThreads * cNumEvents)
+		{
+			xentest_evt receivedEvt {};
+
+			if (!receiveEvent(eventPage, eventBuffer, receivedEvt))
+			{
+				std::this_thread::yield();
+
+				continue;
+			}
+
+			auto producer = receivedEvt.op.event2.u64data1;
+
+			REQUIRE(producer < cNumThreads);
+			REQUIRE(receivedEvt.seq == nextSeq[producer]++);
+
+			numReceived++;
+		}
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Check backlog")
+	{
+		const int cNumExtra = 10;
+
+		ringBuffer.setOverflowPolicy(XenBackend::OverflowPolicy::BACKLOG, 100);
+
+		for (int i = 0; i < static_cast<int>(XENTEST_IN_RING_LEN) + cNumExtra;
+			 i++)
+		{
+			events[1].seq = i;
+
+			REQUIRE(ringBuffer.sendEvent(events[1]));
+		}
+
+		REQUIRE(ringBuffer.getOverflowStats().numSpilled == cNumExtra);
+		REQUIRE(ringBuffer.getOverflowStats().numDropped == 0);
+
+		int seq = 0;
+
+		for (int retry = 0; retry < 1000 &&
+			 seq < static_cast<int>(XENTEST_IN_RING_LEN) + cNumExtra; retry++)
+		{
+			xentest_evt receivedEvt {};
+
+			while (receiveEvent(eventPage, eventBuffer, receivedEvt))
+			{
+				REQUIRE(receivedEvt.seq == seq++);
+			}
+
+			sleep_for(milliseconds(1));
+		}
+
+		REQUIRE(seq == XENTEST_IN_RING_LEN + cNumExtra);
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Check backlog without notifications")
+	{
+		const int cNumExtra = 10;
+
+		ringBuffer.setOverflowPolicy(XenBackend::OverflowPolicy::BACKLOG, 100);
+
+		for (int i = 0; i < static_cast<int>(XENTEST_IN_RING_LEN) + cNumExtra;
+			 i++)
+		{
+			events[1].seq = i;
+
+			REQUIRE(ringBuffer.sendEvent(events[1]));
+		}
+
+		REQUIRE(ringBuffer.getOverflowStats().numSpilled == cNumExtra);
+
+		// the frontend consumes events without notifications, the backlog
+		// is drained by the timer
+
+		int seq = 0;
+
+		for (int retry = 0; retry < 1000 &&
+			 seq < static_cast<int>(XENTEST_IN_RING_LEN) + cNumExtra; retry++)
+		{
+			xentest_evt receivedEvt {};
+
+			while (receiveEvent(eventPage, eventBuffer, receivedEvt, false))
+			{
+				REQUIRE(receivedEvt.seq == seq++);
+			}
+
+			sleep_for(milliseconds(1));
+		}
+
+		REQUIRE(seq == XENTEST_IN_RING_LEN + cNumExtra);
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Check drop oldest")
+	{
+		const int cBacklogSize = 5;
+		const int cNumExtra = 10;
+
+		// without backlog it would behave as drop newest
+
+		REQUIRE_THROWS(ringBuffer.setOverflowPolicy(
+				XenBackend::OverflowPolicy::DROP_OLDEST));
+
+		ringBuffer.setOverflowPolicy(XenBackend::OverflowPolicy::DROP_OLDEST,
+									 cBacklogSize);
+
+		for (int i = 0; i < static_cast<int>(XENTEST_IN_RING_LEN) + cNumExtra;
+			 i++)
+		{
+			events[1].seq = i;
+
+			REQUIRE(ringBuffer.sendEvent(events[1]));
+		}
+
+		auto stats = ringBuffer.getOverflowStats();
+
+		REQUIRE(stats.numSpilled == cNumExtra);
+		REQUIRE(stats.numDropped == cNumExtra - cBacklogSize);
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Check block")
+	{
+		ringBuffer.setOverflowPolicy(XenBackend::OverflowPolicy::BLOCK, 0,
+									 milliseconds(10));
+
+		REQUIRE(ringBuffer.sendEvents(events, 1) == 1);
+
+		std::vector<xentest_evt> batch(XENTEST_IN_RING_LEN - 1, events[0]);
+
+		REQUIRE(ringBuffer.sendEvents(batch.data(), batch.size()) ==
+				batch.size());
+
+		// ring is full, wait for timeout
+		REQUIRE_FALSE(ringBuffer.sendEvent(events[0]));
+		REQUIRE(ringBuffer.getOverflowStats().numDropped == 1);
+
+		ringBuffer.setOverflowPolicy(XenBackend::OverflowPolicy::BLOCK, 0,
+									 milliseconds(1000));
+
+		std::thread consumer([eventPage, eventBuffer] {
+			sleep_for(milliseconds(20));
+
+			xentest_evt receivedEvt {};
+
+			receiveEvent(eventPage, eventBuffer, receivedEvt);
+		});
+
+		REQUIRE(ringBuffer.sendEvent(events[0]));
+
+		consumer.join();
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Construct in place")
+	{
+		for(int i = 0; i < 1000; i++)
+		{
+			ringBuffer.constructEvent([i](xentest_evt& evt) {
+				evt.id = XENTEST_EVT2;
+				evt.seq = i;
+				evt.op.event2.u64data1 = i;
+			});
+
+			xentest_evt receivedEvt {};
+
+			REQUIRE(receiveEvent(eventPage, eventBuffer, receivedEvt));
+
+			REQUIRE(receivedEvt.seq == i);
+			REQUIRE(calculateEvent(receivedEvt) == i);
+			REQUIRE_FALSE(gError);
+		}
+
+		ringBuffer.stop();
+	}
+
+	SECTION("Check construct failure")
+	{
+		REQUIRE_THROWS(ringBuffer.constructEvent([](xentest_evt& evt) {
+			evt.id = XENTEST_EVT2;
+			evt.seq = 1;
+
+			throw std::runtime_error("construct failed");
+		}));
+
+		xentest_evt receivedEvt {};
+
+		// nothing is published on failure
+
+		REQUIRE_FALSE(receiveEvent(eventPage, eventBuffer, receivedEvt));
+
+		REQUIRE(ringBuffer.sendEvent(events[0]));
+		REQUIRE(receiveEvent(eventPage, eventBuffer, receivedEvt));
+		REQUIRE(receivedEvt.id == XENTEST_EVT1);
+
 		ringBuffer.stop();
 	}
 }
@@ -21,6 +21,11 @@
 #ifndef TESTS_TESTRINGBUFFER_HPP_
 #define TESTS_TESTRINGBUFFER_HPP_
 
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 #include "RingBufferBase.hpp"
 
 extern "C" {
@@ -38,6 +43,12 @@ public:
 						 	 	 	 xentest_req, xentest_rsp>
 		(domId, port, ref) {}
 
+	TestRingBufferIn(domid_t domId, evtchn_port_t port,
+					 const std::vector<grant_ref_t>& refs) :
+		XenBackend::RingBufferInBase<xen_test_back_ring, xen_test_sring,
+									 xentest_req, xentest_rsp>
+		(domId, port, refs) {}
+
 	~TestRingBufferIn() { stop(); }
 
 private:
@@ -45,6 +56,96 @@ private:
 	void processRequest(const xentest_req& req) override;
 };
 
+class TestRingBufferInStatic final : public XenBackend::RingBufferInBase<
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp,
+									TestRingBufferInStatic>
+{
+public:
+
+	TestRingBufferInStatic(domid_t domId, evtchn_port_t port,
+						   grant_ref_t ref) :
+		XenBackend::RingBufferInBase<xen_test_back_ring, xen_test_sring,
+									 xentest_req, xentest_rsp,
+									 TestRingBufferInStatic>
+		(domId, port, ref) {}
+
+	~TestRingBufferInStatic() { stop(); }
+
+	// called directly by the base class
+	void processRequest(const xentest_req& req) override;
+};
+
+class TestRingBufferInBatch : public XenBackend::RingBufferInBase<
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>
+{
+public:
+
+	TestRingBufferInBatch(domid_t domId, evtchn_port_t port, grant_ref_t ref) :
+		XenBackend::RingBufferInBase<xen_test_back_ring, xen_test_sring,
+									 xentest_req, xentest_rsp>
+		(domId, port, ref), mNumBatches(0), mNumRequests(0) {}
+
+	~TestRingBufferInBatch() { stop(); }
+
+	size_t getNumBatches() const { return mNumBatches; }
+	size_t getNumRequests() const { return mNumRequests; }
+
+private:
+
+	std::atomic<size_t> mNumBatches;
+	std::atomic<size_t> mNumRequests;
+
+	void processRequests(const xentest_req* reqs, size_t count) override;
+};
+
+class TestRingBufferInPlace : public XenBackend::RingBufferInBase<
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>
+{
+public:
+
+	TestRingBufferInPlace(domid_t domId, evtchn_port_t port, grant_ref_t ref) :
+		XenBackend::RingBufferInBase<xen_test_back_ring, xen_test_sring,
+									 xentest_req, xentest_rsp>
+		(domId, port, ref)
+	{
+		setInPlace(true);
+	}
+
+	~TestRingBufferInPlace() { stop(); }
+
+private:
+
+	void processRequestInPlace(const xentest_req& req) override;
+};
+
+class TestRingBufferInAsync : public XenBackend::RingBufferInBase<
+									xen_test_back_ring, xen_test_sring,
+									xentest_req, xentest_rsp>
+{
+public:
+
+	TestRingBufferInAsync(domid_t domId, evtchn_port_t port, grant_ref_t ref) :
+		XenBackend::RingBufferInBase<xen_test_back_ring, xen_test_sring,
+									 xentest_req, xentest_rsp>
+		(domId, port, ref) {}
+
+	~TestRingBufferInAsync() { stop(); }
+
+	typedef std::pair<ResponseToken, xentest_rsp> PendingResponse;
+
+	std::vector<PendingResponse> takeResponses();
+
+private:
+
+	std::mutex mMutex;
+	std::vector<PendingResponse> mResponses;
+
+	void processRequest(const xentest_req& req) override;
+};
+
 class TestRingBufferOut : public XenBackend::RingBufferOutBase<
 									xentest_event_page, xentest_evt>
 {
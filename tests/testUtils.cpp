@@ -0,0 +1,479 @@
+/*
+ *  Test Utils
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "catch.hpp"
+
+#include "Arena.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+
+using std::atomic_bool;
+using std::atomic_int;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::string;
+using std::thread;
+using std::this_thread::sleep_for;
+using std::unique_ptr;
+using std::vector;
+
+using XenBackend::Arena;
+using XenBackend::ArenaAllocator;
+using XenBackend::AsyncContext;
+using XenBackend::Exception;
+using XenBackend::LatencyHistogram;
+using XenBackend::PollFd;
+using XenBackend::ThreadAttributes;
+using XenBackend::Timer;
+using XenBackend::TraceBuffer;
+using XenBackend::TraceEntry;
+using XenBackend::TracePoint;
+
+TEST_CASE("Timer", "[utils]")
+{
+	atomic_int numCalls(0);
+
+	SECTION("Check single shot")
+	{
+		Timer timer([&numCalls] { numCalls++; });
+
+		timer.start(milliseconds(10));
+
+		REQUIRE_THROWS_AS(timer.start(milliseconds(10)), Exception);
+
+		sleep_for(milliseconds(50));
+
+		REQUIRE(numCalls == 1);
+
+		// restart after firing
+
+		timer.start(milliseconds(10));
+
+		sleep_for(milliseconds(50));
+
+		REQUIRE(numCalls == 2);
+	}
+
+	SECTION("Check periodic")
+	{
+		Timer timer([&numCalls] { numCalls++; }, true);
+
+		timer.start(milliseconds(10));
+
+		sleep_for(milliseconds(105));
+
+		timer.stop();
+
+		int result = numCalls;
+
+		REQUIRE(result >= 5);
+		REQUIRE(result <= 11);
+
+		sleep_for(milliseconds(30));
+
+		REQUIRE(numCalls == result);
+	}
+
+	SECTION("Check stop")
+	{
+		Timer timer([&numCalls] { numCalls++; });
+
+		timer.start(milliseconds(20));
+		timer.stop();
+
+		sleep_for(milliseconds(50));
+
+		REQUIRE(numCalls == 0);
+	}
+
+	SECTION("Check many timers")
+	{
+		const int cNumTimers = 1000;
+
+		vector<unique_ptr<Timer>> timers;
+
+		for (int i = 0; i < cNumTimers; i++)
+		{
+			timers.emplace_back(new Timer([&numCalls] { numCalls++; }));
+
+			// timers after the wheel round
+
+			timers.back()->start(milliseconds(i % 2 ? 5 : 1100));
+		}
+
+		sleep_for(milliseconds(100));
+
+		REQUIRE(numCalls == cNumTimers / 2);
+
+		sleep_for(milliseconds(1100));
+
+		REQUIRE(numCalls == cNumTimers);
+	}
+}
+
+TEST_CASE("PollFd", "[utils]")
+{
+	int pipe1[2], pipe2[2];
+
+	REQUIRE(pipe(pipe1) == 0);
+	REQUIRE(pipe(pipe2) == 0);
+
+	uint8_t data = 0;
+
+	SECTION("Check single fd")
+	{
+		PollFd pollFd(pipe1[0], POLLIN);
+
+		REQUIRE(write(pipe1[1], &data, sizeof(data)) == sizeof(data));
+
+		REQUIRE(pollFd.poll());
+
+		REQUIRE(read(pipe1[0], &data, sizeof(data)) == sizeof(data));
+
+		pollFd.stop();
+
+		REQUIRE_FALSE(pollFd.poll());
+	}
+
+	SECTION("Check multiple fds")
+	{
+		PollFd pollFd;
+		vector<int> readyFds;
+
+		auto callback = [&readyFds, &data] (int fd, short int revents) {
+			REQUIRE((revents & POLLIN));
+			REQUIRE(read(fd, &data, sizeof(data)) == sizeof(data));
+
+			readyFds.push_back(fd);
+		};
+
+		pollFd.addFd(pipe1[0], POLLIN, callback);
+		pollFd.addFd(pipe2[0], POLLIN, callback);
+
+		REQUIRE(write(pipe2[1], &data, sizeof(data)) == sizeof(data));
+
+		REQUIRE(pollFd.poll());
+		REQUIRE(readyFds.size() == 1);
+		REQUIRE(readyFds[0] == pipe2[0]);
+
+		pollFd.removeFd(pipe2[0]);
+
+		REQUIRE(write(pipe2[1], &data, sizeof(data)) == sizeof(data));
+		REQUIRE(write(pipe1[1], &data, sizeof(data)) == sizeof(data));
+
+		REQUIRE(pollFd.poll());
+		REQUIRE(readyFds.size() == 2);
+		REQUIRE(readyFds[1] == pipe1[0]);
+
+		pollFd.stop();
+
+		REQUIRE_FALSE(pollFd.poll());
+	}
+
+	SECTION("Check remove while dispatching")
+	{
+		PollFd pollFd;
+		atomic_bool entered(false);
+		atomic_bool finished(false);
+
+		pollFd.addFd(pipe1[0], POLLIN,
+					 [&entered, &finished, &data] (int fd, short int) {
+			REQUIRE(read(fd, &data, sizeof(data)) == sizeof(data));
+
+			entered = true;
+
+			sleep_for(milliseconds(100));
+
+			finished = true;
+		});
+
+		REQUIRE(write(pipe1[1], &data, sizeof(data)) == sizeof(data));
+
+		thread pollThread([&pollFd] { pollFd.poll(); });
+
+		while (!entered)
+		{
+			sleep_for(milliseconds(1));
+		}
+
+		// the running callback is finished when removeFd() returns
+
+		pollFd.removeFd(pipe1[0]);
+
+		REQUIRE(finished);
+
+		pollThread.join();
+	}
+
+	close(pipe1[0]);
+	close(pipe1[1]);
+	close(pipe2[0]);
+	close(pipe2[1]);
+}
+
+TEST_CASE("LatencyHistogram", "[utils]")
+{
+	LatencyHistogram histogram;
+
+	REQUIRE(histogram.get().getPercentile(99) == 0);
+
+	for (int i = 0; i < 99; i++)
+	{
+		histogram.record(microseconds(1));
+	}
+
+	histogram.record(microseconds(1000));
+
+	auto snapshot = histogram.get();
+
+	REQUIRE(snapshot.count == 100);
+	REQUIRE(snapshot.sumUs == 1099);
+	REQUIRE(snapshot.getAverage() == 10);
+	REQUIRE(snapshot.getPercentile(50) == 2);
+	REQUIRE(snapshot.getPercentile(99) == 2);
+	REQUIRE(snapshot.getPercentile(100) == 1024);
+
+	snapshot += histogram.get();
+
+	REQUIRE(snapshot.count == 200);
+	REQUIRE(snapshot.getPercentile(99.9) == 1024);
+}
+
+TEST_CASE("TraceBuffer", "[utils]")
+{
+	auto& traceBuffer = TraceBuffer::getInstance();
+	vector<TraceEntry> entries;
+
+	traceBuffer.clear();
+	traceBuffer.getEntries(entries);
+
+	REQUIRE(entries.empty());
+
+	SECTION("Check order")
+	{
+		traceBuffer.record(TracePoint::EVENT_RECEIVED, 3, 3);
+		traceBuffer.record(TracePoint::REQUESTS_DEQUEUED, 3, 8);
+		traceBuffer.record(TracePoint::RESPONSES_PUSHED, 3, 8);
+
+		traceBuffer.getEntries(entries);
+
+		REQUIRE(entries.size() == 3);
+		REQUIRE(entries[0].point == TracePoint::EVENT_RECEIVED);
+		REQUIRE(entries[1].point == TracePoint::REQUESTS_DEQUEUED);
+		REQUIRE(entries[1].port == 3);
+		REQUIRE(entries[1].arg == 8);
+		REQUIRE(entries[2].point == TracePoint::RESPONSES_PUSHED);
+		REQUIRE(entries[0].time <= entries[2].time);
+	}
+
+	SECTION("Check overwrite")
+	{
+		for (uint32_t i = 0; i < TraceBuffer::cNumEntries + 10; i++)
+		{
+			traceBuffer.record(TracePoint::PROCESS_ENTER, 1, i);
+		}
+
+		traceBuffer.getEntries(entries);
+
+		REQUIRE(entries.size() == TraceBuffer::cNumEntries);
+		REQUIRE(entries.front().arg == 10);
+		REQUIRE(entries.back().arg == TraceBuffer::cNumEntries + 9);
+	}
+}
+
+TEST_CASE("ThreadAttributes", "[utils]")
+{
+	ThreadAttributes attributes;
+
+	REQUIRE(attributes.empty());
+
+	attributes.name = "xenbe-test-thread-name";
+	attributes.cpus = {0};
+	attributes.policy = SCHED_OTHER;
+
+	REQUIRE_FALSE(attributes.empty());
+
+	char name[16] = {};
+
+	SECTION("Check apply")
+	{
+		atomic_bool terminate(false);
+
+		thread testThread([&terminate] {
+			while (!terminate) { sleep_for(milliseconds(1)); } });
+
+		attributes.apply(testThread);
+
+		pthread_getname_np(testThread.native_handle(), name, sizeof(name));
+
+		cpu_set_t cpuSet;
+
+		CPU_ZERO(&cpuSet);
+
+		pthread_getaffinity_np(testThread.native_handle(), sizeof(cpuSet),
+							   &cpuSet);
+
+		terminate = true;
+
+		testThread.join();
+
+		REQUIRE(string(name) == "xenbe-test-thre");
+		REQUIRE(CPU_COUNT(&cpuSet) == 1);
+		REQUIRE(CPU_ISSET(0, &cpuSet));
+	}
+
+	SECTION("Check try apply")
+	{
+		atomic_bool terminate(false);
+
+		thread testThread([&terminate] {
+			while (!terminate) { sleep_for(milliseconds(1)); } });
+
+		// invalid CPU is skipped, other attributes are still applied
+
+		attributes.cpus = {CPU_SETSIZE};
+
+		REQUIRE_THROWS(attributes.apply(testThread));
+
+		pthread_setname_np(testThread.native_handle(), "other");
+
+		REQUIRE_FALSE(attributes.tryApply(testThread));
+
+		pthread_getname_np(testThread.native_handle(), name, sizeof(name));
+
+		terminate = true;
+
+		testThread.join();
+
+		REQUIRE(string(name) == "xenbe-test-thre");
+	}
+
+	SECTION("Check async context")
+	{
+		AsyncContext asyncContext;
+
+		attributes.name = "xenbe-async";
+
+		asyncContext.setThreadAttributes(attributes);
+
+		atomic_bool called(false);
+
+		asyncContext.call([&name, &called] {
+			pthread_getname_np(pthread_self(), name, sizeof(name));
+			called = true; });
+
+		for (int i = 0; i < 1000 && !called; i++)
+		{
+			sleep_for(milliseconds(1));
+		}
+
+		asyncContext.stop();
+
+		REQUIRE(string(name) == "xenbe-async");
+	}
+
+	SECTION("Check NUMA node")
+	{
+		REQUIRE_THROWS_AS(ThreadAttributes::getNodeCpus(-1), Exception);
+
+		if (access("/sys/devices/system/node/node0", F_OK) == 0)
+		{
+			REQUIRE_FALSE(ThreadAttributes::getNodeCpus(0).empty());
+		}
+	}
+}
+
+TEST_CASE("Arena", "[utils]")
+{
+	Arena arena(20, 4);
+
+	REQUIRE(arena.getBlockSize() >= 20);
+	REQUIRE(arena.getBlockSize() % alignof(std::max_align_t) == 0);
+	REQUIRE(arena.getNumBlocks() == 4);
+	REQUIRE(arena.getNumFreeBlocks() == 4);
+
+	SECTION("Check allocate")
+	{
+		vector<void*> blocks;
+
+		for (int i = 0; i < 4; i++)
+		{
+			blocks.push_back(arena.allocate(20));
+		}
+
+		REQUIRE(arena.getNumFreeBlocks() == 0);
+		REQUIRE_THROWS_AS(arena.allocate(1), Exception);
+
+		arena.deallocate(blocks[2]);
+
+		REQUIRE(arena.allocate(1) == blocks[2]);
+
+		for (auto block : blocks)
+		{
+			arena.deallocate(block);
+		}
+
+		REQUIRE(arena.getNumFreeBlocks() == 4);
+		REQUIRE_THROWS_AS(arena.allocate(arena.getBlockSize() + 1), Exception);
+	}
+
+	SECTION("Check create")
+	{
+		auto value = arena.create<vector<int>::size_type>(5);
+
+		REQUIRE(*value == 5);
+		REQUIRE(arena.getNumFreeBlocks() == 3);
+
+		arena.destroy(value);
+
+		REQUIRE(arena.getNumFreeBlocks() == 4);
+	}
+
+	SECTION("Check allocator")
+	{
+		vector<uint16_t, ArenaAllocator<uint16_t>> values(
+				(ArenaAllocator<uint16_t>(arena)));
+
+		values.reserve(arena.getBlockSize() / sizeof(uint16_t));
+
+		for (int i = 0; i < 8; i++)
+		{
+			values.push_back(i);
+		}
+
+		REQUIRE(values[7] == 7);
+		REQUIRE(arena.getNumFreeBlocks() == 3);
+
+		values = vector<uint16_t, ArenaAllocator<uint16_t>>(
+				(ArenaAllocator<uint16_t>(arena)));
+
+		REQUIRE(arena.getNumFreeBlocks() == 4);
+	}
+}
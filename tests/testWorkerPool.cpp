@@ -0,0 +1,217 @@
+/*
+ *  Test WorkerPool
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+
+#include "Utils.hpp"
+#include "WorkerPool.hpp"
+
+using std::atomic_bool;
+using std::atomic_int;
+using std::chrono::milliseconds;
+using std::thread;
+using std::this_thread::sleep_for;
+using std::vector;
+
+using XenBackend::AsyncContext;
+using XenBackend::Exception;
+using XenBackend::WorkerPool;
+using XenBackend::WorkerPoolPtr;
+using XenBackend::WorkerQueuePtr;
+
+TEST_CASE("WorkerPool", "[workerpool]")
+{
+	WorkerPool pool(4);
+
+	REQUIRE(pool.getNumWorkers() == 4);
+
+	SECTION("Check order")
+	{
+		const int cNumQueues = 8;
+		const int cNumTasks = 1000;
+
+		vector<WorkerQueuePtr> queues;
+		vector<vector<int>> results(cNumQueues);
+
+		for (int i = 0; i < cNumQueues; i++)
+		{
+			queues.push_back(pool.createQueue());
+		}
+
+		for (int j = 0; j < cNumTasks; j++)
+		{
+			for (int i = 0; i < cNumQueues; i++)
+			{
+				auto& result = results[i];
+
+				queues[i]->post([&result, j] { result.push_back(j); });
+			}
+		}
+
+		for (int i = 0; i < cNumQueues; i++)
+		{
+			queues[i]->wait();
+
+			REQUIRE(results[i].size() == cNumTasks);
+
+			for (int j = 0; j < cNumTasks; j++)
+			{
+				REQUIRE(results[i][j] == j);
+			}
+		}
+	}
+
+	SECTION("Check parallel execution")
+	{
+		atomic_int numRunning(0);
+		atomic_int maxRunning(0);
+
+		vector<WorkerQueuePtr> queues;
+
+		for (int i = 0; i < 4; i++)
+		{
+			queues.push_back(pool.createQueue());
+
+			queues.back()->post([&numRunning, &maxRunning] {
+				int running = ++numRunning;
+
+				if (running > maxRunning)
+				{
+					maxRunning = running;
+				}
+
+				sleep_for(milliseconds(50));
+
+				numRunning--;
+			});
+		}
+
+		for (auto queue : queues)
+		{
+			queue->wait();
+		}
+
+		REQUIRE(maxRunning > 1);
+	}
+
+	SECTION("Check error in task")
+	{
+		auto queue = pool.createQueue();
+		int value = 0;
+
+		queue->post([] { throw Exception("Task error", EINVAL); });
+		queue->post([&value] { value = 1; });
+
+		queue->wait();
+
+		REQUIRE(value == 1);
+	}
+
+	SECTION("Check stop")
+	{
+		auto queue = pool.createQueue();
+		atomic_int value(0);
+
+		for (int i = 0; i < 100; i++)
+		{
+			queue->post([&value] { value++; });
+		}
+
+		pool.stop();
+
+		REQUIRE(value == 100);
+		REQUIRE_THROWS_AS(queue->post([] {}), Exception);
+	}
+}
+
+TEST_CASE("AsyncContextWorkerPool", "[workerpool]")
+{
+	WorkerPoolPtr pool(new WorkerPool(2));
+
+	AsyncContext asyncContext;
+
+	asyncContext.setWorkerPool(pool);
+
+	vector<int> results;
+
+	for (int i = 0; i < 100; i++)
+	{
+		asyncContext.call([&results, i] { results.push_back(i); });
+	}
+
+	asyncContext.stop();
+
+	REQUIRE(results.size() == 100);
+
+	for (int i = 0; i < 100; i++)
+	{
+		REQUIRE(results[i] == i);
+	}
+
+	// calls after stop are ignored
+
+	asyncContext.call([&results] { results.push_back(0); });
+
+	pool->stop();
+
+	REQUIRE(results.size() == 100);
+}
+
+TEST_CASE("AsyncContextWorkerPoolStop", "[workerpool]")
+{
+	WorkerPoolPtr pool(new WorkerPool(2));
+
+	// no call is executed after stop() returns even if it races with stop()
+
+	for (int i = 0; i < 20; i++)
+	{
+		AsyncContext asyncContext;
+		atomic_int numCalls(0);
+		atomic_bool terminate(false);
+
+		asyncContext.setWorkerPool(pool);
+
+		thread caller([&] {
+			while (!terminate)
+			{
+				asyncContext.call([&numCalls] { numCalls++; });
+			}
+		});
+
+		sleep_for(milliseconds(1));
+
+		asyncContext.stop();
+
+		int value = numCalls;
+
+		sleep_for(milliseconds(5));
+
+		terminate = true;
+
+		caller.join();
+
+		REQUIRE(numCalls == value);
+	}
+}
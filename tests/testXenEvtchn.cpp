@@ -18,21 +18,28 @@
  * Copyright (C) 2016 EPAM Systems Inc.
  */
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #include "catch.hpp"
 
 #include "mocks/XenEvtchnMock.hpp"
 #include "XenEvtchn.hpp"
 
+using std::atomic_int;
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::condition_variable;
 using std::mutex;
+using std::this_thread::sleep_for;
 using std::unique_lock;
 
 using XenBackend::XenEvtchn;
+using XenBackend::XenEvtchnLoop;
+using XenBackend::XenEvtchnLoopPtr;
 
 static mutex gMutex;
 static condition_variable gCondVar;
@@ -61,6 +68,25 @@ static void waitForCbk()
 	gCondVar.wait_for(lock, milliseconds(100));
 }
 
+static int gLoopCbkMask = 0;
+
+static void loopCbk(int mask)
+{
+	unique_lock<mutex> lock(gMutex);
+
+	gLoopCbkMask |= mask;
+
+	gCondVar.notify_all();
+}
+
+static bool waitForLoopCbk(int mask)
+{
+	unique_lock<mutex> lock(gMutex);
+
+	return gCondVar.wait_for(lock, milliseconds(100),
+							 [mask] { return gLoopCbkMask == mask; });
+}
+
 TEST_CASE("XenEvtchn", "[xenevtchn]")
 {
 	XenEvtchnMock::setErrorMode(false);
@@ -124,3 +150,213 @@ TEST_CASE("XenEvtchnError", "[xenevtchn]")
 
 	REQUIRE_THROWS(XenEvtchn(3, 24, eventChannelCbk, errorHandling));
 }
+
+TEST_CASE("XenEvtchnLoop", "[xenevtchn]")
+{
+	XenEvtchnMock::setErrorMode(false);
+
+	XenEvtchnLoopPtr loop(new XenEvtchnLoop());
+
+	XenEvtchn eventChannel1(loop, 3, 24, [] { loopCbk(1); }, errorHandling);
+	XenEvtchn eventChannel2(loop, 4, 24, [] { loopCbk(2); }, errorHandling);
+
+	eventChannel1.start();
+	eventChannel2.start();
+
+	gLoopCbkMask = 0;
+	gNumErrors = 0;
+
+	SECTION("Check notification")
+	{
+		eventChannel2.notify();
+
+		REQUIRE(eventChannel2.getPort() ==
+				XenEvtchnMock::getLastNotifiedPort());
+
+		XenEvtchnMock::signalPort(eventChannel1.getPort());
+
+		REQUIRE(waitForLoopCbk(1));
+
+		XenEvtchnMock::signalPort(eventChannel2.getPort());
+
+		REQUIRE(waitForLoopCbk(3));
+
+		REQUIRE(gNumErrors == 0);
+	}
+
+	SECTION("Check stopped channel")
+	{
+		eventChannel1.stop();
+
+		XenEvtchnMock::signalPort(eventChannel1.getPort());
+		XenEvtchnMock::signalPort(eventChannel2.getPort());
+
+		REQUIRE(waitForLoopCbk(2));
+
+		REQUIRE(gNumErrors == 0);
+	}
+
+	SECTION("Check error in loop")
+	{
+		XenEvtchnMock::setErrorMode(true);
+
+		XenEvtchnMock::signalPort(eventChannel1.getPort());
+
+		waitForCbk();
+
+		XenEvtchnMock::setErrorMode(false);
+
+		REQUIRE(gNumErrors == 2);
+	}
+}
+
+static XenEvtchn* gOwnChannel = nullptr;
+static bool gOwnChannelDeleted = false;
+
+static void deleteOwnChannel()
+{
+	// releases the last reference to the loop on the loop thread
+
+	delete gOwnChannel;
+
+	unique_lock<mutex> lock(gMutex);
+
+	gOwnChannelDeleted = true;
+
+	gCondVar.notify_all();
+}
+
+TEST_CASE("XenEvtchnLoopDeleteInCallback", "[xenevtchn]")
+{
+	XenEvtchnMock::setErrorMode(false);
+
+	gOwnChannelDeleted = false;
+
+	{
+		XenEvtchnLoopPtr loop(new XenEvtchnLoop());
+
+		gOwnChannel = new XenEvtchn(loop, 3, 24, deleteOwnChannel,
+									errorHandling);
+
+		gOwnChannel->start();
+	}
+
+	XenEvtchnMock::signalPort(gOwnChannel->getPort());
+
+	unique_lock<mutex> lock(gMutex);
+
+	REQUIRE(gCondVar.wait_for(lock, milliseconds(100),
+							  [] { return gOwnChannelDeleted; }));
+}
+
+TEST_CASE("XenEvtchnDeferredUnmask", "[xenevtchn]")
+{
+	XenEvtchnMock::setErrorMode(false);
+
+	int numCalls = 0;
+	bool blocked = true;
+
+	XenEvtchn eventChannel(3, 24, [&numCalls, &blocked] {
+		unique_lock<mutex> lock(gMutex);
+
+		numCalls++;
+
+		gCondVar.notify_all();
+		gCondVar.wait(lock, [&blocked] { return !blocked; }); },
+		errorHandling);
+
+	bool deferredUnmask = false;
+	int expectedCalls = 0;
+
+	SECTION("Check immediate unmask")
+	{
+		deferredUnmask = false;
+		expectedCalls = 6;
+	}
+
+	SECTION("Check deferred unmask")
+	{
+		deferredUnmask = true;
+		expectedCalls = 2;
+	}
+
+	eventChannel.setDeferredUnmask(deferredUnmask);
+	eventChannel.start();
+
+	XenEvtchnMock::signalPort(eventChannel.getPort());
+
+	unique_lock<mutex> lock(gMutex);
+
+	REQUIRE(gCondVar.wait_for(lock, milliseconds(100),
+							  [&numCalls] { return numCalls == 1; }));
+
+	// signals received while the callback runs
+
+	lock.unlock();
+
+	for (int i = 0; i < 5; i++)
+	{
+		XenEvtchnMock::signalPort(eventChannel.getPort());
+	}
+
+	lock.lock();
+
+	blocked = false;
+
+	gCondVar.notify_all();
+
+	gCondVar.wait_for(lock, milliseconds(100), [&numCalls, expectedCalls]
+					  { return numCalls == expectedCalls; });
+
+	lock.unlock();
+
+	// let possible extra notifications come
+
+	sleep_for(milliseconds(20));
+
+	lock.lock();
+
+	REQUIRE(numCalls == expectedCalls);
+
+	lock.unlock();
+
+	eventChannel.stop();
+}
+
+TEST_CASE("XenEvtchnNotifyInterval", "[xenevtchn]")
+{
+	XenEvtchnMock::setErrorMode(false);
+
+	XenEvtchn eventChannel(3, 24, eventChannelCbk, errorHandling);
+
+	atomic_int numNotifications(0);
+
+	XenEvtchnMock::setNotifyCbk(eventChannel.getPort(),
+								[&numNotifications] { numNotifications++; });
+
+	eventChannel.setMinNotifyInterval(milliseconds(50));
+
+	for (int i = 0; i < 5; i++)
+	{
+		eventChannel.notify();
+	}
+
+	REQUIRE(numNotifications == 1);
+	REQUIRE(eventChannel.getMetrics().numDeferred == 4);
+
+	for (int i = 0; i < 200 && numNotifications != 2; i++)
+	{
+		sleep_for(milliseconds(1));
+	}
+
+	REQUIRE(numNotifications == 2);
+	REQUIRE(eventChannel.getMetrics().numSent == 2);
+
+	eventChannel.setMinNotifyInterval(microseconds(0));
+
+	eventChannel.notify();
+
+	REQUIRE(numNotifications == 3);
+
+	XenEvtchnMock::setNotifyCbk(eventChannel.getPort(), nullptr);
+}
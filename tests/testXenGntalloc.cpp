@@ -0,0 +1,93 @@
+/*
+ *  Test XenGntalloc
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include <sys/mman.h>
+
+#include "catch.hpp"
+
+#include "mocks/XenGnttabMock.hpp"
+#include "XenGntalloc.hpp"
+
+using XenBackend::XenGntallocBuffer;
+using XenBackend::XenGntallocBufferPtr;
+using XenBackend::XenGntallocException;
+using XenBackend::XenGntallocPool;
+using XenBackend::XenGntallocPoolPtr;
+
+TEST_CASE("XenGntalloc", "[xengntalloc]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapped = XenGnttabMock::checkMapBuffers();
+
+	SECTION("Check buffer")
+	{
+		{
+			XenGntallocBuffer buffer(3, 4, false);
+
+			REQUIRE(buffer.getDomId() == 3);
+			REQUIRE(buffer.getRefs().size() == 4);
+			REQUIRE(buffer.size() == 4 * XC_PAGE_SIZE);
+			REQUIRE(XenGnttabMock::getMapBufferSize(buffer.get()) ==
+					buffer.size());
+			REQUIRE(XenGnttabMock::getMapBufferProt(buffer.get()) ==
+					PROT_READ);
+		}
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped);
+	}
+
+	SECTION("Check pool")
+	{
+		XenGntallocPoolPtr pool(new XenGntallocPool(3, 2, 1));
+
+		REQUIRE(pool->getBuffers().size() == 2);
+		REQUIRE(pool->getNumFree() == 2);
+
+		auto buffer1 = pool->get();
+		auto buffer2 = pool->get();
+
+		REQUIRE(buffer1);
+		REQUIRE(buffer2);
+		REQUIRE(buffer1 != buffer2);
+		REQUIRE_FALSE(pool->get());
+
+		auto ref = buffer1->getRefs()[0];
+
+		buffer1.reset();
+
+		REQUIRE(pool->getNumFree() == 1);
+
+		// pages are reused
+		REQUIRE(pool->get()->getRefs()[0] == ref);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 2);
+	}
+
+	SECTION("Check errors")
+	{
+		REQUIRE_THROWS_AS(XenGntallocBuffer(3, 0), XenGntallocException);
+
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS_AS(XenGntallocBuffer(3, 1), XenGntallocException);
+
+		XenGnttabMock::setErrorMode(false);
+	}
+}
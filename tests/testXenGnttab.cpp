@@ -24,6 +24,13 @@
 #include "XenGnttab.hpp"
 
 using XenBackend::XenGnttabBuffer;
+using XenBackend::XenGnttabBufferPtr;
+using XenBackend::XenGnttabCache;
+using XenBackend::XenGnttabCopy;
+using XenBackend::XenGnttabException;
+using XenBackend::XenGnttabSgBuffer;
+using XenBackend::XenGnttabUnmapQueue;
+using XenBackend::XenGnttabUnmapQueuePtr;
 
 TEST_CASE("XenGnttab", "[xengnttab]")
 {
@@ -48,6 +55,39 @@ TEST_CASE("XenGnttab", "[xengnttab]")
 				XenGnttabMock::getMapBufferSize(xenBuffer.get()));
 	}
 
+	SECTION("Check protection")
+	{
+		XenGnttabBuffer xenBuffer(3, 14, PROT_READ);
+
+		REQUIRE(XenGnttabMock::getMapBufferProt(xenBuffer.get()) == PROT_READ);
+	}
+
+	SECTION("Check scatter-gather pages")
+	{
+		auto numMapped = XenGnttabMock::checkMapBuffers();
+
+		{
+			XenGnttabSgBuffer xenBuffer(std::vector<domid_t>{3, 4, 3}, {7, 2, 9});
+
+			REQUIRE(xenBuffer.getNumPages() == 3);
+			REQUIRE(XenGnttabMock::getMapBufferSize(xenBuffer.getPage(0)) ==
+					3 * XC_PAGE_SIZE);
+			REQUIRE(static_cast<uint8_t*>(xenBuffer.getPage(2)) -
+					static_cast<uint8_t*>(xenBuffer.getPage(0)) ==
+					2 * XC_PAGE_SIZE);
+
+			// one map call for all pages
+			REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 1);
+		}
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped);
+
+		std::vector<domid_t> domIds {3};
+		std::vector<grant_ref_t> refs {7, 2};
+
+		REQUIRE_THROWS_AS(XenGnttabSgBuffer(domIds, refs), XenGnttabException);
+	}
+
 	SECTION("Check errors")
 	{
 		XenGnttabMock::setErrorMode(true);
@@ -55,3 +95,186 @@ TEST_CASE("XenGnttab", "[xengnttab]")
 		REQUIRE_THROWS(XenGnttabBuffer(3, 14));
 	}
 }
+
+TEST_CASE("XenGnttabCache", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapped = XenGnttabMock::checkMapBuffers();
+
+	XenGnttabCache cache(2);
+
+	SECTION("Check hit")
+	{
+		auto buffer1 = cache.get(3, 14);
+		auto buffer2 = cache.get(3, 14);
+
+		REQUIRE(buffer1 == buffer2);
+		REQUIRE(cache.getNumHits() == 1);
+		REQUIRE(cache.getNumMisses() == 1);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 1);
+	}
+
+	SECTION("Check eviction")
+	{
+		cache.get(3, 14);
+		cache.get(3, 15);
+
+		// make 14 recently used
+		cache.get(3, 14);
+
+		auto buffer = cache.get(3, 16);
+
+		REQUIRE(cache.size() == 2);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 2);
+
+		cache.get(3, 14);
+
+		REQUIRE(cache.getNumHits() == 2);
+
+		// 16 is evicted but still mapped while it is used
+		cache.get(3, 15);
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 3);
+
+		buffer.reset();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 2);
+	}
+
+	SECTION("Check invalidate")
+	{
+		cache.get(3, 14);
+		cache.get(4, 14);
+
+		cache.invalidate(3);
+
+		REQUIRE(cache.size() == 1);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 1);
+
+		cache.clear();
+
+		REQUIRE(cache.size() == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped);
+	}
+}
+
+TEST_CASE("XenGnttabCopy", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+	XenGnttabMock::setInvalidRef(UINT32_MAX);
+
+	XenGnttabCopy copy;
+
+	SECTION("Check copy")
+	{
+		char src[] = "Hello";
+		char dst[sizeof(src)] = {};
+
+		REQUIRE(copy.addToForeign(3, 20, 100, src, sizeof(src)) == 0);
+
+		copy.copy();
+
+		REQUIRE(copy.getStatus(0) == GNTST_okay);
+
+		copy.clear();
+
+		REQUIRE(copy.addFromForeign(3, 20, 100, dst, sizeof(dst)) == 0);
+		REQUIRE(copy.size() == 1);
+
+		copy.copy();
+
+		REQUIRE(copy.getNumFailed() == 0);
+		REQUIRE(std::string(dst) == src);
+	}
+
+	SECTION("Check segment status")
+	{
+		char buffer[16] = {};
+
+		XenGnttabMock::setInvalidRef(21);
+
+		copy.addFromForeign(3, 20, 0, buffer, sizeof(buffer));
+		copy.addFromForeign(3, 21, 0, buffer, sizeof(buffer));
+
+		copy.copy();
+
+		REQUIRE(copy.getNumFailed() == 1);
+		REQUIRE(copy.getStatus(0) == GNTST_okay);
+		REQUIRE(copy.getStatus(1) != GNTST_okay);
+
+		XenGnttabMock::setInvalidRef(UINT32_MAX);
+	}
+
+	SECTION("Check errors")
+	{
+		char buffer[16] = {};
+
+		REQUIRE_THROWS_AS(copy.addFromForeign(3, 20, XC_PAGE_SIZE - 8, buffer,
+											  sizeof(buffer)),
+						  XenGnttabException);
+
+		copy.addFromForeign(3, 20, 0, buffer, sizeof(buffer));
+
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS_AS(copy.copy(), XenGnttabException);
+
+		XenGnttabMock::setErrorMode(false);
+	}
+}
+
+TEST_CASE("XenGnttabUnmapQueue", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numMapped = XenGnttabMock::checkMapBuffers();
+
+	SECTION("Check deferred unmap")
+	{
+		XenGnttabUnmapQueuePtr queue(new XenGnttabUnmapQueue());
+
+		for (grant_ref_t ref = 0; ref < 100; ref++)
+		{
+			auto buffer = queue->map(3, ref, PROT_READ);
+
+			REQUIRE(XenGnttabMock::getMapBufferProt(buffer->get()) ==
+					PROT_READ);
+		}
+
+		queue->flush();
+
+		REQUIRE(queue->getNumPendingPages() == 0);
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped);
+	}
+
+	SECTION("Check queue limit")
+	{
+		XenGnttabUnmapQueuePtr queue(new XenGnttabUnmapQueue(0));
+
+		auto buffer = queue->map(3, 14);
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped + 1);
+
+		// limit is reached, buffer is unmapped in place
+		buffer.reset();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped);
+	}
+
+	SECTION("Check cache")
+	{
+		XenGnttabUnmapQueuePtr queue(new XenGnttabUnmapQueue());
+		XenGnttabCache cache(1);
+
+		cache.setUnmapQueue(queue);
+
+		cache.get(3, 14);
+		cache.get(3, 15);
+		cache.clear();
+
+		queue->flush();
+
+		REQUIRE(XenGnttabMock::checkMapBuffers() == numMapped);
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ *  Test XenGnttabDmaBuf
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Copyright (C) 2016 EPAM Systems Inc.
+ */
+
+#include "catch.hpp"
+
+#include "mocks/XenGnttabMock.hpp"
+#include "XenGnttabDmaBuf.hpp"
+
+using XenBackend::XenGnttabDmaBufExporter;
+using XenBackend::XenGnttabDmaBufImporter;
+using XenBackend::XenGnttabException;
+
+TEST_CASE("XenGnttabDmaBuf", "[xengnttab]")
+{
+	XenGnttabMock::setErrorMode(false);
+
+	auto numDmaBufs = XenGnttabMock::getNumDmaBufs();
+
+	SECTION("Check export")
+	{
+		{
+			XenGnttabDmaBufExporter dmaBuf(3, {1, 2, 3});
+
+			REQUIRE(dmaBuf.getFd() >= 0);
+			REQUIRE(dmaBuf.getRefs().size() == 3);
+			REQUIRE(XenGnttabMock::getNumDmaBufs() == numDmaBufs + 1);
+		}
+
+		REQUIRE(XenGnttabMock::getNumDmaBufs() == numDmaBufs);
+	}
+
+	SECTION("Check import")
+	{
+		{
+			XenGnttabDmaBufImporter dmaBuf(3, 100, 4);
+
+			REQUIRE(dmaBuf.getFd() == 100);
+			REQUIRE(dmaBuf.getRefs().size() == 4);
+			REQUIRE(XenGnttabMock::getNumDmaBufs() == numDmaBufs + 1);
+		}
+
+		REQUIRE(XenGnttabMock::getNumDmaBufs() == numDmaBufs);
+	}
+
+	SECTION("Check errors")
+	{
+		REQUIRE_THROWS_AS(XenGnttabDmaBufExporter(3, {}), XenGnttabException);
+		REQUIRE_THROWS_AS(XenGnttabDmaBufImporter(3, 100, 0),
+						  XenGnttabException);
+
+		XenGnttabMock::setErrorMode(true);
+
+		REQUIRE_THROWS_AS(XenGnttabDmaBufExporter(3, {1}), XenGnttabException);
+		REQUIRE_THROWS_AS(XenGnttabDmaBufImporter(3, 100, 1),
+						  XenGnttabException);
+
+		XenGnttabMock::setErrorMode(false);
+	}
+}
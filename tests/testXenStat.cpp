@@ -18,11 +18,27 @@
  * Copyright (C) 2016 EPAM Systems Inc.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "catch.hpp"
 
 #include "mocks/XenCtrlMock.hpp"
+#include "mocks/XenStoreMock.hpp"
 #include "XenStat.hpp"
 
+using std::chrono::hours;
+using std::chrono::milliseconds;
+using std::condition_variable;
+using std::mutex;
+using std::this_thread::sleep_for;
+using std::unique_lock;
+using std::vector;
+
+using XenBackend::DomainStats;
 using XenBackend::XenStat;
 
 TEST_CASE("XenStat", "[xenctrl]")
@@ -66,6 +82,43 @@ TEST_CASE("XenStat", "[xenctrl]")
 		}
 	}
 
+	SECTION("Check output vectors")
+	{
+		vector<domid_t> doms = { 100, 101 };
+
+		xenStat.getExistingDoms(doms);
+
+		REQUIRE(doms.size() == 8);
+
+		xenStat.getRunningDoms(doms);
+
+		REQUIRE(doms.size() == 3);
+		REQUIRE(doms[0] == domIds[5]);
+	}
+
+	SECTION("Check cache")
+	{
+		xenStat.setRefreshInterval(hours(1));
+
+		REQUIRE(xenStat.getExistingDoms().size() == 8);
+
+		info.domain = 9;
+
+		XenCtrlMock::addDomInfo(info);
+
+		REQUIRE(xenStat.getExistingDoms().size() == 8);
+
+		xenStat.invalidate();
+
+		REQUIRE(xenStat.getExistingDoms().size() == 9);
+
+		xenStat.setRefreshInterval(milliseconds(0));
+
+		XenCtrlMock::removeDomInfo(9);
+
+		REQUIRE(xenStat.getExistingDoms().size() == 8);
+	}
+
 	SECTION("Check errors")
 	{
 		XenCtrlMock::setErrorMode(true);
@@ -74,6 +127,120 @@ TEST_CASE("XenStat", "[xenctrl]")
 	}
 }
 
+TEST_CASE("XenStatDomainsChanged", "[xenctrl]")
+{
+	XenCtrlMock::setErrorMode(false);
+	XenStoreMock::setErrorMode(false);
+
+	XenStat xenStat;
+
+	mutex mtx;
+	condition_variable condVar;
+	vector<domid_t> added, removed;
+	int numCalls = 0;
+
+	xenStat.setDomainsChangedCallback(
+		[&](const vector<domid_t>& newDoms, const vector<domid_t>& oldDoms)
+		{
+			unique_lock<mutex> lock(mtx);
+
+			added = newDoms;
+			removed = oldDoms;
+			numCalls++;
+
+			condVar.notify_all();
+		});
+
+	xc_domaininfo_t info = {};
+
+	info.domain = 20;
+
+	XenCtrlMock::addDomInfo(info);
+	XenStoreMock::writeValue("@introduceDomain", "");
+
+	{
+		unique_lock<mutex> lock(mtx);
+
+		REQUIRE(condVar.wait_for(lock, milliseconds(500),
+								 [&numCalls] { return numCalls == 1; }));
+		REQUIRE(added.size() == 1);
+		REQUIRE(added[0] == 20);
+		REQUIRE(removed.empty());
+	}
+
+	XenCtrlMock::removeDomInfo(20);
+	XenStoreMock::writeValue("@releaseDomain", "");
+
+	{
+		unique_lock<mutex> lock(mtx);
+
+		REQUIRE(condVar.wait_for(lock, milliseconds(500),
+								 [&numCalls] { return numCalls == 2; }));
+		REQUIRE(added.empty());
+		REQUIRE(removed.size() == 1);
+		REQUIRE(removed[0] == 20);
+	}
+
+	xenStat.setDomainsChangedCallback(nullptr);
+}
+
+TEST_CASE("XenStatDomainStats", "[xenctrl]")
+{
+	XenCtrlMock::setErrorMode(false);
+
+	XenStat xenStat;
+
+	xc_domaininfo_t info = {};
+
+	info.domain = 30;
+	info.flags = XEN_DOMINF_running;
+	info.tot_pages = 100;
+	info.max_pages = 200;
+	info.nr_online_vcpus = 2;
+
+	XenCtrlMock::addDomInfo(info);
+
+	vector<DomainStats> stats;
+
+	xenStat.getDomainStats(stats);
+
+	auto stat = std::find_if(stats.begin(), stats.end(),
+							 [](const DomainStats& item)
+							 { return item.domId == 30; });
+
+	REQUIRE(stat != stats.end());
+	REQUIRE(stat->totPages == 100);
+	REQUIRE(stat->maxPages == 200);
+	REQUIRE(stat->numOnlineVcpus == 2);
+	REQUIRE(stat->cpuUsage == 0.0);
+	REQUIRE(stat->totPagesDelta == 0);
+
+	sleep_for(milliseconds(10));
+
+	info.cpu_time = 1000000;
+	info.tot_pages = 80;
+
+	XenCtrlMock::addDomInfo(info);
+
+	// other requests don't move the stats baseline
+
+	xenStat.getRunningDoms();
+
+	xenStat.getDomainStats(stats);
+
+	stat = std::find_if(stats.begin(), stats.end(),
+						[](const DomainStats& item)
+						{ return item.domId == 30; });
+
+	REQUIRE(stat != stats.end());
+	REQUIRE(stat->cpuTime == 1000000);
+	REQUIRE(stat->cpuUsage > 0.0);
+	REQUIRE(stat->cpuUsage <= 10.0);
+	REQUIRE(stat->totPagesDelta == -20);
+
+	XenCtrlMock::removeDomInfo(30);
+}
+
 TEST_CASE("XenStatError", "[xenctrl]")
 {
 	XenCtrlMock::setErrorMode(true);
@@ -19,9 +19,11 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #include "catch.hpp"
 
@@ -38,6 +40,7 @@ using std::unique_ptr;
 using std::vector;
 
 using XenBackend::XenStore;
+using XenBackend::XenStoreCache;
 using XenBackend::XenStoreException;
 
 static mutex gMutex;
@@ -119,6 +122,39 @@ TEST_CASE("XenStore", "[xenstore]")
 		REQUIRE(xenStore.readString(path) == strVal);
 
 		REQUIRE_THROWS(xenStore.readInt("/non/exist/entry"));
+
+		auto metrics = xenStore.getMetrics();
+
+		REQUIRE(metrics.numWrites == 3);
+		REQUIRE(metrics.numReads == 4);
+	}
+
+	SECTION("Check try read")
+	{
+		string path = "/local/domain/3/try";
+		int intVal = 0;
+		unsigned int uintVal = 0;
+		string strVal;
+		vector<string> items;
+
+		xenStore.writeInt(path + "/int", -5);
+		xenStore.writeUint(path + "/uint", 7);
+
+		REQUIRE(xenStore.tryReadInt(path + "/int", intVal));
+		REQUIRE(intVal == -5);
+
+		REQUIRE(xenStore.tryReadUint(path + "/uint", uintVal));
+		REQUIRE(uintVal == 7);
+
+		REQUIRE(xenStore.tryReadString(path + "/int", strVal));
+		REQUIRE(strVal == "-5");
+
+		REQUIRE(xenStore.tryReadDirectory(path, items));
+		REQUIRE(items.size() == 2);
+
+		REQUIRE_FALSE(xenStore.tryReadInt("/non/exist/entry", intVal));
+		REQUIRE_FALSE(xenStore.tryReadString("/non/exist/entry", strVal));
+		REQUIRE_FALSE(xenStore.tryReadDirectory("/non/exist/dir", items));
 	}
 
 	SECTION("Check read/write error")
@@ -182,6 +218,41 @@ TEST_CASE("XenStore", "[xenstore]")
 		REQUIRE(result.size() == 0);
 	}
 
+	SECTION("Check transactions")
+	{
+		string path = "/local/domain/3/transaction/";
+
+		xenStore.runTransaction([&xenStore, &path](xs_transaction_t t) {
+			xenStore.writeString(path + "entry0", "Entry 0", t);
+			xenStore.writeUint(path + "entry1", 1, t);
+		});
+
+		auto result = xenStore.readMany({path + "entry0", path + "entry1"});
+
+		REQUIRE(result.size() == 2);
+		REQUIRE(result[0] == "Entry 0");
+		REQUIRE(result[1] == "1");
+
+		int numRuns = 0;
+
+		XenStoreMock::setTransactionConflicts(2);
+
+		xenStore.runTransaction([&numRuns](xs_transaction_t t) {
+			numRuns++;
+		});
+
+		REQUIRE(numRuns == 3);
+
+		XenStoreMock::setTransactionConflicts(3);
+
+		REQUIRE_THROWS_AS(xenStore.runTransaction([](xs_transaction_t t) {}, 2),
+						  XenStoreException);
+
+		XenStoreMock::setTransactionConflicts(0);
+
+		REQUIRE_THROWS(xenStore.readMany({path + "entry0", "/non/exist"}));
+	}
+
 	SECTION("Check watches")
 	{
 		string path = "/local/domain/3/watch1";
@@ -211,6 +282,266 @@ TEST_CASE("XenStore", "[xenstore]")
 		xenStore.clearWatch(path);
 	}
 
+	SECTION("Check clear watch while callback is running")
+	{
+		string path = "/local/domain/3/clear";
+		bool started = false;
+		std::atomic_bool finished(false);
+
+		xenStore.setWatch(path, [&started, &finished] (const string&) {
+			{
+				unique_lock<mutex> lock(gMutex);
+
+				started = true;
+
+				gCondVar.notify_all();
+			}
+
+			std::this_thread::sleep_for(milliseconds(50));
+
+			finished = true;
+		});
+
+		{
+			unique_lock<mutex> lock(gMutex);
+
+			REQUIRE(gCondVar.wait_for(lock, milliseconds(1000),
+									  [&started] { return started; }));
+		}
+
+		// clear should wait till the running callback is finished
+
+		xenStore.clearWatch(path);
+
+		REQUIRE(finished);
+	}
+
+	SECTION("Check clear watch in callback")
+	{
+		string path = "/local/domain/3/clearown";
+		int numCalls = 0;
+		bool cleared = false;
+
+		// the callback clears own watch on the watch thread, so clearWatch
+		// should not wait for the callback
+
+		xenStore.setWatch(path, [&xenStore, &path, &numCalls, &cleared]
+								(const string&) {
+			xenStore.clearWatch(path);
+
+			unique_lock<mutex> lock(gMutex);
+
+			numCalls++;
+			cleared = true;
+
+			gCondVar.notify_all();
+		});
+
+		{
+			unique_lock<mutex> lock(gMutex);
+
+			REQUIRE(gCondVar.wait_for(lock, milliseconds(1000),
+									  [&cleared] { return cleared; }));
+		}
+
+		XenStoreMock::writeValue(path, "Changed");
+
+		std::this_thread::sleep_for(milliseconds(50));
+
+		unique_lock<mutex> lock(gMutex);
+
+		REQUIRE(numCalls == 1);
+	}
+
+	SECTION("Check coalesced watches")
+	{
+		string path = "/local/domain/3/coalesced";
+		int numCalls = 0;
+
+		auto callback = [&numCalls] (const string&) {
+			unique_lock<mutex> lock(gMutex);
+
+			numCalls++;
+
+			gCondVar.notify_all();
+		};
+
+		auto waitForCalls = [&numCalls] (int count) {
+			unique_lock<mutex> lock(gMutex);
+
+			return gCondVar.wait_for(lock, milliseconds(1000),
+									 [&numCalls, count] {
+										return numCalls >= count; });
+		};
+
+		xenStore.setWatch(path, callback, milliseconds(50));
+
+		// initial watch event
+
+		REQUIRE(waitForCalls(1));
+
+		auto numCoalesced = xenStore.getMetrics().numCoalescedEvents;
+
+		for (int i = 0; i < 10; i++)
+		{
+			XenStoreMock::writeValue(path, "Changed" + std::to_string(i));
+		}
+
+		REQUIRE(waitForCalls(2));
+
+		waitForWatch();
+
+		REQUIRE(numCalls == 2);
+		REQUIRE(xenStore.getMetrics().numCoalescedEvents - numCoalesced == 9);
+
+		xenStore.clearWatch(path);
+	}
+
+	SECTION("Check child watches")
+	{
+		string parent = "/local/domain/3/parent";
+		string child = parent + "/child";
+		vector<string> paths;
+
+		auto callback = [&paths] (const string& path) {
+			unique_lock<mutex> lock(gMutex);
+
+			paths.push_back(path);
+
+			gCondVar.notify_all();
+		};
+
+		auto waitForPaths = [&paths] (size_t size) {
+			unique_lock<mutex> lock(gMutex);
+
+			return gCondVar.wait_for(lock, milliseconds(1000),
+									 [&paths, size] {
+										return paths.size() >= size; });
+		};
+
+		xenStore.setWatch(parent, callback);
+
+		// initial watch event
+
+		REQUIRE(waitForPaths(1));
+
+		xenStore.setChildWatch(child, callback);
+
+		XenStoreMock::writeValue(child + "/entry", "Changed");
+
+		REQUIRE(waitForPaths(3));
+		REQUIRE(paths[1] == parent);
+		REQUIRE(paths[2] == child);
+
+		XenStoreMock::writeValue(parent + "/other", "Changed");
+
+		REQUIRE(waitForPaths(4));
+		REQUIRE(paths[3] == parent);
+
+		xenStore.clearWatch(child);
+
+		XenStoreMock::writeValue(child + "/entry", "Changed again");
+
+		REQUIRE(waitForPaths(5));
+		REQUIRE(paths[4] == parent);
+
+		waitForWatch();
+
+		REQUIRE(paths.size() == 5);
+
+		xenStore.clearWatch(parent);
+	}
+
+	SECTION("Check cache")
+	{
+		string path = "/local/domain/3/cached";
+
+		xenStore.writeUint(path + "/ring-ref", 12);
+		xenStore.writeString(path + "/name", "Name");
+		xenStore.writeString("/local/domain/3/uncached", "Uncached");
+
+		XenStoreCache cache(xenStore, path);
+
+		// skip initial watch event
+
+		waitForWatch();
+
+		REQUIRE(cache.readUint(path + "/ring-ref") == 12);
+		REQUIRE(cache.readUint(path + "/ring-ref") == 12);
+		REQUIRE(cache.readString(path + "/name") == "Name");
+		REQUIRE(cache.readString("/local/domain/3/uncached") == "Uncached");
+
+		REQUIRE(cache.getNumHits() == 1);
+		REQUIRE(cache.getNumMisses() == 2);
+		REQUIRE(cache.size() == 2);
+
+		REQUIRE_THROWS(cache.readString(path + "/missing"));
+
+		XenStoreMock::writeValue(path + "/ring-ref", "13");
+
+		for (int i = 0; i < 10 && cache.size(); i++)
+		{
+			waitForWatch();
+		}
+
+		REQUIRE(cache.size() == 0);
+		REQUIRE(cache.readUint(path + "/ring-ref") == 13);
+	}
+
+	SECTION("Check cache on shared store")
+	{
+		string path = "/local/domain/3/shared";
+		int numCalls = 0;
+
+		auto waitForCalls = [&numCalls] (int count) {
+			unique_lock<mutex> lock(gMutex);
+
+			return gCondVar.wait_for(lock, milliseconds(1000),
+									 [&numCalls, count] {
+										return numCalls >= count; });
+		};
+
+		xenStore.writeUint(path + "/ring-ref", 12);
+
+		// the backend watches the same path as the cache
+
+		xenStore.setWatch(path, [&numCalls] (const string&) {
+			unique_lock<mutex> lock(gMutex);
+
+			numCalls++;
+
+			gCondVar.notify_all();
+		});
+
+		REQUIRE(waitForCalls(1));
+
+		{
+			XenStoreCache cache(xenStore, path);
+
+			REQUIRE(cache.readUint(path + "/ring-ref") == 12);
+			REQUIRE(cache.size() == 1);
+
+			XenStoreMock::writeValue(path + "/ring-ref", "13");
+
+			REQUIRE(waitForCalls(2));
+
+			for (int i = 0; i < 10 && cache.size(); i++)
+			{
+				waitForWatch();
+			}
+
+			REQUIRE(cache.size() == 0);
+		}
+
+		// deleting the cache keeps the backend watch
+
+		XenStoreMock::writeValue(path + "/ring-ref", "14");
+
+		REQUIRE(waitForCalls(3));
+
+		xenStore.clearWatch(path);
+	}
+
 	SECTION("Check watches error")
 	{
 		XenStoreMock::setErrorMode(true);